@@ -0,0 +1,229 @@
+#include "cpu.hpp"
+#include "disassembler.hpp"
+#include "test_rom.hpp"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// Microbenchmarks and whole runs of the core. Everything runs on ROMs built
+// here, so results only change when the code does. Two optional runs use real
+// ROMs from the environment:
+//   NES_BENCH_NESTEST  nestest.nes, run in automation mode from $C000
+//   NES_BENCH_ROM      any NROM game, run for N frames without input
+//
+//   nes_bench --benchmark_out=results.json --benchmark_out_format=json
+
+static const char *const ADDRESSING_NAMES[] = {
+    "Immediate",  "ZeroPage",   "ZeroPage_X", "ZeroPage_Y",
+    "Absolute",   "Absolute_X", "Absolute_Y", "Indirect_X",
+    "Indirect_Y", "Indirect",   "NoneAddressing"};
+
+static std::vector<uint8_t> readRom(const char *variable) {
+  const char *path = getenv(variable);
+  if (path == nullptr) {
+    return {};
+  }
+  std::ifstream input(path, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(input), {});
+}
+
+// One instruction at $8000 with operand bytes $00 $03, so every zero page,
+// absolute and indirect operand lands in RAM
+static CPU instructionCpu(uint8_t opcode) {
+  CPU cpu = CPU(Bus(buildRom({opcode, 0x00, 0x03}, 0x8000)));
+  cpu.reset();
+  return cpu;
+}
+
+static void BM_Opcode(benchmark::State &state, uint8_t opcode) {
+  CPU cpu = instructionCpu(opcode);
+  for (auto _ : state) {
+    // Put back whatever the instruction moved
+    cpu.PC = 0x8000;
+    cpu.SP = 0xFD;
+    benchmark::DoNotOptimize(cpu.step());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Immediate has no address of its own, getOperandAddress handles it
+static void BM_AddressingMode(benchmark::State &state) {
+  CPU::ADDRESSING mode = static_cast<CPU::ADDRESSING>(state.range(0));
+  CPU cpu = instructionCpu(0xEA);
+  cpu.PC = 0x8001;
+  cpu.X = 0x11;
+  cpu.Y = 0x22;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cpu.getAbsoluteAddress(mode, cpu.PC));
+  }
+  state.SetLabel(ADDRESSING_NAMES[mode]);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddressingMode)->DenseRange(CPU::ZeroPage, CPU::NoneAddressing);
+
+// Unmapped addresses log every access, so they are left out, the numbers
+// would be those of std::cout
+static void BM_BusRead(benchmark::State &state, uint16_t base) {
+  CPU cpu = instructionCpu(0xEA);
+  Bus &bus = cpu.getBus();
+  // PRG RAM is only mapped once something is written to it
+  bus.writeToMemory(PRG_RAM_START, 0);
+  uint16_t offset = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bus.readFromMemory(base + (offset & 0xFF)));
+    offset++;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_BusRead, ram, static_cast<uint16_t>(0x0000));
+BENCHMARK_CAPTURE(BM_BusRead, ram_mirror, static_cast<uint16_t>(0x1800));
+BENCHMARK_CAPTURE(BM_BusRead, prg_ram, static_cast<uint16_t>(PRG_RAM_START));
+BENCHMARK_CAPTURE(BM_BusRead, prg_rom, static_cast<uint16_t>(0xC000));
+
+// A vblank wait polling PPUSTATUS, the clock moves on by an LDA absolute
+// between reads so every read catches the PPU up
+static void BM_BusReadPpuStatus(benchmark::State &state) {
+  CPU cpu = instructionCpu(0xEA);
+  Bus &bus = cpu.getBus();
+  uint64_t clock = 0;
+  for (auto _ : state) {
+    clock += 4;
+    bus.setClock(clock);
+    benchmark::DoNotOptimize(bus.readFromMemory(0x2002));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BusReadPpuStatus);
+
+static void BM_BusReadController(benchmark::State &state) {
+  CPU cpu = instructionCpu(0xEA);
+  Bus &bus = cpu.getBus();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bus.readFromMemory(CONTROLLER_1));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BusReadController);
+
+static void BM_BusWriteRam(benchmark::State &state) {
+  CPU cpu = instructionCpu(0xEA);
+  Bus &bus = cpu.getBus();
+  uint16_t offset = 0;
+  for (auto _ : state) {
+    bus.writeToMemory(0x0300 + (offset & 0xFF), offset);
+    offset++;
+  }
+  benchmark::DoNotOptimize(bus.readFromMemory(0x0300));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BusWriteRam);
+
+static void BM_TraceCpuState(benchmark::State &state) {
+  // LDA ($10),Y exercises the most formatting
+  CPU cpu = instructionCpu(0xB1);
+  Disassembler disassembler = Disassembler(cpu.getBus().getRom());
+  bool disassemble = state.range(0) != 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        traceCpuState(&cpu, disassemble ? &disassembler : nullptr));
+  }
+  state.SetLabel(disassemble ? "disassembled" : "registers");
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TraceCpuState)->Arg(0)->Arg(1);
+
+// Polls the controller and draws into the screen, like a game's main loop
+static std::vector<uint8_t> frameRom() {
+  // LDX #$00
+  // poll: LDA #$01, STA $4016, LDA #$00, STA $4016, LDY #$08
+  // bit: LDA $4016, STA $0200,X, INX, DEY, BNE bit
+  // INC $10, LDA $10, STA ($20),Y, JMP poll
+  return buildRom({0xA2, 0x00, 0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9,
+                   0x00, 0x8D, 0x16, 0x40, 0xA0, 0x08, 0xAD, 0x16,
+                   0x40, 0x95, 0x00, 0xE8, 0x88, 0xD0, 0xF7, 0xE6,
+                   0x10, 0xA5, 0x10, 0x91, 0x20, 0x4C, 0x02, 0x80},
+                  0x8000);
+}
+
+static void runFrames(benchmark::State &state,
+                      const std::vector<uint8_t> &rom) {
+  int64_t frames = state.range(0);
+  uint64_t cycles = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    CPU cpu = CPU(Bus(rom));
+    cpu.reset();
+    cpu.getBus().setControllerState(0, BUTTON_A | BUTTON_RIGHT);
+    state.ResumeTiming();
+    for (int64_t frame = 0; frame < frames; frame++) {
+      if (!cpu.runFrame()) {
+        state.SkipWithError("CPU stopped");
+        break;
+      }
+    }
+    cycles += cpu.cycles;
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  state.counters["cycles_per_second"] =
+      benchmark::Counter(cycles, benchmark::Counter::kIsRate);
+}
+
+static void BM_Frames(benchmark::State &state) { runFrames(state, frameRom()); }
+BENCHMARK(BM_Frames)->Arg(1)->Arg(60)->Arg(600)->Unit(benchmark::kMillisecond);
+
+static void BM_GameFrames(benchmark::State &state) {
+  std::vector<uint8_t> rom = readRom("NES_BENCH_ROM");
+  if (rom.empty()) {
+    state.SkipWithError("NES_BENCH_ROM is not set");
+    return;
+  }
+  runFrames(state, rom);
+}
+BENCHMARK(BM_GameFrames)->Arg(600)->Unit(benchmark::kMillisecond);
+
+// nestest in automation mode starts at $C000 and runs every official
+// instruction, the CPU stops at the first unofficial one it doesn't know
+static void BM_Nestest(benchmark::State &state) {
+  std::vector<uint8_t> rom = readRom("NES_BENCH_NESTEST");
+  if (rom.empty()) {
+    state.SkipWithError("NES_BENCH_NESTEST is not set");
+    return;
+  }
+  uint64_t instructions = 0;
+  uint8_t result = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    CPU cpu = CPU(Bus(rom));
+    cpu.reset();
+    cpu.PC = 0xC000;
+    state.ResumeTiming();
+    // nestest finishes well within this, it only stops a runaway
+    for (int step = 0; step < 100000 && cpu.step(); step++) {
+      instructions++;
+    }
+    result = cpu.readFromMemory(0x02) | cpu.readFromMemory(0x03);
+  }
+  state.SetItemsProcessed(instructions);
+  // Zero when every test it got through passed
+  state.counters["result"] = result;
+}
+BENCHMARK(BM_Nestest)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char **argv) {
+  for (const CPU::instruction &ins : CPU::opcodeTable) {
+    char name[64];
+    snprintf(name, sizeof(name), "BM_Opcode/%02X_%s_%s", ins.opcode,
+             ins.name.c_str(), ADDRESSING_NAMES[ins.mode]);
+    benchmark::RegisterBenchmark(name, BM_Opcode, ins.opcode);
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "cpu.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Runtime side of ROMs compiled ahead of time by nes_recompile (see
+// recompiler.hpp). The generated C++ is linked into a binary and registers
+// itself at startup, every CPU built for that ROM then runs it from runFrame.
+
+// Runs compiled code from cpu.PC, one instruction at a time exactly as
+// CPU::step would, until `until` cycles, an event the interpreter has to
+// service, a backward jump, JSR, RTS or RTI, or code it doesn't cover. Leaves
+// PC at the next instruction and returns false if it ran nothing. When it
+// ends on one of those jumps `last` is set to the jump's address.
+typedef bool (*AotFunction)(CPU &cpu, uint64_t until, uint16_t &last);
+
+struct AotEntry {
+  uint16_t address;
+  AotFunction function;
+};
+
+struct AotProgram {
+  uint64_t romHash;
+  // Function that can start at each address of $8000-$FFFF, nullptr where
+  // the interpreter runs
+  std::array<AotFunction, 0x8000> functions;
+  size_t functionCount;
+};
+
+// Called by generated code from a static initializer
+bool registerAotProgram(uint64_t romHash, const AotEntry *entries,
+                        size_t count, size_t functionCount);
+// nullptr if nothing was compiled for the ROM
+const AotProgram *findAotProgram(uint64_t romHash);
+
+// Helpers the generated code is made of
+
+// The instruction can't run here: the budget is used up, or an NMI or DMA
+// stall is due which only CPU::step services
+inline bool aotStop(CPU &cpu, uint64_t until) {
+  return cpu.cycles >= until || cpu.cycles >= cpu.getBus().getNextEvent();
+}
+
+inline bool aotLeave(CPU &cpu, uint16_t address, uint64_t start) {
+  cpu.PC = address;
+  return cpu.cycles != start;
+}
+
+// The instruction at address through the interpreter's handler, with the
+// same PC and clock bookkeeping as CPU::step
+template <uint8_t opcode, uint8_t bytes, uint8_t cycles>
+inline void aotExecute(CPU &cpu, uint16_t address) {
+  cpu.PC = address + 1;
+  cpu.getBus().setClock(cpu.cycles + cycles - 1);
+  (cpu.*CPU::dispatchTable[opcode])();
+  if (cpu.PC == static_cast<uint16_t>(address + 1)) {
+    cpu.PC = address + bytes;
+  }
+  cpu.cycles += cycles;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "cpu.hpp"
+#include "movie.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// One emulator instance to run in a batch
+struct BatchJob {
+  std::vector<uint8_t> rom;
+  // Input to play, nullptr runs without input from power on. Jobs can share
+  // a movie.
+  std::shared_ptr<const Movie> movie;
+  uint32_t frameBudget;
+  // Keep the state hash of every frame, not just the last one
+  bool recordFrameHashes;
+  // Work RAM copied out once the instance finishes, as (address, length)
+  std::vector<std::pair<uint16_t, uint16_t>> ramRegions;
+};
+
+struct BatchResult {
+  // False if the instance never started, e.g. the movie is for another ROM
+  bool started;
+  // True if the CPU stopped before the frame budget ran out
+  bool stopped;
+  uint32_t frames;
+  uint64_t stateHash;
+  std::vector<uint64_t> frameHashes;
+  // The requested RAM regions, back to back
+  std::vector<uint8_t> ram;
+};
+
+// Runs many independent instances over a work stealing thread pool. Each
+// instance is scheduled sliceFrames frames at a time, a worker takes slices
+// from the back of its own queue and steals from the front of the others
+// when it runs dry, so long running instances spread over all threads.
+//
+// Instances share nothing mutable, the only data every CPU reads is the
+// static opcode tables.
+class BatchRunner {
+public:
+  // threads = 0 uses every hardware thread
+  BatchRunner(size_t threads = 0, uint32_t sliceFrames = 60);
+  size_t add(BatchJob job);
+  // Runs every job to completion, results are in the order jobs were added
+  std::vector<BatchResult> run();
+  // Slices taken from another worker's queue during the last run
+  uint64_t getSteals() const { return steals; }
+  size_t getThreadCount() const { return threadCount; }
+
+private:
+  struct Instance {
+    BatchJob job;
+    std::unique_ptr<CPU> cpu;
+    BatchResult result;
+  };
+  struct Queue {
+    std::mutex lock;
+    std::deque<size_t> instances;
+  };
+
+  size_t threadCount;
+  uint32_t sliceFrames;
+  std::vector<Instance> instances;
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::atomic<size_t> remaining;
+  std::atomic<uint64_t> steals;
+
+  void worker(size_t index);
+  bool take(size_t worker, size_t &instance);
+  // Returns true once the instance is finished
+  bool runSlice(Instance &instance);
+  void finish(Instance &instance);
+};
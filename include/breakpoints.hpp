@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+
+// Execution breakpoints and read/write watchpoints. Each kind keeps a count of
+// set addresses per 256 byte page next to a bitmap of the page, the CPU only
+// looks at the bitmap when the page count is non zero, so code and data on
+// pages without any breakpoint run at full speed.
+class Breakpoints {
+public:
+  enum KIND { EXECUTE, READ, WRITE, KIND_COUNT };
+
+  struct Hit {
+    KIND kind;
+    uint16_t address;
+  };
+
+  Breakpoints();
+  void add(KIND kind, uint16_t address);
+  void remove(KIND kind, uint16_t address);
+  void clear();
+  // Set addresses of the kind on a 256 byte page
+  uint16_t getPageCount(KIND kind, uint8_t page) const {
+    return pageCount[kind][page];
+  }
+  bool has(KIND kind, uint16_t address) const {
+    return (bitmap[kind][address >> 8][(address & 0xFF) >> 6] >>
+            (address & 0x3F)) &
+           1;
+  }
+
+  // Called by the CPU before executing the instruction at pc, returns true if
+  // execution should stop there
+  bool checkExecute(uint16_t pc) {
+    return pageCount[EXECUTE][pc >> 8] != 0 && checkExecuteSlow(pc);
+  }
+  // Called by the CPU on every memory access, a hit is latched and stops the
+  // CPU once the instruction doing the access completes
+  void checkAccess(KIND kind, uint16_t address) {
+    if (pageCount[kind][address >> 8] != 0 && has(kind, address)) {
+      latch(kind, address);
+    }
+  }
+  // Skips the execution breakpoint at pc the next time it is checked, so a
+  // debugger can resume from the instruction it is stopped on
+  void resumeFrom(uint16_t pc);
+
+  bool hasHit() const { return hitPending; }
+  Hit getHit() const { return hit; }
+  void clearHit() { hitPending = false; }
+
+private:
+  uint16_t pageCount[KIND_COUNT][256];
+  uint64_t bitmap[KIND_COUNT][256][4];
+  bool hitPending;
+  Hit hit;
+  bool ignoreOnce;
+  uint16_t ignoreAddress;
+
+  bool checkExecuteSlow(uint16_t pc);
+  void latch(KIND kind, uint16_t address);
+};
@@ -1,5 +1,9 @@
 #pragma once
+#include "ppu.hpp"
+#include "savestate.hpp"
+#include <array>
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <optional>
 
@@ -7,6 +11,34 @@
 #define RAM_END 0x1FFF
 #define PPU_START 0x2000
 #define PPU_END 0x3FFF
+#define PRG_RAM_START 0x6000
+#define PRG_RAM_END 0x7FFF
+#define PRG_RAM_SIZE 0x2000
+#define CONTROLLER_1 0x4016
+#define CONTROLLER_2 0x4017
+#define OAM_DMA 0x4014
+// Granularity of the memory map and of copy on write
+#define MEMORY_PAGE_SIZE 0x100
+#define MEMORY_PAGE_COUNT 0x100
+#define RAM_PAGE_COUNT 8
+
+class CodeDataLogger;
+
+typedef std::array<uint8_t, MEMORY_PAGE_SIZE> MemoryPage;
+typedef std::array<uint8_t, PRG_RAM_SIZE> PrgRam;
+typedef std::array<uint8_t, MEMORY_PAGE_SIZE * MEMORY_PAGE_COUNT> FlatMemory;
+
+// Standard controller buttons, in the order they are shifted out
+enum Button {
+  BUTTON_A = (1 << 0),
+  BUTTON_B = (1 << 1),
+  BUTTON_SELECT = (1 << 2),
+  BUTTON_START = (1 << 3),
+  BUTTON_UP = (1 << 4),
+  BUTTON_DOWN = (1 << 5),
+  BUTTON_LEFT = (1 << 6),
+  BUTTON_RIGHT = (1 << 7)
+};
 
 enum Mirroring {
   VERTICAL,
@@ -24,16 +56,113 @@ struct Rom {
 class Bus {
 public:
   Bus(std::vector<uint8_t> romData);
+  // 64KB of plain RAM without ROM or I/O, every address reads back what was
+  // last written there. For running CPU test vectors.
+  static Bus flat();
+  // Copies get their own RAM, use fork() to share it until written
+  Bus(const Bus &other);
+  Bus(Bus &&other) = default;
+  Bus &operator=(const Bus &other);
+  Bus &operator=(Bus &&other) = default;
+  // Returns a bus sharing the ROM and every RAM page with this one. Pages
+  // are copied on the first write from either side, so a fork costs the
+  // memory map plus the pages it ends up changing.
+  Bus fork();
+  // RAM pages not shared with any fork
+  size_t getPrivatePageCount() const;
+  // The 2KB of work RAM as one writable block, for access without copying.
+  // Pages shared with a fork are made private first. The pointer stays valid
+  // until the bus is forked or destroyed.
+  uint8_t *getRam();
+  // All 64KB of a flat bus, nullptr for any other bus
+  uint8_t *getFlatMemory();
+  // Copies work RAM out without the side effects of readFromMemory
+  void readRam(uint16_t address, uint8_t *data, size_t size) const;
   void writeToMemory(uint16_t address, uint8_t data);
   uint8_t readFromMemory(uint16_t address);
+  // What readFromMemory would return, without touching the PPU's registers,
+  // the controllers' shift registers or the code/data log
+  uint8_t peek(uint16_t address) const;
   void writeShortToMemory(uint16_t address, uint16_t data);
   uint16_t readShortFromMemory(uint16_t address);
+  // The byte at address if both reads and writes of it go straight to
+  // memory, for read-modify-write in place. nullptr if either takes the slow
+  // path (I/O, ROM, RAM shared with a fork).
+  uint8_t *resolveRam(uint16_t address);
   static std::optional<Rom> readBytes(std::vector<uint8_t>& raw);
+  // The ROM is immutable once loaded, so copies of the bus share it
+  std::shared_ptr<const Rom> getRom() const { return rom; }
+  uint64_t getRomHash() const { return romHash; }
+  // Buttons currently held on a controller (0 or 1), a mask of Button
+  void setControllerState(uint8_t port, uint8_t buttons);
+  uint64_t hashRam(uint64_t seed = 0) const;
+  // RAM, controllers and the PPU as of the CPU cycle, seeded with the CPU
+  // side of the state
+  uint64_t hashState(uint64_t seed, uint64_t cycle) const;
+  void saveState(BusState &state, uint64_t cycle) const;
+  void loadState(const BusState &state);
+  // CPU cycle of the access the CPU is about to make, the PPU is caught up
+  // to it when its registers are touched
+  void setClock(uint64_t cycle) { clock = cycle; }
+  // The CPU has to stop for an event once its clock reaches this: an NMI, or
+  // the stall of an OAM DMA
+  uint64_t getNextEvent() const {
+    return dmaStall != 0 ? 0 : ppu.getNextEvent();
+  }
+  // Cycles the last OAM DMA halts the CPU for, once
+  uint16_t takeDmaStall();
+  bool takeNmi(uint64_t cycle) { return ppu.takeNmi(cycle); }
+  // See PPU::getNextChange
+  uint64_t getNextPpuChange(uint64_t cycle) const {
+    return ppu.getNextChange(cycle);
+  }
+  const PPU &getPpu() const { return ppu; }
+  // The PPU's picture with every line up to the CPU cycle drawn
+  const uint8_t *getFramebuffer(uint64_t cycle) const {
+    ppu.catchUp(cycle);
+    return ppu.getFramebuffer();
+  }
+  void resetPpu() { ppu.reset(); }
+  // See PPU::setDrawing
+  void setPpuDrawing(bool draw) { ppu.setDrawing(draw); }
+  // Logs how the CPU and PPU use each ROM byte, see CodeDataLogger. ROM reads
+  // go through the slow path while one is set. Forks don't inherit it.
+  void setCodeDataLogger(CodeDataLogger *logger);
+  CodeDataLogger *getCodeDataLogger() const { return codeDataLogger; }
+  // Start of the instruction the CPU is running, reads of its own bytes are
+  // fetches rather than data to the logger
+  void setFetchAddress(uint16_t address) { fetchAddress = address; }
 private:
-  uint8_t cpuVram[2048];
-  uint8_t readPrgRom(uint16_t address);
-  uint16_t readShortFromPrgRom(uint16_t address);
-  Rom rom;
+  // Work RAM, 2KB mirrored up to $1FFF
+  std::shared_ptr<MemoryPage> ramPages[RAM_PAGE_COUNT];
+  // Cartridge RAM at $6000-$7FFF, allocated on the first write and copied on
+  // write as a whole. States and hashes only carry it once allocated.
+  std::shared_ptr<PrgRam> prgRam;
+  // Only set on a flat bus, which maps it over the whole address space
+  std::shared_ptr<FlatMemory> flatMemory;
+  // Direct pointers per page of the address space, nullptr goes through the
+  // slow path (I/O registers, writes to shared RAM pages, ROM writes)
+  const uint8_t *readMap[MEMORY_PAGE_COUNT];
+  uint8_t *writeMap[MEMORY_PAGE_COUNT];
+  uint64_t romHash;
+  uint8_t controllerState[2];
+  uint8_t controllerShift[2];
+  bool controllerStrobe;
+  // Caught up lazily, even by const methods like saveState
+  mutable PPU ppu;
+  uint64_t clock;
+  uint16_t dmaStall;
+  CodeDataLogger *codeDataLogger;
+  uint16_t fetchAddress;
+  uint8_t readController(uint8_t port);
+  // Only for fork(), which fills everything in through copyFrom
+  Bus() {}
+  void copyFrom(const Bus &other, bool sharePages);
+  void mapPages();
+  uint8_t *unsharePage(uint8_t ramPage);
+  uint8_t *unsharePrgRam();
+  uint8_t readSlow(uint16_t address);
+  void writeSlow(uint16_t address, uint8_t data);
+  uint8_t readPrgRom(uint16_t address) const;
+  std::shared_ptr<const Rom> rom;
 };
-
-
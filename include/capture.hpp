@@ -0,0 +1,106 @@
+#pragma once
+#include "palette.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CAPTURE_FRAME_RATE 60
+#define CAPTURE_SAMPLE_RATE 44100
+#define CAPTURE_SAMPLES_PER_FRAME (CAPTURE_SAMPLE_RATE / CAPTURE_FRAME_RATE)
+#define CAPTURE_FRAME_SIZE (SCREEN_WIDTH * SCREEN_HEIGHT)
+#define CAPTURE_PICTURE_SIZE (256 * 240)
+
+// What each pushed frame holds
+enum CaptureSource {
+  // The 32x32 screen bytes at $0200
+  CAPTURE_SCREEN,
+  // The 256x240 PPU picture, one palette index per pixel
+  CAPTURE_PICTURE
+};
+
+// What pushFrame does when the writer has fallen a whole queue behind
+enum CaptureOverflow {
+  // Wait for the writer, the recording is complete but emulation slows down
+  CAPTURE_BLOCK,
+  // Drop the frame and its audio, emulation never waits
+  CAPTURE_DROP
+};
+
+struct CaptureStats {
+  uint64_t framesQueued;
+  uint64_t framesWritten;
+  uint64_t framesDropped;
+  // Time pushFrame spent waiting on a full queue
+  uint64_t blockedNanos;
+  uint64_t bytesWritten;
+  // Most frames that were waiting in the queue at once
+  size_t queueHighWater;
+};
+
+// Records frames to a y4m video and their audio to a 16 bit mono WAV. The
+// emulation thread only copies each frame into a bounded queue, a writer
+// thread converts it to YUV and writes both files through large buffers, so
+// emulation never waits on the disk unless the queue fills up.
+class Capture {
+public:
+  Capture(size_t queueFrames = 16, CaptureOverflow overflow = CAPTURE_BLOCK,
+          CaptureSource source = CAPTURE_SCREEN);
+  ~Capture();
+  Capture(const Capture &) = delete;
+  Capture &operator=(const Capture &) = delete;
+  // Either path can be empty to skip that stream
+  bool open(const std::string &videoPath, const std::string &audioPath);
+  // Queues getFrameSize() pixels and the samples that go with them,
+  // returns false if the frame was dropped
+  bool pushFrame(const uint8_t *screen, const int16_t *samples,
+                 size_t sampleCount);
+  // Writes out everything queued and finishes the files, returns false if
+  // any write failed
+  bool close();
+  CaptureStats getStats();
+  // CAPTURE_FRAME_SIZE or CAPTURE_PICTURE_SIZE, depending on the source
+  size_t getFrameSize() const;
+
+private:
+  struct Frame {
+    std::vector<uint8_t> pixels;
+    std::vector<int16_t> samples;
+  };
+  // Output file written in large blocks
+  struct Output {
+    int fd = -1;
+    std::vector<uint8_t> buffer;
+    bool append(const void *data, size_t size, uint64_t &written);
+    bool flush(uint64_t &written);
+  };
+
+  CaptureOverflow overflow;
+  int width;
+  int height;
+  std::vector<Frame> queue;
+  // Next slot to fill and next slot to write
+  size_t head;
+  size_t tail;
+  size_t count;
+  bool closing;
+  bool failed;
+  CaptureStats stats;
+  std::mutex lock;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+  std::thread writer;
+  Output video;
+  Output audio;
+  uint64_t audioBytes;
+  // Y, U and V of every pixel value
+  uint8_t yuv[256][3];
+  // FRAME marker and planes of the frame being written
+  std::vector<uint8_t> planes;
+
+  void writeLoop();
+  bool writeFrame(const Frame &frame, uint64_t &written);
+};
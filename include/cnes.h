@@ -0,0 +1,113 @@
+/* Stable C interface to the emulator, built as the libcnes shared library.
+ *
+ * Everything goes through an opaque cnes_t handle. Functions returning int
+ * give CNES_OK or one of the negative CNES_ERROR codes. Pointers handed out
+ * for the frame buffer, work RAM and audio point straight into the emulator,
+ * nothing is copied, and they stay valid until the next cnes_load_rom or
+ * cnes_destroy on the same handle. A handle must only be used by one thread
+ * at a time, separate handles are independent.
+ *
+ * Only additions are made to this interface, CNES_API_VERSION goes up when
+ * something is added. */
+#ifndef CNES_H
+#define CNES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(CNES_BUILDING)
+#define CNES_EXPORT __declspec(dllexport)
+#elif defined(_WIN32)
+#define CNES_EXPORT __declspec(dllimport)
+#else
+#define CNES_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CNES_API_VERSION 2
+
+/* The screen is 32x32 pixels, one palette index per pixel, row by row. It is
+ * work RAM $0200-$05FF, which is what programs draw into. */
+#define CNES_FRAME_WIDTH 32
+#define CNES_FRAME_HEIGHT 32
+#define CNES_RAM_SIZE 2048
+/* What the PPU draws, one palette index per pixel, row by row */
+#define CNES_PPU_FRAME_WIDTH 256
+#define CNES_PPU_FRAME_HEIGHT 240
+
+/* Controller buttons for cnes_set_input, same bits as the hardware report */
+#define CNES_BUTTON_A (1 << 0)
+#define CNES_BUTTON_B (1 << 1)
+#define CNES_BUTTON_SELECT (1 << 2)
+#define CNES_BUTTON_START (1 << 3)
+#define CNES_BUTTON_UP (1 << 4)
+#define CNES_BUTTON_DOWN (1 << 5)
+#define CNES_BUTTON_LEFT (1 << 6)
+#define CNES_BUTTON_RIGHT (1 << 7)
+
+#define CNES_OK 0
+/* The CPU hit BRK or an unknown opcode, load a state or ROM to continue */
+#define CNES_STOPPED 1
+#define CNES_ERROR_INVALID_ARGUMENT -1
+#define CNES_ERROR_NO_ROM -2
+#define CNES_ERROR_BAD_ROM -3
+#define CNES_ERROR_BAD_STATE -4
+#define CNES_ERROR_OUT_OF_MEMORY -5
+
+typedef struct cnes cnes_t;
+
+/* CNES_API_VERSION of the library actually loaded */
+CNES_EXPORT int cnes_api_version(void);
+
+/* Returns NULL if out of memory */
+CNES_EXPORT cnes_t *cnes_create(void);
+CNES_EXPORT void cnes_destroy(cnes_t *nes);
+
+/* Loads an iNES image and resets. The data is copied, the caller keeps it.
+ * Truncated images and mappers other than NROM give CNES_ERROR_BAD_ROM. */
+CNES_EXPORT int cnes_load_rom(cnes_t *nes, const uint8_t *data, size_t size);
+CNES_EXPORT int cnes_reset(cnes_t *nes);
+
+/* Runs to the next frame boundary, returns CNES_OK, CNES_STOPPED or an
+ * error */
+CNES_EXPORT int cnes_step_frame(cnes_t *nes);
+/* Frame the CPU is in, counted from power on. Follows loaded states. */
+CNES_EXPORT uint64_t cnes_frame_count(const cnes_t *nes);
+
+/* Buttons held on port 0 or 1, a mask of CNES_BUTTON bits. They are latched
+ * by the program, so set them before stepping the frame that reads them. */
+CNES_EXPORT int cnes_set_input(cnes_t *nes, unsigned port, uint8_t buttons);
+
+/* Save states are plain bytes of cnes_state_size() length, the same format
+ * the emulator writes to disk. They only load into the ROM they came from. */
+CNES_EXPORT size_t cnes_state_size(void);
+CNES_EXPORT int cnes_save_state(const cnes_t *nes, void *buffer, size_t size);
+CNES_EXPORT int cnes_load_state(cnes_t *nes, const void *buffer, size_t size);
+
+/* CNES_FRAME_WIDTH * CNES_FRAME_HEIGHT palette indices, NULL without a ROM */
+CNES_EXPORT const uint8_t *cnes_framebuffer(const cnes_t *nes);
+/* CNES_PPU_FRAME_WIDTH * CNES_PPU_FRAME_HEIGHT palette indices of the
+ * PPU's picture up to where the CPU is, NULL without a ROM or until the PPU
+ * has drawn a line. Lines are only drawn while the program has rendering on.
+ * Since version 2. */
+CNES_EXPORT const uint8_t *cnes_ppu_framebuffer(const cnes_t *nes);
+/* Whether stepped frames draw into cnes_ppu_framebuffer, on by default and
+ * kept across ROM loads. Turning it off saves the drawing for frames nobody
+ * looks at, such as the ones run-ahead throws away, the picture stays as it
+ * was. Emulation runs the same either way. Since version 2. */
+CNES_EXPORT int cnes_set_drawing(cnes_t *nes, int enabled);
+/* CNES_RAM_SIZE bytes of work RAM, writes go straight to the emulated
+ * memory. NULL without a ROM. */
+CNES_EXPORT uint8_t *cnes_ram(cnes_t *nes);
+/* Signed 16 bit mono samples produced by the last frame, NULL when there
+ * are none. There is no APU yet, so this is always empty. */
+CNES_EXPORT const int16_t *cnes_audio(const cnes_t *nes, size_t *samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct Rom;
+
+// Bits of a .cdl byte, the format FCEUX and Mesen use
+enum CdlFlags {
+  // PRG ROM
+  CDL_CODE = (1 << 0),
+  CDL_DATA = (1 << 1),
+  // 2 bits, which 8KB window of $8000-$FFFF the byte was read through
+  CDL_BANK_SHIFT = 2,
+  CDL_BANK_MASK = (3 << 2),
+  // Target of an indirect jump
+  CDL_INDIRECT_CODE = (1 << 4),
+  // CHR ROM
+  CDL_CHR_DRAWN = (1 << 0),
+  CDL_CHR_READ = (1 << 1)
+};
+
+// ROM bytes, out of the ROM's size, with each kind of use logged
+struct CdlStats {
+  size_t prgBytes;
+  size_t code;
+  size_t data;
+  size_t indirectCode;
+  size_t chrBytes;
+  size_t chrDrawn;
+  size_t chrRead;
+};
+
+// Code/Data Logger: one byte per PRG ROM byte then one per CHR ROM byte,
+// flagging how the game used it, indexed by offset in the ROM image. Written
+// as a .cdl file for disassemblers and for nes_recompile, which compiles
+// indirect jump targets it otherwise can't find.
+//
+// Attach it with Bus::setCodeDataLogger. The CPU marks each instruction's
+// bytes as code when it runs it, ROM reads other than the instruction's own
+// fetches are data. Those reads are found on the bus's slow path, ROM pages
+// are taken out of the page table while a logger is set. Without one the
+// cost is a null test per instruction and per pattern row drawn.
+class CodeDataLogger {
+public:
+  CodeDataLogger(std::shared_ptr<const Rom> rom);
+  // The opcode and operands of an instruction at a CPU address
+  void logCode(uint16_t address, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+      uint16_t byte = address + i;
+      if (byte >= 0x8000 && this->prgSize != 0) {
+        this->log[prgOffset(byte)] |= CDL_CODE | bankBits(byte);
+      }
+    }
+  }
+  void logIndirectCode(uint16_t address) {
+    if (address >= 0x8000 && this->prgSize != 0) {
+      this->log[prgOffset(address)] |= CDL_INDIRECT_CODE | bankBits(address);
+    }
+  }
+  void logData(uint16_t address) {
+    if (address >= 0x8000 && this->prgSize != 0) {
+      this->log[prgOffset(address)] |= CDL_DATA | bankBits(address);
+    }
+  }
+  // Both planes of a pattern row the PPU drew, or a $2007 read of CHR
+  void logChrDrawn(uint16_t pattern) {
+    if (this->chrSize != 0) {
+      this->log[this->prgSize + pattern % this->chrSize] |= CDL_CHR_DRAWN;
+      this->log[this->prgSize + (pattern + 8) % this->chrSize] |=
+          CDL_CHR_DRAWN;
+    }
+  }
+  void logChrRead(uint16_t address) {
+    if (this->chrSize != 0) {
+      this->log[this->prgSize + address % this->chrSize] |= CDL_CHR_READ;
+    }
+  }
+
+  // Merges a log saved earlier, false if it can't be read or is for a ROM
+  // of another size
+  bool load(const std::string &path);
+  bool save(const std::string &path) const;
+  const std::vector<uint8_t> &getLog() const { return log; }
+  // CPU addresses of the logged indirect jump targets, in ROM order
+  std::vector<uint16_t> getIndirectTargets() const;
+  CdlStats getStats() const;
+
+private:
+  size_t prgSize;
+  size_t chrSize;
+  std::vector<uint8_t> log;
+
+  // 16KB images are mirrored into $C000-$FFFF
+  size_t prgOffset(uint16_t address) const {
+    return (address - 0x8000) % this->prgSize;
+  }
+  static uint8_t bankBits(uint16_t address) {
+    return ((address >> 13) & 3) << CDL_BANK_SHIFT;
+  }
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include "cpu.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// nestest runs its official opcode tests in about 26500 cycles
+#define CONFORMANCE_NESTEST_CYCLES 100000
+// A minute of emulated time
+#define CONFORMANCE_DEFAULT_CYCLES (60ull * 60 * CYCLES_PER_FRAME)
+// blargg's tests ask for a reset and wait at least 100ms for it
+#define CONFORMANCE_RESET_DELAY (6 * CYCLES_PER_FRAME)
+// Status byte, signature and message of blargg's result protocol
+#define BLARGG_STATUS 0x6000
+#define BLARGG_SIGNATURE 0x6001
+#define BLARGG_MESSAGE 0x6004
+#define BLARGG_RUNNING 0x80
+#define BLARGG_NEEDS_RESET 0x81
+
+// How a test ROM reports its result
+enum ConformanceKind {
+  // nestest in automation mode, entered at $C000, error codes of the official
+  // and unofficial opcode tests in $02 and $03
+  CONFORMANCE_NESTEST,
+  // Writes DE B0 61 to $6001, then a status to $6000 and a message to $6004
+  CONFORMANCE_BLARGG,
+  // No protocol, passes if it runs its whole budget without the CPU stopping
+  CONFORMANCE_OTHER
+};
+
+enum ConformanceStatus {
+  CONFORMANCE_PASS,
+  CONFORMANCE_FAIL,
+  // The budget ran out before the ROM reported a result
+  CONFORMANCE_TIMEOUT,
+  // The CPU stopped before the ROM reported a result
+  CONFORMANCE_CRASH,
+  // Not a ROM this emulator can run, e.g. an unsupported mapper
+  CONFORMANCE_SKIPPED
+};
+
+struct ConformanceTest {
+  std::string name;
+  std::vector<uint8_t> rom;
+  // nestest is recognised by name, blargg's protocol when the ROM uses it
+  bool nestest;
+  uint64_t cycleBudget;
+};
+
+struct ConformanceResult {
+  ConformanceKind kind;
+  ConformanceStatus status;
+  // Result code the ROM reported, 0 is a pass
+  uint8_t code;
+  // Message written by blargg's tests, or why the test didn't run to the end
+  std::string message;
+  uint64_t cycles;
+  double seconds;
+};
+
+const char *conformanceStatusName(ConformanceStatus status);
+
+// Runs a suite of test ROMs headless, one ROM per thread at a time. Every ROM
+// gets its own CPU and its own cycle budget, and reports how fast it ran in
+// emulated cycles per second so the suite doubles as a throughput check.
+class ConformanceRunner {
+public:
+  // threads = 0 uses every hardware thread
+  ConformanceRunner(size_t threads = 0);
+  size_t add(ConformanceTest test);
+  // Adds every .nes file under a directory, sorted by path. Budgets come
+  // from budgets.txt in the directory if it lists the file as
+  // "<relative path> <cycles>", otherwise from the defaults above.
+  bool addDirectory(const std::string &directory);
+  const std::vector<ConformanceTest> &getTests() const { return tests; }
+  // Results are in the order tests were added
+  std::vector<ConformanceResult> run();
+  size_t getThreadCount() const { return threadCount; }
+
+  static ConformanceResult runTest(const ConformanceTest &test);
+
+private:
+  size_t threadCount;
+  std::vector<ConformanceTest> tests;
+};
@@ -1,21 +1,50 @@
 #pragma once
 #include "bus.hpp"
+#include <array>
 #include <cstdint>
 #include <string>
-#include <unordered_map>
 #include <vector>
 #include <functional>
 
+// Longest loop body, in bytes, checked for being an idle loop
+#define IDLE_LOOP_MAX_BYTES 16
+
+// Entries in CPU::fusedTable
+#define FUSED_SEQUENCE_COUNT 7
+
+struct AotProgram;
+class Breakpoints;
+class Disassembler;
+class Profiler;
+
+// Spin loops runFrame skipped instead of running
+struct IdleLoopStats {
+  // Times a loop was skipped
+  uint64_t loops;
+  uint64_t cycles;
+};
 
 class CPU {
 public:
   CPU(Bus bus);
+  CPU(const CPU &other) = default;
+  CPU(CPU &&other) = default;
+  CPU &operator=(const CPU &other) = default;
+  CPU &operator=(CPU &&other) = default;
   ~CPU();
+  // Branches execution: the child shares the ROM, the decode tables and all
+  // RAM pages with this CPU until one of them writes, see Bus::fork. Profiler
+  // and breakpoint hooks are not inherited.
+  CPU fork();
+  // 64-bit hash of everything that decides how execution continues, for
+  // spotting identical states. The absolute frame number is left out, only
+  // the position within the frame counts.
+  uint64_t hashState() const;
   // 8 bit registers
   uint8_t A, X, Y, S, P, SP;
   uint16_t PC;
-  // 16bit address bus width, 64kib total of byte addressable memory
-  uint8_t memory[0xFFFF];
+  // Total CPU cycles executed since power on
+  uint64_t cycles;
 
   enum FLAGS {
     C = (1 << 0),
@@ -42,55 +71,69 @@ public:
     NoneAddressing
   };
 
-  // CPU Instructions
+  // CPU Instructions. Handlers that take an operand are templated on its
+  // addressing mode, dispatchTable holds one instance per opcode.
   uint8_t BRK();
   uint8_t TAX();
   uint8_t INX();
-  uint8_t STA(ADDRESSING mode);
-  uint8_t ADC(ADDRESSING mode);
-  uint8_t AND(ADDRESSING mode);
-  uint8_t ASL(ADDRESSING mode);
+  template <ADDRESSING mode> uint8_t STA();
+  template <ADDRESSING mode> uint8_t ADC();
+  template <ADDRESSING mode> uint8_t AND();
+  template <ADDRESSING mode> uint8_t ASL();
   uint8_t ASLAccumulator();
   void branch(bool condition);
-  void compare(ADDRESSING mode, uint8_t reg);
-  uint8_t BIT(ADDRESSING mode);
-  uint8_t DEC(ADDRESSING mode);
-  void DECX();
-  void DECY();
-  uint8_t EOR(ADDRESSING mode);
-  uint8_t INC(ADDRESSING mode);
-  void INCX();
-  void INCY();
-  uint8_t JMP(ADDRESSING mode);
-  uint8_t JSR(ADDRESSING mode);
-  uint8_t LDA(ADDRESSING mode);
-  uint8_t LDX(ADDRESSING mode);
-  uint8_t LDY(ADDRESSING mode);
-  uint8_t LSR(ADDRESSING mode);
+  // Branches if the flag is set, or clear when set is false
+  template <FLAGS flag, bool set> uint8_t branchIf();
+  template <ADDRESSING mode> void compare(uint8_t reg);
+  template <ADDRESSING mode> uint8_t CMP();
+  template <ADDRESSING mode> uint8_t CPX();
+  template <ADDRESSING mode> uint8_t CPY();
+  template <ADDRESSING mode> uint8_t BIT();
+  uint8_t CLC();
+  uint8_t CLD();
+  uint8_t CLI();
+  uint8_t CLV();
+  template <ADDRESSING mode> uint8_t DEC();
+  uint8_t DECX();
+  uint8_t DECY();
+  template <ADDRESSING mode> uint8_t EOR();
+  template <ADDRESSING mode> uint8_t INC();
+  uint8_t INCY();
+  template <ADDRESSING mode> uint8_t JMP();
+  template <ADDRESSING mode> uint8_t JSR();
+  template <ADDRESSING mode> uint8_t LDA();
+  template <ADDRESSING mode> uint8_t LDX();
+  template <ADDRESSING mode> uint8_t LDY();
+  template <ADDRESSING mode> uint8_t LSR();
   uint8_t LSRAccumulator();
-  uint8_t ORA(ADDRESSING mode);
+  uint8_t NOP();
+  template <ADDRESSING mode> uint8_t ORA();
   uint8_t PHA();
   uint8_t PHP();
   uint8_t PLA();
   uint8_t PLP();
-  uint8_t ROL(ADDRESSING mode);
+  template <ADDRESSING mode> uint8_t ROL();
   uint8_t ROLAccumulator();
-  uint8_t ROR(ADDRESSING mode);
+  template <ADDRESSING mode> uint8_t ROR();
   uint8_t RORAccumulator();
   uint8_t RTI();
   uint8_t RTS();
-  uint8_t SBC(ADDRESSING mode);
+  template <ADDRESSING mode> uint8_t SBC();
   uint8_t SEC();
   uint8_t SED();
   uint8_t SEI();
-  uint8_t STX(ADDRESSING mode);
-  uint8_t STY(ADDRESSING mode);
+  template <ADDRESSING mode> uint8_t STX();
+  template <ADDRESSING mode> uint8_t STY();
   uint8_t TAY();
   uint8_t TSX();
   uint8_t TXA();
   uint8_t TXS();
   uint8_t TYA();
 
+  typedef uint8_t (CPU::*handler)();
+  // Handler of every opcode in opcodeTable, the others are NOP
+  static const std::array<handler, 256> dispatchTable;
+
   // Memory Access
   uint8_t readFromMemory(uint16_t address);
   void writeToMemory(uint16_t address, uint8_t data);
@@ -98,15 +141,63 @@ public:
   void writeShortToMemory(uint16_t address, uint16_t data);
   void loadProgram(uint8_t program[], uint32_t size);
   void loadProgramAndRun(uint8_t program[], uint32_t size);
+  // Address of the operand of the instruction at PC - 1. Handlers use
+  // operandAddress<mode>(), these switch on the mode first.
   uint16_t getOperandAddress(ADDRESSING mode);
   uint16_t getAbsoluteAddress(ADDRESSING mode, uint16_t address);
 
   // This method is for testing, receives programs as a seperate input stream
   void interpret();
   void interpretWithCB(const std::function<void(CPU*)> &callback);
+  // Executes a single instruction, returns false once BRK or an unknown
+  // opcode is hit or when a breakpoint or watchpoint stops execution
+  bool step();
+  // Runs until the cycle counter crosses the next frame boundary, returns
+  // false if step() stopped first. Idle loops are skipped, see
+  // skipIdleLoops.
+  bool runFrame();
+  uint64_t getFrame() const { return cycles / CYCLES_PER_FRAME; }
+  // When set, every executed instruction is recorded into the profiler
+  Profiler *profiler;
+  // When set, execution stops on the breakpoints and watchpoints in it
+  Breakpoints *breakpoints;
+  // Lets runFrame fast forward through loops that wait for the next event
+  // without changing anything, like `LDA $2002; BPL` or `JMP *`. The state
+  // afterwards is exactly what running them would give, turning it off only
+  // makes runFrame slower. Never done with a profiler, breakpoints or a
+  // code/data logger set.
+  bool skipIdleLoops;
+  const IdleLoopStats &getIdleLoopStats() const { return idleLoopStats; }
+  // Lets runFrame run the sequences in fusedTable as one superinstruction,
+  // with one dispatch and only the flags the last instruction leaves. Like
+  // skipIdleLoops it never changes the result and is off with hooks set.
+  bool fuseInstructions;
+  // Times each entry of fusedTable ran, every run saved one dispatch per
+  // instruction after the first
+  const std::array<uint64_t, FUSED_SEQUENCE_COUNT> &getFusedCounts() const {
+    return fusedCounts;
+  }
+  // Lets runFrame run code compiled ahead of time for this ROM, if the binary
+  // was linked with some (see aot.hpp). The results are the same as the
+  // interpreter's, and it is off with hooks set too.
+  bool runCompiled;
+  bool hasCompiledCode() const { return compiled != nullptr; }
+  // Cycles spent in compiled code
+  uint64_t getCompiledCycles() const { return compiledCycles; }
+  // Whether the last runFrame stopped on an opcode the CPU doesn't
+  // implement, rather than on BRK or a breakpoint. PC is left on it.
+  bool isStoppedOnUnknown() const { return stoppedOnUnknown; }
+
+  // Save states, see savestate.hpp. Loading fails if the state was taken
+  // with a different ROM or by an incompatible version.
+  void saveState(SaveState &state) const;
+  bool loadState(const SaveState &state);
 
   // CPU Functional Methods
   void reset();
+  // Pushes PC and the status and jumps through the NMI vector. step() calls
+  // it when the PPU raises an NMI.
+  void nmi();
   void pushOnStack(uint8_t value);
   uint8_t popFromStack();
 
@@ -122,11 +213,71 @@ public:
     // Addressing mode
     ADDRESSING mode;
   };
-  static std::vector<instruction> opcodeTable;
-  std::unordered_map<uint16_t, instruction> lookupTable;
+  // Immutable, shared by every CPU on every thread
+  static const std::vector<instruction> opcodeTable;
+  // opcodeTable indexed by opcode, unknown opcodes have zero bytes
+  static const std::array<instruction, 256> lookupTable;
+
+  struct fusedSequence {
+    // e.g. "DEX; BNE"
+    std::string name;
+    std::vector<uint8_t> opcodes;
+  };
+  // Superinstructions, picked from the most common fall through pairs in
+  // profiles of the ROMs we run (see Profiler::writePairs). Sequences that
+  // start with the same opcode are next to each other.
+  static const std::vector<fusedSequence> fusedTable;
+  // True if some fused sequence starts with these two opcodes
+  static bool isFused(uint8_t first, uint8_t second);
   void setZeroAndNegativeFlags(uint8_t value);
+  Bus &getBus() { return bus; }
+  const Bus &getBus() const { return bus; }
 private:
   Bus bus;
+  // The last short backward jump, from the instruction at `from` to `head`,
+  // and the registers it left. The loop is idle if the next jump back finds
+  // the same registers and its body can't write or read anything that
+  // changes.
+  struct IdleLoop {
+    uint16_t head;
+    uint16_t from;
+    bool idleBody;
+    // The body reads PPUSTATUS, so it can only be skipped up to the next
+    // change of the PPU's flags
+    bool pollsPpu;
+    bool seen;
+    uint8_t A, X, Y, S, SP;
+    uint64_t cycles;
+  };
+  IdleLoop idleLoop;
+  IdleLoopStats idleLoopStats;
+  std::array<uint64_t, FUSED_SEQUENCE_COUNT> fusedCounts;
+  const AotProgram *compiled;
+  uint64_t compiledCycles;
+  bool stoppedOnUnknown;
+
+  // Takes the OAM DMA stall and the NMI that are due before the next
+  // instruction
+  void serviceEvents();
+  void observeLoop(uint16_t from, uint64_t until);
+  bool isIdleLoopBody(uint16_t head, uint16_t from, bool &pollsPpu);
+  // Instruction fetches go straight to the bus, read watchpoints only see
+  // the data instructions access
+  uint8_t fetch(uint16_t address) { return bus.readFromMemory(address); }
+  uint16_t fetchShort(uint16_t address) {
+    return bus.readShortFromMemory(address);
+  }
+  template <ADDRESSING mode> uint16_t operandAddress();
+  // The value a read instruction works on, immediates are part of the fetch
+  template <ADDRESSING mode> uint8_t readOperand(uint16_t address);
+  // Reads the operand, writes back op(operand). RAM is modified in place
+  // through one pointer, anything else goes through the bus twice.
+  template <ADDRESSING mode, typename F> void readModifyWrite(F op);
+  // Runs the fused sequence at PC if there is one and it ends before
+  // `until`, leaving `last` at the address of its last instruction
+  bool stepFused(uint64_t until, uint16_t &last);
+  bool isFusable(size_t index, uint16_t pc, uint64_t until);
+  uint16_t fusedBranch(uint16_t address, bool condition);
 };
 
-std::string traceCpuState(CPU *cpu);
+std::string traceCpuState(CPU *cpu, Disassembler *disassembler = nullptr);
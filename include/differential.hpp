@@ -0,0 +1,138 @@
+#pragma once
+#include "cpu.hpp"
+#include "lockstep.hpp"
+#include "movie.hpp"
+#include "savestate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Addresses of each memory listed in a divergence report before the rest are
+// only counted
+#define DIFFERENTIAL_RAM_REPORT_LIMIT 16
+
+// An execution engine for the differential executor. Every engine runs the
+// same instruction semantics and exchanges states as SaveState, so states
+// can be compared field by field whatever the engine keeps internally.
+class ExecutionBackend {
+public:
+  virtual ~ExecutionBackend() {}
+  virtual std::string getName() const = 0;
+  virtual uint64_t getRomHash() const = 0;
+  virtual void setControllerState(uint8_t port, uint8_t buttons) = 0;
+  // Runs to the next frame boundary, false once the CPU stopped
+  virtual bool runFrame() = 0;
+  virtual uint64_t getCycles() const = 0;
+  // Has to agree with CPU::hashState for equal states
+  virtual uint64_t hashState() const = 0;
+  virtual void saveState(SaveState &state) const = 0;
+  virtual bool loadState(const SaveState &state) = 0;
+};
+
+// The reference interpreter
+class CpuBackend : public ExecutionBackend {
+public:
+  CpuBackend(std::vector<uint8_t> rom);
+  std::string getName() const override { return "cpu"; }
+  uint64_t getRomHash() const override { return cpu.getBus().getRomHash(); }
+  void setControllerState(uint8_t port, uint8_t buttons) override {
+    cpu.getBus().setControllerState(port, buttons);
+  }
+  bool runFrame() override { return cpu.runFrame(); }
+  uint64_t getCycles() const override { return cpu.cycles; }
+  uint64_t hashState() const override { return cpu.hashState(); }
+  void saveState(SaveState &state) const override { cpu.saveState(state); }
+  bool loadState(const SaveState &state) override {
+    return cpu.loadState(state);
+  }
+  CPU &getCpu() { return cpu; }
+
+private:
+  CPU cpu;
+};
+
+// One lane of a LockstepCPU, every lane gets the same input so they all run
+// the same code together
+template <size_t LANES> class LockstepBackend : public ExecutionBackend {
+public:
+  LockstepBackend(std::vector<uint8_t> rom, size_t lane = 0)
+      : cpu(std::make_unique<LockstepCPU<LANES>>(std::move(rom))),
+        lane(lane) {
+    this->cpu->reset();
+  }
+  std::string getName() const override {
+    return "lockstep" + std::to_string(LANES);
+  }
+  uint64_t getRomHash() const override { return cpu->getRomHash(); }
+  void setControllerState(uint8_t port, uint8_t buttons) override {
+    for (size_t i = 0; i < LANES; i++) {
+      cpu->setControllerState(i, port, buttons);
+    }
+  }
+  bool runFrame() override {
+    cpu->runFrame();
+    return !cpu->isStopped(lane);
+  }
+  uint64_t getCycles() const override { return cpu->cycles[lane]; }
+  uint64_t hashState() const override { return cpu->hashState(lane); }
+  void saveState(SaveState &state) const override {
+    cpu->saveState(lane, state);
+  }
+  bool loadState(const SaveState &state) override {
+    bool loaded = true;
+    for (size_t i = 0; i < LANES; i++) {
+      loaded = cpu->loadState(i, state) && loaded;
+    }
+    return loaded;
+  }
+
+private:
+  // About 40KB of lanes, kept off the stack
+  std::unique_ptr<LockstepCPU<LANES>> cpu;
+  size_t lane;
+};
+
+struct DifferentialResult {
+  // False if the run never started, e.g. the movie is for another ROM
+  bool started;
+  bool diverged;
+  // Both sides stopped in the same state before the frame budget ran out
+  bool stopped;
+  // Frame boundaries that matched
+  uint64_t frames;
+  // What differed at the first divergence, empty if nothing did
+  std::string report;
+  // The reference at the last boundary that matched, to replay the
+  // divergence from, and both sides where they first differed
+  SaveState lastMatch;
+  SaveState reference;
+  SaveState candidate;
+};
+
+// Runs a reference backend and a candidate side by side on the same input
+// and checks they agree at every frame boundary. A boundary costs a
+// comparison of cycle counts and state hashes and a copy of the reference
+// state to replay from, the candidate's state is only saved and diffed field
+// by field once the hashes disagree. Any faster backend has to run a ROM
+// corpus through this without diverging.
+class DifferentialExecutor {
+public:
+  DifferentialExecutor(ExecutionBackend &reference,
+                       ExecutionBackend &candidate);
+  // Plays frames of the movie, or runs without input if movie is nullptr,
+  // and stops at the first divergence
+  DifferentialResult run(const Movie *movie, size_t frames);
+  // Short report of every field that differs, empty if none does
+  static std::string diffStates(const SaveState &reference,
+                                const SaveState &candidate,
+                                const std::string &referenceName,
+                                const std::string &candidateName);
+
+private:
+  ExecutionBackend &reference;
+  ExecutionBackend &candidate;
+
+  void diverge(DifferentialResult &result, const std::string &why);
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include "bus.hpp"
+#include "cpu.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define PRG_BANK_SIZE 0x4000
+#define PRG_SLOT_COUNT 2
+
+#define NMI_VECTOR 0xFFFA
+#define RESET_VECTOR 0xFFFC
+#define IRQ_VECTOR 0xFFFE
+
+// One decoded instruction, memoized at the ROM offset of its opcode byte
+struct DecodedInstruction {
+  enum FLAGS {
+    // The entry has been decoded, every other field is garbage until then
+    DECODED = (1 << 0),
+    // Found by following control flow from one of the vectors
+    REACHABLE = (1 << 1),
+    // Target of a vector or a JSR
+    ENTRY_POINT = (1 << 2),
+    // Target of a branch or a JMP
+    JUMP_TARGET = (1 << 3),
+    // Opcode is not in CPU::opcodeTable
+    UNKNOWN = (1 << 4)
+  };
+
+  // Offset of the formatted text in the owning bank's text pool
+  uint32_t text;
+  uint16_t operand;
+  uint8_t opcode;
+  uint8_t bytes;
+  uint8_t flags;
+};
+
+class Disassembler {
+public:
+  Disassembler(std::shared_ptr<const Rom> rom);
+
+  // Follows reachable code from the NMI, reset and IRQ vectors through the
+  // banks currently mapped in, decoding each instruction once
+  void analyze();
+  // Changes which bank is visible in a 16KB slot ($8000 or $C000). Cached
+  // decodes of every bank are kept, so switching back is free.
+  void setBank(uint8_t slot, uint16_t bank);
+
+  // Returns the memoized decode of the instruction at a CPU address, decoding
+  // it on first use. Returns nullptr for addresses outside of PRG ROM.
+  const DecodedInstruction *lookup(uint16_t address);
+  // Mnemonic and operand, ie "LDA $0200,X". nullptr outside of PRG ROM. The
+  // text is formatted once, the pointer is valid until the next call.
+  const char *format(uint16_t address);
+  const CPU::instruction *getInstruction(uint8_t opcode) const {
+    return opcodes[opcode];
+  }
+  size_t getBankCount() const { return banks.size(); }
+
+private:
+  struct Bank {
+    std::vector<DecodedInstruction> entries;
+    std::string text;
+  };
+
+  std::shared_ptr<const Rom> rom;
+  std::vector<Bank> banks;
+  uint16_t slots[PRG_SLOT_COUNT];
+  const CPU::instruction *opcodes[256];
+
+  uint8_t readPrgRom(uint16_t address) const;
+  DecodedInstruction *entryFor(uint16_t address);
+  DecodedInstruction *decode(uint16_t address);
+};
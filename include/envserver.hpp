@@ -0,0 +1,148 @@
+#pragma once
+#include "cpu.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// "CNEV" read as a little endian word
+#define ENV_MAGIC 0x56454E43
+#define ENV_VERSION 2
+// Observations of a batch land in slot sequence % ENV_SLOTS, so a client can
+// read one batch while the next is being stepped
+#define ENV_SLOTS 2
+// The screen inside the RAM of an observation, 32x32 palette indices
+#define ENV_FRAME_OFFSET 0x0200
+#define ENV_FRAME_SIZE (32 * 32)
+
+// Wire format of the control socket, little endian, sent as raw structs.
+// Observations are never sent over the socket, they are written to the
+// shared memory region named in EnvHello.
+
+enum EnvRequestType { ENV_STEP = 1, ENV_CLOSE = 2 };
+enum EnvEntryFlags { ENV_RESET = (1 << 0) };
+
+// Sent by the server as soon as a client connects
+struct EnvHello {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t instanceCount;
+  uint32_t slotCount;
+  uint64_t sharedSize;
+  char sharedName[64];
+};
+
+// Followed by count EnvStepEntry
+struct EnvRequest {
+  uint32_t magic;
+  uint32_t type;
+  uint32_t sequence;
+  uint32_t count;
+};
+
+struct EnvStepEntry {
+  uint32_t instance;
+  // Frames to run with these buttons held, 0 only observes
+  uint32_t frames;
+  uint8_t buttons[2];
+  uint8_t flags;
+  uint8_t padding;
+};
+
+// One per request, in request order
+struct EnvReply {
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t slot;
+  // Entries that were stepped, or -1 if the request was rejected
+  int32_t status;
+};
+
+// Start of the shared memory region, followed by slotCount * instanceCount
+// observations, slot by slot
+struct EnvSharedHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t instanceCount;
+  uint32_t slotCount;
+};
+
+struct EnvObservation {
+  // Sequence of the batch that wrote this, UINT32_MAX before the first.
+  // Instances a batch did not step keep their older observation.
+  uint32_t sequence;
+  uint8_t stopped;
+  uint8_t padding[3];
+  uint64_t frame;
+  uint64_t stateHash;
+  uint8_t ram[2048];
+  // PPU picture row by row, one palette index per pixel, all 0 until the
+  // PPU has drawn a line
+  uint8_t picture[PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT];
+};
+
+// Offset of an observation in the shared memory region
+inline size_t envObservationOffset(uint32_t instanceCount, uint32_t slot,
+                                   uint32_t instance) {
+  return sizeof(EnvSharedHeader) +
+         (static_cast<size_t>(slot) * instanceCount + instance) *
+             sizeof(EnvObservation);
+}
+
+// Runs many instances of one ROM for clients in other processes. Requests
+// come in over a Unix domain socket and are executed strictly in order, one
+// reply each. Observations go into POSIX shared memory the client maps, so
+// only the small control messages cross the socket. A client may have up to
+// ENV_SLOTS requests in flight: the server is already stepping the next
+// batch while the client reads the slot of the previous one.
+//
+// Clients are served one at a time, instances keep running across
+// connections. Run one server per worker for parallelism.
+class EnvServer {
+public:
+  EnvServer(std::vector<uint8_t> rom, uint32_t instances);
+  ~EnvServer();
+  // Owns the socket and the shared memory
+  EnvServer(const EnvServer &) = delete;
+  EnvServer &operator=(const EnvServer &) = delete;
+  bool open(const std::string &socketPath, const std::string &sharedName);
+  // Serves clients until one sends ENV_CLOSE, returns false on socket errors
+  bool serve();
+  // Executes a step request into its slot, returns the reply status
+  int32_t step(uint32_t sequence, const std::vector<EnvStepEntry> &entries);
+  EnvObservation &getObservation(uint32_t slot, uint32_t instance);
+
+private:
+  // State after reset, copied into an instance for ENV_RESET
+  CPU powerOn;
+  std::vector<CPU> instances;
+  std::string socketPath;
+  std::string sharedName;
+  int listenFd;
+  uint8_t *shared;
+  size_t sharedSize;
+
+  // Returns false once the client is gone or asked to close
+  bool serveClient(int clientFd, bool &closing);
+};
+
+// Client side of EnvServer, for C++ callers and tests
+class EnvClient {
+public:
+  EnvClient();
+  ~EnvClient();
+  EnvClient(const EnvClient &) = delete;
+  EnvClient &operator=(const EnvClient &) = delete;
+  bool connect(const std::string &socketPath);
+  bool sendStep(uint32_t sequence, const std::vector<EnvStepEntry> &entries);
+  bool sendClose();
+  // Blocks until the next reply arrives
+  bool receive(EnvReply &reply);
+  const EnvObservation &getObservation(uint32_t slot, uint32_t instance) const;
+  const EnvHello &getHello() const { return hello; }
+
+private:
+  int fd;
+  EnvHello hello;
+  const uint8_t *shared;
+};
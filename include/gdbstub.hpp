@@ -0,0 +1,43 @@
+#pragma once
+#include "breakpoints.hpp"
+#include "cpu.hpp"
+#include <cstdint>
+#include <string>
+
+// GDB remote serial protocol stub. Registers are exposed in the order A, X, Y,
+// P, SP (one byte each) then PC (two bytes, little endian). Breakpoints map to
+// Z0/Z1 and watchpoints to Z2/Z3/Z4, all backed by the Breakpoints bitmaps.
+class GdbStub {
+public:
+  GdbStub(CPU &cpu, Breakpoints &breakpoints);
+  ~GdbStub();
+  // Listens on 127.0.0.1:port
+  bool listenTcp(uint16_t port);
+  // Listens on a Unix domain socket, replacing whatever is at path
+  bool listenUnix(const std::string &path);
+  // Waits for a debugger to attach and serves it until it detaches or kills
+  // the session
+  void serve();
+  // Serves a debugger already connected on fd, which is closed afterwards
+  void serveClient(int fd);
+
+private:
+  CPU &cpu;
+  Breakpoints &breakpoints;
+  int listenFd;
+  int clientFd;
+  std::string unixPath;
+  std::string received;
+
+  bool readPacket(std::string &packet);
+  bool sendPacket(const std::string &payload);
+  bool fillBuffer(bool block);
+  bool pollInterrupt();
+  std::string handle(const std::string &packet, bool &done);
+  std::string run(bool singleStep);
+  std::string stopReply(bool stopped);
+  std::string readRegisters();
+  std::string changeBreakpoint(const std::string &packet, bool insert);
+  uint8_t peek(uint16_t address);
+  void poke(uint16_t address, uint8_t data);
+};
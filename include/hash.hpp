@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Finalizer from MurmurHash3, spreads every input bit over the whole word
+inline uint64_t mixHash(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xFF51AFD7ED558CCDULL;
+  value ^= value >> 33;
+  value *= 0xC4CEB9FE1A85EC53ULL;
+  value ^= value >> 33;
+  return value;
+}
+
+// Fast non cryptographic 64-bit hash, eight bytes per step. Used to identify
+// ROM images and to compare emulator states, not for anything adversarial.
+inline uint64_t hashBytes(const void *data, size_t size,
+                          uint64_t seed = 0x9E3779B97F4A7C15ULL) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = seed ^ (size * 0x9E3779B97F4A7C15ULL);
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, 8);
+    hash = (hash ^ mixHash(word)) * 0x9E3779B97F4A7C15ULL;
+    bytes += 8;
+    size -= 8;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, bytes, size);
+  hash ^= mixHash(tail);
+  return mixHash(hash);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Pull parser for JSON. Input is read through a fixed size buffer and the
+// caller asks for one value at a time, so files of any size parse in
+// constant memory without building a document.
+//
+// Every call returns false on malformed input and keeps failing from then on,
+// getError() says what went wrong and where. Containers are walked with
+// hasNext():
+//
+//   reader.beginObject();
+//   while (reader.hasNext()) {
+//     reader.readKey(key);
+//     ...read or skip the value...
+//   }
+class JsonReader {
+public:
+  JsonReader();
+  ~JsonReader();
+  JsonReader(const JsonReader &) = delete;
+  JsonReader &operator=(const JsonReader &) = delete;
+  bool open(const std::string &path);
+  // Parses text held in memory instead of a file
+  void openString(std::string text);
+  bool beginArray();
+  bool beginObject();
+  // True if the current array or object has another element. Consumes the
+  // separating comma, or the closing bracket when it returns false.
+  bool hasNext();
+  // An object key and its colon
+  bool readKey(std::string &key);
+  bool readString(std::string &value);
+  bool readInteger(int64_t &value);
+  // Skips a whole value of any type, nested containers included
+  bool skipValue();
+  // True once only whitespace is left
+  bool atEnd();
+  bool failed() const { return !error.empty(); }
+  const std::string &getError() const { return error; }
+
+private:
+  FILE *file;
+  std::vector<char> buffer;
+  size_t position;
+  size_t size;
+  // Bytes consumed before the start of the buffer, for error messages
+  uint64_t offset;
+  // Whether each open container has had an element yet
+  std::vector<bool> first;
+  std::string error;
+
+  bool refill();
+  // Next character after whitespace without consuming it, 0 at the end
+  char peek();
+  bool expect(char c);
+  bool fail(const std::string &message);
+  bool skipLiteral(const char *literal);
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include "cpu.hpp"
+#include "movie.hpp"
+#include "savestate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// "CNKI" read as a little endian word
+#define KEYFRAME_INDEX_MAGIC 0x494B4E43
+#define KEYFRAME_INDEX_VERSION 1
+
+// Sidecar index for a movie: the full save state at the start of every
+// interval'th frame. Seeking to frame N loads the nearest keyframe at or
+// before it and plays at most interval - 1 frames of the movie from there.
+//
+// Entries are fixed size and appended as the movie runs, so the file is
+// usable up to the last complete entry even if recording is cut short, and
+// entry i sits at a known offset for random access through mmap.
+struct KeyframeIndexHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t stateSize;
+  uint64_t romHash;
+  uint32_t interval;
+  uint32_t reserved;
+};
+
+struct KeyframeEntry {
+  uint32_t frame;
+  uint32_t reserved;
+  // Offset of the frame's input in the movie file
+  uint64_t movieOffset;
+  SaveState state;
+};
+
+class KeyframeIndexWriter {
+public:
+  bool open(const std::string &path, uint64_t romHash, uint32_t interval);
+  // Call at the start of every frame, before its input is applied. Appends
+  // and flushes an entry on keyframe frames.
+  bool onFrame(const CPU &cpu, uint32_t frame, uint64_t movieOffset);
+
+private:
+  std::ofstream output;
+  uint32_t interval;
+};
+
+// Read only view of an index file, mapped into memory
+class KeyframeIndex {
+public:
+  KeyframeIndex();
+  ~KeyframeIndex();
+  KeyframeIndex(const KeyframeIndex &) = delete;
+  KeyframeIndex &operator=(const KeyframeIndex &) = delete;
+
+  bool open(const std::string &path);
+  void close();
+  size_t getCount() const { return count; }
+  uint32_t getInterval() const { return header->interval; }
+  const KeyframeEntry &getEntry(size_t index) const { return entries[index]; }
+  // Newest keyframe at or before frame, nullptr if the index is empty
+  const KeyframeEntry *find(uint32_t frame) const;
+  // Puts cpu at the start of frame by loading a keyframe and playing the
+  // movie up to frame
+  bool seek(const Movie &movie, CPU &cpu, uint32_t frame) const;
+
+private:
+  void *mapping;
+  size_t mappingSize;
+  const KeyframeIndexHeader *header;
+  const KeyframeEntry *entries;
+  size_t count;
+};
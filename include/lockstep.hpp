@@ -0,0 +1,80 @@
+#pragma once
+#include "bus.hpp"
+#include "savestate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Structure of arrays CPU running LANES instances of the same cartridge with
+// their own registers, RAM and controllers. Each step picks the lane that is
+// furthest behind and executes its instruction for every lane sitting at the
+// same PC in ROM, so the opcode is fetched and dispatched once for the whole
+// group and the register and ALU work runs over all lanes as plain array
+// loops the compiler turns into vector code. Lanes that diverge simply form
+// smaller groups, and code running from RAM (which can differ per lane) is
+// executed one lane at a time.
+//
+// Instruction semantics are those of CPU::step, lane for lane, so a lane
+// ends up in exactly the state a CPU would given the same input. There is no
+// PPU per lane yet, so that only holds for programs that leave it alone.
+// Instantiated for 8 and 16 lanes.
+template <size_t LANES> class LockstepCPU {
+public:
+  LockstepCPU(std::vector<uint8_t> romData);
+  // Resets every lane, see CPU::reset
+  void reset();
+  // Runs every lane to its next frame boundary, returns false if any lane
+  // stopped (BRK or an unknown opcode). Stopped lanes stay stopped until a
+  // state is loaded into them.
+  bool runFrame();
+  bool isStopped(size_t lane) const { return stopped[lane]; }
+
+  void setControllerState(size_t lane, uint8_t port, uint8_t buttons);
+  // Work RAM of a lane, without side effects
+  uint8_t peek(size_t lane, uint16_t address) const {
+    return ram[address & 0x7FF][lane];
+  }
+  // Same layout as CPU::saveState, so states move freely between the two
+  void saveState(size_t lane, SaveState &state) const;
+  bool loadState(size_t lane, const SaveState &state);
+  // Equal to CPU::hashState of a CPU in the same state
+  uint64_t hashState(size_t lane) const;
+  uint64_t getRomHash() const { return romHash; }
+
+  // Instruction groups dispatched and the lane instructions they covered,
+  // laneSteps / groupSteps is the average number of lanes per dispatch
+  uint64_t getGroupSteps() const { return groupSteps; }
+  uint64_t getLaneSteps() const { return laneSteps; }
+
+  alignas(64) uint8_t A[LANES];
+  alignas(64) uint8_t X[LANES];
+  alignas(64) uint8_t Y[LANES];
+  alignas(64) uint8_t S[LANES];
+  alignas(64) uint8_t P[LANES];
+  alignas(64) uint8_t SP[LANES];
+  alignas(64) uint16_t PC[LANES];
+  alignas(64) uint64_t cycles[LANES];
+
+private:
+  std::shared_ptr<const Rom> rom;
+  uint64_t romHash;
+  // Interleaved so the same address of every lane is one contiguous row
+  alignas(64) uint8_t ram[2048][LANES];
+  uint8_t controllerState[LANES][2];
+  uint8_t controllerShift[LANES][2];
+  uint8_t controllerStrobe[LANES];
+  // Cartridge RAM, one lane at a time like Bus, which only counts it as part
+  // of the state once written
+  uint8_t prgRam[LANES][PRG_RAM_SIZE];
+  bool prgRamUsed[LANES];
+  bool stopped[LANES];
+  uint64_t groupSteps;
+  uint64_t laneSteps;
+
+  // mask holds 0xFF for lanes taking part, code is read from leader
+  void execute(size_t leader, const uint8_t mask[LANES]);
+  uint8_t read(size_t lane, uint16_t address);
+  void write(size_t lane, uint16_t address, uint8_t data);
+  uint8_t readPrgRom(uint16_t address) const;
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include "cpu.hpp"
+#include "savestate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// "CNMV" read as a little endian word
+#define MOVIE_MAGIC 0x564D4E43
+#define MOVIE_VERSION 1
+#define MOVIE_PORTS 2
+
+// Input movie: the controller state of every frame, enough to replay a run
+// bit for bit. The file is a MovieHeader, the start save state when the
+// movie doesn't begin at power on, then MOVIE_PORTS bytes per frame.
+struct MovieHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint64_t romHash;
+  // Seed of the Rng used while recording
+  uint64_t seed;
+  uint32_t frameCount;
+  uint32_t reserved;
+};
+
+class Movie {
+public:
+  enum FLAGS { FROM_STATE = (1 << 0) };
+
+  Movie(uint64_t romHash = 0, uint64_t seed = 0);
+  // Starts the movie from state instead of power on
+  void setStartState(const SaveState &state);
+  bool hasStartState() const { return header.flags & FROM_STATE; }
+  const SaveState &getStartState() const { return startState; }
+  void recordFrame(const uint8_t buttons[MOVIE_PORTS]);
+  // Drops every frame from frames on
+  void truncate(size_t frames) {
+    if (frames < getFrameCount()) {
+      inputs.resize(frames * MOVIE_PORTS);
+    }
+  }
+  uint8_t getInput(size_t frame, uint8_t port) const {
+    return inputs[frame * MOVIE_PORTS + port];
+  }
+  size_t getFrameCount() const { return inputs.size() / MOVIE_PORTS; }
+  // Where the input of frame is stored in the saved file
+  uint64_t getInputOffset(size_t frame) const {
+    return sizeof(MovieHeader) + (hasStartState() ? sizeof(SaveState) : 0) +
+           frame * MOVIE_PORTS;
+  }
+  uint64_t getRomHash() const { return header.romHash; }
+  uint64_t getSeed() const { return header.seed; }
+
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+
+  // Puts a freshly powered on cpu where the movie starts, fails if the movie
+  // was recorded on another ROM
+  bool begin(CPU &cpu) const;
+  // Sets the controllers to the input of frame
+  void applyInput(CPU &cpu, size_t frame) const;
+  // Applies the input of frame and runs it, false if the CPU stopped
+  bool playFrame(CPU &cpu, size_t frame) const;
+
+private:
+  MovieHeader header;
+  SaveState startState;
+  std::vector<uint8_t> inputs;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+
+// Screen of the 32x32 display programs draw into at $0200-$05FF, one byte
+// per pixel
+#define SCREEN_START 0x0200
+#define SCREEN_WIDTH 32
+#define SCREEN_HEIGHT 32
+
+struct PaletteColor {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+};
+
+// Colour of a screen byte, anything past 14 shows as cyan
+inline PaletteColor paletteColor(uint8_t byte) {
+  switch (byte) {
+  case 0:
+    return {0, 0, 0};
+  case 1:
+    return {255, 255, 255};
+  case 2:
+  case 9:
+    return {120, 120, 120};
+  case 3:
+  case 10:
+    return {255, 0, 0};
+  case 4:
+  case 11:
+    return {0, 255, 0};
+  case 5:
+  case 12:
+    return {0, 0, 255};
+  case 6:
+  case 13:
+    return {255, 0, 255};
+  case 7:
+  case 14:
+    return {255, 255, 0};
+  }
+  return {0, 255, 255};
+}
+
+// Colour of a PPU palette index, the usual approximation of an NTSC 2C02
+inline PaletteColor ppuPaletteColor(uint8_t index) {
+  static const PaletteColor colors[64] = {
+      {84, 84, 84},    {0, 30, 116},    {8, 16, 144},    {48, 0, 136},
+      {68, 0, 100},    {92, 0, 48},     {84, 4, 0},      {60, 24, 0},
+      {32, 42, 0},     {8, 58, 0},      {0, 64, 0},      {0, 60, 0},
+      {0, 50, 60},     {0, 0, 0},       {0, 0, 0},       {0, 0, 0},
+      {152, 150, 152}, {8, 76, 196},    {48, 50, 236},   {92, 30, 228},
+      {136, 20, 176},  {160, 20, 100},  {152, 34, 32},   {120, 60, 0},
+      {84, 90, 0},     {40, 114, 0},    {8, 124, 0},     {0, 118, 40},
+      {0, 102, 120},   {0, 0, 0},       {0, 0, 0},       {0, 0, 0},
+      {236, 238, 236}, {76, 154, 236},  {120, 124, 236}, {176, 98, 236},
+      {228, 84, 236},  {236, 88, 180},  {236, 106, 100}, {212, 136, 32},
+      {160, 170, 0},   {116, 196, 0},   {76, 208, 32},   {56, 204, 108},
+      {56, 180, 204},  {60, 60, 60},    {0, 0, 0},       {0, 0, 0},
+      {236, 238, 236}, {168, 204, 236}, {188, 188, 236}, {212, 178, 236},
+      {236, 174, 236}, {236, 174, 212}, {236, 180, 176}, {228, 196, 144},
+      {204, 210, 120}, {180, 222, 120}, {168, 226, 144}, {152, 226, 180},
+      {160, 214, 228}, {160, 162, 160}, {0, 0, 0},       {0, 0, 0}};
+  return colors[index & 0x3F];
+}
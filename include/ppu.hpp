@@ -0,0 +1,136 @@
+#pragma once
+#include "savestate.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+
+class CodeDataLogger;
+struct Rom;
+
+// NTSC CPU cycles per video frame, 341 dots * 262 lines / 3 dots per cycle
+#define CYCLES_PER_FRAME 29781
+#define PPU_DOTS_PER_LINE 341
+#define PPU_DOTS_PER_FRAME (CYCLES_PER_FRAME * 3)
+#define PPU_VISIBLE_LINES 240
+// Dot 1 of line 241 sets vblank, dot 1 of the pre-render line 261 clears it
+// along with sprite 0 hit
+#define PPU_VBLANK_DOT (241 * PPU_DOTS_PER_LINE + 1)
+#define PPU_PRERENDER_DOT (261 * PPU_DOTS_PER_LINE + 1)
+#define PPU_FRAME_WIDTH 256
+#define PPU_FRAME_HEIGHT 240
+#define PPU_VRAM_SIZE 0x800
+#define CHR_RAM_SIZE 0x2000
+
+// PPUCTRL, PPUMASK and PPUSTATUS bits
+enum PpuFlags {
+  PPUCTRL_INCREMENT_32 = (1 << 2),
+  PPUCTRL_SPRITE_TABLE = (1 << 3),
+  PPUCTRL_BACKGROUND_TABLE = (1 << 4),
+  PPUCTRL_SPRITE_16 = (1 << 5),
+  PPUCTRL_NMI = (1 << 7),
+  PPUMASK_GRAYSCALE = (1 << 0),
+  PPUMASK_BACKGROUND_LEFT = (1 << 1),
+  PPUMASK_SPRITES_LEFT = (1 << 2),
+  PPUMASK_BACKGROUND = (1 << 3),
+  PPUMASK_SPRITES = (1 << 4),
+  PPUSTATUS_SPRITE_0 = (1 << 6),
+  PPUSTATUS_VBLANK = (1 << 7)
+};
+
+typedef std::array<uint8_t, PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT> Framebuffer;
+typedef std::array<uint8_t, CHR_RAM_SIZE> ChrRam;
+
+// Picture processing unit, run lazily instead of three dots per CPU cycle.
+// It is caught up to the CPU's clock only when the CPU touches one of its
+// registers, when an event the CPU has to see is due (see getNextEvent) and
+// when its state is saved or hashed. Catching up jumps from event to event
+// (start of a visible line, sprite 0 hit, vblank, pre-render line) and draws
+// a whole line at a time, so the CPU keeps running in its tight loop and a
+// frame costs 240 line draws, or three events with rendering off.
+//
+// Frames are anchored to the CPU's, dot = cycle % CYCLES_PER_FRAME * 3.
+// Writes in the middle of a line take effect from the next line and sprite
+// overflow is never set.
+class PPU {
+public:
+  PPU();
+  // Pattern tables are the ROM's CHR, or CHR RAM if it has none
+  void setRom(std::shared_ptr<const Rom> rom);
+  // The reset button: registers clear and timing starts over with the CPU's
+  // cycle counter, memories are kept
+  void reset();
+  // Runs every event up to the CPU cycle
+  void catchUp(uint64_t cycle);
+  // $2000-$2007 and their mirrors, accessed at the CPU cycle
+  uint8_t readRegister(uint16_t address, uint64_t cycle);
+  // What readRegister would return, without clearing vblank, moving the
+  // VRAM address or filling the read buffer
+  uint8_t peekRegister(uint16_t address, uint64_t cycle);
+  void writeRegister(uint16_t address, uint8_t data, uint64_t cycle);
+  // OAM DMA, the 256 bytes go to OAM starting at OAMADDR
+  void writeOam(const uint8_t *data, uint64_t cycle);
+  // The CPU has to call takeNmi once its clock reaches this
+  uint64_t getNextEvent() const { return nextEvent; }
+  // True once per NMI, after catching up to the cycle
+  bool takeNmi(uint64_t cycle);
+  // First CPU cycle after `cycle` at which a $2002 read could return
+  // something else or an NMI could fire
+  uint64_t getNextChange(uint64_t cycle) const;
+  // Palette indices of the lines drawn so far, nullptr before the first.
+  // Lines are only drawn while rendering is on.
+  const uint8_t *getFramebuffer() const;
+  // Off for frames nobody looks at, like the ones run-ahead throws away.
+  // Lines still scroll and find sprite 0 hits, only the framebuffer is left
+  // as it was.
+  void setDrawing(bool draw) { drawing = draw; }
+  bool isDrawing() const { return drawing; }
+  // Registers and memories, without the absolute frame number
+  uint64_t hashState(uint64_t seed) const;
+  void saveState(PpuState &state) const;
+  void loadState(const PpuState &state);
+  // Pattern rows drawn and CHR read through $2007 are logged in it
+  void setCodeDataLogger(CodeDataLogger *logger) { codeDataLogger = logger; }
+
+private:
+  std::shared_ptr<const Rom> rom;
+  // Caught up to dot `dot` of frame `frame`, the events before it have run
+  uint64_t frame;
+  uint32_t dot;
+  uint64_t nextEvent;
+  // Where sprite 0 hits in this frame once the line with it was drawn
+  uint32_t sprite0Dot;
+  uint8_t ctrl;
+  uint8_t mask;
+  uint8_t status;
+  uint8_t oamAddress;
+  // Current and temporary VRAM address, fine X scroll and the write toggle
+  // shared by $2005 and $2006
+  uint16_t v;
+  uint16_t t;
+  uint8_t fineX;
+  bool writeToggle;
+  uint8_t readBuffer;
+  // Last value on the PPU's data bus, write only registers read back as it
+  uint8_t latch;
+  bool nmiPending;
+  std::array<uint8_t, PPU_VRAM_SIZE> vram;
+  std::array<uint8_t, 32> palette;
+  std::array<uint8_t, 256> oam;
+  // Copied on write like the bus's RAM, so forks share them
+  std::shared_ptr<ChrRam> chrRam;
+  std::shared_ptr<Framebuffer> framebuffer;
+  bool drawing;
+  CodeDataLogger *codeDataLogger;
+
+  void runEvents(uint32_t until);
+  uint32_t nextEventDot(uint32_t from) const;
+  void runEvent(uint32_t eventDot);
+  void renderLine(uint32_t line);
+  void drawLine(uint32_t line);
+  bool hasSprite0(uint32_t line) const;
+  void updateNextEvent();
+  uint8_t readVram(uint16_t address) const;
+  void writeVram(uint16_t address, uint8_t data);
+  uint8_t readChr(uint16_t address) const;
+  uint16_t nametableIndex(uint16_t address) const;
+};
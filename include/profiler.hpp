@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class Disassembler;
+
+// Guest code profiler. Counts are kept in flat arrays indexed by PC, so the
+// cost per instruction is a couple of increments plus a shadow call stack
+// update on JSR/RTS/RTI. Counts are per CPU address until mappers exist.
+class Profiler {
+public:
+  Profiler();
+  void reset();
+
+  // Called by the CPU after every instruction with the program counter and
+  // stack pointer as they are after the instruction executed
+  void record(uint16_t pc, uint8_t opcode, uint8_t cycles, uint16_t nextPc,
+              uint8_t sp);
+  // Called when the CPU services an interrupt taken at from. sp is the stack
+  // pointer before the return address and status were pushed.
+  void enterInterrupt(uint16_t from, uint16_t handler, uint8_t sp);
+
+  uint64_t getInstructionCount(uint16_t pc) const { return instructions[pc]; }
+  uint64_t getCycleCount(uint16_t pc) const { return cycles[pc]; }
+  uint64_t getTotalCycles() const { return totalCycles; }
+  // Calls and interrupts on the shadow call stack that haven't returned
+  size_t getCallDepth() const { return stack.size(); }
+  // The n PCs with the most cycles, hottest first
+  std::vector<std::pair<uint16_t, uint64_t>> hottest(size_t n) const;
+  // Times the second opcode ran straight after the first, without a jump in
+  // between
+  uint64_t getPairCount(uint8_t first, uint8_t second) const {
+    return pairs[first << 8 | second];
+  }
+  // The n most common pairs as (first << 8 | second, count), commonest first
+  std::vector<std::pair<uint16_t, uint64_t>> commonestPairs(size_t n) const;
+  // "<first> <second> <count> <% of instructions>" for the n commonest
+  // pairs, marking the ones the CPU already fuses (see CPU::fusedTable)
+  void writePairs(std::ostream &out, size_t n) const;
+
+  // Callgrind format, loadable by kcachegrind/qcachegrind. When given a
+  // disassembler, instructions in ROM are annotated with their mnemonic.
+  void writeCallgrind(std::ostream &out, Disassembler *disassembler) const;
+  // Folded stacks, one "root;sub_C000;sub_C123 cycles" line per call path,
+  // as consumed by flamegraph.pl and speedscope
+  void writeFoldedStacks(std::ostream &out) const;
+
+private:
+  // Node in the tree of every call path seen so far
+  struct CallNode {
+    uint32_t parent;
+    uint32_t function;
+    uint64_t selfCycles;
+    std::unordered_map<uint16_t, uint32_t> children;
+  };
+  // Entry of the shadow call stack
+  struct Frame {
+    uint16_t function;
+    uint16_t callSite;
+    // Stack pointer before the call, once it is back here the call returned
+    uint8_t sp;
+    uint32_t node;
+    uint64_t entryCycles;
+    uint64_t entryInstructions;
+  };
+  struct CallEdge {
+    uint64_t calls;
+    uint64_t inclusiveCycles;
+    uint64_t inclusiveInstructions;
+  };
+
+  std::vector<uint64_t> instructions;
+  std::vector<uint64_t> cycles;
+  // Function each PC was last seen executing in
+  std::vector<uint32_t> owner;
+  uint64_t totalCycles;
+  uint64_t totalInstructions;
+  // Opcode pairs, indexed by first << 8 | second
+  std::vector<uint64_t> pairs;
+  // The previous instruction fell through to this address
+  uint32_t fallThrough;
+  uint8_t previousOpcode;
+
+  std::vector<CallNode> nodes;
+  std::vector<Frame> stack;
+  // Keyed by (call site, callee)
+  std::map<std::pair<uint16_t, uint16_t>, CallEdge> edges;
+
+  void call(uint16_t callSite, uint16_t function, uint8_t sp);
+  void unwind(uint8_t sp);
+  uint32_t currentFunction() const;
+};
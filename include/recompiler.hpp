@@ -0,0 +1,60 @@
+#pragma once
+#include "disassembler.hpp"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Static recompiler, turns the PRG ROM of an NROM game into C++ that runs in
+// place of the interpreter (see aot.hpp). Code is found by following control
+// flow from the vectors like Disassembler::analyze. Each vector and JSR
+// target starts a function holding everything reachable from it through
+// branches, JMPs and fall through that no earlier function took.
+//
+// Every instruction still runs through the interpreter's handler with the
+// same bookkeeping as CPU::step, what goes away is fetching and decoding it
+// and looking up the next one: forward branches and jumps inside a function
+// are gotos. Backward ones, JSR, RTS and RTI return to runFrame so it can
+// still skip idle loops. BRK, JMP indirect and unknown opcodes are left to
+// the interpreter, as is any code in RAM and code only reached through JMP
+// indirect that wasn't added with addEntryPoint.
+class Recompiler {
+public:
+  Recompiler(std::shared_ptr<const Rom> rom, uint64_t romHash);
+  // Makes a function start at the address too, for code only reached
+  // through indirect jumps (see CodeDataLogger::getIndirectTargets). Call
+  // before analyze.
+  void addEntryPoint(uint16_t address) { entryPoints.push_back(address); }
+  // Finds the functions, false if the ROM can't be compiled
+  bool analyze();
+  // The generated translation unit, which registers itself for the ROM at
+  // startup. `source` only goes into the header comment.
+  void write(std::ostream &out, const std::string &source);
+  size_t getFunctionCount() const { return functions.size(); }
+  size_t getInstructionCount() const { return instructionCount; }
+  // Reachable instructions left to the interpreter
+  size_t getFallbackCount() const { return fallbackCount; }
+
+private:
+  struct Function {
+    uint16_t entry;
+    // In address order
+    std::vector<uint16_t> instructions;
+  };
+
+  std::shared_ptr<const Rom> rom;
+  uint64_t romHash;
+  Disassembler disassembler;
+  std::vector<uint16_t> entryPoints;
+  std::vector<Function> functions;
+  // Index + 1 of the function that took each address of $8000-$FFFF
+  std::vector<uint32_t> owners;
+  std::vector<bool> fallbacks;
+  size_t instructionCount;
+  size_t fallbackCount;
+
+  uint16_t readVector(uint16_t address) const;
+  uint32_t ownerOf(uint16_t address) const;
+  void writeFunction(std::ostream &out, size_t index);
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include "cpu.hpp"
+#include "savestate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Rewind history kept in a fixed arena. Every interval frames a snapshot is
+// taken and stored as the run length encoded XOR against the snapshot before
+// it, with a full keyframe every keyframeInterval snapshots. Work RAM changes
+// little between frames, so most deltas are a few dozen bytes.
+//
+// All storage is allocated up front, capturing and rewinding never touch the
+// heap. When the arena fills up the oldest keyframe and its deltas are dropped.
+class RewindBuffer {
+public:
+  RewindBuffer(size_t arenaSize, uint32_t interval = 1,
+               uint32_t keyframeInterval = 60);
+
+  // Call once per emulated frame, captures a snapshot every interval frames
+  void onFrame(const CPU &cpu);
+  void capture(const CPU &cpu);
+  // Restores the newest snapshot into cpu and drops it, so calling this once
+  // per frame plays history backwards. Returns false once it is empty.
+  bool rewind(CPU &cpu);
+  void clear();
+
+  size_t getSnapshotCount() const { return count; }
+  size_t getBytesUsed() const { return bytesUsed; }
+
+private:
+  struct Record {
+    uint32_t offset;
+    uint32_t length;
+    bool keyframe;
+  };
+
+  uint32_t interval;
+  uint32_t keyframeInterval;
+  uint32_t framesUntilCapture;
+  uint32_t snapshotsUntilKeyframe;
+
+  std::vector<uint8_t> arena;
+  size_t writeOffset;
+  size_t bytesUsed;
+  // Ring of records, oldest at first
+  std::vector<Record> records;
+  size_t first;
+  size_t count;
+
+  // Newest snapshot, the one rewind steps back from
+  SaveState current;
+  SaveState scratch;
+  std::vector<uint8_t> encoded;
+
+  Record &recordAt(size_t index) {
+    return records[(first + index) % records.size()];
+  }
+  void push(const uint8_t *data, size_t length, bool keyframe);
+  void dropOldestGroup();
+  // Encodes to against from, or against all zeroes when from is nullptr
+  size_t encode(const SaveState *from, const SaveState &to);
+  void apply(const Record &record, SaveState &state);
+};
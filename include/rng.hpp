@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+// Small deterministic generator (xorshift64*). Anything random that can
+// affect emulation has to come from one of these so a run can be replayed
+// from its seed, the seed is stored in input movies for that reason.
+class Rng {
+public:
+  Rng(uint64_t seed) : seed(seed), state(seed != 0 ? seed : 1) {}
+
+  uint64_t next() {
+    this->state ^= this->state >> 12;
+    this->state ^= this->state << 25;
+    this->state ^= this->state >> 27;
+    return this->state * 0x2545F4914F6CDD1DULL;
+  }
+  // Uniform in [low, high]
+  uint32_t nextInRange(uint32_t low, uint32_t high) {
+    return low + static_cast<uint32_t>((next() >> 32) % (high - low + 1));
+  }
+  uint64_t getSeed() const { return seed; }
+
+private:
+  uint64_t seed;
+  uint64_t state;
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include "cpu.hpp"
+#include "savestate.hpp"
+#include <cstdint>
+#include <functional>
+#include <ostream>
+
+// Run-ahead hides a game's own input lag. Each host frame the real frame is
+// run, then the state is saved, frames more are run ahead with the same
+// input, the last one is presented and the state is restored. Only the
+// presented frame reaches the output callback, the rest are discarded.
+class RunAhead {
+public:
+  struct Stats {
+    uint64_t hostFrames;
+    uint64_t emulatedFrames;
+    // Time spent in the real frames, the frames run ahead and in saving and
+    // restoring state
+    uint64_t realNanos;
+    uint64_t aheadNanos;
+    uint64_t stateNanos;
+  };
+
+  RunAhead(uint32_t frames);
+  // Runs one host frame with the input already set on the bus, calls present
+  // with the frame to show. Returns false if the CPU stopped on the real
+  // frame.
+  bool runFrame(CPU &cpu, const std::function<void(const CPU &)> &present);
+  const Stats &getStats() const { return stats; }
+  void resetStats();
+  // Average cost per host frame and how much of it run-ahead adds
+  void report(std::ostream &out) const;
+
+private:
+  uint32_t frames;
+  SaveState state;
+  Stats stats;
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// "CNSS" read as a little endian word
+#define SAVE_STATE_MAGIC 0x53534E43
+// Bump whenever the layout of SaveState or anything in it changes
+#define SAVE_STATE_VERSION 5
+
+// Every struct here is plain data, a save state is copied around with memcpy
+// and written to disk as is. Immutable data (the ROM) is not stored, only its
+// hash so a state can't be loaded into the wrong game.
+struct CpuState {
+  uint64_t cycles;
+  uint16_t PC;
+  uint8_t A, X, Y, S, P, SP;
+};
+
+struct PpuState {
+  uint64_t frame;
+  uint32_t dot;
+  uint32_t sprite0Dot;
+  uint16_t v, t;
+  uint8_t ctrl, mask, status, oamAddress;
+  uint8_t fineX, writeToggle, readBuffer, latch;
+  uint8_t nmiPending;
+  // Non zero once the game has written to CHR RAM
+  uint8_t chrRamUsed;
+  uint8_t padding[2];
+  uint8_t vram[2048];
+  uint8_t palette[32];
+  uint8_t oam[256];
+  // Zero if the ROM has CHR ROM or until used
+  uint8_t chrRam[8192];
+};
+
+struct BusState {
+  uint8_t cpuVram[2048];
+  uint8_t controllerState[2];
+  uint8_t controllerShift[2];
+  uint8_t controllerStrobe;
+  // Non zero once the game has written to PRG RAM
+  uint8_t prgRamUsed;
+  // CPU cycles an OAM DMA still has to take
+  uint16_t dmaStall;
+  // Cartridge RAM at $6000-$7FFF, zero until used
+  uint8_t prgRam[8192];
+  PpuState ppu;
+};
+
+struct SaveState {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint64_t romHash;
+  CpuState cpu;
+  BusState bus;
+};
+
+bool writeSaveState(const std::string &path, const SaveState &state);
+bool readSaveState(const std::string &path, SaveState &state);
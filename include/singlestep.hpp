@@ -0,0 +1,84 @@
+#pragma once
+#include "cpu.hpp"
+#include "jsonreader.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Runs the per instruction test vectors of SingleStepTests (the nes6502 set,
+// one <opcode>.json per opcode). Each case gives the registers and the RAM
+// an instruction touches before and after it runs, plus its bus cycles.
+
+struct SingleStepState {
+  uint16_t pc;
+  uint8_t s, a, x, y, p;
+  // (address, value) pairs
+  std::vector<std::pair<uint16_t, uint8_t>> ram;
+};
+
+struct SingleStepCase {
+  std::string name;
+  SingleStepState initial;
+  SingleStepState final;
+  // Length of the bus cycle list, the instruction's cycle count
+  uint32_t cycles;
+};
+
+// Reads the cases of a test file one at a time
+class SingleStepReader {
+public:
+  SingleStepReader();
+  bool open(const std::string &path);
+  void openString(std::string text);
+  // False after the last case, or on malformed input (see failed())
+  bool next(SingleStepCase &test);
+  bool failed() const { return reader.failed(); }
+  const std::string &getError() const { return reader.getError(); }
+
+private:
+  JsonReader reader;
+  bool started;
+
+  bool readState(SingleStepState &state);
+};
+
+struct SingleStepResult {
+  uint8_t opcode;
+  uint64_t cases;
+  uint64_t failures;
+  // Cases that ended in the right state after the wrong number of cycles,
+  // counted apart from failures
+  uint64_t cycleMismatches;
+  // The first failing case and what differed in it
+  std::string firstFailure;
+  // Set if the file couldn't be read to the end
+  std::string error;
+};
+
+// Runs test files in parallel, one file per thread at a time. Each thread
+// runs its cases on one CPU over a flat 64KB bus (see Bus::flat), resetting
+// only the addresses a case touched.
+class SingleStepRunner {
+public:
+  // threads = 0 uses every hardware thread
+  SingleStepRunner(size_t threads = 0);
+  void add(uint8_t opcode, std::string path);
+  // Adds the file of every opcode in CPU::opcodeTable that has one in the
+  // directory, returns how many were found
+  size_t addDirectory(const std::string &directory);
+  // Results are in the order files were added
+  std::vector<SingleStepResult> run();
+  size_t getThreadCount() const { return threadCount; }
+
+  static SingleStepResult runFile(uint8_t opcode, const std::string &path);
+  // Runs one case on a CPU over a flat bus. Returns what differed, empty if
+  // the final state matched.
+  static std::string runCase(CPU &cpu, const SingleStepCase &test,
+                             bool &cyclesMatch);
+
+private:
+  size_t threadCount;
+  std::vector<std::pair<uint8_t, std::string>> files;
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Events kept per thread, older ones are overwritten
+#define TIMELINE_RING_SIZE (1 << 16)
+
+// Host side phases of a frame. The APU has no work yet and the PPU is caught
+// up from inside the CPU's run, they are here so the trace layout doesn't
+// change once they get phases of their own.
+enum TimelinePhase {
+  TIMELINE_FRAME,
+  TIMELINE_CPU,
+  TIMELINE_PPU,
+  TIMELINE_APU,
+  TIMELINE_INPUT,
+  TIMELINE_UPLOAD,
+  TIMELINE_PRESENT,
+  TIMELINE_SLEEP,
+  // From the first input since the last present to the next present
+  TIMELINE_LATENCY,
+  TIMELINE_PHASE_COUNT
+};
+
+struct TimelineEvent {
+  // Timestamp counter ticks
+  uint64_t start;
+  uint64_t end;
+  uint32_t phase;
+  uint32_t frame;
+};
+
+struct TimelineStats {
+  size_t count;
+  // Microseconds
+  double mean;
+  double p50;
+  double p90;
+  double p99;
+  double max;
+};
+
+const char *timelinePhaseName(TimelinePhase phase);
+
+// Frame timeline of the host side of emulation. Scoped timers record into a
+// ring per thread using the CPU timestamp counter, so recording is a couple
+// of counter reads and a store with no locks. The timeline can be written as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev) and summarised as
+// percentiles per phase.
+//
+// Rings are read without stopping the writers, export once the threads
+// recording into it are done or paused.
+class Timeline {
+public:
+  Timeline();
+  Timeline(const Timeline &) = delete;
+  Timeline &operator=(const Timeline &) = delete;
+  static uint64_t now();
+  void record(TimelinePhase phase, uint64_t start, uint64_t end,
+              uint32_t frame);
+  // Names the calling thread in the trace
+  void setThreadName(const std::string &name);
+  // New input arrived, the next present closes a latency event
+  void markInput();
+  void markPresent(uint32_t frame);
+  // Every event still in the rings, oldest first per thread
+  std::vector<TimelineEvent> getEvents(TimelinePhase phase) const;
+  TimelineStats getStats(TimelinePhase phase) const;
+  void writeChromeTrace(std::ostream &out) const;
+  // One line per phase that has events
+  void writeSummary(std::ostream &out) const;
+  double ticksToMicroseconds(uint64_t ticks) const;
+  // Threads that have recorded, one ring each
+  size_t getThreadCount() const;
+
+private:
+  struct Ring {
+    std::vector<TimelineEvent> events;
+    // Events ever written, the newest is at (written - 1) % size
+    std::atomic<uint64_t> written;
+    uint32_t thread;
+    std::thread::id owner;
+    std::string name;
+  };
+
+  // Tells rings of different timelines apart in the per thread cache
+  uint64_t id;
+  mutable std::mutex lock;
+  std::vector<std::unique_ptr<Ring>> rings;
+  std::atomic<uint64_t> pendingInput;
+  // The counter is calibrated against the steady clock since construction
+  uint64_t startTicks;
+  int64_t startNanos;
+
+  Ring &threadRing();
+  double ticksPerMicrosecond() const;
+  template <typename F> void forEachEvent(F visit) const;
+};
+
+// Times a scope into a timeline, does nothing if the timeline is nullptr
+class TimelineScope {
+public:
+  TimelineScope(Timeline *timeline, TimelinePhase phase, uint32_t frame = 0)
+      : timeline(timeline), phase(phase), frame(frame),
+        start(timeline != nullptr ? Timeline::now() : 0) {}
+  ~TimelineScope() {
+    if (this->timeline != nullptr) {
+      this->timeline->record(this->phase, this->start, Timeline::now(),
+                             this->frame);
+    }
+  }
+  TimelineScope(const TimelineScope &) = delete;
+  TimelineScope &operator=(const TimelineScope &) = delete;
+
+private:
+  Timeline *timeline;
+  TimelinePhase phase;
+  uint32_t frame;
+  uint64_t start;
+};
@@ -0,0 +1,34 @@
+#include "aot.hpp"
+#include <memory>
+#include <vector>
+
+// Filled from static initializers of other translation units, so it has to
+// be constructed on first use
+static std::vector<std::unique_ptr<AotProgram>> &programs() {
+  static std::vector<std::unique_ptr<AotProgram>> registered;
+  return registered;
+}
+
+bool registerAotProgram(uint64_t romHash, const AotEntry *entries,
+                        size_t count, size_t functionCount) {
+  auto program = std::make_unique<AotProgram>();
+  program->romHash = romHash;
+  program->functions.fill(nullptr);
+  program->functionCount = functionCount;
+  for (size_t i = 0; i < count; i++) {
+    if (entries[i].address >= 0x8000) {
+      program->functions[entries[i].address - 0x8000] = entries[i].function;
+    }
+  }
+  programs().push_back(std::move(program));
+  return true;
+}
+
+const AotProgram *findAotProgram(uint64_t romHash) {
+  for (const std::unique_ptr<AotProgram> &program : programs()) {
+    if (program->romHash == romHash) {
+      return program.get();
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,142 @@
+#include "batchrunner.hpp"
+#include <algorithm>
+#include <thread>
+
+BatchRunner::BatchRunner(size_t threads, uint32_t sliceFrames)
+    : threadCount(threads), sliceFrames(sliceFrames > 0 ? sliceFrames : 1),
+      remaining(0), steals(0) {
+  if (this->threadCount == 0) {
+    this->threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+size_t BatchRunner::add(BatchJob job) {
+  this->instances.push_back(Instance{std::move(job), nullptr, BatchResult{}});
+  return this->instances.size() - 1;
+}
+
+std::vector<BatchResult> BatchRunner::run() {
+  this->queues.clear();
+  for (size_t i = 0; i < this->threadCount; i++) {
+    this->queues.push_back(std::make_unique<Queue>());
+  }
+  // Deal the instances out round robin, stealing evens out the rest
+  for (size_t i = 0; i < this->instances.size(); i++) {
+    this->queues[i % this->threadCount]->instances.push_back(i);
+  }
+  this->remaining = this->instances.size();
+  this->steals = 0;
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < this->threadCount; i++) {
+    threads.emplace_back(&BatchRunner::worker, this, i);
+  }
+  worker(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<BatchResult> results;
+  results.reserve(this->instances.size());
+  for (Instance &instance : this->instances) {
+    results.push_back(std::move(instance.result));
+  }
+  this->instances.clear();
+  return results;
+}
+
+bool BatchRunner::take(size_t worker, size_t &instance) {
+  {
+    Queue &own = *this->queues[worker];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.instances.empty()) {
+      instance = own.instances.back();
+      own.instances.pop_back();
+      return true;
+    }
+  }
+  for (size_t offset = 1; offset < this->threadCount; offset++) {
+    Queue &victim = *this->queues[(worker + offset) % this->threadCount];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.instances.empty()) {
+      instance = victim.instances.front();
+      victim.instances.pop_front();
+      this->steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void BatchRunner::worker(size_t index) {
+  while (this->remaining > 0) {
+    size_t instance;
+    if (!take(index, instance)) {
+      // Everything left is being run by other workers right now
+      std::this_thread::yield();
+      continue;
+    }
+    if (runSlice(this->instances[instance])) {
+      this->remaining--;
+    } else {
+      Queue &own = *this->queues[index];
+      std::lock_guard<std::mutex> guard(own.lock);
+      own.instances.push_back(instance);
+    }
+  }
+}
+
+bool BatchRunner::runSlice(Instance &instance) {
+  const BatchJob &job = instance.job;
+  BatchResult &result = instance.result;
+  if (instance.cpu == nullptr) {
+    // Built on the worker so ROM parsing is spread over the threads too
+    instance.cpu = std::make_unique<CPU>(Bus(job.rom));
+    if (job.movie != nullptr) {
+      result.started = job.movie->begin(*instance.cpu);
+    } else {
+      instance.cpu->reset();
+      result.started = true;
+    }
+    if (!result.started) {
+      instance.cpu = nullptr;
+      return true;
+    }
+  }
+
+  CPU &cpu = *instance.cpu;
+  uint32_t end = std::min(result.frames + this->sliceFrames, job.frameBudget);
+  while (result.frames < end) {
+    if (job.movie != nullptr && result.frames < job.movie->getFrameCount()) {
+      job.movie->applyInput(cpu, result.frames);
+    }
+    bool running = cpu.runFrame();
+    result.frames++;
+    if (job.recordFrameHashes) {
+      result.frameHashes.push_back(cpu.hashState());
+    }
+    if (!running) {
+      result.stopped = true;
+      finish(instance);
+      return true;
+    }
+  }
+  if (result.frames >= job.frameBudget) {
+    finish(instance);
+    return true;
+  }
+  return false;
+}
+
+void BatchRunner::finish(Instance &instance) {
+  CPU &cpu = *instance.cpu;
+  BatchResult &result = instance.result;
+  result.stateHash = cpu.hashState();
+  for (const std::pair<uint16_t, uint16_t> &region : instance.job.ramRegions) {
+    for (uint32_t i = 0; i < region.second; i++) {
+      result.ram.push_back(cpu.readFromMemory(region.first + i));
+    }
+  }
+  // Results are all that is kept of a finished instance
+  instance.cpu = nullptr;
+}
@@ -0,0 +1,60 @@
+#include "breakpoints.hpp"
+#include <cstring>
+
+Breakpoints::Breakpoints() { clear(); }
+
+void Breakpoints::add(KIND kind, uint16_t address) {
+  if (has(kind, address)) {
+    return;
+  }
+  this->bitmap[kind][address >> 8][(address & 0xFF) >> 6] |=
+      (1ULL << (address & 0x3F));
+  this->pageCount[kind][address >> 8]++;
+}
+
+void Breakpoints::remove(KIND kind, uint16_t address) {
+  if (!has(kind, address)) {
+    return;
+  }
+  this->bitmap[kind][address >> 8][(address & 0xFF) >> 6] &=
+      ~(1ULL << (address & 0x3F));
+  this->pageCount[kind][address >> 8]--;
+}
+
+void Breakpoints::clear() {
+  memset(this->pageCount, 0, sizeof(this->pageCount));
+  memset(this->bitmap, 0, sizeof(this->bitmap));
+  this->hitPending = false;
+  this->ignoreOnce = false;
+}
+
+void Breakpoints::resumeFrom(uint16_t pc) {
+  // Only armed when there is a breakpoint at pc, that way the very next
+  // checkExecute is guaranteed to take the slow path and disarm it
+  if (has(EXECUTE, pc)) {
+    this->ignoreOnce = true;
+    this->ignoreAddress = pc;
+  }
+}
+
+bool Breakpoints::checkExecuteSlow(uint16_t pc) {
+  if (this->ignoreOnce) {
+    this->ignoreOnce = false;
+    if (pc == this->ignoreAddress) {
+      return false;
+    }
+  }
+  if (!has(EXECUTE, pc)) {
+    return false;
+  }
+  latch(EXECUTE, pc);
+  return true;
+}
+
+void Breakpoints::latch(KIND kind, uint16_t address) {
+  // Keep the first hit of an instruction
+  if (!this->hitPending) {
+    this->hitPending = true;
+    this->hit = Hit{kind, address};
+  }
+}
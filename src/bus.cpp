@@ -1,43 +1,409 @@
 #include "bus.hpp"
+#include "codedatalogger.hpp"
+#include "hash.hpp"
+#include <atomic>
 #include <cstring>
 #include <iostream>
 
 #define PRG_ROM_PAGE_SIZE 0x4000
 #define CHR_ROM_PAGE_SIZE 0x2000
 
+// RAM is allocated as one block so a bus that was never forked has it
+// contiguous (see getRam), each page still gets its own reference count for
+// copy on write
+static void allocateRam(std::shared_ptr<MemoryPage> pages[RAM_PAGE_COUNT],
+                        const std::shared_ptr<MemoryPage> *contents) {
+  auto block = std::make_shared<std::array<MemoryPage, RAM_PAGE_COUNT>>();
+  for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+    MemoryPage &memory = (*block)[page];
+    if (contents != nullptr) {
+      memory = *contents[page];
+    } else {
+      memory.fill(0);
+    }
+    pages[page] =
+        std::shared_ptr<MemoryPage>(&memory, [block](MemoryPage *) {});
+  }
+}
+
 Bus::Bus(std::vector<uint8_t> romData) { 
-  memset(this->cpuVram, 0, sizeof(cpuVram));
+  allocateRam(this->ramPages, nullptr);
+  memset(this->controllerState, 0, sizeof(controllerState));
+  memset(this->controllerShift, 0, sizeof(controllerShift));
+  this->controllerStrobe = false;
+  this->clock = 0;
+  this->dmaStall = 0;
+  this->codeDataLogger = nullptr;
+  this->fetchAddress = 0;
   std::optional<Rom> decodedRom = readBytes(romData);
   if (decodedRom.has_value()) {
-    this->rom = decodedRom.value();
+    this->rom = std::make_shared<const Rom>(decodedRom.value());
+  } else {
+    this->rom = std::make_shared<const Rom>();
+  }
+  this->romHash = hashBytes(this->rom->progRom.data(), this->rom->progRom.size(),
+                            hashBytes(this->rom->chrRom.data(),
+                                      this->rom->chrRom.size()));
+  this->ppu.setRom(this->rom);
+  mapPages();
+}
+
+Bus Bus::flat() {
+  Bus bus = Bus(std::vector<uint8_t>());
+  bus.flatMemory = std::make_shared<FlatMemory>();
+  bus.flatMemory->fill(0);
+  bus.mapPages();
+  return bus;
+}
+
+Bus::Bus(const Bus &other) { copyFrom(other, false); }
+
+Bus &Bus::operator=(const Bus &other) {
+  if (this != &other) {
+    copyFrom(other, false);
+  }
+  return *this;
+}
+
+Bus Bus::fork() {
+  Bus child;
+  child.copyFrom(*this, true);
+  child.setCodeDataLogger(nullptr);
+  // Both sides now go through the slow path on their next write to RAM
+  mapPages();
+  return child;
+}
+
+size_t Bus::getPrivatePageCount() const {
+  size_t count = 0;
+  for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+    count += this->ramPages[page].use_count() == 1;
+  }
+  return count;
+}
+
+uint8_t *Bus::getFlatMemory() {
+  return this->flatMemory != nullptr ? this->flatMemory->data() : nullptr;
+}
+
+uint8_t *Bus::getRam() {
+  uint8_t *base = this->ramPages[0]->data();
+  bool contiguous = true;
+  for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+    contiguous = contiguous && this->ramPages[page].use_count() == 1 &&
+                 this->ramPages[page]->data() == base + page * MEMORY_PAGE_SIZE;
+  }
+  if (!contiguous) {
+    // Pages were shared with or copied away from a fork, gather them again
+    std::shared_ptr<MemoryPage> pages[RAM_PAGE_COUNT];
+    allocateRam(pages, this->ramPages);
+    for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+      this->ramPages[page] = std::move(pages[page]);
+    }
+    mapPages();
+  }
+  return this->ramPages[0]->data();
+}
+
+void Bus::readRam(uint16_t address, uint8_t *data, size_t size) const {
+  for (size_t i = 0; i < size; i++) {
+    uint16_t offset = (address + i) & 0x7FF;
+    data[i] = (*this->ramPages[offset >> 8])[offset & 0xFF];
+  }
+}
+
+void Bus::copyFrom(const Bus &other, bool sharePages) {
+  if (sharePages) {
+    for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+      this->ramPages[page] = other.ramPages[page];
+    }
+  } else {
+    allocateRam(this->ramPages, other.ramPages);
+  }
+  if (sharePages || other.prgRam == nullptr) {
+    this->prgRam = other.prgRam;
   } else {
-    this->rom = Rom{};
+    this->prgRam = std::make_shared<PrgRam>(*other.prgRam);
+  }
+  // Even forks copy flat memory, it is only used by tests
+  this->flatMemory = other.flatMemory == nullptr
+                         ? nullptr
+                         : std::make_shared<FlatMemory>(*other.flatMemory);
+  memcpy(this->controllerState, other.controllerState,
+         sizeof(this->controllerState));
+  memcpy(this->controllerShift, other.controllerShift,
+         sizeof(this->controllerShift));
+  this->controllerStrobe = other.controllerStrobe;
+  this->ppu = other.ppu;
+  this->clock = other.clock;
+  this->dmaStall = other.dmaStall;
+  this->codeDataLogger = other.codeDataLogger;
+  this->fetchAddress = other.fetchAddress;
+  this->romHash = other.romHash;
+  this->rom = other.rom;
+  mapPages();
+}
+
+void Bus::setCodeDataLogger(CodeDataLogger *logger) {
+  this->codeDataLogger = logger;
+  this->ppu.setCodeDataLogger(logger);
+  mapPages();
+}
+
+void Bus::mapPages() {
+  for (uint16_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+    this->readMap[page] = nullptr;
+    this->writeMap[page] = nullptr;
+  }
+  if (this->flatMemory != nullptr) {
+    for (uint16_t page = 0; page < MEMORY_PAGE_COUNT; page++) {
+      this->readMap[page] = this->flatMemory->data() + (page << 8);
+      this->writeMap[page] = this->flatMemory->data() + (page << 8);
+    }
+    return;
+  }
+  for (uint16_t page = RAM_START >> 8; page <= RAM_END >> 8; page++) {
+    std::shared_ptr<MemoryPage> &ram = this->ramPages[page % RAM_PAGE_COUNT];
+    this->readMap[page] = ram->data();
+    if (ram.use_count() == 1) {
+      this->writeMap[page] = ram->data();
+    }
+  }
+  if (this->prgRam != nullptr) {
+    for (uint16_t page = PRG_RAM_START >> 8; page <= PRG_RAM_END >> 8;
+         page++) {
+      uint8_t *memory = this->prgRam->data() + (page << 8) - PRG_RAM_START;
+      this->readMap[page] = memory;
+      if (this->prgRam.use_count() == 1) {
+        this->writeMap[page] = memory;
+      }
+    }
+  }
+  const std::vector<uint8_t> &prg = this->rom->progRom;
+  // The logger sees ROM reads on the slow path
+  if (!prg.empty() && this->codeDataLogger == nullptr) {
+    for (uint16_t page = 0x8000 >> 8; page < MEMORY_PAGE_COUNT; page++) {
+      // 16KB images are mirrored into $C000-$FFFF
+      size_t offset = ((page << 8) - 0x8000) % prg.size();
+      this->readMap[page] = prg.data() + offset;
+    }
+  }
+}
+
+uint8_t *Bus::unsharePage(uint8_t ramPage) {
+  std::shared_ptr<MemoryPage> &ram = this->ramPages[ramPage];
+  if (ram.use_count() != 1) {
+    ram = std::make_shared<MemoryPage>(*ram);
+  } else {
+    // The other owners are gone, pair with their release of the page
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  for (uint16_t page = ramPage; page <= RAM_END >> 8; page += RAM_PAGE_COUNT) {
+    this->readMap[page] = ram->data();
+    this->writeMap[page] = ram->data();
+  }
+  return ram->data();
+}
+
+uint8_t *Bus::unsharePrgRam() {
+  if (this->prgRam == nullptr) {
+    this->prgRam = std::make_shared<PrgRam>();
+    this->prgRam->fill(0);
+  } else if (this->prgRam.use_count() != 1) {
+    this->prgRam = std::make_shared<PrgRam>(*this->prgRam);
+  } else {
+    // Same as unsharePage, the forks that shared it are gone
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  mapPages();
+  return this->prgRam->data();
+}
+
+void Bus::saveState(BusState &state, uint64_t cycle) const {
+  for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+    memcpy(state.cpuVram + page * MEMORY_PAGE_SIZE, this->ramPages[page]->data(),
+           MEMORY_PAGE_SIZE);
+  }
+  memcpy(state.controllerState, this->controllerState,
+         sizeof(state.controllerState));
+  memcpy(state.controllerShift, this->controllerShift,
+         sizeof(state.controllerShift));
+  state.controllerStrobe = this->controllerStrobe;
+  state.prgRamUsed = this->prgRam != nullptr;
+  state.dmaStall = this->dmaStall;
+  if (this->prgRam != nullptr) {
+    memcpy(state.prgRam, this->prgRam->data(), PRG_RAM_SIZE);
+  } else {
+    memset(state.prgRam, 0, PRG_RAM_SIZE);
+  }
+  this->ppu.catchUp(cycle);
+  this->ppu.saveState(state.ppu);
+}
+
+void Bus::loadState(const BusState &state) {
+  for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+    const uint8_t *saved = state.cpuVram + page * MEMORY_PAGE_SIZE;
+    // Leave pages shared with a fork alone when they already match
+    if (memcmp(this->ramPages[page]->data(), saved, MEMORY_PAGE_SIZE) != 0) {
+      memcpy(unsharePage(page), saved, MEMORY_PAGE_SIZE);
+    }
+  }
+  memcpy(this->controllerState, state.controllerState,
+         sizeof(this->controllerState));
+  memcpy(this->controllerShift, state.controllerShift,
+         sizeof(this->controllerShift));
+  this->controllerStrobe = state.controllerStrobe;
+  this->dmaStall = state.dmaStall;
+  if (!state.prgRamUsed) {
+    if (this->prgRam != nullptr) {
+      this->prgRam = nullptr;
+      mapPages();
+    }
+  } else if (this->prgRam == nullptr ||
+             memcmp(this->prgRam->data(), state.prgRam, PRG_RAM_SIZE) != 0) {
+    memcpy(unsharePrgRam(), state.prgRam, PRG_RAM_SIZE);
   }
+  this->ppu.loadState(state.ppu);
+}
+
+uint64_t Bus::hashRam(uint64_t seed) const {
+  uint64_t hash = seed;
+  for (uint8_t page = 0; page < RAM_PAGE_COUNT; page++) {
+    hash = hashBytes(this->ramPages[page]->data(), MEMORY_PAGE_SIZE, hash);
+  }
+  return hash;
+}
+
+uint64_t Bus::hashState(uint64_t seed, uint64_t cycle) const {
+  uint64_t controllers = static_cast<uint64_t>(this->controllerState[0]) |
+                         static_cast<uint64_t>(this->controllerState[1]) << 8 |
+                         static_cast<uint64_t>(this->controllerShift[0]) << 16 |
+                         static_cast<uint64_t>(this->controllerShift[1]) << 24 |
+                         static_cast<uint64_t>(this->controllerStrobe) << 32 |
+                         static_cast<uint64_t>(this->dmaStall) << 40;
+  uint64_t hash = hashRam(mixHash(seed ^ mixHash(controllers)));
+  if (this->prgRam != nullptr) {
+    hash = hashBytes(this->prgRam->data(), PRG_RAM_SIZE, hash);
+  }
+  this->ppu.catchUp(cycle);
+  return this->ppu.hashState(hash);
+}
+
+uint16_t Bus::takeDmaStall() {
+  uint16_t stall = this->dmaStall;
+  this->dmaStall = 0;
+  return stall;
+}
+
+void Bus::setControllerState(uint8_t port, uint8_t buttons) {
+  this->controllerState[port & 1] = buttons;
+  if (this->controllerStrobe) {
+    this->controllerShift[port & 1] = buttons;
+  }
+}
+
+uint8_t Bus::readController(uint8_t port) {
+  if (this->controllerStrobe) {
+    return this->controllerState[port] & BUTTON_A;
+  }
+  uint8_t bit = this->controllerShift[port] & 1;
+  // Official controllers return 1 once all eight buttons have been read
+  this->controllerShift[port] = (this->controllerShift[port] >> 1) | 0x80;
+  return bit;
 }
 
 uint8_t Bus::readFromMemory(uint16_t address) {
-  if (address >= RAM_START && address <= RAM_END) {
-    uint16_t mirroredAddress = address & 0b0000011111111111;
-    return this->cpuVram[mirroredAddress];
-  } else if (address >= 0x8000 && address <= 0xFFFF) {
+  const uint8_t *page = this->readMap[address >> 8];
+  if (page != nullptr) {
+    return page[address & 0xFF];
+  }
+  return readSlow(address);
+}
+
+uint8_t Bus::peek(uint16_t address) const {
+  const uint8_t *page = this->readMap[address >> 8];
+  if (page != nullptr) {
+    return page[address & 0xFF];
+  }
+  if (address >= 0x8000) {
+    return readPrgRom(address);
+  } else if (address >= PPU_START && address <= PPU_END) {
+    return this->ppu.peekRegister(address, this->clock);
+  } else if (address == CONTROLLER_1 || address == CONTROLLER_2) {
+    uint8_t port = address - CONTROLLER_1;
+    return this->controllerStrobe ? this->controllerState[port] & BUTTON_A
+                                  : this->controllerShift[port] & 1;
+  }
+  return 0;
+}
+
+void Bus::writeToMemory(uint16_t address, uint8_t data) {
+  uint8_t *page = this->writeMap[address >> 8];
+  if (page != nullptr) {
+    page[address & 0xFF] = data;
+    return;
+  }
+  writeSlow(address, data);
+}
+
+uint8_t *Bus::resolveRam(uint16_t address) {
+  uint8_t *page = this->writeMap[address >> 8];
+  if (page == nullptr || page != this->readMap[address >> 8]) {
+    return nullptr;
+  }
+  return page + (address & 0xFF);
+}
+
+uint8_t Bus::readSlow(uint16_t address) {
+  if (address >= 0x8000 && address <= 0xFFFF) {
+    // Instructions are at most 3 bytes
+    if (this->codeDataLogger != nullptr &&
+        static_cast<uint16_t>(address - this->fetchAddress) >= 3) {
+      this->codeDataLogger->logData(address);
+    }
     return readPrgRom(address);
   }
   else if (address >= PPU_START && address <= PPU_END) {
-    uint16_t mirroredAddress = address & 0b0010000000000111;
-    // TODO implement PPU
+    return this->ppu.readRegister(address, this->clock);
+  } else if (address == CONTROLLER_1 || address == CONTROLLER_2) {
+    return readController(address - CONTROLLER_1);
+  } else if (address >= PRG_RAM_START && address <= PRG_RAM_END) {
+    // Not written yet
+    return 0;
   }
   std::cout << "Read From Memory: Ignoring invalid memory access at " << address << "\n";
   return 0;
 }
 
-void Bus::writeToMemory(uint16_t address, uint8_t data) {
+void Bus::writeSlow(uint16_t address, uint8_t data) {
   if (address >= RAM_START && address <= RAM_END) {
-    uint16_t mirroredAddress = address & 0b11111111111;
-    this->cpuVram[mirroredAddress] = data;
+    // First write to a page shared with a fork
+    unsharePage((address >> 8) % RAM_PAGE_COUNT)[address & 0xFF] = data;
     return;
   } else if (address >= PPU_START && address <= PPU_END) {
-    uint16_t mirroredAddress = address & 0b0010000000000111;
-    // TODO implement PPU
+    this->ppu.writeRegister(address, data, this->clock);
+    return;
+  } else if (address == OAM_DMA) {
+    uint8_t page[MEMORY_PAGE_SIZE];
+    for (uint16_t offset = 0; offset < MEMORY_PAGE_SIZE; offset++) {
+      page[offset] = readFromMemory(data << 8 | offset);
+    }
+    this->ppu.writeOam(page, this->clock);
+    // The CPU is halted for the copy, one more cycle to line up on an even
+    // one
+    this->dmaStall += 513 + (this->clock & 1);
+    return;
+  } else if (address >= PRG_RAM_START && address <= PRG_RAM_END) {
+    // First write, or first write to RAM shared with a fork
+    unsharePrgRam()[address - PRG_RAM_START] = data;
+    return;
+  } else if (address == CONTROLLER_1) {
+    // Strobe is shared by both ports, the shift registers reload while high
+    this->controllerStrobe = data & 1;
+    if (this->controllerStrobe) {
+      memcpy(this->controllerShift, this->controllerState,
+             sizeof(this->controllerShift));
+    }
     return;
   } else if (address >= 0x8000 && address <= 0xFFFF) {
     std::cout << "Attempt write to prog rom at " << address << "\n";
@@ -46,50 +412,23 @@ void Bus::writeToMemory(uint16_t address, uint8_t data) {
 }
 
 uint16_t Bus::readShortFromMemory(uint16_t address) {
-  if (address >= RAM_START && address <= RAM_END) {
-    uint16_t mirroredAddress = address & 0b0000011111111111;
-    return ((this->cpuVram[mirroredAddress + 1]) << 8) |
-           (this->cpuVram[mirroredAddress]);
-  } else if (address >= PPU_START && address <= PPU_END) {
-    uint16_t mirroredAddress = address & 0b0010000000000111;
-    // TODO implement PPU
-  } else if (address >= 0x8000 && address <= 0xFFFF) {
-    return readShortFromPrgRom(address);
-  }
-  std::cout << "Read Short From Memory: Ignoring invalid memory access at " << address << "\n";
-  return 0;
-}
-
-uint8_t Bus::readPrgRom(uint16_t address) {
-  address -= 0x8000;
-  if (this->rom.progRom.size() == 0x4000 && address >= 0x4000) {
-    address = address % 0x4000;
-  }
-  return this->rom.progRom[address];
+  // RAM mirrors wrap, so $07FF reads its high byte from $0800 = $0000
+  uint16_t lo = readFromMemory(address);
+  uint16_t hi = readFromMemory(address + 1);
+  return (hi << 8) | lo;
 }
 
-uint16_t Bus::readShortFromPrgRom(uint16_t address) {
+uint8_t Bus::readPrgRom(uint16_t address) const {
   address -= 0x8000;
-  if (this->rom.progRom.size() == 0x4000 && address >= 0x4000) {
+  if (this->rom->progRom.size() == 0x4000 && address >= 0x4000) {
     address = address % 0x4000;
   }
-  uint16_t lo = this->rom.progRom[address];
-  uint16_t hi = this->rom.progRom[address + 1];
-  return (hi << 8) | lo;
+  return this->rom->progRom[address];
 }
 
 void Bus::writeShortToMemory(uint16_t address, uint16_t data) {
-  if (address >= RAM_START && address <= RAM_END) {
-    uint16_t mirroredAddress = address & 0b11111111111;
-    this->cpuVram[mirroredAddress] = data & 0xFF;
-    this->cpuVram[mirroredAddress + 1] = data >> 8;
-    return;
-  } else if (address >= PPU_START && address <= PPU_END) {
-    uint16_t mirroredAddress = address & 0b0010000000000111;
-    // TODO implement PPU
-    return;
-  }
-  std::cout << "Write Short to memory: Ignoring invalid memory access at" << address << "\n";
+  writeToMemory(address, data & 0xFF);
+  writeToMemory(address + 1, data >> 8);
 }
 
 std::optional<Rom> Bus::readBytes(std::vector<uint8_t>& raw) {
@@ -97,7 +436,8 @@ std::optional<Rom> Bus::readBytes(std::vector<uint8_t>& raw) {
     // Method for testing, allows for construction of a bus with an empty ROM
     return {};
   }
-  if (raw[0] != 0x4E || raw[1] != 0x45 || raw[2] != 0x53 || raw[3] != 0x1A) {
+  if (raw.size() < 16 || raw[0] != 0x4E || raw[1] != 0x45 || raw[2] != 0x53 ||
+      raw[3] != 0x1A) {
     return {};
   }
   uint8_t mapper = (raw[7] & 0b11110000) | (raw[6] >> 4);
@@ -122,6 +462,10 @@ std::optional<Rom> Bus::readBytes(std::vector<uint8_t>& raw) {
 
   uint32_t prgRomStart = 16 + 512 * skipTrainer;
   uint32_t chrRomStart = prgRomStart + prgRomSize;
+  // Truncated images would be copied from past the end of the buffer
+  if (raw.size() < chrRomStart + chrRomSize) {
+    return {};
+  }
   return Rom{mapper,
           std::vector<uint8_t>(raw.begin() + prgRomStart,
                                raw.begin() + prgRomStart + prgRomSize),
@@ -0,0 +1,250 @@
+#include "capture.hpp"
+#include "ppu.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+// Files are written a megabyte at a time
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+#define WAV_HEADER_SIZE 44
+
+static void putLittle(uint8_t *out, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out[i] = value >> (8 * i);
+  }
+}
+
+bool Capture::Output::append(const void *data, size_t size,
+                             uint64_t &written) {
+  if (this->buffer.size() + size > CAPTURE_BUFFER_SIZE && !flush(written)) {
+    return false;
+  }
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  this->buffer.insert(this->buffer.end(), bytes, bytes + size);
+  return true;
+}
+
+bool Capture::Output::flush(uint64_t &written) {
+  const uint8_t *bytes = this->buffer.data();
+  size_t size = this->buffer.size();
+  while (size > 0) {
+    ssize_t count = write(this->fd, bytes, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    bytes += count;
+    size -= count;
+    written += count;
+  }
+  this->buffer.clear();
+  return true;
+}
+
+static_assert(CAPTURE_PICTURE_SIZE == PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT,
+              "capture picture size must match the PPU");
+
+Capture::Capture(size_t queueFrames, CaptureOverflow overflow,
+                 CaptureSource source)
+    : overflow(overflow),
+      width(source == CAPTURE_PICTURE ? PPU_FRAME_WIDTH : SCREEN_WIDTH),
+      height(source == CAPTURE_PICTURE ? PPU_FRAME_HEIGHT : SCREEN_HEIGHT),
+      queue(queueFrames > 0 ? queueFrames : 1), head(0), tail(0), count(0),
+      closing(false), failed(false), stats(), audioBytes(0),
+      planes(6 + 3 * getFrameSize()) {
+  for (Frame &frame : this->queue) {
+    frame.pixels.resize(getFrameSize());
+    // Enough for a frame of audio without allocating while running
+    frame.samples.reserve(2 * CAPTURE_SAMPLES_PER_FRAME);
+  }
+  // BT.601 studio range, what players assume for y4m
+  for (int byte = 0; byte < 256; byte++) {
+    PaletteColor color = source == CAPTURE_PICTURE ? ppuPaletteColor(byte)
+                                                   : paletteColor(byte);
+    int r = color.r;
+    int g = color.g;
+    int b = color.b;
+    this->yuv[byte][0] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    this->yuv[byte][1] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    this->yuv[byte][2] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+}
+
+Capture::~Capture() { close(); }
+
+bool Capture::open(const std::string &videoPath,
+                   const std::string &audioPath) {
+  uint64_t written = 0;
+  if (!videoPath.empty()) {
+    this->video.fd = ::open(videoPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                            0644);
+    if (this->video.fd < 0) {
+      std::cout << "Could not create " << videoPath << "\n";
+      return false;
+    }
+    this->video.buffer.reserve(CAPTURE_BUFFER_SIZE);
+    std::string header = "YUV4MPEG2 W" + std::to_string(this->width) + " H" +
+                         std::to_string(this->height) + " F" +
+                         std::to_string(CAPTURE_FRAME_RATE) +
+                         ":1 Ip A1:1 C444\n";
+    this->video.append(header.data(), header.size(), written);
+  }
+  if (!audioPath.empty()) {
+    this->audio.fd = ::open(audioPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                            0644);
+    if (this->audio.fd < 0) {
+      std::cout << "Could not create " << audioPath << "\n";
+      return false;
+    }
+    this->audio.buffer.reserve(CAPTURE_BUFFER_SIZE);
+    // Sizes are filled in by close() once they are known
+    uint8_t header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF\0\0\0\0WAVEfmt ", 16);
+    putLittle(header + 16, 16, 4);
+    putLittle(header + 20, 1, 2);
+    putLittle(header + 22, 1, 2);
+    putLittle(header + 24, CAPTURE_SAMPLE_RATE, 4);
+    putLittle(header + 28, CAPTURE_SAMPLE_RATE * sizeof(int16_t), 4);
+    putLittle(header + 32, sizeof(int16_t), 2);
+    putLittle(header + 34, 16, 2);
+    memcpy(header + 36, "data\0\0\0\0", 8);
+    this->audio.append(header, sizeof(header), written);
+  }
+  this->writer = std::thread(&Capture::writeLoop, this);
+  return true;
+}
+
+bool Capture::pushFrame(const uint8_t *screen, const int16_t *samples,
+                        size_t sampleCount) {
+  std::unique_lock<std::mutex> guard(this->lock);
+  if (this->count == this->queue.size()) {
+    if (this->overflow == CAPTURE_DROP) {
+      this->stats.framesDropped++;
+      return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    this->notFull.wait(guard,
+                       [this]() { return this->count < this->queue.size(); });
+    this->stats.blockedNanos +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+  }
+  // The writer is never at head, but even a picture is cheap to copy under
+  // the lock
+  Frame &frame = this->queue[this->head];
+  memcpy(frame.pixels.data(), screen, frame.pixels.size());
+  frame.samples.assign(samples, samples + sampleCount);
+  this->head = (this->head + 1) % this->queue.size();
+  this->count++;
+  this->stats.framesQueued++;
+  if (this->count > this->stats.queueHighWater) {
+    this->stats.queueHighWater = this->count;
+  }
+  this->notEmpty.notify_one();
+  return true;
+}
+
+void Capture::writeLoop() {
+  uint64_t written = 0;
+  bool ok = true;
+  std::unique_lock<std::mutex> guard(this->lock);
+  for (;;) {
+    this->notEmpty.wait(
+        guard, [this]() { return this->count > 0 || this->closing; });
+    if (this->count == 0) {
+      break;
+    }
+    const Frame &frame = this->queue[this->tail];
+    guard.unlock();
+    ok = ok && writeFrame(frame, written);
+    guard.lock();
+    this->tail = (this->tail + 1) % this->queue.size();
+    this->count--;
+    this->stats.framesWritten++;
+    this->stats.bytesWritten += written;
+    written = 0;
+    this->notFull.notify_one();
+  }
+  guard.unlock();
+  if (this->video.fd >= 0) {
+    ok = ok && this->video.flush(written);
+  }
+  if (this->audio.fd >= 0) {
+    ok = ok && this->audio.flush(written);
+  }
+  guard.lock();
+  this->stats.bytesWritten += written;
+  this->failed = this->failed || !ok;
+}
+
+bool Capture::writeFrame(const Frame &frame, uint64_t &written) {
+  if (this->video.fd >= 0) {
+    // FRAME marker and the three full resolution planes
+    size_t size = frame.pixels.size();
+    uint8_t *planes = this->planes.data();
+    memcpy(planes, "FRAME\n", 6);
+    for (int plane = 0; plane < 3; plane++) {
+      uint8_t *out = planes + 6 + plane * size;
+      for (size_t pixel = 0; pixel < size; pixel++) {
+        out[pixel] = this->yuv[frame.pixels[pixel]][plane];
+      }
+    }
+    if (!this->video.append(planes, this->planes.size(), written)) {
+      return false;
+    }
+  }
+  if (this->audio.fd >= 0) {
+    // WAV is little endian, like every host this builds for
+    size_t size = frame.samples.size() * sizeof(int16_t);
+    if (!this->audio.append(frame.samples.data(), size, written)) {
+      return false;
+    }
+    this->audioBytes += size;
+  }
+  return true;
+}
+
+bool Capture::close() {
+  if (this->writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> guard(this->lock);
+      this->closing = true;
+    }
+    this->notEmpty.notify_one();
+    this->writer.join();
+  }
+  if (this->audio.fd >= 0) {
+    uint8_t size[4];
+    putLittle(size, WAV_HEADER_SIZE - 8 + this->audioBytes, 4);
+    bool patched = pwrite(this->audio.fd, size, 4, 4) == 4;
+    putLittle(size, this->audioBytes, 4);
+    patched = patched && pwrite(this->audio.fd, size, 4, 40) == 4;
+    this->failed = this->failed || !patched;
+    ::close(this->audio.fd);
+    this->audio.fd = -1;
+  }
+  if (this->video.fd >= 0) {
+    ::close(this->video.fd);
+    this->video.fd = -1;
+  }
+  if (this->failed) {
+    std::cout << "Capture: writing failed, the recording is incomplete\n";
+    // Only report it once
+    this->failed = false;
+    return false;
+  }
+  return true;
+}
+
+size_t Capture::getFrameSize() const { return this->width * this->height; }
+
+CaptureStats Capture::getStats() {
+  std::lock_guard<std::mutex> guard(this->lock);
+  return this->stats;
+}
@@ -0,0 +1,169 @@
+#include "cnes.h"
+#include "cpu.hpp"
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <vector>
+
+#define FRAME_BUFFER_START 0x0200
+
+static_assert(CNES_RAM_SIZE == sizeof(BusState::cpuVram),
+              "CNES_RAM_SIZE must match the emulated RAM");
+static_assert(FRAME_BUFFER_START + CNES_FRAME_WIDTH * CNES_FRAME_HEIGHT <=
+                  CNES_RAM_SIZE,
+              "The frame buffer must fit in work RAM");
+static_assert(CNES_PPU_FRAME_WIDTH == PPU_FRAME_WIDTH &&
+                  CNES_PPU_FRAME_HEIGHT == PPU_FRAME_HEIGHT,
+              "The PPU frame size is part of the ABI");
+static_assert(CNES_BUTTON_A == BUTTON_A && CNES_BUTTON_RIGHT == BUTTON_RIGHT,
+              "Button bits are part of the ABI");
+
+struct cnes {
+  std::unique_ptr<CPU> cpu;
+  // Into the bus of cpu, set on every ROM load
+  uint8_t *ram = nullptr;
+  bool drawing = true;
+  std::vector<int16_t> audio;
+};
+
+int cnes_api_version(void) { return CNES_API_VERSION; }
+
+cnes_t *cnes_create(void) { return new (std::nothrow) cnes(); }
+
+void cnes_destroy(cnes_t *nes) { delete nes; }
+
+int cnes_load_rom(cnes_t *nes, const uint8_t *data, size_t size) {
+  if (nes == nullptr || (data == nullptr && size > 0)) {
+    return CNES_ERROR_INVALID_ARGUMENT;
+  }
+  // Nothing may throw across the C boundary, allocation is all that can
+  try {
+    std::vector<uint8_t> rom(data, data + size);
+    std::optional<Rom> decoded = Bus::readBytes(rom);
+    // Only NROM is emulated, anything else would run with the wrong banks
+    if (!decoded.has_value() || decoded->mapper != 0) {
+      return CNES_ERROR_BAD_ROM;
+    }
+    nes->ram = nullptr;
+    nes->cpu = std::make_unique<CPU>(Bus(std::move(rom)));
+  } catch (const std::bad_alloc &) {
+    nes->cpu = nullptr;
+    return CNES_ERROR_OUT_OF_MEMORY;
+  }
+  nes->cpu->getBus().setPpuDrawing(nes->drawing);
+  nes->cpu->reset();
+  // The handle never forks, so this stays put for the life of the CPU
+  nes->ram = nes->cpu->getBus().getRam();
+  return CNES_OK;
+}
+
+int cnes_reset(cnes_t *nes) {
+  if (nes == nullptr) {
+    return CNES_ERROR_INVALID_ARGUMENT;
+  }
+  if (nes->cpu == nullptr) {
+    return CNES_ERROR_NO_ROM;
+  }
+  nes->cpu->reset();
+  return CNES_OK;
+}
+
+int cnes_step_frame(cnes_t *nes) {
+  if (nes == nullptr) {
+    return CNES_ERROR_INVALID_ARGUMENT;
+  }
+  if (nes->cpu == nullptr) {
+    return CNES_ERROR_NO_ROM;
+  }
+  return nes->cpu->runFrame() ? CNES_OK : CNES_STOPPED;
+}
+
+uint64_t cnes_frame_count(const cnes_t *nes) {
+  if (nes == nullptr || nes->cpu == nullptr) {
+    return 0;
+  }
+  return nes->cpu->getFrame();
+}
+
+int cnes_set_input(cnes_t *nes, unsigned port, uint8_t buttons) {
+  if (nes == nullptr || port > 1) {
+    return CNES_ERROR_INVALID_ARGUMENT;
+  }
+  if (nes->cpu == nullptr) {
+    return CNES_ERROR_NO_ROM;
+  }
+  nes->cpu->getBus().setControllerState(port, buttons);
+  return CNES_OK;
+}
+
+size_t cnes_state_size(void) { return sizeof(SaveState); }
+
+int cnes_save_state(const cnes_t *nes, void *buffer, size_t size) {
+  if (nes == nullptr || buffer == nullptr || size < sizeof(SaveState)) {
+    return CNES_ERROR_INVALID_ARGUMENT;
+  }
+  if (nes->cpu == nullptr) {
+    return CNES_ERROR_NO_ROM;
+  }
+  SaveState state;
+  nes->cpu->saveState(state);
+  memcpy(buffer, &state, sizeof(state));
+  return CNES_OK;
+}
+
+int cnes_load_state(cnes_t *nes, const void *buffer, size_t size) {
+  if (nes == nullptr || buffer == nullptr || size < sizeof(SaveState)) {
+    return CNES_ERROR_INVALID_ARGUMENT;
+  }
+  if (nes->cpu == nullptr) {
+    return CNES_ERROR_NO_ROM;
+  }
+  // The buffer comes from the caller and need not be aligned
+  SaveState state;
+  memcpy(&state, buffer, sizeof(state));
+  return nes->cpu->loadState(state) ? CNES_OK : CNES_ERROR_BAD_STATE;
+}
+
+const uint8_t *cnes_framebuffer(const cnes_t *nes) {
+  if (nes == nullptr || nes->ram == nullptr) {
+    return nullptr;
+  }
+  return nes->ram + FRAME_BUFFER_START;
+}
+
+const uint8_t *cnes_ppu_framebuffer(const cnes_t *nes) {
+  if (nes == nullptr || nes->cpu == nullptr) {
+    return nullptr;
+  }
+  // The handle never forks, so the PPU never copies it away once drawn
+  return nes->cpu->getBus().getFramebuffer(nes->cpu->cycles);
+}
+
+int cnes_set_drawing(cnes_t *nes, int enabled) {
+  if (nes == nullptr) {
+    return CNES_ERROR_INVALID_ARGUMENT;
+  }
+  nes->drawing = enabled != 0;
+  if (nes->cpu != nullptr) {
+    nes->cpu->getBus().setPpuDrawing(nes->drawing);
+  }
+  return CNES_OK;
+}
+
+uint8_t *cnes_ram(cnes_t *nes) {
+  if (nes == nullptr) {
+    return nullptr;
+  }
+  return nes->ram;
+}
+
+const int16_t *cnes_audio(const cnes_t *nes, size_t *samples) {
+  if (samples != nullptr) {
+    *samples = nes == nullptr ? 0 : nes->audio.size();
+  }
+  if (nes == nullptr) {
+    return nullptr;
+  }
+  return nes->audio.data();
+}
@@ -0,0 +1,71 @@
+#include "codedatalogger.hpp"
+#include "bus.hpp"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+CodeDataLogger::CodeDataLogger(std::shared_ptr<const Rom> rom) {
+  this->prgSize = rom->progRom.size();
+  this->chrSize = rom->chrRom.size();
+  this->log.assign(this->prgSize + this->chrSize, 0);
+}
+
+bool CodeDataLogger::load(const std::string &path) {
+  std::ifstream input(path, std::ios::binary);
+  std::vector<uint8_t> saved(std::istreambuf_iterator<char>(input), {});
+  if (!input.is_open()) {
+    std::cout << "Could not read " << path << "\n";
+    return false;
+  }
+  if (saved.size() != this->log.size()) {
+    std::cout << path << " is a log of " << saved.size()
+              << " bytes, this ROM has " << this->log.size() << "\n";
+    return false;
+  }
+  for (size_t i = 0; i < this->log.size(); i++) {
+    this->log[i] |= saved[i];
+  }
+  return true;
+}
+
+bool CodeDataLogger::save(const std::string &path) const {
+  std::ofstream output(path, std::ios::binary | std::ios::trunc);
+  output.write(reinterpret_cast<const char *>(this->log.data()),
+               this->log.size());
+  if (!output) {
+    std::cout << "Could not write " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+std::vector<uint16_t> CodeDataLogger::getIndirectTargets() const {
+  std::vector<uint16_t> targets;
+  for (size_t offset = 0; offset < this->prgSize; offset++) {
+    uint8_t flags = this->log[offset];
+    if (flags & CDL_INDIRECT_CODE) {
+      // The bank bits say which mirror of a 16KB image it ran from
+      uint16_t window = (flags & CDL_BANK_MASK) >> CDL_BANK_SHIFT;
+      targets.push_back(0x8000 | window << 13 | (offset & 0x1FFF));
+    }
+  }
+  return targets;
+}
+
+CdlStats CodeDataLogger::getStats() const {
+  CdlStats stats = {};
+  stats.prgBytes = this->prgSize;
+  stats.chrBytes = this->chrSize;
+  for (size_t offset = 0; offset < this->prgSize; offset++) {
+    uint8_t flags = this->log[offset];
+    stats.code += (flags & CDL_CODE) != 0;
+    stats.data += (flags & CDL_DATA) != 0;
+    stats.indirectCode += (flags & CDL_INDIRECT_CODE) != 0;
+  }
+  for (size_t offset = this->prgSize; offset < this->log.size(); offset++) {
+    uint8_t flags = this->log[offset];
+    stats.chrDrawn += (flags & CDL_CHR_DRAWN) != 0;
+    stats.chrRead += (flags & CDL_CHR_READ) != 0;
+  }
+  return stats;
+}
@@ -0,0 +1,230 @@
+#include "conformance.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+// Longest message read back from a blargg test
+#define BLARGG_MESSAGE_LIMIT 1024
+
+static const uint8_t BLARGG_SIGNATURE_BYTES[] = {0xDE, 0xB0, 0x61};
+
+const char *conformanceStatusName(ConformanceStatus status) {
+  switch (status) {
+  case CONFORMANCE_PASS:
+    return "PASS";
+  case CONFORMANCE_FAIL:
+    return "FAIL";
+  case CONFORMANCE_TIMEOUT:
+    return "TIMEOUT";
+  case CONFORMANCE_CRASH:
+    return "CRASH";
+  case CONFORMANCE_SKIPPED:
+    return "SKIPPED";
+  }
+  return "?";
+}
+
+ConformanceRunner::ConformanceRunner(size_t threads) : threadCount(threads) {
+  if (this->threadCount == 0) {
+    this->threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+size_t ConformanceRunner::add(ConformanceTest test) {
+  this->tests.push_back(std::move(test));
+  return this->tests.size() - 1;
+}
+
+bool ConformanceRunner::addDirectory(const std::string &directory) {
+  namespace fs = std::filesystem;
+  std::error_code error;
+  if (!fs::is_directory(directory, error)) {
+    std::cout << "Conformance: " << directory << " is not a directory\n";
+    return false;
+  }
+  std::map<std::string, uint64_t> budgets;
+  std::ifstream budgetFile(fs::path(directory) / "budgets.txt");
+  std::string line;
+  while (std::getline(budgetFile, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    uint64_t cycles;
+    if (fields >> name >> cycles && name[0] != '#') {
+      budgets[name] = cycles;
+    }
+  }
+
+  std::vector<fs::path> paths;
+  for (fs::recursive_directory_iterator it(directory, error), end;
+       !error && it != end; it.increment(error)) {
+    if (it->is_regular_file() && it->path().extension() == ".nes") {
+      paths.push_back(it->path());
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+  for (const fs::path &path : paths) {
+    ConformanceTest test;
+    test.name = fs::relative(path, directory).generic_string();
+    std::ifstream input(path, std::ios::binary);
+    test.rom.assign(std::istreambuf_iterator<char>(input), {});
+    std::string file = path.filename().string();
+    std::transform(file.begin(), file.end(), file.begin(), ::tolower);
+    test.nestest = file.find("nestest") != std::string::npos;
+    auto budget = budgets.find(test.name);
+    if (budget != budgets.end()) {
+      test.cycleBudget = budget->second;
+    } else {
+      test.cycleBudget = test.nestest ? CONFORMANCE_NESTEST_CYCLES
+                                      : CONFORMANCE_DEFAULT_CYCLES;
+    }
+    add(std::move(test));
+  }
+  return true;
+}
+
+std::vector<ConformanceResult> ConformanceRunner::run() {
+  std::vector<ConformanceResult> results(this->tests.size());
+  std::atomic<size_t> next(0);
+  // ROMs take wildly different times, so threads pull the next one when they
+  // finish rather than splitting the list up front
+  auto worker = [&]() {
+    for (size_t i = next++; i < this->tests.size(); i = next++) {
+      results[i] = runTest(this->tests[i]);
+    }
+  };
+  std::vector<std::thread> threads;
+  size_t count = std::min(this->threadCount, this->tests.size());
+  for (size_t i = 1; i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
+static bool hasBlarggSignature(CPU &cpu) {
+  for (uint16_t i = 0; i < sizeof(BLARGG_SIGNATURE_BYTES); i++) {
+    if (cpu.readFromMemory(BLARGG_SIGNATURE + i) != BLARGG_SIGNATURE_BYTES[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string blarggMessage(CPU &cpu) {
+  std::string message;
+  for (uint16_t i = 0; i < BLARGG_MESSAGE_LIMIT; i++) {
+    char c = cpu.readFromMemory(BLARGG_MESSAGE + i);
+    if (c == 0) {
+      break;
+    }
+    message += c;
+  }
+  // The tests print with newlines, keep the result on one line
+  std::replace(message.begin(), message.end(), '\n', ' ');
+  while (!message.empty() && message.back() == ' ') {
+    message.pop_back();
+  }
+  return message;
+}
+
+ConformanceResult ConformanceRunner::runTest(const ConformanceTest &test) {
+  ConformanceResult result = {};
+  result.kind = test.nestest ? CONFORMANCE_NESTEST : CONFORMANCE_OTHER;
+  std::shared_ptr<const Rom> rom = Bus(test.rom).getRom();
+  if (rom->progRom.empty()) {
+    result.status = CONFORMANCE_SKIPPED;
+    result.message = "not an iNES ROM";
+    return result;
+  }
+  if (rom->mapper != 0) {
+    result.status = CONFORMANCE_SKIPPED;
+    result.message = "mapper " + std::to_string(rom->mapper) +
+                     " is not supported";
+    return result;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  CPU cpu = CPU(Bus(test.rom));
+  cpu.reset();
+  if (test.nestest) {
+    cpu.PC = 0xC000;
+  }
+  // Cycles run before resets the ROM asked for, reset() starts over at 7
+  uint64_t spent = 0;
+  uint64_t resetAt = 0;
+  bool running = true;
+  bool reported = false;
+  while (running && spent + cpu.cycles < test.cycleBudget) {
+    running = cpu.runFrame();
+    if (test.nestest || !hasBlarggSignature(cpu)) {
+      continue;
+    }
+    result.kind = CONFORMANCE_BLARGG;
+    uint8_t status = cpu.readFromMemory(BLARGG_STATUS);
+    if (status < BLARGG_RUNNING) {
+      result.code = status;
+      reported = true;
+      break;
+    }
+    if (status == BLARGG_NEEDS_RESET && resetAt == 0) {
+      resetAt = cpu.cycles + CONFORMANCE_RESET_DELAY;
+    } else if (resetAt != 0 && cpu.cycles >= resetAt) {
+      spent += cpu.cycles;
+      cpu.reset();
+      resetAt = 0;
+    }
+  }
+  result.cycles = spent + cpu.cycles;
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  switch (result.kind) {
+  case CONFORMANCE_NESTEST: {
+    // The CPU stops at the first unofficial opcode it doesn't implement, the
+    // official tests are done by then
+    result.code = cpu.readFromMemory(0x02);
+    if (result.code == 0) {
+      result.code = cpu.readFromMemory(0x03);
+    }
+    if (result.code != 0) {
+      result.status = CONFORMANCE_FAIL;
+      return result;
+    }
+    // Stopping anywhere else, on BRK or after an official opcode went wrong,
+    // means the tests never got that far
+    result.status = running                    ? CONFORMANCE_TIMEOUT
+                    : cpu.isStoppedOnUnknown() ? CONFORMANCE_PASS
+                                               : CONFORMANCE_CRASH;
+    break;
+  }
+  case CONFORMANCE_BLARGG:
+    result.message = blarggMessage(cpu);
+    if (reported) {
+      result.status = result.code == 0 ? CONFORMANCE_PASS : CONFORMANCE_FAIL;
+      return result;
+    }
+    result.status = running ? CONFORMANCE_TIMEOUT : CONFORMANCE_CRASH;
+    break;
+  case CONFORMANCE_OTHER:
+    result.status = running ? CONFORMANCE_PASS : CONFORMANCE_CRASH;
+    break;
+  }
+  if (!running) {
+    std::ostringstream where;
+    where << "stopped at $" << std::hex << std::uppercase << cpu.PC;
+    result.message = result.message.empty()
+                         ? where.str()
+                         : result.message + " (" + where.str() + ")";
+  }
+  return result;
+}
@@ -1,10 +1,16 @@
 #include "cpu.hpp"
+#include "aot.hpp"
+#include "breakpoints.hpp"
+#include "codedatalogger.hpp"
+#include "hash.hpp"
+#include "profiler.hpp"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 
 #define TOP_OF_STACK 0xFF
 
-std::vector<CPU::instruction> CPU::opcodeTable = {
+const std::vector<CPU::instruction> CPU::opcodeTable = {
     {0x00, "BRK", 1, 7, ADDRESSING::NoneAddressing},
     {0xAA, "TAX", 1, 2, ADDRESSING::NoneAddressing},
     {0xE8, "INX", 1, 2, ADDRESSING::NoneAddressing},
@@ -136,8 +142,8 @@ std::vector<CPU::instruction> CPU::opcodeTable = {
 
     {0x48, "PHA", 1, 3, ADDRESSING::NoneAddressing},
     {0x08, "PHP", 1, 3, ADDRESSING::NoneAddressing},
-    {0x68, "PLA", 1, 3, ADDRESSING::NoneAddressing},
-    {0x28, "PLP", 1, 3, ADDRESSING::NoneAddressing},
+    {0x68, "PLA", 1, 4, ADDRESSING::NoneAddressing},
+    {0x28, "PLP", 1, 4, ADDRESSING::NoneAddressing},
 
     {0x2A, "ROL", 1, 2, ADDRESSING::NoneAddressing},
     {0x26, "ROL", 2, 5, ADDRESSING::ZeroPage},
@@ -163,9 +169,9 @@ std::vector<CPU::instruction> CPU::opcodeTable = {
     {0x40, "RTI", 1, 6, ADDRESSING::NoneAddressing},
     {0x60, "RTS", 1, 6, ADDRESSING::NoneAddressing},
 
-    {0x38, "SEC", 1, 6, ADDRESSING::NoneAddressing},
-    {0xF8, "SED", 1, 6, ADDRESSING::NoneAddressing},
-    {0x78, "SEI", 1, 6, ADDRESSING::NoneAddressing},
+    {0x38, "SEC", 1, 2, ADDRESSING::NoneAddressing},
+    {0xF8, "SED", 1, 2, ADDRESSING::NoneAddressing},
+    {0x78, "SEI", 1, 2, ADDRESSING::NoneAddressing},
 
     {0x86, "STX", 2, 3, ADDRESSING::ZeroPage},
     {0x96, "STX", 2, 4, ADDRESSING::ZeroPage_Y},
@@ -190,25 +196,134 @@ std::vector<CPU::instruction> CPU::opcodeTable = {
     {0x85, "STA", 2, 3, ADDRESSING::ZeroPage},
     {0x95, "STA", 2, 4, ADDRESSING::ZeroPage_X},
     {0x8D, "STA", 3, 4, ADDRESSING::Absolute},
-    {0x9D, "STA", 2, 5, ADDRESSING::Absolute_X},
-    {0x99, "STA", 2, 5, ADDRESSING::Absolute_Y},
+    {0x9D, "STA", 3, 5, ADDRESSING::Absolute_X},
+    {0x99, "STA", 3, 5, ADDRESSING::Absolute_Y},
     {0x81, "STA", 2, 6, ADDRESSING::Indirect_X},
     {0x91, "STA", 2, 6, ADDRESSING::Indirect_Y},
 };
 
-CPU::CPU(Bus bus) : bus(bus) {
+static std::array<CPU::instruction, 256> buildLookupTable() {
+  std::array<CPU::instruction, 256> table{};
+  for (const CPU::instruction &ins : CPU::opcodeTable) {
+    table[ins.opcode] = ins;
+  }
+  return table;
+}
+
+// Shared by every CPU, built once from opcodeTable
+const std::array<CPU::instruction, 256> CPU::lookupTable = buildLookupTable();
+
+const std::vector<CPU::fusedSequence> CPU::fusedTable = {
+    {"DEX; BNE", {0xCA, 0xD0}},
+    {"DEY; BNE", {0x88, 0xD0}},
+    {"INX; CPX #imm; BNE", {0xE8, 0xE0, 0xD0}},
+    {"INY; CPY #imm; BNE", {0xC8, 0xC0, 0xD0}},
+    {"LDA zp; CMP #imm; BEQ", {0xA5, 0xC9, 0xF0}},
+    {"LDA zp; CMP #imm; BNE", {0xA5, 0xC9, 0xD0}},
+    {"LDA abs,X; STA abs,Y", {0xBD, 0x99}},
+};
+
+// First fusedTable entry starting with each opcode plus one, 0 if none
+static std::array<uint8_t, 256> buildFusedFirst() {
+  std::array<uint8_t, 256> table{};
+  for (size_t i = CPU::fusedTable.size(); i > 0; i--) {
+    table[CPU::fusedTable[i - 1].opcodes[0]] = i;
+  }
+  return table;
+}
+
+static const std::array<uint8_t, 256> fusedFirst = buildFusedFirst();
+
+bool CPU::isFused(uint8_t first, uint8_t second) {
+  for (const fusedSequence &sequence : fusedTable) {
+    if (sequence.opcodes[0] == first && sequence.opcodes[1] == second) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Instructions an idle loop can be made of: none of them write memory or
+// touch the stack, and only loads and compares read it
+static std::array<bool, 256> buildIdleOpcodes() {
+  std::array<bool, 256> table{};
+  for (uint8_t opcode : {
+           0xA9, 0xA5, 0xAD, // LDA
+           0xA2, 0xA6, 0xAE, // LDX
+           0xA0, 0xA4, 0xAC, // LDY
+           0x24, 0x2C,       // BIT
+           0xC9, 0xC5, 0xCD, // CMP
+           0xE0, 0xE4, 0xEC, // CPX
+           0xC0, 0xC4, 0xCC, // CPY
+           0x29, 0x25, 0x2D, // AND
+           0x09, 0x05, 0x0D, // ORA
+           0x49, 0x45, 0x4D, // EOR
+           0x10, 0x30, 0x50, 0x70, 0x90, 0xB0, 0xD0, 0xF0, // Branches
+           0x4C,             // JMP absolute
+           0xEA,             // NOP
+       }) {
+    table[opcode] = true;
+  }
+  return table;
+}
+
+static const std::array<bool, 256> idleOpcodes = buildIdleOpcodes();
+
+// Reads that give the same value pass after pass: RAM, PRG RAM and ROM, and
+// PPUSTATUS. Reading PPUSTATUS clears vblank and the write toggle, so every
+// read after the first sees the same flags until the PPU changes them, and
+// loops polling it are only skipped up to PPU::getNextChange.
+static bool isIdleRead(uint16_t address) {
+  return address <= RAM_END || address >= PRG_RAM_START ||
+         (address <= PPU_END && (address & 7) == 2);
+}
+
+CPU::CPU(Bus bus) : bus(std::move(bus)) {
   this->A = 0x00;
   this->X = 0x00;
   this->Y = 0x00;
+  this->P = 0x00;
   this->S = (0x00 | FLAGS::I);
   this->PC = 0x8000;
   this->SP = TOP_OF_STACK;
-  memset(this->memory, 0, sizeof(this->memory));
+  this->cycles = 0;
+  this->profiler = nullptr;
+  this->breakpoints = nullptr;
+  this->skipIdleLoops = true;
+  this->idleLoop = {};
+  this->idleLoopStats = {};
+  this->fuseInstructions = true;
+  this->fusedCounts = {};
+  this->runCompiled = true;
+  this->compiled = findAotProgram(this->bus.getRomHash());
+  this->compiledCycles = 0;
+  this->stoppedOnUnknown = false;
+}
 
-  // Best way I can think of to accomplish this for now
-  for (instruction ins : CPU::opcodeTable) {
-    lookupTable[ins.opcode] = ins;
-  }
+CPU CPU::fork() {
+  CPU child = CPU(this->bus.fork());
+  child.A = this->A;
+  child.X = this->X;
+  child.Y = this->Y;
+  child.S = this->S;
+  child.P = this->P;
+  child.SP = this->SP;
+  child.PC = this->PC;
+  child.cycles = this->cycles;
+  return child;
+}
+
+uint64_t CPU::hashState() const {
+  uint64_t registers = static_cast<uint64_t>(this->PC) |
+                       static_cast<uint64_t>(this->A) << 16 |
+                       static_cast<uint64_t>(this->X) << 24 |
+                       static_cast<uint64_t>(this->Y) << 32 |
+                       static_cast<uint64_t>(this->S) << 40 |
+                       static_cast<uint64_t>(this->P) << 48 |
+                       static_cast<uint64_t>(this->SP) << 56;
+  uint64_t hash = mixHash(registers) ^
+                  mixHash(this->cycles % CYCLES_PER_FRAME + 0x9E3779B97F4A7C15ULL);
+  return this->bus.hashState(hash, this->cycles);
 }
 
 CPU::~CPU() {
@@ -228,25 +343,92 @@ void CPU::setZeroAndNegativeFlags(uint8_t value) {
   }
 }
 
-uint8_t CPU::LDA(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t value = readFromMemory(address);
+template <CPU::ADDRESSING mode> inline uint16_t CPU::operandAddress() {
+  if constexpr (mode == Immediate) {
+    return this->PC;
+  } else if constexpr (mode == ZeroPage) {
+    return static_cast<uint16_t>(fetch(this->PC));
+  } else if constexpr (mode == ZeroPage_X) {
+    return static_cast<uint16_t>(
+        static_cast<uint8_t>(fetch(this->PC) + this->X));
+  } else if constexpr (mode == ZeroPage_Y) {
+    return static_cast<uint16_t>(
+        static_cast<uint8_t>(fetch(this->PC) + this->Y));
+  } else if constexpr (mode == Absolute) {
+    return fetchShort(this->PC);
+  } else if constexpr (mode == Absolute_X) {
+    return static_cast<uint16_t>(fetchShort(this->PC) + this->X);
+  } else if constexpr (mode == Absolute_Y) {
+    return static_cast<uint16_t>(fetchShort(this->PC) + this->Y);
+  } else if constexpr (mode == Indirect_X) {
+    uint8_t base = fetch(this->PC);
+    uint8_t pointer = static_cast<uint8_t>(base + this->X);
+    uint16_t lo = readFromMemory(pointer);
+    uint16_t high = readFromMemory(static_cast<uint8_t>(pointer + 1));
+    return ((high << 8) | lo);
+  } else if constexpr (mode == Indirect_Y) {
+    uint8_t pointer = fetch(this->PC);
+    uint16_t lo = readFromMemory(pointer);
+    uint16_t high = readFromMemory(static_cast<uint8_t>(pointer + 1));
+    return static_cast<uint16_t>(((high << 8) | lo) + this->Y);
+  } else if constexpr (mode == Indirect) {
+    uint16_t pointer = fetchShort(this->PC);
+    uint16_t lo, hi;
+    if ((pointer & 0x00FF) == 0x00FF) {
+      lo = readFromMemory(pointer);
+      hi = readFromMemory(pointer & 0xFF00);
+    } else {
+      lo = readFromMemory(pointer);
+      hi = readFromMemory(pointer + 1);
+    }
+    return ((hi << 8) | lo);
+  } else {
+    return 0xFFFF;
+  }
+}
+
+template <CPU::ADDRESSING mode>
+inline uint8_t CPU::readOperand(uint16_t address) {
+  if constexpr (mode == Immediate) {
+    return fetch(address);
+  } else {
+    return readFromMemory(address);
+  }
+}
+
+template <CPU::ADDRESSING mode, typename F>
+inline void CPU::readModifyWrite(F op) {
+  uint16_t address = operandAddress<mode>();
+  // Watchpoints have to see both accesses
+  uint8_t *target =
+      this->breakpoints == nullptr ? this->bus.resolveRam(address) : nullptr;
+  if (target != nullptr) {
+    *target = op(*target);
+    return;
+  }
+  uint8_t data = readFromMemory(address);
+  writeToMemory(address, op(data));
+}
+
+template <CPU::ADDRESSING mode> uint8_t CPU::LDA() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t value = readOperand<mode>(address);
   this->A = value;
   setZeroAndNegativeFlags(this->A);
   return 0;
 }
 
-uint8_t CPU::LDX(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t value = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::LDX() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t value = readOperand<mode>(address);
   this->X = value;
   setZeroAndNegativeFlags(this->X);
   return 0;
 }
 
-uint8_t CPU::LDY(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t value = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::LDY() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t value = readOperand<mode>(address);
   this->Y = value;
   setZeroAndNegativeFlags(this->Y);
   return 0;
@@ -269,15 +451,15 @@ uint8_t CPU::INX() {
   return 0;
 }
 
-uint8_t CPU::STA(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
+template <CPU::ADDRESSING mode> uint8_t CPU::STA() {
+  uint16_t address = operandAddress<mode>();
   writeToMemory(address, this->A);
   return 0;
 }
 
-uint8_t CPU::ADC(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::ADC() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t data = readOperand<mode>(address);
   uint16_t sum = this->A + data + (this->S & FLAGS::C);
 
   if (sum > 0xFF) {
@@ -303,25 +485,25 @@ uint8_t CPU::ADC(ADDRESSING mode) {
   return 0;
 }
 
-uint8_t CPU::AND(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t operand = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::AND() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t operand = readOperand<mode>(address);
   this->A &= operand;
   setZeroAndNegativeFlags(this->A);
   return 0;
 }
 
-uint8_t CPU::ASL(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t operand = readFromMemory(address);
-  if (operand >> 7) {
-    this->S |= FLAGS::C;
-  } else {
-    this->S &= ~(FLAGS::C);
-  }
-  operand <<= 1;
-  writeToMemory(address, operand);
-  setZeroAndNegativeFlags(operand);
+template <CPU::ADDRESSING mode> uint8_t CPU::ASL() {
+  readModifyWrite<mode>([this](uint8_t operand) {
+    if (operand >> 7) {
+      this->S |= FLAGS::C;
+    } else {
+      this->S &= ~(FLAGS::C);
+    }
+    operand <<= 1;
+    setZeroAndNegativeFlags(operand);
+    return operand;
+  });
   return 0;
 }
 
@@ -338,15 +520,20 @@ uint8_t CPU::ASLAccumulator() {
 
 void CPU::branch(bool condition) {
   if (condition) {
-    int8_t offset = static_cast<int8_t>(readFromMemory(this->PC));
+    int8_t offset = static_cast<int8_t>(fetch(this->PC));
     uint16_t newAddress = this->PC + 1 + static_cast<uint16_t>(offset);
     this->PC = newAddress & 0xFFFF;
   }
 }
 
-uint8_t CPU::BIT(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t operand = readFromMemory(address);
+template <CPU::FLAGS flag, bool set> uint8_t CPU::branchIf() {
+  branch(static_cast<bool>(this->S & flag) == set);
+  return 0;
+}
+
+template <CPU::ADDRESSING mode> uint8_t CPU::BIT() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t operand = readOperand<mode>(address);
   uint8_t result = this->A & operand;
   if (result == 0) {
     this->S |= FLAGS::Z;
@@ -369,9 +556,9 @@ uint8_t CPU::BIT(ADDRESSING mode) {
   return 0;
 }
 
-void CPU::compare(ADDRESSING mode, uint8_t reg) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
+template <CPU::ADDRESSING mode> void CPU::compare(uint8_t reg) {
+  uint16_t address = operandAddress<mode>();
+  uint8_t data = readOperand<mode>(address);
   if (reg >= data) {
     this->S |= FLAGS::C;
   } else {
@@ -380,62 +567,99 @@ void CPU::compare(ADDRESSING mode, uint8_t reg) {
   setZeroAndNegativeFlags(static_cast<uint8_t>(reg - data));
 }
 
-uint8_t CPU::DEC(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::CMP() {
+  compare<mode>(this->A);
+  return 0;
+}
 
-  data -= 1;
-  setZeroAndNegativeFlags(data);
-  writeToMemory(address, data);
+template <CPU::ADDRESSING mode> uint8_t CPU::CPX() {
+  compare<mode>(this->X);
+  return 0;
+}
+
+template <CPU::ADDRESSING mode> uint8_t CPU::CPY() {
+  compare<mode>(this->Y);
+  return 0;
+}
+
+uint8_t CPU::CLC() {
+  this->S &= (~FLAGS::C);
   return 0;
 }
 
-void CPU::DECX() {
+uint8_t CPU::CLD() {
+  this->S &= (~FLAGS::D);
+  return 0;
+}
+
+uint8_t CPU::CLI() {
+  this->S &= (~FLAGS::I);
+  return 0;
+}
+
+uint8_t CPU::CLV() {
+  this->S &= (~FLAGS::V);
+  return 0;
+}
+
+template <CPU::ADDRESSING mode> uint8_t CPU::DEC() {
+  readModifyWrite<mode>([this](uint8_t data) {
+    data -= 1;
+    setZeroAndNegativeFlags(data);
+    return data;
+  });
+  return 0;
+}
+
+uint8_t CPU::DECX() {
   uint8_t data = this->X;
 
   data -= 1;
   setZeroAndNegativeFlags(data);
   this->X = data;
+  return 0;
 }
 
-void CPU::DECY() {
+uint8_t CPU::DECY() {
   uint8_t data = this->Y;
 
   data -= 1;
   setZeroAndNegativeFlags(data);
   this->Y = data;
+  return 0;
 }
 
-uint8_t CPU::EOR(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::EOR() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t data = readOperand<mode>(address);
   this->A ^= data;
   setZeroAndNegativeFlags(this->A);
   return 0;
 }
 
-uint8_t CPU::INC(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
-  data += 1;
-  setZeroAndNegativeFlags(data);
-  writeToMemory(address, data);
+template <CPU::ADDRESSING mode> uint8_t CPU::INC() {
+  readModifyWrite<mode>([this](uint8_t data) {
+    data += 1;
+    setZeroAndNegativeFlags(data);
+    return data;
+  });
   return 0;
 }
 
-void CPU::INCY() {
+uint8_t CPU::INCY() {
   this->Y++;
   setZeroAndNegativeFlags(this->Y);
+  return 0;
 }
 
-uint8_t CPU::JMP(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
+template <CPU::ADDRESSING mode> uint8_t CPU::JMP() {
+  uint16_t address = operandAddress<mode>();
   this->PC = address;
   return 0;
 }
 
-uint8_t CPU::JSR(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
+template <CPU::ADDRESSING mode> uint8_t CPU::JSR() {
+  uint16_t address = operandAddress<mode>();
   uint16_t stackValue = this->PC + 1;
   pushOnStack(static_cast<uint8_t>(stackValue >> 8));
   pushOnStack(static_cast<uint8_t>(stackValue & 0xFF));
@@ -454,28 +678,30 @@ uint8_t CPU::LSRAccumulator() {
   return 0;
 }
 
-uint8_t CPU::LSR(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
-  if (data & 0x1) {
-    this->S |= FLAGS::C;
-  } else {
-    this->S &= ~(FLAGS::C);
-  }
-  data >>= 1;
-  setZeroAndNegativeFlags(data);
-  writeToMemory(address, data);
+template <CPU::ADDRESSING mode> uint8_t CPU::LSR() {
+  readModifyWrite<mode>([this](uint8_t data) {
+    if (data & 0x1) {
+      this->S |= FLAGS::C;
+    } else {
+      this->S &= ~(FLAGS::C);
+    }
+    data >>= 1;
+    setZeroAndNegativeFlags(data);
+    return data;
+  });
   return 0;
 }
 
-uint8_t CPU::ORA(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::ORA() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t data = readOperand<mode>(address);
   this->A |= data;
   setZeroAndNegativeFlags(this->A);
   return 0;
 }
 
+uint8_t CPU::NOP() { return 0; }
+
 uint8_t CPU::PHA() {
   pushOnStack(this->A);
   return 0;
@@ -514,16 +740,16 @@ uint8_t CPU::ROLAccumulator() {
   return 0;
 }
 
-uint8_t CPU::ROL(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
-  // Set Carry flag to 7th bit of the value and move carry bit into bit 0
-  uint8_t c = (this->S & FLAGS::C);
-  this->S |= ((data & (1 << 7)) >> 7);
-  data <<= 1;
-  data |= c;
-  setZeroAndNegativeFlags(data);
-  writeToMemory(address, data);
+template <CPU::ADDRESSING mode> uint8_t CPU::ROL() {
+  readModifyWrite<mode>([this](uint8_t data) {
+    // Set Carry flag to 7th bit of the value and move carry bit into bit 0
+    uint8_t c = (this->S & FLAGS::C);
+    this->S |= ((data & (1 << 7)) >> 7);
+    data <<= 1;
+    data |= c;
+    setZeroAndNegativeFlags(data);
+    return data;
+  });
   return 0;
 }
 
@@ -537,16 +763,16 @@ uint8_t CPU::RORAccumulator() {
   return 0;
 }
 
-uint8_t CPU::ROR(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
-  // Set Carry flag to 7th bit of the value and move carry bit into bit 7
-  uint8_t c = (this->S & FLAGS::C);
-  this->S |= (data & (1 << 0));
-  data >>= 1;
-  data |= (c << 7);
-  setZeroAndNegativeFlags(data);
-  writeToMemory(address, data);
+template <CPU::ADDRESSING mode> uint8_t CPU::ROR() {
+  readModifyWrite<mode>([this](uint8_t data) {
+    // Set Carry flag to 7th bit of the value and move carry bit into bit 7
+    uint8_t c = (this->S & FLAGS::C);
+    this->S |= (data & (1 << 0));
+    data >>= 1;
+    data |= (c << 7);
+    setZeroAndNegativeFlags(data);
+    return data;
+  });
   return 0;
 }
 
@@ -554,7 +780,7 @@ uint8_t CPU::RTI() {
   // TODO VERIFY
   uint8_t status = popFromStack();
   status &= (~FLAGS::B);
-  status |= (~FLAGS::U);
+  status |= FLAGS::U;
   uint16_t lo = popFromStack();
   uint16_t hi = popFromStack();
   this->S = status;
@@ -570,9 +796,9 @@ uint8_t CPU::RTS() {
   return 0;
 }
 
-uint8_t CPU::SBC(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
-  uint8_t data = readFromMemory(address);
+template <CPU::ADDRESSING mode> uint8_t CPU::SBC() {
+  uint16_t address = operandAddress<mode>();
+  uint8_t data = readOperand<mode>(address);
 
   // Calculate the effective carry: 1 if carry flag is set, 0 otherwise
   uint8_t carry = (this->S & FLAGS::C) ? 0 : 1;
@@ -639,14 +865,14 @@ uint8_t CPU::SEI() {
   return 0;
 }
 
-uint8_t CPU::STX(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
+template <CPU::ADDRESSING mode> uint8_t CPU::STX() {
+  uint16_t address = operandAddress<mode>();
   writeToMemory(address, this->X);
   return 0;
 }
 
-uint8_t CPU::STY(ADDRESSING mode) {
-  uint16_t address = getOperandAddress(mode);
+template <CPU::ADDRESSING mode> uint8_t CPU::STY() {
+  uint16_t address = operandAddress<mode>();
   writeToMemory(address, this->Y);
   return 0;
 }
@@ -681,10 +907,16 @@ uint8_t CPU::TYA() {
 }
 
 uint8_t CPU::readFromMemory(uint16_t address) {
+  if (this->breakpoints != nullptr) {
+    this->breakpoints->checkAccess(Breakpoints::READ, address);
+  }
   return this->bus.readFromMemory(address);
 }
 
 void CPU::writeToMemory(uint16_t address, uint8_t data) {
+  if (this->breakpoints != nullptr) {
+    this->breakpoints->checkAccess(Breakpoints::WRITE, address);
+  }
   // std::cout << std::hex << address << "\n";
   // this->memory[address] = data;
   this->bus.writeToMemory(address, data);
@@ -695,10 +927,18 @@ uint16_t CPU::readShortFromMemory(uint16_t address) {
   // uint16_t lo = this->memory[address];
   // uint16_t hi = this->memory[address + 1];
   // return (hi << 8 | lo);
+  if (this->breakpoints != nullptr) {
+    this->breakpoints->checkAccess(Breakpoints::READ, address);
+    this->breakpoints->checkAccess(Breakpoints::READ, address + 1);
+  }
   return this->bus.readShortFromMemory(address);
 }
 
 void CPU::writeShortToMemory(uint16_t address, uint16_t data) {
+  if (this->breakpoints != nullptr) {
+    this->breakpoints->checkAccess(Breakpoints::WRITE, address);
+    this->breakpoints->checkAccess(Breakpoints::WRITE, address + 1);
+  }
   this->bus.writeShortToMemory(address, data);
   // uint8_t lo = data & 0x00FF;
   // uint8_t hi = ((data & 0xFF00) >> 8);
@@ -738,375 +978,509 @@ void CPU::interpretWithCB(const std::function<void(CPU *)> &callback) {
     if (callback != nullptr) {
       callback(this);
     }
-    uint8_t opcode = readFromMemory(this->PC);
-    this->PC++;
-    uint16_t prevProgCounter = this->PC;
-    switch (opcode) {
-    // BRK
-    case 0x00:
-      BRK();
+    if (!step()) {
       return;
-    // LDA
-    case 0xA9:
-    case 0xA5:
-    case 0xB5:
-    case 0xAD:
-    case 0xBD:
-    case 0xB9:
-    case 0xA1:
-    case 0xB1:
-      LDA(lookupTable[opcode].mode);
-      break;
-    // TAX
-    case 0xAA:
-      TAX();
-      break;
-    // INX
-    case 0xE8:
-      INX();
-      break;
-    // STA
-    case 0x85:
-    case 0x95:
-    case 0x8D:
-    case 0x9D:
-    case 0x99:
-    case 0x81:
-    case 0x91:
-      STA(lookupTable[opcode].mode);
-      break;
-    // ADC
-    case 0x69:
-    case 0x65:
-    case 0x75:
-    case 0x6D:
-    case 0x7D:
-    case 0x79:
-    case 0x61:
-    case 0x71:
-      ADC(lookupTable[opcode].mode);
-      break;
-    // AND
-    case 0x29:
-    case 0x25:
-    case 0x35:
-    case 0x2D:
-    case 0x3D:
-    case 0x39:
-    case 0x21:
-    case 0x31:
-      AND(lookupTable[opcode].mode);
-      break;
-    // ASL
-    case 0x0A:
-      ASLAccumulator();
-      break;
-    case 0x06:
-    case 0x16:
-    case 0x0E:
-    case 0x1E:
-      ASL(lookupTable[opcode].mode);
-      break;
-    // BCC
-    case 0x90:
-      branch(!(this->S & FLAGS::C));
-      break;
-    // BCS
-    case 0xB0:
-      branch((this->S & FLAGS::C));
-      break;
-    // BEQ
-    case 0xF0:
-      branch((this->S & FLAGS::Z));
-      break;
-    // BIT
-    case 0x24:
-    case 0x2C:
-      BIT(lookupTable[opcode].mode);
-      break;
-    // BMI
-    case 0x30:
-      branch((this->S & FLAGS::N));
-      break;
-    // BNE
-    case 0xD0:
-      branch(!(this->S & FLAGS::Z));
-      break;
-    // BPL
-    case 0x10:
-      branch(!(this->S & FLAGS::N));
-      break;
-    // BVC
-    case 0x50:
-      branch(!(this->S & FLAGS::V));
-      break;
-    // BVS
-    case 0x70:
-      branch((this->S & FLAGS::V));
-      break;
-    // CLC
-    case 0x18:
-      this->S &= (~FLAGS::C);
-      break;
-    // CLD
-    case 0xD8:
-      this->S &= (~FLAGS::D);
-      break;
-    // CLI
-    case 0x58:
-      this->S &= (~FLAGS::I);
-      break;
-    // CLV
-    case 0xB8:
-      this->S &= (~FLAGS::V);
-      break;
-    // CMP
-    case 0xC9:
-    case 0xC5:
-    case 0xD5:
-    case 0xCD:
-    case 0xDD:
-    case 0xD9:
-    case 0xC1:
-    case 0xD1:
-      compare(lookupTable[opcode].mode, this->A);
-      break;
-    // CPX
-    case 0xE0:
-    case 0xE4:
-    case 0xEC:
-      compare(lookupTable[opcode].mode, this->X);
-      break;
-    // CPY
-    case 0xC0:
-    case 0xC4:
-    case 0xCC:
-      compare(lookupTable[opcode].mode, this->Y);
-      break;
-    // DEC
-    case 0xC6:
-    case 0xD6:
-    case 0xCE:
-    case 0xDE:
-      DEC(lookupTable[opcode].mode);
-      break;
-    // DEX
-    case 0xCA:
-      DECX();
-      break;
-    // DEY
-    case 0x88:
-      DECY();
-      break;
-    // EOR
-    case 0x49:
-    case 0x45:
-    case 0x55:
-    case 0x4D:
-    case 0x5D:
-    case 0x59:
-    case 0x41:
-    case 0x51:
-      EOR(lookupTable[opcode].mode);
-      break;
-    // INC
-    case 0xE6:
-    case 0xF6:
-    case 0xEE:
-    case 0xFE:
-      INC(lookupTable[opcode].mode);
-      break;
-    // INY
-    case 0xC8:
-      INCY();
-      break;
-    // JMP
-    case 0x4C:
-    case 0x6C:
-      JMP(lookupTable[opcode].mode);
-      break;
-    // JSR
-    case 0x20:
-      JSR(lookupTable[opcode].mode);
-      break;
-    // LDX
-    case 0xA2:
-    case 0xA6:
-    case 0xB6:
-    case 0xAE:
-    case 0xBE:
-      LDX(lookupTable[opcode].mode);
-      break;
-    // LSR
-    case 0x4A:
-      LSRAccumulator();
-      break;
-    case 0x46:
-    case 0x56:
-    case 0x4E:
-    case 0x5E:
-      LSR(lookupTable[opcode].mode);
-      break;
-    // NOP
-    case 0xEA:
-      break;
-    // ORA
-    case 0x09:
-    case 0x05:
-    case 0x15:
-    case 0x0D:
-    case 0x1D:
-    case 0x19:
-    case 0x01:
-    case 0x11:
-      ORA(lookupTable[opcode].mode);
-      break;
-    // PHA
-    case 0x48:
-      PHA();
-      break;
-    // PHP
-    case 0x08:
-      PHP();
-      break;
-    // PLA
-    case 0x68:
-      PLA();
-      break;
-    // PLP
-    case 0x28:
-      PLP();
-      break;
-    // ROL
-    case 0x2A:
-      ROLAccumulator();
-      break;
-    case 0x26:
-    case 0x36:
-    case 0x2E:
-    case 0x3E:
-      ROL(lookupTable[opcode].mode);
-      break;
-    // ROR
-    case 0x6A:
-      RORAccumulator();
-      break;
-    case 0x66:
-    case 0x76:
-    case 0x6E:
-    case 0x7E:
-      ROR(lookupTable[opcode].mode);
-      break;
-    // RTI
-    case 0x40:
-      RTI();
-      break;
-    case 0x60:
-      RTS();
-      break;
-    // SBC
-    case 0xE9:
-    case 0xE5:
-    case 0xF5:
-    case 0xED:
-    case 0xFD:
-    case 0xF9:
-    case 0xE1:
-    case 0xF1:
-      SBC(lookupTable[opcode].mode);
-      break;
-    // SEC
-    case 0x38:
-      SEC();
-      break;
-    // SED
-    case 0xF8:
-      SED();
-      break;
-    // SEI
-    case 0x78:
-      SEI();
-      break;
-    // STX
-    case 0x86:
-    case 0x96:
-    case 0x8E:
-      STX(lookupTable[opcode].mode);
-      break;
-    // STY
-    case 0x84:
-    case 0x94:
-    case 0x8C:
-      STY(lookupTable[opcode].mode);
-      break;
-    // TAY
-    case 0xA8:
-      TAY();
-      break;
-    // TSX
-    case 0xBA:
-      TSX();
-      break;
-    // TXA
-    case 0x8A:
-      TXA();
-      break;
-    // TXS
-    case 0x9A:
-      TXS();
-      break;
-    // TYA
-    case 0x98:
-      TYA();
-      break;
     }
-    if (this->PC == prevProgCounter) {
-      this->PC += (lookupTable[opcode].bytes - 1);
+  }
+}
+
+bool CPU::runFrame() {
+  uint64_t frameEnd = (getFrame() + 1) * CYCLES_PER_FRAME;
+  // Memory may have been changed from outside since the last frame
+  this->idleLoop.seen = false;
+  this->stoppedOnUnknown = false;
+  // Only step() logs code, and checking a loop for idle reads its code as
+  // data
+  bool hooked = this->profiler != nullptr || this->breakpoints != nullptr ||
+                this->bus.getCodeDataLogger() != nullptr;
+  bool skipping = this->skipIdleLoops && !hooked;
+  bool fusing = this->fuseInstructions && !hooked;
+  const AotProgram *program =
+      this->runCompiled && !hooked ? this->compiled : nullptr;
+  while (this->cycles < frameEnd) {
+    uint16_t from = this->PC;
+    AotFunction function = program != nullptr && from >= 0x8000
+                               ? program->functions[from - 0x8000]
+                               : nullptr;
+    uint64_t before = this->cycles;
+    if (function != nullptr && function(*this, frameEnd, from)) {
+      // from is the last jump it took if that was the way out
+      this->compiledCycles += this->cycles - before;
+    } else {
+      // Sequences are only fused when no NMI can come in between
+      uint64_t until = std::min(frameEnd, this->bus.getNextEvent());
+      if ((!fusing || !stepFused(until, from)) && !step()) {
+        return false;
+      }
+    }
+    if (skipping && this->PC <= from) {
+      observeLoop(from, frameEnd);
+    }
+  }
+  return true;
+}
+
+// Called after the instruction at `from` jumped back to PC. Nothing but the
+// frame boundary can end an idle loop, so once a loop is known to come round
+// to the same state it is skipped as many whole times as fit before `until`,
+// and the last partial pass is run as usual.
+void CPU::observeLoop(uint16_t from, uint64_t until) {
+  IdleLoop &loop = this->idleLoop;
+  if (!loop.seen || loop.head != this->PC || loop.from != from) {
+    loop.head = this->PC;
+    loop.from = from;
+    loop.idleBody = isIdleLoopBody(this->PC, from, loop.pollsPpu);
+  } else if (loop.idleBody && loop.A == this->A && loop.X == this->X &&
+             loop.Y == this->Y && loop.S == this->S && loop.SP == this->SP) {
+    uint64_t period = this->cycles - loop.cycles;
+    until = std::min(until, loop.pollsPpu
+                                ? this->bus.getNextPpuChange(this->cycles)
+                                : this->bus.getNextEvent());
+    if (this->cycles + period < until) {
+      uint64_t skipped = (until - this->cycles - 1) / period * period;
+      this->cycles += skipped;
+      this->idleLoopStats.loops++;
+      this->idleLoopStats.cycles += skipped;
+    }
+  }
+  loop.seen = true;
+  loop.A = this->A;
+  loop.X = this->X;
+  loop.Y = this->Y;
+  loop.S = this->S;
+  loop.SP = this->SP;
+  loop.cycles = this->cycles;
+}
+
+bool CPU::stepFused(uint64_t until, uint16_t &last) {
+  uint16_t pc = this->PC;
+  uint8_t opcode = this->bus.readFromMemory(pc);
+  if (fusedFirst[opcode] == 0) {
+    return false;
+  }
+  size_t index = fusedFirst[opcode] - 1;
+  while (!isFusable(index, pc, until)) {
+    index++;
+    if (index == fusedTable.size() || fusedTable[index].opcodes[0] != opcode) {
+      return false;
+    }
+  }
+  switch (index) {
+  // DEX; BNE and DEY; BNE
+  case 0:
+  case 1: {
+    uint8_t &reg = index == 0 ? this->X : this->Y;
+    reg--;
+    setZeroAndNegativeFlags(reg);
+    last = pc + 1;
+    this->PC = fusedBranch(last, reg != 0);
+    break;
+  }
+  // INX; CPX #imm; BNE and INY; CPY #imm; BNE, the increment's flags are
+  // overwritten by the compare
+  case 2:
+  case 3: {
+    uint8_t &reg = index == 2 ? this->X : this->Y;
+    reg++;
+    uint8_t data = this->bus.readFromMemory(pc + 2);
+    if (reg >= data) {
+      this->S |= FLAGS::C;
+    } else {
+      this->S &= ~(FLAGS::C);
+    }
+    setZeroAndNegativeFlags(static_cast<uint8_t>(reg - data));
+    last = pc + 3;
+    this->PC = fusedBranch(last, reg != data);
+    break;
+  }
+  // LDA zp; CMP #imm; BEQ and LDA zp; CMP #imm; BNE, the load's flags are
+  // overwritten by the compare
+  case 4:
+  case 5: {
+    this->A = this->bus.readFromMemory(this->bus.readFromMemory(pc + 1));
+    uint8_t data = this->bus.readFromMemory(pc + 3);
+    if (this->A >= data) {
+      this->S |= FLAGS::C;
+    } else {
+      this->S &= ~(FLAGS::C);
+    }
+    setZeroAndNegativeFlags(static_cast<uint8_t>(this->A - data));
+    last = pc + 4;
+    this->PC = fusedBranch(last, (this->A == data) == (index == 4));
+    break;
+  }
+  // LDA abs,X; STA abs,Y
+  case 6: {
+    uint16_t from = this->bus.readShortFromMemory(pc + 1) + this->X;
+    // Each access on the last cycle of its instruction, as in step()
+    this->bus.setClock(this->cycles + 3);
+    this->A = this->bus.readFromMemory(from);
+    setZeroAndNegativeFlags(this->A);
+    uint16_t to = this->bus.readShortFromMemory(pc + 4) + this->Y;
+    this->bus.setClock(this->cycles + 8);
+    this->bus.writeToMemory(to, this->A);
+    last = pc + 3;
+    this->PC = pc + 6;
+    break;
+  }
+  }
+  for (uint8_t op : fusedTable[index].opcodes) {
+    this->cycles += lookupTable[op].cycles;
+  }
+  this->fusedCounts[index]++;
+  return true;
+}
+
+// The opcodes after the first match, and step() by step the frame wouldn't
+// end before the last instruction
+bool CPU::isFusable(size_t index, uint16_t pc, uint64_t until) {
+  const std::vector<uint8_t> &opcodes = fusedTable[index].opcodes;
+  uint64_t cycles = this->cycles;
+  for (size_t i = 1; i < opcodes.size(); i++) {
+    pc += lookupTable[opcodes[i - 1]].bytes;
+    cycles += lookupTable[opcodes[i - 1]].cycles;
+    if (cycles >= until || this->bus.readFromMemory(pc) != opcodes[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Where a branch at address leaves PC, as step() and branch() do
+uint16_t CPU::fusedBranch(uint16_t address, bool condition) {
+  uint16_t next = address + 2;
+  if (condition) {
+    int8_t offset = static_cast<int8_t>(this->bus.readFromMemory(address + 1));
+    uint16_t target = next + static_cast<uint16_t>(offset);
+    // step() takes a branch to its own operand as not taken
+    if (target != address + 1) {
+      next = target;
+    }
+  }
+  return next;
+}
+
+bool CPU::isIdleLoopBody(uint16_t head, uint16_t from, bool &pollsPpu) {
+  pollsPpu = false;
+  // Only code in RAM or on the cartridge, and the jump back at most a few
+  // instructions from the head
+  bool inRam = from <= RAM_END;
+  if (from - head >= IDLE_LOOP_MAX_BYTES || (!inRam && head < PRG_RAM_START)) {
+    return false;
+  }
+  uint32_t pc = head;
+  while (pc <= from) {
+    uint8_t opcode = this->bus.readFromMemory(pc);
+    const instruction &ins = lookupTable[opcode];
+    if (!idleOpcodes[opcode]) {
+      return false;
+    }
+    // Zero page reads are always RAM
+    if (opcode != 0x4C && ins.mode == Absolute) {
+      uint16_t address = this->bus.readShortFromMemory(pc + 1);
+      if (!isIdleRead(address)) {
+        return false;
+      }
+      pollsPpu = pollsPpu || (address >= PPU_START && address <= PPU_END);
+    }
+    if (pc == from) {
+      return true;
     }
+    pc += ins.bytes;
+  }
+  // The jump back isn't on an instruction boundary of the body
+  return false;
+}
+
+// One handler per opcode, each templated handler instantiated for the
+// addressing mode the opcode uses
+static std::array<CPU::handler, 256> buildDispatchTable() {
+  std::array<CPU::handler, 256> table;
+  // Unknown opcodes never get here, step() stops on them
+  table.fill(&CPU::NOP);
+  // BRK
+  table[0x00] = &CPU::BRK;
+  // TAX
+  table[0xAA] = &CPU::TAX;
+  // INX
+  table[0xE8] = &CPU::INX;
+  // BCC
+  table[0x90] = &CPU::branchIf<CPU::C, false>;
+  // BCS
+  table[0xB0] = &CPU::branchIf<CPU::C, true>;
+  // BEQ
+  table[0xF0] = &CPU::branchIf<CPU::Z, true>;
+  // BMI
+  table[0x30] = &CPU::branchIf<CPU::N, true>;
+  // BNE
+  table[0xD0] = &CPU::branchIf<CPU::Z, false>;
+  // BPL
+  table[0x10] = &CPU::branchIf<CPU::N, false>;
+  // BVC
+  table[0x50] = &CPU::branchIf<CPU::V, false>;
+  // BVS
+  table[0x70] = &CPU::branchIf<CPU::V, true>;
+  // CLC
+  table[0x18] = &CPU::CLC;
+  // CLD
+  table[0xD8] = &CPU::CLD;
+  // CLI
+  table[0x58] = &CPU::CLI;
+  // CLV
+  table[0xB8] = &CPU::CLV;
+  // BIT
+  table[0x24] = &CPU::BIT<CPU::ZeroPage>;
+  table[0x2C] = &CPU::BIT<CPU::Absolute>;
+  // ADC
+  table[0x69] = &CPU::ADC<CPU::Immediate>;
+  table[0x65] = &CPU::ADC<CPU::ZeroPage>;
+  table[0x75] = &CPU::ADC<CPU::ZeroPage_X>;
+  table[0x6D] = &CPU::ADC<CPU::Absolute>;
+  table[0x7D] = &CPU::ADC<CPU::Absolute_X>;
+  table[0x79] = &CPU::ADC<CPU::Absolute_Y>;
+  table[0x61] = &CPU::ADC<CPU::Indirect_X>;
+  table[0x71] = &CPU::ADC<CPU::Indirect_Y>;
+  // AND
+  table[0x29] = &CPU::AND<CPU::Immediate>;
+  table[0x25] = &CPU::AND<CPU::ZeroPage>;
+  table[0x35] = &CPU::AND<CPU::ZeroPage_X>;
+  table[0x2D] = &CPU::AND<CPU::Absolute>;
+  table[0x3D] = &CPU::AND<CPU::Absolute_X>;
+  table[0x39] = &CPU::AND<CPU::Absolute_Y>;
+  table[0x21] = &CPU::AND<CPU::Indirect_X>;
+  table[0x31] = &CPU::AND<CPU::Indirect_Y>;
+  // CMP
+  table[0xC9] = &CPU::CMP<CPU::Immediate>;
+  table[0xC5] = &CPU::CMP<CPU::ZeroPage>;
+  table[0xD5] = &CPU::CMP<CPU::ZeroPage_X>;
+  table[0xCD] = &CPU::CMP<CPU::Absolute>;
+  table[0xDD] = &CPU::CMP<CPU::Absolute_X>;
+  table[0xD9] = &CPU::CMP<CPU::Absolute_Y>;
+  table[0xC1] = &CPU::CMP<CPU::Indirect_X>;
+  table[0xD1] = &CPU::CMP<CPU::Indirect_Y>;
+  // CPX
+  table[0xE0] = &CPU::CPX<CPU::Immediate>;
+  table[0xE4] = &CPU::CPX<CPU::ZeroPage>;
+  table[0xEC] = &CPU::CPX<CPU::Absolute>;
+  // CPY
+  table[0xC0] = &CPU::CPY<CPU::Immediate>;
+  table[0xC4] = &CPU::CPY<CPU::ZeroPage>;
+  table[0xCC] = &CPU::CPY<CPU::Absolute>;
+  // DEC
+  table[0xC6] = &CPU::DEC<CPU::ZeroPage>;
+  table[0xD6] = &CPU::DEC<CPU::ZeroPage_X>;
+  table[0xCE] = &CPU::DEC<CPU::Absolute>;
+  table[0xDE] = &CPU::DEC<CPU::Absolute_X>;
+  // DEX
+  table[0xCA] = &CPU::DECX;
+  // DEY
+  table[0x88] = &CPU::DECY;
+  // EOR
+  table[0x49] = &CPU::EOR<CPU::Immediate>;
+  table[0x45] = &CPU::EOR<CPU::ZeroPage>;
+  table[0x55] = &CPU::EOR<CPU::ZeroPage_X>;
+  table[0x4D] = &CPU::EOR<CPU::Absolute>;
+  table[0x5D] = &CPU::EOR<CPU::Absolute_X>;
+  table[0x59] = &CPU::EOR<CPU::Absolute_Y>;
+  table[0x41] = &CPU::EOR<CPU::Indirect_X>;
+  table[0x51] = &CPU::EOR<CPU::Indirect_Y>;
+  // INC
+  table[0xE6] = &CPU::INC<CPU::ZeroPage>;
+  table[0xF6] = &CPU::INC<CPU::ZeroPage_X>;
+  table[0xEE] = &CPU::INC<CPU::Absolute>;
+  table[0xFE] = &CPU::INC<CPU::Absolute_X>;
+  // INY
+  table[0xC8] = &CPU::INCY;
+  // JMP
+  table[0x4C] = &CPU::JMP<CPU::Absolute>;
+  table[0x6C] = &CPU::JMP<CPU::Indirect>;
+  // JSR
+  table[0x20] = &CPU::JSR<CPU::Absolute>;
+  // LDA
+  table[0xA9] = &CPU::LDA<CPU::Immediate>;
+  table[0xA5] = &CPU::LDA<CPU::ZeroPage>;
+  table[0xB5] = &CPU::LDA<CPU::ZeroPage_X>;
+  table[0xAD] = &CPU::LDA<CPU::Absolute>;
+  table[0xBD] = &CPU::LDA<CPU::Absolute_X>;
+  table[0xB9] = &CPU::LDA<CPU::Absolute_Y>;
+  table[0xA1] = &CPU::LDA<CPU::Indirect_X>;
+  table[0xB1] = &CPU::LDA<CPU::Indirect_Y>;
+  // LDX
+  table[0xA2] = &CPU::LDX<CPU::Immediate>;
+  table[0xA6] = &CPU::LDX<CPU::ZeroPage>;
+  table[0xB6] = &CPU::LDX<CPU::ZeroPage_Y>;
+  table[0xAE] = &CPU::LDX<CPU::Absolute>;
+  table[0xBE] = &CPU::LDX<CPU::Absolute_Y>;
+  // LDY
+  table[0xA0] = &CPU::LDY<CPU::Immediate>;
+  table[0xA4] = &CPU::LDY<CPU::ZeroPage>;
+  table[0xB4] = &CPU::LDY<CPU::ZeroPage_X>;
+  table[0xAC] = &CPU::LDY<CPU::Absolute>;
+  table[0xBC] = &CPU::LDY<CPU::Absolute_X>;
+  // LSR
+  table[0x4A] = &CPU::LSRAccumulator;
+  table[0x46] = &CPU::LSR<CPU::ZeroPage>;
+  table[0x56] = &CPU::LSR<CPU::ZeroPage_X>;
+  table[0x4E] = &CPU::LSR<CPU::Absolute>;
+  table[0x5E] = &CPU::LSR<CPU::Absolute_X>;
+  // NOP
+  table[0xEA] = &CPU::NOP;
+  // ORA
+  table[0x09] = &CPU::ORA<CPU::Immediate>;
+  table[0x05] = &CPU::ORA<CPU::ZeroPage>;
+  table[0x15] = &CPU::ORA<CPU::ZeroPage_X>;
+  table[0x0D] = &CPU::ORA<CPU::Absolute>;
+  table[0x1D] = &CPU::ORA<CPU::Absolute_X>;
+  table[0x19] = &CPU::ORA<CPU::Absolute_Y>;
+  table[0x01] = &CPU::ORA<CPU::Indirect_X>;
+  table[0x11] = &CPU::ORA<CPU::Indirect_Y>;
+  // PHA
+  table[0x48] = &CPU::PHA;
+  // PHP
+  table[0x08] = &CPU::PHP;
+  // PLA
+  table[0x68] = &CPU::PLA;
+  // PLP
+  table[0x28] = &CPU::PLP;
+  // ROL
+  table[0x2A] = &CPU::ROLAccumulator;
+  table[0x26] = &CPU::ROL<CPU::ZeroPage>;
+  table[0x36] = &CPU::ROL<CPU::ZeroPage_X>;
+  table[0x2E] = &CPU::ROL<CPU::Absolute>;
+  table[0x3E] = &CPU::ROL<CPU::Absolute_X>;
+  // ROR
+  table[0x6A] = &CPU::RORAccumulator;
+  table[0x66] = &CPU::ROR<CPU::ZeroPage>;
+  table[0x76] = &CPU::ROR<CPU::ZeroPage_X>;
+  table[0x6E] = &CPU::ROR<CPU::Absolute>;
+  table[0x7E] = &CPU::ROR<CPU::Absolute_X>;
+  // SBC
+  table[0xE9] = &CPU::SBC<CPU::Immediate>;
+  table[0xE5] = &CPU::SBC<CPU::ZeroPage>;
+  table[0xF5] = &CPU::SBC<CPU::ZeroPage_X>;
+  table[0xED] = &CPU::SBC<CPU::Absolute>;
+  table[0xFD] = &CPU::SBC<CPU::Absolute_X>;
+  table[0xF9] = &CPU::SBC<CPU::Absolute_Y>;
+  table[0xE1] = &CPU::SBC<CPU::Indirect_X>;
+  table[0xF1] = &CPU::SBC<CPU::Indirect_Y>;
+  // RTI
+  table[0x40] = &CPU::RTI;
+  // RTS
+  table[0x60] = &CPU::RTS;
+  // SEC
+  table[0x38] = &CPU::SEC;
+  // SED
+  table[0xF8] = &CPU::SED;
+  // SEI
+  table[0x78] = &CPU::SEI;
+  // STX
+  table[0x86] = &CPU::STX<CPU::ZeroPage>;
+  table[0x96] = &CPU::STX<CPU::ZeroPage_Y>;
+  table[0x8E] = &CPU::STX<CPU::Absolute>;
+  // STY
+  table[0x84] = &CPU::STY<CPU::ZeroPage>;
+  table[0x94] = &CPU::STY<CPU::ZeroPage_X>;
+  table[0x8C] = &CPU::STY<CPU::Absolute>;
+  // TAY
+  table[0xA8] = &CPU::TAY;
+  // TSX
+  table[0xBA] = &CPU::TSX;
+  // TXA
+  table[0x8A] = &CPU::TXA;
+  // TXS
+  table[0x9A] = &CPU::TXS;
+  // TYA
+  table[0x98] = &CPU::TYA;
+  // ASL
+  table[0x0A] = &CPU::ASLAccumulator;
+  table[0x06] = &CPU::ASL<CPU::ZeroPage>;
+  table[0x16] = &CPU::ASL<CPU::ZeroPage_X>;
+  table[0x0E] = &CPU::ASL<CPU::Absolute>;
+  table[0x1E] = &CPU::ASL<CPU::Absolute_X>;
+  // STA
+  table[0x85] = &CPU::STA<CPU::ZeroPage>;
+  table[0x95] = &CPU::STA<CPU::ZeroPage_X>;
+  table[0x8D] = &CPU::STA<CPU::Absolute>;
+  table[0x9D] = &CPU::STA<CPU::Absolute_X>;
+  table[0x99] = &CPU::STA<CPU::Absolute_Y>;
+  table[0x81] = &CPU::STA<CPU::Indirect_X>;
+  table[0x91] = &CPU::STA<CPU::Indirect_Y>;
+  return table;
+}
+
+const std::array<CPU::handler, 256> CPU::dispatchTable = buildDispatchTable();
+
+bool CPU::step() {
+  if (this->cycles >= this->bus.getNextEvent()) {
+    serviceEvents();
+  }
+  if (this->breakpoints != nullptr &&
+      this->breakpoints->checkExecute(this->PC)) {
+    return false;
+  }
+  uint16_t opcodeAddress = this->PC;
+  CodeDataLogger *logger = this->bus.getCodeDataLogger();
+  if (logger != nullptr) {
+    this->bus.setFetchAddress(opcodeAddress);
+  }
+  uint8_t opcode = fetch(this->PC);
+  const instruction &ins = lookupTable[opcode];
+  if (ins.bytes == 0) {
+    // Unofficial opcodes aren't implemented, stop on them instead of spinning
+    // in place without advancing the cycle counter
+    std::cout << "Unknown opcode " << static_cast<int>(opcode) << " at "
+              << opcodeAddress << "\n";
+    this->stoppedOnUnknown = true;
+    return false;
   }
+  if (logger != nullptr) {
+    logger->logCode(opcodeAddress, ins.bytes);
+  }
+  this->PC++;
+  uint16_t prevProgCounter = this->PC;
+  // Loads and stores happen on the last cycle of most instructions
+  this->bus.setClock(this->cycles + ins.cycles - 1);
+  (this->*dispatchTable[opcode])();
+  // BRK stops execution
+  bool running = opcode != 0x00;
+  if (this->PC == prevProgCounter) {
+    this->PC += (ins.bytes - 1);
+  }
+  // JMP indirect
+  if (logger != nullptr && opcode == 0x6C) {
+    logger->logIndirectCode(this->PC);
+  }
+  this->cycles += ins.cycles;
+  if (this->profiler != nullptr) {
+    this->profiler->record(opcodeAddress, opcode, ins.cycles, this->PC,
+                           this->SP);
+  }
+  if (this->breakpoints != nullptr && this->breakpoints->hasHit()) {
+    running = false;
+  }
+  return running;
 }
 
 uint16_t CPU::getAbsoluteAddress(ADDRESSING mode, uint16_t address) {
   switch (mode) {
   case ZeroPage:
-    return static_cast<uint16_t>(readFromMemory(this->PC));
+    return operandAddress<ZeroPage>();
   case ZeroPage_X:
-    return static_cast<uint16_t>(
-        static_cast<uint8_t>(readFromMemory(this->PC) + this->X));
+    return operandAddress<ZeroPage_X>();
   case ZeroPage_Y:
-    return static_cast<uint16_t>(
-        static_cast<uint8_t>(readFromMemory(this->PC) + this->Y));
+    return operandAddress<ZeroPage_Y>();
   case Absolute:
-    return readShortFromMemory(this->PC);
+    return operandAddress<Absolute>();
   case Absolute_X:
-    return static_cast<uint16_t>(readShortFromMemory(this->PC) + this->X);
+    return operandAddress<Absolute_X>();
   case Absolute_Y:
-    return static_cast<uint16_t>(readShortFromMemory(this->PC) + this->Y);
-  case Indirect_X: {
-    uint8_t base = readFromMemory(this->PC);
-    uint8_t pointer = static_cast<uint8_t>(base + this->X);
-    uint16_t lo = readFromMemory(pointer);
-    uint16_t high = readFromMemory(static_cast<uint8_t>(pointer + 1));
-    return ((high << 8) | lo);
-  }
-  case Indirect_Y: {
-    uint8_t pointer = readFromMemory(this->PC);
-    uint16_t lo = readFromMemory(pointer);
-    uint16_t high = readFromMemory(static_cast<uint8_t>(pointer + 1));
-    return static_cast<uint16_t>(((high << 8) | lo) + this->Y);
-  }
-  case Indirect: {
-    uint16_t pointer = readShortFromMemory(this->PC);
-    uint16_t lo, hi;
-    if ((pointer & 0x00FF) == 0x00FF) {
-      lo = readFromMemory(pointer);
-      hi = readFromMemory(pointer & 0xFF00);
-    } else {
-      lo = readFromMemory(pointer);
-      hi = readFromMemory(pointer + 1);
-    }
-    return ((hi << 8) | lo);
-  }
+    return operandAddress<Absolute_Y>();
+  case Indirect_X:
+    return operandAddress<Indirect_X>();
+  case Indirect_Y:
+    return operandAddress<Indirect_Y>();
+  case Indirect:
+    return operandAddress<Indirect>();
   case NoneAddressing:
     // std::cout << "Error: Addressing mode not found" << "\n";
     return 0xFFFF;
@@ -1125,6 +1499,40 @@ uint16_t CPU::getOperandAddress(ADDRESSING mode) {
   }
 }
 
+void CPU::saveState(SaveState &state) const {
+  state.magic = SAVE_STATE_MAGIC;
+  state.version = SAVE_STATE_VERSION;
+  state.size = sizeof(SaveState);
+  state.romHash = this->bus.getRomHash();
+  state.cpu.cycles = this->cycles;
+  state.cpu.PC = this->PC;
+  state.cpu.A = this->A;
+  state.cpu.X = this->X;
+  state.cpu.Y = this->Y;
+  state.cpu.S = this->S;
+  state.cpu.P = this->P;
+  state.cpu.SP = this->SP;
+  this->bus.saveState(state.bus, this->cycles);
+}
+
+bool CPU::loadState(const SaveState &state) {
+  if (state.magic != SAVE_STATE_MAGIC || state.version != SAVE_STATE_VERSION ||
+      state.size != sizeof(SaveState) ||
+      state.romHash != this->bus.getRomHash()) {
+    return false;
+  }
+  this->cycles = state.cpu.cycles;
+  this->PC = state.cpu.PC;
+  this->A = state.cpu.A;
+  this->X = state.cpu.X;
+  this->Y = state.cpu.Y;
+  this->S = state.cpu.S;
+  this->P = state.cpu.P;
+  this->SP = state.cpu.SP;
+  this->bus.loadState(state.bus);
+  return true;
+}
+
 void CPU::reset() {
   this->PC = readShortFromMemory(0xFFFC);
   this->SP = 0xFD;
@@ -1133,4 +1541,28 @@ void CPU::reset() {
   this->S |= FLAGS::B;
   this->A = 0;
   this->X = 0;
+  // The reset sequence takes 7 cycles before the first instruction
+  this->cycles = 7;
+  this->bus.resetPpu();
+}
+
+void CPU::nmi() {
+  uint16_t from = this->PC;
+  uint8_t sp = this->SP;
+  pushOnStack(this->PC >> 8);
+  pushOnStack(this->PC & 0xFF);
+  pushOnStack((this->S & ~FLAGS::B) | FLAGS::U);
+  this->S |= FLAGS::I;
+  this->PC = readShortFromMemory(0xFFFA);
+  this->cycles += 7;
+  if (this->profiler != nullptr) {
+    this->profiler->enterInterrupt(from, this->PC, sp);
+  }
+}
+
+void CPU::serviceEvents() {
+  this->cycles += this->bus.takeDmaStall();
+  if (this->bus.takeNmi(this->cycles)) {
+    nmi();
+  }
 }
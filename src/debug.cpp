@@ -1,5 +1,7 @@
 #include "cpu.hpp"
+#include "disassembler.hpp"
 #include <algorithm>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -15,12 +17,137 @@ bool all_equal(const T &t, const U &u, Others const &...args) {
   return (t == u) || all_equal(t, args...);
 }
 
-std::string traceCpuState(CPU *cpu) {
+// Reads for the trace itself, which is shown before the instruction runs and
+// mustn't change what it will read
+static uint8_t traceRead(CPU *cpu, uint16_t address) {
+  return cpu->getBus().peek(address);
+}
+
+// Where the instruction at `pc` will access memory, from its operand bytes
+static uint16_t traceOperandAddress(CPU *cpu, CPU::ADDRESSING mode,
+                                    uint16_t pc) {
+  uint8_t lo = traceRead(cpu, pc + 1);
+  switch (mode) {
+  case CPU::ADDRESSING::ZeroPage:
+    return lo;
+  case CPU::ADDRESSING::ZeroPage_X:
+    return static_cast<uint8_t>(lo + cpu->X);
+  case CPU::ADDRESSING::ZeroPage_Y:
+    return static_cast<uint8_t>(lo + cpu->Y);
+  case CPU::ADDRESSING::Indirect_X: {
+    uint8_t pointer = lo + cpu->X;
+    return traceRead(cpu, pointer) |
+           traceRead(cpu, static_cast<uint8_t>(pointer + 1)) << 8;
+  }
+  case CPU::ADDRESSING::Indirect_Y:
+    return static_cast<uint16_t>(
+        (traceRead(cpu, lo) | traceRead(cpu, static_cast<uint8_t>(lo + 1))
+                                  << 8) +
+        cpu->Y);
+  default:
+    break;
+  }
+  uint16_t absolute = lo | traceRead(cpu, pc + 2) << 8;
+  switch (mode) {
+  case CPU::ADDRESSING::Absolute:
+    return absolute;
+  case CPU::ADDRESSING::Absolute_X:
+    return absolute + cpu->X;
+  case CPU::ADDRESSING::Absolute_Y:
+    return absolute + cpu->Y;
+  case CPU::ADDRESSING::Indirect:
+    // The pointer's high byte doesn't carry into the next page
+    return traceRead(cpu, absolute) |
+           traceRead(cpu, (absolute & 0xFF00) | ((absolute + 1) & 0x00FF))
+               << 8;
+  default:
+    return 0;
+  }
+}
+
+// Code in ROM: the text comes from the disassembler's cache, only the values
+// the instruction will see and the registers are filled in
+static std::string traceDecoded(CPU *cpu, uint16_t programCounter,
+                                const DecodedInstruction *decoded,
+                                const char *text, CPU::ADDRESSING mode,
+                                uint16_t operandAddress, uint8_t operandValue) {
+  char hexDump[12];
+  switch (decoded->bytes) {
+  case 1:
+    std::snprintf(hexDump, sizeof(hexDump), "%02X", decoded->opcode);
+    break;
+  case 2:
+    std::snprintf(hexDump, sizeof(hexDump), "%02X %02X", decoded->opcode,
+                  decoded->operand & 0xFF);
+    break;
+  default:
+    std::snprintf(hexDump, sizeof(hexDump), "%02X %02X %02X", decoded->opcode,
+                  decoded->operand & 0xFF, decoded->operand >> 8);
+    break;
+  }
+  char values[32] = "";
+  switch (mode) {
+  case CPU::ADDRESSING::ZeroPage:
+    std::snprintf(values, sizeof(values), " = %02X", operandValue);
+    break;
+  case CPU::ADDRESSING::Absolute:
+    if (decoded->opcode != 0x4C) {
+      std::snprintf(values, sizeof(values), " = %02X", operandValue);
+    }
+    break;
+  case CPU::ADDRESSING::ZeroPage_X:
+  case CPU::ADDRESSING::ZeroPage_Y:
+    std::snprintf(values, sizeof(values), " @ %02X = %02X", operandAddress,
+                  operandValue);
+    break;
+  case CPU::ADDRESSING::Absolute_X:
+  case CPU::ADDRESSING::Absolute_Y:
+    std::snprintf(values, sizeof(values), " @ %04X = %02X", operandAddress,
+                  operandValue);
+    break;
+  case CPU::ADDRESSING::Indirect_X:
+    std::snprintf(values, sizeof(values), " = %02X @ %04X = %02X",
+                  static_cast<uint8_t>(decoded->operand + cpu->X),
+                  operandAddress, operandValue);
+    break;
+  case CPU::ADDRESSING::Indirect_Y:
+    std::snprintf(values, sizeof(values), " = %04X @ %04X = %02X",
+                  static_cast<uint16_t>(operandAddress - cpu->Y),
+                  operandAddress, operandValue);
+    break;
+  case CPU::ADDRESSING::Indirect:
+    std::snprintf(values, sizeof(values), " = %04X", operandAddress);
+    break;
+  default:
+    // Implied and accumulator instructions have an empty operand column
+    if (decoded->bytes == 1) {
+      values[0] = ' ';
+      values[1] = '\0';
+    }
+    break;
+  }
+  char line[112];
+  std::snprintf(line, sizeof(line),
+                "%4X  %8s     %s%s A:%02X X:%02X Y:%02X P:%02X SP:%02X",
+                programCounter, hexDump, text, values, cpu->A, cpu->X, cpu->Y,
+                cpu->S, cpu->SP);
+  return line;
+}
+
+std::string traceCpuState(CPU *cpu, Disassembler *disassembler) {
   // The format of the output string should be PC/CPU OPCODE/OPCODE IN ASS/IF
   // INDIRECT +X OR +Y/REST OF REGISTERS/CPU PPU CLOCK CYCLES
-  uint8_t opcode = cpu->readFromMemory(cpu->PC);
   uint16_t programCounter = cpu->PC;
-  CPU::instruction instruction = cpu->lookupTable[opcode];
+  // Code in ROM comes pre-decoded and pre-formatted from the disassembler,
+  // anything else (RAM, or no disassembler) is read off the bus
+  const DecodedInstruction *decoded =
+      disassembler != nullptr ? disassembler->lookup(programCounter) : nullptr;
+  if (decoded != nullptr && (decoded->flags & DecodedInstruction::UNKNOWN)) {
+    decoded = nullptr;
+  }
+  uint8_t opcode =
+      decoded != nullptr ? decoded->opcode : traceRead(cpu, programCounter);
+  const CPU::instruction &instruction = cpu->lookupTable[opcode];
   std::string assemblyName = instruction.name;
   uint8_t sizeOfInstruction = instruction.bytes;
   std::vector<uint8_t> hexDump;
@@ -35,8 +162,13 @@ std::string traceCpuState(CPU *cpu) {
     operandValue = 0;
   } else {
     operandAddress =
-        cpu->getAbsoluteAddress(instruction.mode, programCounter + 1);
-    operandValue = cpu->readFromMemory(operandAddress);
+        traceOperandAddress(cpu, instruction.mode, programCounter);
+    operandValue = traceRead(cpu, operandAddress);
+  }
+  if (decoded != nullptr) {
+    return traceDecoded(cpu, programCounter, decoded,
+                        disassembler->format(programCounter), instruction.mode,
+                        operandAddress, operandValue);
   }
 
   std::string tempString;
@@ -51,7 +183,7 @@ std::string traceCpuState(CPU *cpu) {
     break;
   }
   case 2: {
-    uint8_t address = cpu->readFromMemory(programCounter + 1);
+    uint8_t address = traceRead(cpu, programCounter + 1);
     hexDump.push_back(address);
     switch (instruction.mode) {
     case CPU::ADDRESSING::Immediate: {
@@ -113,29 +245,19 @@ std::string traceCpuState(CPU *cpu) {
     break;
   }
   case 3: {
-    uint16_t lo = cpu->readFromMemory(programCounter + 1);
-    uint16_t hi = cpu->readFromMemory(programCounter + 2);
-    hexDump.push_back(lo);
-    hexDump.push_back(hi);
-    uint16_t address = cpu->readShortFromMemory(programCounter + 1);
+    uint16_t address = traceRead(cpu, programCounter + 1) |
+                       traceRead(cpu, programCounter + 2) << 8;
+    hexDump.push_back(address & 0xFF);
+    hexDump.push_back(address >> 8);
     switch (instruction.mode) {
     case CPU::ADDRESSING::Indirect:
     case CPU::ADDRESSING::NoneAddressing: {
-      uint16_t jumpAddress;
+      char temp[20];
       if (instruction.opcode == 0x6C) {
-        if ((address & 0x00FF) == 0x00FF) {
-          uint16_t lo = cpu->readFromMemory(address);
-          uint16_t hi = cpu->readFromMemory(address * 0xFF00);
-          jumpAddress = (hi << 8) | lo;
-        } else {
-          jumpAddress = cpu->readShortFromMemory(address);
-        }
-        char temp[20];
-        std::sprintf(temp, "($%04x) = %04x", address, jumpAddress);
-        tempString = temp;
+        std::sprintf(temp, "($%04x) = %04x", address, operandAddress);
+      } else {
+        std::sprintf(temp, "$%04x", address);
       }
-      char temp[10];
-      std::sprintf(temp, "$%04x", address);
       tempString = temp;
       break;
     }
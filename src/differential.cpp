@@ -0,0 +1,182 @@
+#include "differential.hpp"
+#include <algorithm>
+#include <cstdio>
+
+CpuBackend::CpuBackend(std::vector<uint8_t> rom) : cpu(Bus(std::move(rom))) {
+  this->cpu.reset();
+}
+
+DifferentialExecutor::DifferentialExecutor(ExecutionBackend &reference,
+                                           ExecutionBackend &candidate)
+    : reference(reference), candidate(candidate) {}
+
+static void describe(std::string &report, const char *what,
+                     const std::string &referenceName, uint64_t expected,
+                     const std::string &candidateName, uint64_t actual,
+                     int digits) {
+  char line[128];
+  snprintf(line, sizeof(line), "%s: %s $%0*llX, %s $%0*llX\n", what,
+           referenceName.c_str(), digits,
+           static_cast<unsigned long long>(expected), candidateName.c_str(),
+           digits, static_cast<unsigned long long>(actual));
+  report += line;
+}
+
+std::string DifferentialExecutor::diffStates(const SaveState &reference,
+                                             const SaveState &candidate,
+                                             const std::string &referenceName,
+                                             const std::string &candidateName) {
+  std::string report;
+  auto field = [&](const char *what, uint64_t expected, uint64_t actual,
+                   int digits) {
+    if (expected != actual) {
+      describe(report, what, referenceName, expected, candidateName, actual,
+               digits);
+    }
+  };
+  const CpuState &expected = reference.cpu;
+  const CpuState &actual = candidate.cpu;
+  field("cycles", expected.cycles, actual.cycles, 1);
+  field("PC", expected.PC, actual.PC, 4);
+  field("A", expected.A, actual.A, 2);
+  field("X", expected.X, actual.X, 2);
+  field("Y", expected.Y, actual.Y, 2);
+  field("S", expected.S, actual.S, 2);
+  field("P", expected.P, actual.P, 2);
+  field("SP", expected.SP, actual.SP, 2);
+  for (int port = 0; port < 2; port++) {
+    std::string name = "controller " + std::to_string(port + 1);
+    field((name + " buttons").c_str(), reference.bus.controllerState[port],
+          candidate.bus.controllerState[port], 2);
+    field((name + " shift").c_str(), reference.bus.controllerShift[port],
+          candidate.bus.controllerShift[port], 2);
+  }
+  field("strobe", reference.bus.controllerStrobe,
+        candidate.bus.controllerStrobe, 1);
+  field("DMA stall", reference.bus.dmaStall, candidate.bus.dmaStall, 1);
+  // Each memory lists its first differing bytes and counts the rest
+  auto memory = [&](const char *name, const uint8_t *want, const uint8_t *got,
+                    size_t size, size_t start) {
+    size_t differing = 0;
+    for (size_t offset = 0; offset < size; offset++) {
+      if (want[offset] != got[offset] &&
+          differing++ < DIFFERENTIAL_RAM_REPORT_LIMIT) {
+        char what[32];
+        snprintf(what, sizeof(what), "%s $%04zX", name, start + offset);
+        describe(report, what, referenceName, want[offset], candidateName,
+                 got[offset], 2);
+      }
+    }
+    if (differing > DIFFERENTIAL_RAM_REPORT_LIMIT) {
+      report += "and " +
+                std::to_string(differing - DIFFERENTIAL_RAM_REPORT_LIMIT) +
+                " more " + name + " bytes\n";
+    }
+  };
+  memory("RAM", reference.bus.cpuVram, candidate.bus.cpuVram,
+         sizeof(reference.bus.cpuVram), 0);
+  field("PRG RAM used", reference.bus.prgRamUsed, candidate.bus.prgRamUsed,
+        1);
+  memory("PRG RAM", reference.bus.prgRam, candidate.bus.prgRam,
+         sizeof(reference.bus.prgRam), PRG_RAM_START);
+
+  const PpuState &expectedPpu = reference.bus.ppu;
+  const PpuState &actualPpu = candidate.bus.ppu;
+  field("PPU frame", expectedPpu.frame, actualPpu.frame, 1);
+  field("PPU dot", expectedPpu.dot, actualPpu.dot, 1);
+  field("sprite 0 dot", expectedPpu.sprite0Dot, actualPpu.sprite0Dot, 1);
+  field("PPU v", expectedPpu.v, actualPpu.v, 4);
+  field("PPU t", expectedPpu.t, actualPpu.t, 4);
+  field("PPUCTRL", expectedPpu.ctrl, actualPpu.ctrl, 2);
+  field("PPUMASK", expectedPpu.mask, actualPpu.mask, 2);
+  field("PPUSTATUS", expectedPpu.status, actualPpu.status, 2);
+  field("OAMADDR", expectedPpu.oamAddress, actualPpu.oamAddress, 2);
+  field("fine X", expectedPpu.fineX, actualPpu.fineX, 1);
+  field("write toggle", expectedPpu.writeToggle, actualPpu.writeToggle, 1);
+  field("read buffer", expectedPpu.readBuffer, actualPpu.readBuffer, 2);
+  field("PPU latch", expectedPpu.latch, actualPpu.latch, 2);
+  field("NMI pending", expectedPpu.nmiPending, actualPpu.nmiPending, 1);
+  memory("VRAM", expectedPpu.vram, actualPpu.vram, sizeof(expectedPpu.vram),
+         0x2000);
+  memory("palette", expectedPpu.palette, actualPpu.palette,
+         sizeof(expectedPpu.palette), 0x3F00);
+  memory("OAM", expectedPpu.oam, actualPpu.oam, sizeof(expectedPpu.oam), 0);
+  memory("CHR RAM", expectedPpu.chrRam, actualPpu.chrRam,
+         sizeof(expectedPpu.chrRam), 0);
+  return report;
+}
+
+void DifferentialExecutor::diverge(DifferentialResult &result,
+                                   const std::string &why) {
+  result.diverged = true;
+  this->reference.saveState(result.reference);
+  this->candidate.saveState(result.candidate);
+  result.report = why + "\n" +
+                  diffStates(result.reference, result.candidate,
+                             this->reference.getName(),
+                             this->candidate.getName());
+}
+
+DifferentialResult DifferentialExecutor::run(const Movie *movie,
+                                             size_t frames) {
+  DifferentialResult result = {};
+  if (movie != nullptr) {
+    if (movie->getRomHash() != this->reference.getRomHash() ||
+        movie->getRomHash() != this->candidate.getRomHash()) {
+      result.report = "The movie was recorded on another ROM\n";
+      return result;
+    }
+    if (movie->hasStartState() &&
+        (!this->reference.loadState(movie->getStartState()) ||
+         !this->candidate.loadState(movie->getStartState()))) {
+      result.report = "The movie's start state does not load\n";
+      return result;
+    }
+    frames = std::min(frames, movie->getFrameCount());
+  }
+  result.started = true;
+  this->reference.saveState(result.lastMatch);
+  // Cheap checks first, the full diff only runs once they fail
+  auto matches = [this]() {
+    return this->reference.getCycles() == this->candidate.getCycles() &&
+           this->reference.hashState() == this->candidate.hashState();
+  };
+  if (!matches()) {
+    diverge(result, "Differs before the first frame");
+    return result;
+  }
+  for (size_t frame = 0; frame < frames; frame++) {
+    if (movie != nullptr) {
+      for (uint8_t port = 0; port < MOVIE_PORTS; port++) {
+        uint8_t buttons = movie->getInput(frame, port);
+        this->reference.setControllerState(port, buttons);
+        this->candidate.setControllerState(port, buttons);
+      }
+    }
+    bool referenceRunning = this->reference.runFrame();
+    bool candidateRunning = this->candidate.runFrame();
+    std::string where = "frame " + std::to_string(frame) + ": ";
+    if (referenceRunning != candidateRunning) {
+      diverge(result, where + "only " +
+                          (referenceRunning ? this->candidate.getName()
+                                            : this->reference.getName()) +
+                          " stopped");
+      return result;
+    }
+    if (!matches()) {
+      diverge(result, where + "states differ");
+      if (result.report.find('\n') == result.report.size() - 1) {
+        // Saved states are equal, so a hash covers something they don't
+        result.report += "state hashes differ but the saved states match\n";
+      }
+      return result;
+    }
+    result.frames++;
+    this->reference.saveState(result.lastMatch);
+    if (!referenceRunning) {
+      result.stopped = true;
+      break;
+    }
+  }
+  return result;
+}
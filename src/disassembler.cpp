@@ -0,0 +1,214 @@
+#include "disassembler.hpp"
+#include <cstdio>
+
+#define NO_TEXT 0xFFFFFFFF
+
+Disassembler::Disassembler(std::shared_ptr<const Rom> rom) : rom(rom) {
+  size_t bankCount = this->rom->progRom.size() / PRG_BANK_SIZE;
+  this->banks.resize(bankCount);
+  for (Bank &bank : this->banks) {
+    bank.entries.resize(PRG_BANK_SIZE, DecodedInstruction{NO_TEXT, 0, 0, 0, 0});
+  }
+  // NROM layout, a 16KB ROM is mirrored into both slots
+  this->slots[0] = 0;
+  this->slots[1] = bankCount > 0 ? bankCount - 1 : 0;
+
+  for (const CPU::instruction *&ins : this->opcodes) {
+    ins = nullptr;
+  }
+  for (const CPU::instruction &ins : CPU::opcodeTable) {
+    this->opcodes[ins.opcode] = &ins;
+  }
+}
+
+void Disassembler::setBank(uint8_t slot, uint16_t bank) {
+  if (slot < PRG_SLOT_COUNT && bank < this->banks.size()) {
+    this->slots[slot] = bank;
+  }
+}
+
+uint8_t Disassembler::readPrgRom(uint16_t address) const {
+  if (address < 0x8000 || this->banks.empty()) {
+    return 0;
+  }
+  uint16_t bank = this->slots[(address - 0x8000) / PRG_BANK_SIZE];
+  return this->rom->progRom[bank * PRG_BANK_SIZE + (address % PRG_BANK_SIZE)];
+}
+
+DecodedInstruction *Disassembler::entryFor(uint16_t address) {
+  if (address < 0x8000 || this->banks.empty()) {
+    return nullptr;
+  }
+  Bank &bank = this->banks[this->slots[(address - 0x8000) / PRG_BANK_SIZE]];
+  return &bank.entries[address % PRG_BANK_SIZE];
+}
+
+DecodedInstruction *Disassembler::decode(uint16_t address) {
+  DecodedInstruction *entry = entryFor(address);
+  if (entry == nullptr || (entry->flags & DecodedInstruction::DECODED)) {
+    return entry;
+  }
+  entry->opcode = readPrgRom(address);
+  entry->flags |= DecodedInstruction::DECODED;
+  const CPU::instruction *ins = this->opcodes[entry->opcode];
+  if (ins == nullptr) {
+    entry->flags |= DecodedInstruction::UNKNOWN;
+    entry->bytes = 1;
+    return entry;
+  }
+  entry->bytes = ins->bytes;
+  // Operands that run off the end of the address space read as zero
+  if (entry->bytes >= 2) {
+    entry->operand = readPrgRom(static_cast<uint16_t>(address + 1));
+  }
+  if (entry->bytes == 3) {
+    entry->operand |= readPrgRom(static_cast<uint16_t>(address + 2)) << 8;
+  }
+  return entry;
+}
+
+void Disassembler::analyze() {
+  std::vector<uint16_t> pending;
+  for (uint16_t vector : {NMI_VECTOR, RESET_VECTOR, IRQ_VECTOR}) {
+    uint16_t target = readPrgRom(vector) | (readPrgRom(vector + 1) << 8);
+    DecodedInstruction *entry = decode(target);
+    if (entry != nullptr) {
+      entry->flags |= DecodedInstruction::ENTRY_POINT;
+      pending.push_back(target);
+    }
+  }
+
+  while (!pending.empty()) {
+    uint16_t address = pending.back();
+    pending.pop_back();
+    // Walk straight line code until something ends the flow
+    for (;;) {
+      DecodedInstruction *entry = decode(address);
+      if (entry == nullptr || (entry->flags & DecodedInstruction::REACHABLE)) {
+        break;
+      }
+      entry->flags |= DecodedInstruction::REACHABLE;
+      if (entry->flags & DecodedInstruction::UNKNOWN) {
+        break;
+      }
+      uint16_t next = address + entry->bytes;
+      uint16_t target = 0;
+      uint8_t targetFlag = 0;
+      bool fallsThrough = true;
+      bool hasTarget = false;
+      switch (entry->opcode) {
+      // BRK, RTI, RTS and JMP indirect leave to somewhere we can't see
+      case 0x00:
+      case 0x40:
+      case 0x60:
+      case 0x6C:
+        fallsThrough = false;
+        break;
+      // JMP
+      case 0x4C:
+        target = entry->operand;
+        targetFlag = DecodedInstruction::JUMP_TARGET;
+        hasTarget = true;
+        fallsThrough = false;
+        break;
+      // JSR
+      case 0x20:
+        target = entry->operand;
+        targetFlag = DecodedInstruction::ENTRY_POINT;
+        hasTarget = true;
+        break;
+      default:
+        // All of the branches are encoded as xxx10000
+        if ((entry->opcode & 0x1F) == 0x10) {
+          target = next + static_cast<int8_t>(entry->operand);
+          targetFlag = DecodedInstruction::JUMP_TARGET;
+          hasTarget = true;
+        }
+        break;
+      }
+      if (hasTarget) {
+        DecodedInstruction *targetEntry = decode(target);
+        if (targetEntry != nullptr) {
+          targetEntry->flags |= targetFlag;
+          pending.push_back(target);
+        }
+      }
+      if (!fallsThrough || next < address) {
+        break;
+      }
+      address = next;
+    }
+  }
+}
+
+const DecodedInstruction *Disassembler::lookup(uint16_t address) {
+  return decode(address);
+}
+
+const char *Disassembler::format(uint16_t address) {
+  DecodedInstruction *entry = decode(address);
+  if (entry == nullptr) {
+    return nullptr;
+  }
+  Bank &bank = this->banks[this->slots[(address - 0x8000) / PRG_BANK_SIZE]];
+  if (entry->text != NO_TEXT) {
+    return bank.text.data() + entry->text;
+  }
+
+  char temp[24];
+  const CPU::instruction *ins = this->opcodes[entry->opcode];
+  if (ins == nullptr) {
+    std::snprintf(temp, sizeof(temp), ".db $%02X", entry->opcode);
+  } else {
+    const char *name = ins->name.c_str();
+    uint16_t operand = entry->operand;
+    switch (ins->mode) {
+    case CPU::ADDRESSING::Immediate:
+      std::snprintf(temp, sizeof(temp), "%s #$%02X", name, operand);
+      break;
+    case CPU::ADDRESSING::ZeroPage:
+      std::snprintf(temp, sizeof(temp), "%s $%02X", name, operand);
+      break;
+    case CPU::ADDRESSING::ZeroPage_X:
+      std::snprintf(temp, sizeof(temp), "%s $%02X,X", name, operand);
+      break;
+    case CPU::ADDRESSING::ZeroPage_Y:
+      std::snprintf(temp, sizeof(temp), "%s $%02X,Y", name, operand);
+      break;
+    case CPU::ADDRESSING::Absolute:
+      std::snprintf(temp, sizeof(temp), "%s $%04X", name, operand);
+      break;
+    case CPU::ADDRESSING::Absolute_X:
+      std::snprintf(temp, sizeof(temp), "%s $%04X,X", name, operand);
+      break;
+    case CPU::ADDRESSING::Absolute_Y:
+      std::snprintf(temp, sizeof(temp), "%s $%04X,Y", name, operand);
+      break;
+    case CPU::ADDRESSING::Indirect_X:
+      std::snprintf(temp, sizeof(temp), "%s ($%02X,X)", name, operand);
+      break;
+    case CPU::ADDRESSING::Indirect_Y:
+      std::snprintf(temp, sizeof(temp), "%s ($%02X),Y", name, operand);
+      break;
+    case CPU::ADDRESSING::Indirect:
+      std::snprintf(temp, sizeof(temp), "%s ($%04X)", name, operand);
+      break;
+    case CPU::ADDRESSING::NoneAddressing:
+      if (entry->bytes == 2) {
+        // Relative branch, show where it lands
+        uint16_t target = address + 2 + static_cast<int8_t>(operand);
+        std::snprintf(temp, sizeof(temp), "%s $%04X", name, target);
+      } else if (entry->opcode == 0x0A || entry->opcode == 0x4A ||
+                 entry->opcode == 0x2A || entry->opcode == 0x6A) {
+        std::snprintf(temp, sizeof(temp), "%s A", name);
+      } else {
+        std::snprintf(temp, sizeof(temp), "%s", name);
+      }
+      break;
+    }
+  }
+  entry->text = bank.text.size();
+  bank.text.append(temp);
+  bank.text.push_back('\0');
+  return bank.text.data() + entry->text;
+}
@@ -0,0 +1,317 @@
+#include "envserver.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Bigger requests are treated as a corrupt stream
+#define MAX_ENTRIES (1 << 20)
+
+static_assert(sizeof(EnvObservation) % 8 == 0,
+              "Observations must stay 8 byte aligned in shared memory");
+
+static bool readFully(int fd, void *data, size_t size) {
+  uint8_t *bytes = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    ssize_t count = read(fd, bytes, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    bytes += count;
+    size -= count;
+  }
+  return true;
+}
+
+static bool writeFully(int fd, const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    // A client going away must not kill the server with SIGPIPE
+    ssize_t count = send(fd, bytes, size, MSG_NOSIGNAL);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    bytes += count;
+    size -= count;
+  }
+  return true;
+}
+
+static bool makeAddress(const std::string &path, sockaddr_un &address) {
+  address = {};
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cout << "Env server: socket path too long " << path << "\n";
+    return false;
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+  return true;
+}
+
+EnvServer::EnvServer(std::vector<uint8_t> rom, uint32_t instances)
+    : powerOn(Bus(std::move(rom))), listenFd(-1), shared(nullptr),
+      sharedSize(0) {
+  this->powerOn.reset();
+  this->instances.assign(instances, this->powerOn);
+}
+
+EnvServer::~EnvServer() {
+  if (this->listenFd >= 0) {
+    close(this->listenFd);
+    unlink(this->socketPath.c_str());
+  }
+  if (this->shared != nullptr) {
+    munmap(this->shared, this->sharedSize);
+    shm_unlink(this->sharedName.c_str());
+  }
+}
+
+bool EnvServer::open(const std::string &socketPath,
+                     const std::string &sharedName) {
+  EnvHello hello;
+  if (sharedName.size() >= sizeof(hello.sharedName) || sharedName[0] != '/') {
+    std::cout << "Env server: shared memory name must start with / and be "
+                 "shorter than "
+              << sizeof(hello.sharedName) << " characters\n";
+    return false;
+  }
+  uint32_t count = this->instances.size();
+  this->sharedSize = envObservationOffset(count, ENV_SLOTS, 0);
+  int sharedFd = shm_open(sharedName.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if (sharedFd < 0) {
+    std::cout << "Env server: could not create shared memory " << sharedName
+              << "\n";
+    return false;
+  }
+  this->sharedName = sharedName;
+  void *mapped = MAP_FAILED;
+  if (ftruncate(sharedFd, this->sharedSize) == 0) {
+    mapped = mmap(nullptr, this->sharedSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, sharedFd, 0);
+  }
+  close(sharedFd);
+  if (mapped == MAP_FAILED) {
+    std::cout << "Env server: could not map shared memory\n";
+    shm_unlink(sharedName.c_str());
+    return false;
+  }
+  this->shared = static_cast<uint8_t *>(mapped);
+  EnvSharedHeader header = {ENV_MAGIC, ENV_VERSION, count, ENV_SLOTS};
+  memcpy(this->shared, &header, sizeof(header));
+  // Nothing written yet, a zero sequence would look like the first batch
+  for (uint32_t slot = 0; slot < ENV_SLOTS; slot++) {
+    for (uint32_t instance = 0; instance < count; instance++) {
+      getObservation(slot, instance).sequence = UINT32_MAX;
+    }
+  }
+
+  sockaddr_un address;
+  if (!makeAddress(socketPath, address)) {
+    return false;
+  }
+  this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (this->listenFd < 0) {
+    std::cout << "Env server: could not create socket\n";
+    return false;
+  }
+  unlink(socketPath.c_str());
+  if (bind(this->listenFd, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      listen(this->listenFd, 1) < 0) {
+    std::cout << "Env server: could not listen on " << socketPath << "\n";
+    close(this->listenFd);
+    this->listenFd = -1;
+    return false;
+  }
+  this->socketPath = socketPath;
+  return true;
+}
+
+EnvObservation &EnvServer::getObservation(uint32_t slot, uint32_t instance) {
+  return *reinterpret_cast<EnvObservation *>(
+      this->shared +
+      envObservationOffset(this->instances.size(), slot, instance));
+}
+
+int32_t EnvServer::step(uint32_t sequence,
+                        const std::vector<EnvStepEntry> &entries) {
+  for (const EnvStepEntry &entry : entries) {
+    if (entry.instance >= this->instances.size()) {
+      return -1;
+    }
+  }
+  uint32_t slot = sequence % ENV_SLOTS;
+  for (const EnvStepEntry &entry : entries) {
+    CPU &cpu = this->instances[entry.instance];
+    if (entry.flags & ENV_RESET) {
+      cpu = this->powerOn;
+    }
+    cpu.getBus().setControllerState(0, entry.buttons[0]);
+    cpu.getBus().setControllerState(1, entry.buttons[1]);
+    bool running = true;
+    for (uint32_t frame = 0; frame < entry.frames && running; frame++) {
+      running = cpu.runFrame();
+    }
+    EnvObservation &observation = getObservation(slot, entry.instance);
+    observation.sequence = sequence;
+    observation.stopped = !running;
+    observation.frame = cpu.getFrame();
+    observation.stateHash = cpu.hashState();
+    memcpy(observation.ram, cpu.getBus().getRam(), sizeof(observation.ram));
+    const uint8_t *picture = cpu.getBus().getFramebuffer(cpu.cycles);
+    if (picture != nullptr) {
+      memcpy(observation.picture, picture, sizeof(observation.picture));
+    } else {
+      memset(observation.picture, 0, sizeof(observation.picture));
+    }
+  }
+  return entries.size();
+}
+
+bool EnvServer::serve() {
+  bool closing = false;
+  while (!closing) {
+    int clientFd = accept(this->listenFd, nullptr, nullptr);
+    if (clientFd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cout << "Env server: accept failed\n";
+      return false;
+    }
+    serveClient(clientFd, closing);
+    close(clientFd);
+  }
+  return true;
+}
+
+bool EnvServer::serveClient(int clientFd, bool &closing) {
+  EnvHello hello = {};
+  hello.magic = ENV_MAGIC;
+  hello.version = ENV_VERSION;
+  hello.instanceCount = this->instances.size();
+  hello.slotCount = ENV_SLOTS;
+  hello.sharedSize = this->sharedSize;
+  strcpy(hello.sharedName, this->sharedName.c_str());
+  if (!writeFully(clientFd, &hello, sizeof(hello))) {
+    return false;
+  }
+  std::vector<EnvStepEntry> entries;
+  for (;;) {
+    EnvRequest request;
+    if (!readFully(clientFd, &request, sizeof(request))) {
+      return false;
+    }
+    if (request.magic != ENV_MAGIC || request.count > MAX_ENTRIES) {
+      std::cout << "Env server: bad request, dropping client\n";
+      return false;
+    }
+    EnvReply reply = {ENV_MAGIC, request.sequence, request.sequence % ENV_SLOTS,
+                      -1};
+    if (request.type == ENV_CLOSE) {
+      closing = true;
+      reply.status = 0;
+      writeFully(clientFd, &reply, sizeof(reply));
+      return false;
+    }
+    entries.resize(request.count);
+    if (!readFully(clientFd, entries.data(),
+                   entries.size() * sizeof(EnvStepEntry))) {
+      return false;
+    }
+    if (request.type == ENV_STEP) {
+      reply.status = step(request.sequence, entries);
+    }
+    if (!writeFully(clientFd, &reply, sizeof(reply))) {
+      return false;
+    }
+  }
+}
+
+EnvClient::EnvClient() : fd(-1), hello(), shared(nullptr) {}
+
+EnvClient::~EnvClient() {
+  if (this->shared != nullptr) {
+    munmap(const_cast<uint8_t *>(this->shared), this->hello.sharedSize);
+  }
+  if (this->fd >= 0) {
+    close(this->fd);
+  }
+}
+
+bool EnvClient::connect(const std::string &socketPath) {
+  sockaddr_un address;
+  if (!makeAddress(socketPath, address)) {
+    return false;
+  }
+  this->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (this->fd < 0 ||
+      ::connect(this->fd, reinterpret_cast<sockaddr *>(&address),
+                sizeof(address)) < 0) {
+    std::cout << "Env client: could not connect to " << socketPath << "\n";
+    return false;
+  }
+  if (!readFully(this->fd, &this->hello, sizeof(this->hello)) ||
+      this->hello.magic != ENV_MAGIC || this->hello.version != ENV_VERSION) {
+    std::cout << "Env client: bad hello from " << socketPath << "\n";
+    return false;
+  }
+  this->hello.sharedName[sizeof(this->hello.sharedName) - 1] = 0;
+  int sharedFd = shm_open(this->hello.sharedName, O_RDONLY, 0);
+  if (sharedFd < 0) {
+    std::cout << "Env client: could not open " << this->hello.sharedName
+              << "\n";
+    return false;
+  }
+  void *mapped = mmap(nullptr, this->hello.sharedSize, PROT_READ, MAP_SHARED,
+                      sharedFd, 0);
+  close(sharedFd);
+  if (mapped == MAP_FAILED) {
+    std::cout << "Env client: could not map shared memory\n";
+    return false;
+  }
+  this->shared = static_cast<const uint8_t *>(mapped);
+  return true;
+}
+
+bool EnvClient::sendStep(uint32_t sequence,
+                         const std::vector<EnvStepEntry> &entries) {
+  EnvRequest request = {ENV_MAGIC, ENV_STEP, sequence,
+                        static_cast<uint32_t>(entries.size())};
+  // One write per request, header and entries together
+  const uint8_t *header = reinterpret_cast<const uint8_t *>(&request);
+  const uint8_t *body = reinterpret_cast<const uint8_t *>(entries.data());
+  std::vector<uint8_t> message;
+  message.reserve(sizeof(request) + entries.size() * sizeof(EnvStepEntry));
+  message.insert(message.end(), header, header + sizeof(request));
+  message.insert(message.end(), body,
+                 body + entries.size() * sizeof(EnvStepEntry));
+  return writeFully(this->fd, message.data(), message.size());
+}
+
+bool EnvClient::sendClose() {
+  EnvRequest request = {ENV_MAGIC, ENV_CLOSE, 0, 0};
+  return writeFully(this->fd, &request, sizeof(request));
+}
+
+bool EnvClient::receive(EnvReply &reply) {
+  return readFully(this->fd, &reply, sizeof(reply)) &&
+         reply.magic == ENV_MAGIC;
+}
+
+const EnvObservation &EnvClient::getObservation(uint32_t slot,
+                                                uint32_t instance) const {
+  return *reinterpret_cast<const EnvObservation *>(
+      this->shared +
+      envObservationOffset(this->hello.instanceCount, slot, instance));
+}
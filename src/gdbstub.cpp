@@ -0,0 +1,427 @@
+#include "gdbstub.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Instructions executed between checks for a ^C from the debugger
+#define RUN_SLICE 4096
+#define REGISTER_COUNT 6
+// Largest packet we take, advertised in qSupported. Memory requests are
+// bounded by it so a client can't make us loop or allocate without limit.
+#define PACKET_SIZE 0x4000
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static void appendHex(std::string &out, uint8_t value) {
+  out.push_back(HEX_DIGITS[value >> 4]);
+  out.push_back(HEX_DIGITS[value & 0xF]);
+}
+
+static uint8_t parseHexByte(const char *text) {
+  char temp[3] = {text[0], text[1], 0};
+  return static_cast<uint8_t>(strtoul(temp, nullptr, 16));
+}
+
+GdbStub::GdbStub(CPU &cpu, Breakpoints &breakpoints)
+    : cpu(cpu), breakpoints(breakpoints), listenFd(-1), clientFd(-1) {}
+
+GdbStub::~GdbStub() {
+  if (this->clientFd >= 0) {
+    close(this->clientFd);
+  }
+  if (this->listenFd >= 0) {
+    close(this->listenFd);
+  }
+  if (!this->unixPath.empty()) {
+    unlink(this->unixPath.c_str());
+  }
+}
+
+bool GdbStub::listenTcp(uint16_t port) {
+  this->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (this->listenFd < 0) {
+    std::cout << "GDB stub: could not create socket\n";
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(this->listenFd, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      listen(this->listenFd, 1) < 0) {
+    std::cout << "GDB stub: could not listen on port " << port << "\n";
+    return false;
+  }
+  std::cout << "GDB stub: listening on 127.0.0.1:" << port << "\n";
+  return true;
+}
+
+bool GdbStub::listenUnix(const std::string &path) {
+  sockaddr_un address = {};
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cout << "GDB stub: socket path too long " << path << "\n";
+    return false;
+  }
+  this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (this->listenFd < 0) {
+    std::cout << "GDB stub: could not create socket\n";
+    return false;
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+  unlink(path.c_str());
+  if (bind(this->listenFd, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      listen(this->listenFd, 1) < 0) {
+    std::cout << "GDB stub: could not listen on " << path << "\n";
+    return false;
+  }
+  this->unixPath = path;
+  std::cout << "GDB stub: listening on " << path << "\n";
+  return true;
+}
+
+void GdbStub::serve() {
+  int fd = accept(this->listenFd, nullptr, nullptr);
+  if (fd < 0) {
+    std::cout << "GDB stub: accept failed\n";
+    return;
+  }
+  serveClient(fd);
+}
+
+void GdbStub::serveClient(int fd) {
+  this->clientFd = fd;
+  // Packets are tiny and latency bound, this fails harmlessly on Unix sockets
+  int noDelay = 1;
+  setsockopt(this->clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay,
+             sizeof(noDelay));
+  Breakpoints *previous = this->cpu.breakpoints;
+  this->cpu.breakpoints = &this->breakpoints;
+
+  bool done = false;
+  std::string packet;
+  while (!done && readPacket(packet)) {
+    // Kill has no reply
+    if (!packet.empty() && packet[0] == 'k') {
+      break;
+    }
+    if (!sendPacket(handle(packet, done))) {
+      break;
+    }
+  }
+  close(this->clientFd);
+  this->clientFd = -1;
+  // Unhooked, the CPU goes back to its fast paths
+  this->cpu.breakpoints = previous;
+}
+
+bool GdbStub::fillBuffer(bool block) {
+  char temp[4096];
+  ssize_t count =
+      recv(this->clientFd, temp, sizeof(temp), block ? 0 : MSG_DONTWAIT);
+  if (count < 0) {
+    return !block && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+  if (count == 0) {
+    return false;
+  }
+  this->received.append(temp, count);
+  return true;
+}
+
+bool GdbStub::readPacket(std::string &packet) {
+  for (;;) {
+    size_t start = this->received.find('$');
+    if (start == std::string::npos) {
+      // Acks and stray ^C while stopped carry no information
+      this->received.clear();
+    } else {
+      size_t end = this->received.find('#', start);
+      if (end != std::string::npos && this->received.size() >= end + 3) {
+        packet = this->received.substr(start + 1, end - start - 1);
+        uint8_t checksum = parseHexByte(&this->received[end + 1]);
+        this->received.erase(0, end + 3);
+        uint8_t sum = 0;
+        for (char c : packet) {
+          sum += static_cast<uint8_t>(c);
+        }
+        if (sum != checksum) {
+          send(this->clientFd, "-", 1, MSG_NOSIGNAL);
+          continue;
+        }
+        send(this->clientFd, "+", 1, MSG_NOSIGNAL);
+        return true;
+      }
+    }
+    if (!fillBuffer(true)) {
+      return false;
+    }
+  }
+}
+
+bool GdbStub::sendPacket(const std::string &payload) {
+  uint8_t sum = 0;
+  for (char c : payload) {
+    sum += static_cast<uint8_t>(c);
+  }
+  std::string framed = "$" + payload + "#";
+  appendHex(framed, sum);
+  size_t sent = 0;
+  while (sent < framed.size()) {
+    ssize_t count = send(this->clientFd, framed.data() + sent,
+                         framed.size() - sent, MSG_NOSIGNAL);
+    if (count <= 0) {
+      return false;
+    }
+    sent += count;
+  }
+  return true;
+}
+
+bool GdbStub::pollInterrupt() {
+  if (!fillBuffer(false)) {
+    // The debugger went away, stop and let serve() notice
+    return true;
+  }
+  size_t position = this->received.find('\x03');
+  if (position == std::string::npos) {
+    return false;
+  }
+  this->received.erase(position, 1);
+  return true;
+}
+
+// Looking at I/O registers mustn't change them, and debugger reads never
+// reach the watchpoints
+uint8_t GdbStub::peek(uint16_t address) {
+  return this->cpu.getBus().peek(address);
+}
+
+// Writes to I/O registers are real writes, the PPU and controllers see them.
+// Debugger accesses must not trip the watchpoints.
+void GdbStub::poke(uint16_t address, uint8_t data) {
+  this->cpu.breakpoints = nullptr;
+  this->cpu.writeToMemory(address, data);
+  this->cpu.breakpoints = &this->breakpoints;
+}
+
+std::string GdbStub::readRegisters() {
+  std::string out;
+  appendHex(out, this->cpu.A);
+  appendHex(out, this->cpu.X);
+  appendHex(out, this->cpu.Y);
+  appendHex(out, this->cpu.S);
+  appendHex(out, this->cpu.SP);
+  appendHex(out, this->cpu.PC & 0xFF);
+  appendHex(out, this->cpu.PC >> 8);
+  return out;
+}
+
+std::string GdbStub::stopReply(bool stopped) {
+  if (!stopped || !this->breakpoints.hasHit()) {
+    return "S05";
+  }
+  Breakpoints::Hit hit = this->breakpoints.getHit();
+  if (hit.kind == Breakpoints::EXECUTE) {
+    return "S05";
+  }
+  const char *kind = hit.kind == Breakpoints::READ ? "rwatch" : "watch";
+  if (this->breakpoints.has(Breakpoints::READ, hit.address) &&
+      this->breakpoints.has(Breakpoints::WRITE, hit.address)) {
+    kind = "awatch";
+  }
+  char temp[32];
+  std::snprintf(temp, sizeof(temp), "T05%s:%04x;", kind, hit.address);
+  return temp;
+}
+
+std::string GdbStub::run(bool singleStep) {
+  this->breakpoints.clearHit();
+  this->breakpoints.resumeFrom(this->cpu.PC);
+  for (uint32_t executed = 1;; executed++) {
+    if (!this->cpu.step()) {
+      return stopReply(true);
+    }
+    if (singleStep) {
+      return stopReply(false);
+    }
+    if (executed % RUN_SLICE == 0 && pollInterrupt()) {
+      // SIGINT
+      return "S02";
+    }
+  }
+}
+
+std::string GdbStub::changeBreakpoint(const std::string &packet, bool insert) {
+  unsigned int type, address, length;
+  if (std::sscanf(packet.c_str() + 1, "%u,%x,%x", &type, &address, &length) !=
+      3) {
+    return "E01";
+  }
+  bool read = type == 3 || type == 4;
+  bool write = type == 2 || type == 4;
+  if (type > 4) {
+    return "";
+  }
+  // Past that the range wraps around onto itself
+  if (length > 0x10000) {
+    return "E01";
+  }
+  // Breakpoints cover the opcode byte, watchpoints every byte of the range
+  if (type <= 1) {
+    length = 1;
+  }
+  for (uint32_t i = 0; i < length; i++) {
+    uint16_t target = static_cast<uint16_t>(address + i);
+    for (Breakpoints::KIND kind :
+         {Breakpoints::EXECUTE, Breakpoints::READ, Breakpoints::WRITE}) {
+      bool wanted = (kind == Breakpoints::EXECUTE && type <= 1) ||
+                    (kind == Breakpoints::READ && read) ||
+                    (kind == Breakpoints::WRITE && write);
+      if (!wanted) {
+        continue;
+      }
+      if (insert) {
+        this->breakpoints.add(kind, target);
+      } else {
+        this->breakpoints.remove(kind, target);
+      }
+    }
+  }
+  return "OK";
+}
+
+std::string GdbStub::handle(const std::string &packet, bool &done) {
+  if (packet.empty()) {
+    return "";
+  }
+  switch (packet[0]) {
+  case '?':
+    return "S05";
+  case 'g':
+    return readRegisters();
+  case 'G': {
+    if (packet.size() < 1 + REGISTER_COUNT * 2 + 2) {
+      return "E01";
+    }
+    const char *data = packet.c_str() + 1;
+    this->cpu.A = parseHexByte(data);
+    this->cpu.X = parseHexByte(data + 2);
+    this->cpu.Y = parseHexByte(data + 4);
+    this->cpu.S = parseHexByte(data + 6);
+    this->cpu.SP = parseHexByte(data + 8);
+    this->cpu.PC = parseHexByte(data + 10) | (parseHexByte(data + 12) << 8);
+    return "OK";
+  }
+  case 'p': {
+    unsigned int index = strtoul(packet.c_str() + 1, nullptr, 16);
+    if (index >= REGISTER_COUNT) {
+      return "E01";
+    }
+    std::string registers = readRegisters();
+    return index == REGISTER_COUNT - 1 ? registers.substr(index * 2, 4)
+                                       : registers.substr(index * 2, 2);
+  }
+  case 'P': {
+    size_t equals = packet.find('=');
+    if (equals == std::string::npos || packet.size() < equals + 3) {
+      return "E01";
+    }
+    unsigned int index = strtoul(packet.c_str() + 1, nullptr, 16);
+    uint8_t value = parseHexByte(packet.c_str() + equals + 1);
+    switch (index) {
+    case 0:
+      this->cpu.A = value;
+      break;
+    case 1:
+      this->cpu.X = value;
+      break;
+    case 2:
+      this->cpu.Y = value;
+      break;
+    case 3:
+      this->cpu.S = value;
+      break;
+    case 4:
+      this->cpu.SP = value;
+      break;
+    case 5:
+      if (packet.size() < equals + 5) {
+        return "E01";
+      }
+      this->cpu.PC = value | (parseHexByte(packet.c_str() + equals + 3) << 8);
+      break;
+    default:
+      return "E01";
+    }
+    return "OK";
+  }
+  case 'm': {
+    unsigned int address, length;
+    // Two hex digits per byte have to fit in a reply
+    if (std::sscanf(packet.c_str() + 1, "%x,%x", &address, &length) != 2 ||
+        length > PACKET_SIZE / 2) {
+      return "E01";
+    }
+    std::string out;
+    for (uint32_t i = 0; i < length; i++) {
+      appendHex(out, peek(static_cast<uint16_t>(address + i)));
+    }
+    return out;
+  }
+  case 'M': {
+    unsigned int address, length;
+    size_t colon = packet.find(':');
+    if (std::sscanf(packet.c_str() + 1, "%x,%x", &address, &length) != 2 ||
+        length > PACKET_SIZE / 2 || colon == std::string::npos ||
+        packet.size() < colon + 1 + static_cast<size_t>(length) * 2) {
+      return "E01";
+    }
+    for (uint32_t i = 0; i < length; i++) {
+      poke(static_cast<uint16_t>(address + i),
+           parseHexByte(packet.c_str() + colon + 1 + i * 2));
+    }
+    return "OK";
+  }
+  case 'c':
+  case 's':
+    if (packet.size() > 1) {
+      this->cpu.PC = strtoul(packet.c_str() + 1, nullptr, 16);
+    }
+    return run(packet[0] == 's');
+  case 'Z':
+  case 'z':
+    return changeBreakpoint(packet, packet[0] == 'Z');
+  case 'D':
+    this->breakpoints.clear();
+    done = true;
+    return "OK";
+  case 'H':
+    return "OK";
+  case 'q':
+    if (packet.rfind("qSupported", 0) == 0) {
+      char temp[32];
+      std::snprintf(temp, sizeof(temp), "PacketSize=%x", PACKET_SIZE);
+      return temp;
+    }
+    if (packet == "qAttached") {
+      return "1";
+    }
+    return "";
+  default:
+    // Empty reply tells the debugger the packet is not supported
+    return "";
+  }
+}
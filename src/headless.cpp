@@ -0,0 +1,573 @@
+#include "cpu.hpp"
+#include "batchrunner.hpp"
+#include "capture.hpp"
+#include "codedatalogger.hpp"
+#include "conformance.hpp"
+#include "differential.hpp"
+#include "envserver.hpp"
+#include "hash.hpp"
+#include "keyframeindex.hpp"
+#include "movie.hpp"
+#include "profiler.hpp"
+#include "rng.hpp"
+#include "runahead.hpp"
+#include "timeline.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+// Headless runner for regression testing, no window and no frame pacing.
+//
+//   nes_headless <rom> --play <movie> [--hashes <file>] [--verify <file>]
+//                [--index <file> --start <frame>]
+//   nes_headless <rom> --frames <n> [--seed <s>] [--record <movie>]
+//                [--hashes <file>]
+//
+// Either mode takes --write-index <file> [--keyframe-interval <k>] to write a
+// keyframe index next to the movie. Playback with --index and --start jumps
+// straight to a frame through that index instead of replaying from power on.
+// --run-ahead <n> runs every frame with run-ahead and reports what it costs,
+// the hashes are of the real timeline so they match a run without it.
+//
+// --batch <n> [--threads <t>] runs n instances in parallel instead, all
+// playing the movie or each with random input from seed + i, and prints
+// "<instance> <frames> <state hash>" for each.
+//
+// --capture <prefix> records what is presented to <prefix>.y4m and
+// <prefix>.wav on a writer thread. --capture-overflow drop drops frames when
+// the writer falls behind instead of waiting for it. --capture-source picture
+// records the 256x240 PPU picture instead of the 32x32 screen at $0200.
+//
+// --serve <socket> [--instances <n>] [--shm <name>] runs n instances as an
+// environment server for other processes instead, see EnvServer.
+//
+// --diff lockstep8|lockstep16 runs the same input on the interpreter and on
+// that backend side by side instead, checking they agree at every frame, and
+// prints what differed at the first divergence.
+//
+// --trace <file> writes a Chrome trace (chrome://tracing, ui.perfetto.dev) of
+// each frame's input, CPU run and present, and prints frame time percentiles
+// per phase. Latency is from a change of input to the frame presented after.
+//
+// --pairs <n> profiles the run and prints the n commonest opcode pairs, to
+// pick superinstructions from (see CPU::fusedTable). Profiling turns fusing
+// and idle loop skipping off.
+//
+// Built with the ROM compiled ahead of time (nes_headless_<name>, see
+// nes_add_recompiled_core), runs it compiled unless --compiled off is given.
+//
+// --cdl <file> logs which ROM bytes run as code, are read as data or are
+// drawn, merged into the file if it exists, in FCEUX's .cdl format. Logging
+// turns fusing, idle loop skipping and compiled code off.
+//
+// Given a directory instead of a ROM, runs every test ROM in it as a
+// conformance suite on [--threads <t>] threads, see ConformanceRunner. Prints
+// "<status> <rom> <cycles> <cycles per second> [message]" for each and exits
+// with 1 if any of them didn't pass.
+//
+// Every frame prints "<frame> <RAM hash> <state hash>". Without --play the
+// input is generated from the seed, holding random buttons for a random
+// number of frames, and can be recorded so the run replays exactly. Hashes go
+// to stdout unless --hashes is given, progress and errors go to stderr.
+
+static void usage() {
+  std::cout << "usage: nes_headless <rom | test directory> [--play <movie>] "
+               "[--frames <n>] "
+               "[--seed <s>] [--record <movie>] [--hashes <file>] "
+               "[--verify <file>] [--write-index <file>] "
+               "[--keyframe-interval <k>] [--index <file>] [--start <frame>] "
+               "[--run-ahead <n>] [--batch <n>] [--threads <t>] "
+               "[--capture <prefix>] [--capture-overflow block|drop] "
+               "[--capture-source screen|picture] "
+               "[--serve <socket>] [--instances <n>] [--shm <name>] "
+               "[--diff lockstep8|lockstep16] [--trace <file>] [--pairs <n>] "
+               "[--compiled on|off] [--cdl <file>]\n";
+}
+
+static bool inputChanged(const Movie &movie, size_t frame) {
+  for (uint8_t port = 0; port < MOVIE_PORTS; port++) {
+    uint8_t previous = frame > 0 ? movie.getInput(frame - 1, port) : 0;
+    if (movie.getInput(frame, port) != previous) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Random input held for a random number of frames
+static void generateInput(Movie &movie, Rng &rng, size_t frames) {
+  uint8_t buttons[MOVIE_PORTS] = {0};
+  uint32_t holdFrames = 0;
+  for (size_t frame = 0; frame < frames; frame++) {
+    if (holdFrames == 0) {
+      buttons[0] = rng.next();
+      holdFrames = rng.nextInRange(1, 30);
+    }
+    holdFrames--;
+    movie.recordFrame(buttons);
+  }
+}
+
+static int runBatch(const std::vector<uint8_t> &rom,
+                    std::shared_ptr<const Movie> movie, uint64_t romHash,
+                    uint64_t seed, size_t frames, size_t count,
+                    size_t threads) {
+  BatchRunner runner = BatchRunner(threads);
+  for (size_t i = 0; i < count; i++) {
+    BatchJob job;
+    job.rom = rom;
+    job.movie = movie;
+    if (job.movie == nullptr) {
+      Rng rng = Rng(seed + i);
+      std::shared_ptr<Movie> generated =
+          std::make_shared<Movie>(romHash, seed + i);
+      generateInput(*generated, rng, frames);
+      job.movie = generated;
+    }
+    job.frameBudget = frames;
+    job.recordFrameHashes = false;
+    runner.add(std::move(job));
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::vector<BatchResult> results = runner.run();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  uint64_t total = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    total += results[i].frames;
+    printf("%zu %u %016llx%s\n", i, results[i].frames,
+           static_cast<unsigned long long>(results[i].stateHash),
+           results[i].started ? (results[i].stopped ? " stopped" : "")
+                              : " failed");
+  }
+  std::cerr << count << " instances, " << total << " frames on "
+            << runner.getThreadCount() << " threads in " << seconds << "s ("
+            << (seconds > 0 ? total / seconds : 0) << " fps, "
+            << runner.getSteals() << " steals)\n";
+  return 0;
+}
+
+static int runConformance(const std::string &directory, size_t threads) {
+  ConformanceRunner runner = ConformanceRunner(threads);
+  if (!runner.addDirectory(directory)) {
+    return 1;
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::vector<ConformanceResult> results = runner.run();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  size_t counts[CONFORMANCE_SKIPPED + 1] = {0};
+  uint64_t cycles = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    const ConformanceResult &result = results[i];
+    counts[result.status]++;
+    cycles += result.cycles;
+    double rate = result.seconds > 0 ? result.cycles / result.seconds : 0;
+    printf("%-7s %s %llu %.0f%s%s\n", conformanceStatusName(result.status),
+           runner.getTests()[i].name.c_str(),
+           static_cast<unsigned long long>(result.cycles), rate,
+           result.message.empty() ? "" : " ", result.message.c_str());
+  }
+  std::cerr << counts[CONFORMANCE_PASS] << " passed, "
+            << counts[CONFORMANCE_FAIL] << " failed, "
+            << counts[CONFORMANCE_TIMEOUT] << " timed out, "
+            << counts[CONFORMANCE_CRASH] << " crashed, "
+            << counts[CONFORMANCE_SKIPPED] << " skipped on "
+            << runner.getThreadCount() << " threads in " << seconds << "s ("
+            << (seconds > 0 ? cycles / seconds : 0) << " cycles/s)\n";
+  bool passed = counts[CONFORMANCE_FAIL] + counts[CONFORMANCE_TIMEOUT] +
+                    counts[CONFORMANCE_CRASH] ==
+                0;
+  return passed ? 0 : 1;
+}
+
+static int runDifferential(const std::vector<uint8_t> &rom,
+                           const Movie &movie, size_t frames,
+                           const std::string &backend) {
+  std::unique_ptr<ExecutionBackend> candidate;
+  if (backend == "lockstep8") {
+    candidate = std::make_unique<LockstepBackend<8>>(rom);
+  } else if (backend == "lockstep16") {
+    candidate = std::make_unique<LockstepBackend<16>>(rom);
+  } else {
+    std::cout << "Unknown backend " << backend << "\n";
+    return 1;
+  }
+  CpuBackend reference = CpuBackend(rom);
+  DifferentialResult result =
+      DifferentialExecutor(reference, *candidate).run(&movie, frames);
+  if (!result.started || result.diverged) {
+    std::cout << result.report;
+    return 1;
+  }
+  std::cerr << result.frames << " frames match"
+            << (result.stopped ? ", both stopped" : "") << "\n";
+  return 0;
+}
+
+static std::string frameHashes(const CPU &cpu, size_t frame) {
+  SaveState state;
+  cpu.saveState(state);
+  char line[64];
+  snprintf(line, sizeof(line), "%zu %016llx %016llx", frame,
+           static_cast<unsigned long long>(cpu.getBus().hashRam()),
+           static_cast<unsigned long long>(hashBytes(&state, sizeof(state))));
+  return line;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    usage();
+    return 1;
+  }
+  std::string romPath = argv[1];
+  std::string playPath, recordPath, hashesPath, verifyPath;
+  std::string writeIndexPath, indexPath;
+  std::string servePath, sharedName;
+  std::string capturePrefix;
+  std::string diffBackend;
+  std::string tracePath;
+  std::string cdlPath;
+  CaptureOverflow captureOverflow = CAPTURE_BLOCK;
+  CaptureSource captureSource = CAPTURE_SCREEN;
+  uint32_t instances = 1;
+  size_t frames = 0;
+  size_t startFrame = 0;
+  uint32_t keyframeInterval = 600;
+  uint32_t runAheadFrames = 0;
+  size_t batch = 0;
+  size_t threads = 0;
+  size_t pairs = 0;
+  uint64_t seed = 1;
+  bool compiled = true;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      usage();
+      return 1;
+    }
+    if (arg == "--play") {
+      playPath = argv[++i];
+    } else if (arg == "--record") {
+      recordPath = argv[++i];
+    } else if (arg == "--hashes") {
+      hashesPath = argv[++i];
+    } else if (arg == "--verify") {
+      verifyPath = argv[++i];
+    } else if (arg == "--frames") {
+      frames = std::stoul(argv[++i]);
+    } else if (arg == "--write-index") {
+      writeIndexPath = argv[++i];
+    } else if (arg == "--keyframe-interval") {
+      keyframeInterval = std::stoul(argv[++i]);
+    } else if (arg == "--index") {
+      indexPath = argv[++i];
+    } else if (arg == "--start") {
+      startFrame = std::stoul(argv[++i]);
+    } else if (arg == "--batch") {
+      batch = std::stoul(argv[++i]);
+    } else if (arg == "--threads") {
+      threads = std::stoul(argv[++i]);
+    } else if (arg == "--run-ahead") {
+      runAheadFrames = std::stoul(argv[++i]);
+    } else if (arg == "--capture") {
+      capturePrefix = argv[++i];
+    } else if (arg == "--capture-overflow") {
+      std::string policy = argv[++i];
+      if (policy != "block" && policy != "drop") {
+        usage();
+        return 1;
+      }
+      captureOverflow = policy == "drop" ? CAPTURE_DROP : CAPTURE_BLOCK;
+    } else if (arg == "--capture-source") {
+      std::string source = argv[++i];
+      if (source != "screen" && source != "picture") {
+        usage();
+        return 1;
+      }
+      captureSource = source == "picture" ? CAPTURE_PICTURE : CAPTURE_SCREEN;
+    } else if (arg == "--serve") {
+      servePath = argv[++i];
+    } else if (arg == "--instances") {
+      instances = std::stoul(argv[++i]);
+    } else if (arg == "--shm") {
+      sharedName = argv[++i];
+    } else if (arg == "--diff") {
+      diffBackend = argv[++i];
+    } else if (arg == "--trace") {
+      tracePath = argv[++i];
+    } else if (arg == "--pairs") {
+      pairs = std::stoul(argv[++i]);
+    } else if (arg == "--compiled") {
+      std::string mode = argv[++i];
+      if (mode != "on" && mode != "off") {
+        usage();
+        return 1;
+      }
+      compiled = mode == "on";
+    } else if (arg == "--cdl") {
+      cdlPath = argv[++i];
+    } else if (arg == "--seed") {
+      seed = std::stoull(argv[++i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  std::error_code error;
+  if (std::filesystem::is_directory(romPath, error)) {
+    return runConformance(romPath, threads);
+  }
+  std::ifstream input(romPath, std::ios::binary);
+  std::vector<uint8_t> buffer(std::istreambuf_iterator<char>(input), {});
+  if (buffer.empty()) {
+    std::cout << "Could not read " << romPath << "\n";
+    return 1;
+  }
+  if (!servePath.empty()) {
+    if (sharedName.empty()) {
+      sharedName = "/cnes-" + std::to_string(getpid());
+    }
+    EnvServer server = EnvServer(buffer, instances);
+    if (!server.open(servePath, sharedName)) {
+      return 1;
+    }
+    std::cerr << "Serving " << instances << " instances on " << servePath
+              << ", observations in " << sharedName << "\n";
+    return server.serve() ? 0 : 1;
+  }
+  CPU cpu = CPU(Bus(buffer));
+  cpu.runCompiled = compiled;
+  CodeDataLogger codeDataLogger = CodeDataLogger(cpu.getBus().getRom());
+  if (!cdlPath.empty()) {
+    if (std::filesystem::exists(cdlPath, error) &&
+        !codeDataLogger.load(cdlPath)) {
+      return 1;
+    }
+    cpu.getBus().setCodeDataLogger(&codeDataLogger);
+  }
+
+  Movie movie = Movie(cpu.getBus().getRomHash(), seed);
+  bool playing = !playPath.empty();
+  if (playing) {
+    if (!movie.load(playPath)) {
+      return 1;
+    }
+    if (frames == 0 || frames > movie.getFrameCount()) {
+      frames = movie.getFrameCount();
+    }
+  }
+  if (batch > 0) {
+    std::shared_ptr<const Movie> shared;
+    if (playing) {
+      shared = std::make_shared<const Movie>(movie);
+    }
+    return runBatch(buffer, shared, cpu.getBus().getRomHash(), seed, frames,
+                    batch, threads);
+  }
+  if (!diffBackend.empty()) {
+    if (!playing) {
+      Rng rng = Rng(seed);
+      generateInput(movie, rng, frames);
+    }
+    return runDifferential(buffer, movie, frames, diffBackend);
+  }
+  if (startFrame > 0 && (!playing || indexPath.empty())) {
+    std::cerr << "--start needs --play and --index\n";
+    return 1;
+  }
+  KeyframeIndex index;
+  if (startFrame > 0) {
+    if (!index.open(indexPath) || !index.seek(movie, cpu, startFrame)) {
+      return 1;
+    }
+  } else if (!movie.begin(cpu)) {
+    return 1;
+  }
+  KeyframeIndexWriter indexWriter;
+  if (!writeIndexPath.empty() &&
+      !indexWriter.open(writeIndexPath, cpu.getBus().getRomHash(),
+                        keyframeInterval)) {
+    return 1;
+  }
+
+  std::ofstream hashesFile;
+  if (!hashesPath.empty()) {
+    hashesFile.open(hashesPath);
+  }
+  std::ostream &hashes = hashesPath.empty() ? std::cout : hashesFile;
+  std::ifstream expected;
+  if (!verifyPath.empty()) {
+    expected.open(verifyPath);
+    // Hash logs always start at frame 0
+    std::string skipped;
+    for (size_t i = 0; i < startFrame; i++) {
+      std::getline(expected, skipped);
+    }
+  }
+
+  Profiler profiler;
+  if (pairs > 0) {
+    cpu.profiler = &profiler;
+  }
+  RunAhead runAhead = RunAhead(runAheadFrames);
+  // Nothing to show headless, presented frames are only counted in the stats
+  Capture capture = Capture(16, captureOverflow, captureSource);
+  if (!capturePrefix.empty() &&
+      !capture.open(capturePrefix + ".y4m", capturePrefix + ".wav")) {
+    return 1;
+  }
+  // There is no APU, the sound track is silence of the right length
+  std::vector<int16_t> silence(CAPTURE_SAMPLES_PER_FRAME, 0);
+  // Screen bytes, or a black picture until the PPU draws its first line
+  std::vector<uint8_t> pixels(capture.getFrameSize(), 0);
+  std::unique_ptr<Timeline> timeline;
+  if (!tracePath.empty()) {
+    timeline = std::make_unique<Timeline>();
+    timeline->setThreadName("emulation");
+  }
+  size_t frame = startFrame;
+  auto present = [&](const CPU &presented) {
+    TimelineScope scope(timeline.get(), TIMELINE_PRESENT, frame);
+    if (timeline) {
+      timeline->markPresent(frame);
+    }
+    if (capturePrefix.empty()) {
+      return;
+    }
+    const uint8_t *screen = pixels.data();
+    if (captureSource == CAPTURE_PICTURE) {
+      const uint8_t *picture = presented.getBus().getFramebuffer(
+          presented.cycles);
+      screen = picture != nullptr ? picture : screen;
+    } else {
+      presented.getBus().readRam(SCREEN_START, pixels.data(), pixels.size());
+    }
+    capture.pushFrame(screen, silence.data(), silence.size());
+  };
+  if (!playing) {
+    Rng rng = Rng(movie.getSeed());
+    generateInput(movie, rng, frames);
+  }
+  bool matched = true;
+  auto start = std::chrono::steady_clock::now();
+  for (; frame < frames; frame++) {
+    TimelineScope frameScope(timeline.get(), TIMELINE_FRAME, frame);
+    indexWriter.onFrame(cpu, frame, movie.getInputOffset(frame));
+    {
+      TimelineScope scope(timeline.get(), TIMELINE_INPUT, frame);
+      movie.applyInput(cpu, frame);
+      if (timeline && inputChanged(movie, frame)) {
+        timeline->markInput();
+      }
+    }
+    bool running;
+    {
+      TimelineScope scope(timeline.get(), TIMELINE_CPU, frame);
+      running = runAhead.runFrame(cpu, present);
+    }
+    std::string line = frameHashes(cpu, frame);
+    hashes << line << "\n";
+    if (expected.is_open()) {
+      std::string wanted;
+      if (!std::getline(expected, wanted) || wanted != line) {
+        std::cerr << "Mismatch at frame " << frame << ": expected \""
+                  << wanted << "\" got \"" << line << "\"\n";
+        matched = false;
+        frame++;
+        break;
+      }
+    }
+    if (!running) {
+      std::cerr << "CPU stopped at " << std::hex << cpu.PC << std::dec
+                << " during frame " << frame << "\n";
+      frame++;
+      break;
+    }
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  // Keep only the frames that actually ran
+  movie.truncate(frame);
+  if (!recordPath.empty() && !playing && !movie.save(recordPath)) {
+    return 1;
+  }
+  std::cerr << frame - startFrame << " frames in " << seconds << "s ("
+            << (seconds > 0 ? (frame - startFrame) / seconds : 0)
+            << " fps)\n";
+  const IdleLoopStats &idle = cpu.getIdleLoopStats();
+  if (idle.loops > 0) {
+    std::cerr << "Skipped " << idle.loops << " idle loops, " << idle.cycles
+              << " cycles ("
+              << 100.0 * idle.cycles / std::max<uint64_t>(cpu.cycles, 1)
+              << "% of emulated time)\n";
+  }
+  if (cpu.getCompiledCycles() > 0) {
+    std::cerr << "Ran " << cpu.getCompiledCycles() << " cycles compiled ("
+              << 100.0 * cpu.getCompiledCycles() /
+                     std::max<uint64_t>(cpu.cycles, 1)
+              << "% of emulated time)\n";
+  }
+  uint64_t fused = 0, saved = 0;
+  for (size_t i = 0; i < CPU::fusedTable.size(); i++) {
+    uint64_t count = cpu.getFusedCounts()[i];
+    fused += count;
+    saved += count * (CPU::fusedTable[i].opcodes.size() - 1);
+  }
+  if (fused > 0) {
+    std::cerr << "Ran " << fused << " superinstructions, saving " << saved
+              << " dispatches:";
+    for (size_t i = 0; i < CPU::fusedTable.size(); i++) {
+      if (cpu.getFusedCounts()[i] > 0) {
+        std::cerr << " " << CPU::fusedTable[i].name << " "
+                  << cpu.getFusedCounts()[i] << ";";
+      }
+    }
+    std::cerr << "\n";
+  }
+  if (pairs > 0) {
+    profiler.writePairs(std::cerr, pairs);
+  }
+  if (!cdlPath.empty()) {
+    if (!codeDataLogger.save(cdlPath)) {
+      return 1;
+    }
+    CdlStats stats = codeDataLogger.getStats();
+    std::cerr << "Logged " << stats.code << " code and " << stats.data
+              << " data bytes of " << stats.prgBytes << " PRG bytes, "
+              << stats.indirectCode << " indirect jump targets, "
+              << stats.chrDrawn << " drawn and " << stats.chrRead
+              << " read of " << stats.chrBytes << " CHR bytes\n";
+  }
+  if (runAheadFrames > 0) {
+    runAhead.report(std::cerr);
+  }
+  if (!capturePrefix.empty()) {
+    bool captured = capture.close();
+    CaptureStats stats = capture.getStats();
+    std::cerr << "Captured " << stats.framesWritten << " frames, "
+              << stats.framesDropped << " dropped, " << stats.bytesWritten
+              << " bytes, waited " << stats.blockedNanos / 1000000
+              << "ms on the writer, queue high water "
+              << stats.queueHighWater << "\n";
+    matched = matched && captured;
+  }
+  if (timeline) {
+    std::ofstream trace(tracePath);
+    timeline->writeChromeTrace(trace);
+    if (!trace) {
+      std::cerr << "Could not write " << tracePath << "\n";
+      return 1;
+    }
+    timeline->writeSummary(std::cerr);
+  }
+  return matched ? 0 : 1;
+}
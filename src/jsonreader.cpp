@@ -0,0 +1,270 @@
+#include "jsonreader.hpp"
+#include <cstring>
+
+#define JSON_BUFFER_SIZE (1 << 16)
+// Deepest nesting skipValue follows before giving up on the input
+#define JSON_MAX_DEPTH 256
+
+JsonReader::JsonReader()
+    : file(nullptr), position(0), size(0), offset(0) {}
+
+JsonReader::~JsonReader() {
+  if (this->file != nullptr) {
+    fclose(this->file);
+  }
+}
+
+bool JsonReader::open(const std::string &path) {
+  this->file = fopen(path.c_str(), "rb");
+  if (this->file == nullptr) {
+    return fail("could not open " + path);
+  }
+  this->buffer.resize(JSON_BUFFER_SIZE);
+  return true;
+}
+
+void JsonReader::openString(std::string text) {
+  this->buffer.assign(text.begin(), text.end());
+  this->size = this->buffer.size();
+}
+
+bool JsonReader::refill() {
+  if (this->position < this->size) {
+    return true;
+  }
+  if (this->file == nullptr) {
+    return false;
+  }
+  this->offset += this->size;
+  this->position = 0;
+  this->size = fread(this->buffer.data(), 1, this->buffer.size(), this->file);
+  return this->size > 0;
+}
+
+char JsonReader::peek() {
+  while (refill()) {
+    char c = this->buffer[this->position];
+    if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+      return c;
+    }
+    this->position++;
+  }
+  return 0;
+}
+
+bool JsonReader::fail(const std::string &message) {
+  if (this->error.empty()) {
+    this->error = message + " at byte " +
+                  std::to_string(this->offset + this->position);
+  }
+  return false;
+}
+
+bool JsonReader::expect(char c) {
+  if (failed()) {
+    return false;
+  }
+  if (peek() != c) {
+    return fail(std::string("expected '") + c + "'");
+  }
+  this->position++;
+  return true;
+}
+
+bool JsonReader::beginArray() {
+  if (!expect('[')) {
+    return false;
+  }
+  this->first.push_back(true);
+  return true;
+}
+
+bool JsonReader::beginObject() {
+  if (!expect('{')) {
+    return false;
+  }
+  this->first.push_back(true);
+  return true;
+}
+
+bool JsonReader::hasNext() {
+  if (failed() || this->first.empty()) {
+    return fail("not inside an array or object");
+  }
+  char c = peek();
+  if (c == ']' || c == '}') {
+    this->position++;
+    this->first.pop_back();
+    return false;
+  }
+  if (!this->first.back() && !expect(',')) {
+    return false;
+  }
+  this->first.back() = false;
+  return true;
+}
+
+bool JsonReader::readKey(std::string &key) {
+  return readString(key) && expect(':');
+}
+
+bool JsonReader::readString(std::string &value) {
+  if (!expect('"')) {
+    return false;
+  }
+  value.clear();
+  for (;;) {
+    if (!refill()) {
+      return fail("unterminated string");
+    }
+    char c = this->buffer[this->position++];
+    if (c == '"') {
+      return true;
+    }
+    if (c != '\\') {
+      value += c;
+      continue;
+    }
+    if (!refill()) {
+      return fail("unterminated string");
+    }
+    c = this->buffer[this->position++];
+    switch (c) {
+    case 'b':
+      value += '\b';
+      break;
+    case 'f':
+      value += '\f';
+      break;
+    case 'n':
+      value += '\n';
+      break;
+    case 'r':
+      value += '\r';
+      break;
+    case 't':
+      value += '\t';
+      break;
+    case 'u': {
+      uint32_t code = 0;
+      for (int i = 0; i < 4; i++) {
+        if (!refill()) {
+          return fail("unterminated string");
+        }
+        char digit = this->buffer[this->position++];
+        const char *hex = "0123456789abcdef";
+        const char *found = strchr(hex, digit | 0x20);
+        if (digit == 0 || found == nullptr) {
+          return fail("bad \\u escape");
+        }
+        code = code << 4 | (found - hex);
+      }
+      // UTF-8, surrogate pairs are kept as two separate code points
+      if (code < 0x80) {
+        value += static_cast<char>(code);
+      } else if (code < 0x800) {
+        value += static_cast<char>(0xC0 | code >> 6);
+        value += static_cast<char>(0x80 | (code & 0x3F));
+      } else {
+        value += static_cast<char>(0xE0 | code >> 12);
+        value += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        value += static_cast<char>(0x80 | (code & 0x3F));
+      }
+      break;
+    }
+    default:
+      // \" \\ and \/
+      value += c;
+      break;
+    }
+  }
+}
+
+bool JsonReader::readInteger(int64_t &value) {
+  if (failed()) {
+    return false;
+  }
+  char c = peek();
+  bool negative = c == '-';
+  if (negative) {
+    this->position++;
+  }
+  int digits = 0;
+  value = 0;
+  while (refill()) {
+    c = this->buffer[this->position];
+    if (c < '0' || c > '9') {
+      break;
+    }
+    value = value * 10 + (c - '0');
+    this->position++;
+    digits++;
+  }
+  if (digits == 0 || c == '.' || c == 'e' || c == 'E') {
+    return fail("expected an integer");
+  }
+  if (negative) {
+    value = -value;
+  }
+  return true;
+}
+
+bool JsonReader::skipLiteral(const char *literal) {
+  for (const char *c = literal; *c != 0; c++) {
+    if (!refill() || this->buffer[this->position] != *c) {
+      return fail(std::string("expected ") + literal);
+    }
+    this->position++;
+  }
+  return true;
+}
+
+bool JsonReader::skipValue() {
+  if (failed()) {
+    return false;
+  }
+  char c = peek();
+  if (c == '"') {
+    std::string ignored;
+    return readString(ignored);
+  }
+  if (c == '[' || c == '{') {
+    if (this->first.size() >= JSON_MAX_DEPTH) {
+      return fail("nested too deep");
+    }
+    bool object = c == '{';
+    if (object ? !beginObject() : !beginArray()) {
+      return false;
+    }
+    std::string key;
+    while (hasNext()) {
+      if ((object && !readKey(key)) || !skipValue()) {
+        return false;
+      }
+    }
+    return !failed();
+  }
+  if (c == 't') {
+    return skipLiteral("true");
+  }
+  if (c == 'f') {
+    return skipLiteral("false");
+  }
+  if (c == 'n') {
+    return skipLiteral("null");
+  }
+  if (c == '-' || (c >= '0' && c <= '9')) {
+    // Any number, fractions and exponents included
+    while (refill()) {
+      c = this->buffer[this->position];
+      if (strchr("+-.eE0123456789", c) == nullptr || c == 0) {
+        break;
+      }
+      this->position++;
+    }
+    return true;
+  }
+  return fail("expected a value");
+}
+
+bool JsonReader::atEnd() { return peek() == 0 && !refill(); }
@@ -0,0 +1,129 @@
+#include "keyframeindex.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool KeyframeIndexWriter::open(const std::string &path, uint64_t romHash,
+                               uint32_t interval) {
+  this->interval = interval > 0 ? interval : 1;
+  KeyframeIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = KEYFRAME_INDEX_MAGIC;
+  header.version = KEYFRAME_INDEX_VERSION;
+  header.stateSize = sizeof(SaveState);
+  header.romHash = romHash;
+  header.interval = this->interval;
+  this->output.open(path, std::ios::binary | std::ios::trunc);
+  this->output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  this->output.flush();
+  if (!this->output) {
+    std::cout << "Could not write keyframe index to " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool KeyframeIndexWriter::onFrame(const CPU &cpu, uint32_t frame,
+                                  uint64_t movieOffset) {
+  if (!this->output.is_open() || frame % this->interval != 0) {
+    return true;
+  }
+  KeyframeEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.frame = frame;
+  entry.movieOffset = movieOffset;
+  cpu.saveState(entry.state);
+  this->output.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+  // Flush every entry so a reader can follow a recording in progress
+  this->output.flush();
+  return static_cast<bool>(this->output);
+}
+
+KeyframeIndex::KeyframeIndex()
+    : mapping(nullptr), mappingSize(0), header(nullptr), entries(nullptr),
+      count(0) {}
+
+KeyframeIndex::~KeyframeIndex() { close(); }
+
+void KeyframeIndex::close() {
+  if (this->mapping != nullptr) {
+    munmap(this->mapping, this->mappingSize);
+  }
+  this->mapping = nullptr;
+  this->mappingSize = 0;
+  this->header = nullptr;
+  this->entries = nullptr;
+  this->count = 0;
+}
+
+bool KeyframeIndex::open(const std::string &path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cout << "Could not open keyframe index " << path << "\n";
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(KeyframeIndexHeader)) {
+    std::cout << "Keyframe index " << path << " is truncated\n";
+    ::close(fd);
+    return false;
+  }
+  this->mappingSize = info.st_size;
+  this->mapping = mmap(nullptr, this->mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (this->mapping == MAP_FAILED) {
+    this->mapping = nullptr;
+    std::cout << "Could not map keyframe index " << path << "\n";
+    return false;
+  }
+  this->header = static_cast<const KeyframeIndexHeader *>(this->mapping);
+  if (this->header->magic != KEYFRAME_INDEX_MAGIC ||
+      this->header->version != KEYFRAME_INDEX_VERSION ||
+      this->header->stateSize != sizeof(SaveState) ||
+      this->header->interval == 0) {
+    std::cout << "Keyframe index " << path << " is not compatible\n";
+    close();
+    return false;
+  }
+  this->entries = reinterpret_cast<const KeyframeEntry *>(
+      static_cast<const uint8_t *>(this->mapping) + sizeof(KeyframeIndexHeader));
+  // A partially written last entry is ignored
+  this->count = (this->mappingSize - sizeof(KeyframeIndexHeader)) /
+                sizeof(KeyframeEntry);
+  return true;
+}
+
+const KeyframeEntry *KeyframeIndex::find(uint32_t frame) const {
+  if (this->count == 0) {
+    return nullptr;
+  }
+  // Keyframes are taken on every interval'th frame from 0, no search needed
+  size_t index = frame / this->header->interval;
+  return &this->entries[index < this->count ? index : this->count - 1];
+}
+
+bool KeyframeIndex::seek(const Movie &movie, CPU &cpu, uint32_t frame) const {
+  if (frame > movie.getFrameCount()) {
+    std::cout << "Frame " << frame << " is past the end of the movie\n";
+    return false;
+  }
+  if (this->count == 0 || this->header->romHash != movie.getRomHash()) {
+    std::cout << "Keyframe index does not belong to this movie\n";
+    return false;
+  }
+  const KeyframeEntry *keyframe = find(frame);
+  if (!cpu.loadState(keyframe->state)) {
+    return false;
+  }
+  for (uint32_t next = keyframe->frame; next < frame; next++) {
+    if (!movie.playFrame(cpu, next)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,931 @@
+#include "lockstep.hpp"
+#include "cpu.hpp"
+#include "hash.hpp"
+#include <cstdint>
+#include <cstring>
+
+#define STACK_PAGE 0x0100
+
+static inline uint8_t setZeroAndNegative(uint8_t status, uint8_t value) {
+  return (status & ~(CPU::Z | CPU::N)) | (value == 0 ? CPU::Z : 0) |
+         (value & CPU::N);
+}
+
+static inline uint8_t setFlag(uint8_t status, uint8_t flag, bool set) {
+  return set ? (status | flag) : (status & ~flag);
+}
+
+// Lanes have no PPU, their states and hashes carry the one a CPU has when
+// the program never touches it
+static PPU untouchedPpu(uint64_t cycle) {
+  PPU ppu;
+  ppu.catchUp(cycle);
+  return ppu;
+}
+
+// a where the lane mask is set, b elsewhere
+static inline uint8_t blend(uint8_t mask, uint8_t a, uint8_t b) {
+  return (a & mask) | (b & ~mask);
+}
+
+template <size_t LANES>
+LockstepCPU<LANES>::LockstepCPU(std::vector<uint8_t> romData)
+    : groupSteps(0), laneSteps(0) {
+  // Parse the image the same way the scalar core does
+  Bus bus = Bus(std::move(romData));
+  this->rom = bus.getRom();
+  this->romHash = bus.getRomHash();
+  memset(this->ram, 0, sizeof(this->ram));
+  memset(this->controllerState, 0, sizeof(this->controllerState));
+  memset(this->controllerShift, 0, sizeof(this->controllerShift));
+  memset(this->controllerStrobe, 0, sizeof(this->controllerStrobe));
+  memset(this->prgRam, 0, sizeof(this->prgRam));
+  memset(this->prgRamUsed, 0, sizeof(this->prgRamUsed));
+  for (size_t lane = 0; lane < LANES; lane++) {
+    this->A[lane] = 0;
+    this->X[lane] = 0;
+    this->Y[lane] = 0;
+    this->P[lane] = 0;
+    this->S[lane] = CPU::I;
+    this->PC[lane] = 0x8000;
+    this->SP[lane] = 0xFF;
+    this->cycles[lane] = 0;
+    this->stopped[lane] = false;
+  }
+}
+
+template <size_t LANES> void LockstepCPU<LANES>::reset() {
+  uint16_t vector = readPrgRom(0xFFFC) | (readPrgRom(0xFFFD) << 8);
+  for (size_t lane = 0; lane < LANES; lane++) {
+    this->PC[lane] = vector;
+    this->SP[lane] = 0xFD;
+    this->S[lane] = CPU::U | CPU::B;
+    this->A[lane] = 0;
+    this->X[lane] = 0;
+    this->cycles[lane] = 7;
+    this->stopped[lane] = false;
+  }
+}
+
+template <size_t LANES>
+void LockstepCPU<LANES>::setControllerState(size_t lane, uint8_t port,
+                                            uint8_t buttons) {
+  this->controllerState[lane][port & 1] = buttons;
+  if (this->controllerStrobe[lane]) {
+    this->controllerShift[lane][port & 1] = buttons;
+  }
+}
+
+template <size_t LANES>
+void LockstepCPU<LANES>::saveState(size_t lane, SaveState &state) const {
+  state.magic = SAVE_STATE_MAGIC;
+  state.version = SAVE_STATE_VERSION;
+  state.size = sizeof(SaveState);
+  state.romHash = this->romHash;
+  state.cpu.cycles = this->cycles[lane];
+  state.cpu.PC = this->PC[lane];
+  state.cpu.A = this->A[lane];
+  state.cpu.X = this->X[lane];
+  state.cpu.Y = this->Y[lane];
+  state.cpu.S = this->S[lane];
+  state.cpu.P = this->P[lane];
+  state.cpu.SP = this->SP[lane];
+  for (size_t address = 0; address < sizeof(state.bus.cpuVram); address++) {
+    state.bus.cpuVram[address] = this->ram[address][lane];
+  }
+  memcpy(state.bus.controllerState, this->controllerState[lane], 2);
+  memcpy(state.bus.controllerShift, this->controllerShift[lane], 2);
+  state.bus.controllerStrobe = this->controllerStrobe[lane];
+  state.bus.prgRamUsed = this->prgRamUsed[lane];
+  state.bus.dmaStall = 0;
+  memcpy(state.bus.prgRam, this->prgRam[lane], PRG_RAM_SIZE);
+  untouchedPpu(this->cycles[lane]).saveState(state.bus.ppu);
+}
+
+template <size_t LANES>
+uint64_t LockstepCPU<LANES>::hashState(size_t lane) const {
+  // Same steps as CPU::hashState and Bus::hashState
+  uint64_t registers = static_cast<uint64_t>(this->PC[lane]) |
+                       static_cast<uint64_t>(this->A[lane]) << 16 |
+                       static_cast<uint64_t>(this->X[lane]) << 24 |
+                       static_cast<uint64_t>(this->Y[lane]) << 32 |
+                       static_cast<uint64_t>(this->S[lane]) << 40 |
+                       static_cast<uint64_t>(this->P[lane]) << 48 |
+                       static_cast<uint64_t>(this->SP[lane]) << 56;
+  uint64_t hash = mixHash(registers) ^
+                  mixHash(this->cycles[lane] % CYCLES_PER_FRAME +
+                          0x9E3779B97F4A7C15ULL);
+  uint64_t controllers =
+      static_cast<uint64_t>(this->controllerState[lane][0]) |
+      static_cast<uint64_t>(this->controllerState[lane][1]) << 8 |
+      static_cast<uint64_t>(this->controllerShift[lane][0]) << 16 |
+      static_cast<uint64_t>(this->controllerShift[lane][1]) << 24 |
+      static_cast<uint64_t>(this->controllerStrobe[lane]) << 32;
+  hash = mixHash(hash ^ mixHash(controllers));
+  uint8_t page[MEMORY_PAGE_SIZE];
+  for (size_t base = 0; base < sizeof(this->ram) / LANES;
+       base += MEMORY_PAGE_SIZE) {
+    for (size_t offset = 0; offset < MEMORY_PAGE_SIZE; offset++) {
+      page[offset] = this->ram[base + offset][lane];
+    }
+    hash = hashBytes(page, MEMORY_PAGE_SIZE, hash);
+  }
+  if (this->prgRamUsed[lane]) {
+    hash = hashBytes(this->prgRam[lane], PRG_RAM_SIZE, hash);
+  }
+  return untouchedPpu(this->cycles[lane]).hashState(hash);
+}
+
+template <size_t LANES>
+bool LockstepCPU<LANES>::loadState(size_t lane, const SaveState &state) {
+  if (state.magic != SAVE_STATE_MAGIC || state.version != SAVE_STATE_VERSION ||
+      state.size != sizeof(SaveState) || state.romHash != this->romHash) {
+    return false;
+  }
+  this->cycles[lane] = state.cpu.cycles;
+  this->PC[lane] = state.cpu.PC;
+  this->A[lane] = state.cpu.A;
+  this->X[lane] = state.cpu.X;
+  this->Y[lane] = state.cpu.Y;
+  this->S[lane] = state.cpu.S;
+  this->P[lane] = state.cpu.P;
+  this->SP[lane] = state.cpu.SP;
+  for (size_t address = 0; address < sizeof(state.bus.cpuVram); address++) {
+    this->ram[address][lane] = state.bus.cpuVram[address];
+  }
+  memcpy(this->controllerState[lane], state.bus.controllerState, 2);
+  memcpy(this->controllerShift[lane], state.bus.controllerShift, 2);
+  this->controllerStrobe[lane] = state.bus.controllerStrobe;
+  this->prgRamUsed[lane] = state.bus.prgRamUsed;
+  memcpy(this->prgRam[lane], state.bus.prgRam, PRG_RAM_SIZE);
+  this->stopped[lane] = false;
+  return true;
+}
+
+template <size_t LANES>
+uint8_t LockstepCPU<LANES>::readPrgRom(uint16_t address) const {
+  const std::vector<uint8_t> &prg = this->rom->progRom;
+  if (prg.empty()) {
+    return 0;
+  }
+  // 16KB images are mirrored into $C000-$FFFF
+  return prg[(address - 0x8000) % prg.size()];
+}
+
+// Mirrors Bus::readFromMemory, minus the logging of unmapped accesses
+template <size_t LANES>
+uint8_t LockstepCPU<LANES>::read(size_t lane, uint16_t address) {
+  if (address <= RAM_END) {
+    return this->ram[address & 0x7FF][lane];
+  } else if (address >= 0x8000) {
+    return readPrgRom(address);
+  } else if (address >= PRG_RAM_START && address <= PRG_RAM_END) {
+    return this->prgRam[lane][address - PRG_RAM_START];
+  } else if (address == CONTROLLER_1 || address == CONTROLLER_2) {
+    uint8_t port = address - CONTROLLER_1;
+    if (this->controllerStrobe[lane]) {
+      return this->controllerState[lane][port] & BUTTON_A;
+    }
+    uint8_t bit = this->controllerShift[lane][port] & 1;
+    this->controllerShift[lane][port] =
+        (this->controllerShift[lane][port] >> 1) | 0x80;
+    return bit;
+  }
+  return 0;
+}
+
+template <size_t LANES>
+void LockstepCPU<LANES>::write(size_t lane, uint16_t address, uint8_t data) {
+  if (address <= RAM_END) {
+    this->ram[address & 0x7FF][lane] = data;
+  } else if (address >= PRG_RAM_START && address <= PRG_RAM_END) {
+    this->prgRam[lane][address - PRG_RAM_START] = data;
+    this->prgRamUsed[lane] = true;
+  } else if (address == CONTROLLER_1) {
+    this->controllerStrobe[lane] = data & 1;
+    if (data & 1) {
+      memcpy(this->controllerShift[lane], this->controllerState[lane], 2);
+    }
+  }
+}
+
+template <size_t LANES> bool LockstepCPU<LANES>::runFrame() {
+  uint64_t frameEnd[LANES];
+  for (size_t lane = 0; lane < LANES; lane++) {
+    frameEnd[lane] = (this->cycles[lane] / CYCLES_PER_FRAME + 1) *
+                     CYCLES_PER_FRAME;
+  }
+  for (;;) {
+    // The lane furthest behind leads, lanes that fell behind on a slower
+    // path catch up and rejoin the group
+    alignas(64) uint8_t active[LANES];
+    size_t leader = 0;
+    uint64_t leaderCycles = UINT64_MAX;
+    for (size_t lane = 0; lane < LANES; lane++) {
+      bool running =
+          !this->stopped[lane] && this->cycles[lane] < frameEnd[lane];
+      active[lane] = running ? 0xFF : 0;
+      uint64_t laneCycles = running ? this->cycles[lane] : UINT64_MAX;
+      leader = laneCycles < leaderCycles ? lane : leader;
+      leaderCycles = laneCycles < leaderCycles ? laneCycles : leaderCycles;
+    }
+    if (leaderCycles == UINT64_MAX) {
+      break;
+    }
+    uint16_t pc = this->PC[leader];
+    alignas(64) uint8_t mask[LANES];
+    if (pc >= 0x8000) {
+      for (size_t lane = 0; lane < LANES; lane++) {
+        mask[lane] = this->PC[lane] == pc ? active[lane] : 0;
+      }
+    } else {
+      // Code in RAM can differ between lanes, run it one lane at a time
+      memset(mask, 0, LANES);
+      mask[leader] = 0xFF;
+    }
+    execute(leader, mask);
+  }
+  for (size_t lane = 0; lane < LANES; lane++) {
+    if (this->stopped[lane]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <size_t LANES>
+void LockstepCPU<LANES>::execute(size_t leader, const uint8_t mask[LANES]) {
+  uint16_t pc = this->PC[leader];
+  uint8_t opcode = read(leader, pc);
+  const CPU::instruction &ins = CPU::lookupTable[opcode];
+  this->groupSteps++;
+  for (size_t lane = 0; lane < LANES; lane++) {
+    this->laneSteps += mask[lane] & 1;
+  }
+  if (ins.bytes == 0) {
+    // Unknown opcode, CPU::step stops without touching anything
+    for (size_t lane = 0; lane < LANES; lane++) {
+      this->stopped[lane] = this->stopped[lane] || mask[lane];
+    }
+    return;
+  }
+
+  // Operand bytes are the same for every lane in the group
+  uint16_t next = pc + 1;
+  uint8_t lo = read(leader, next);
+  uint8_t hi = read(leader, next + 1);
+  uint16_t operand = lo | (hi << 8);
+  for (size_t lane = 0; lane < LANES; lane++) {
+    this->PC[lane] = mask[lane] ? next : this->PC[lane];
+  }
+  alignas(64) uint16_t address[LANES];
+  alignas(64) uint8_t value[LANES];
+
+  // Effective address per lane, see CPU::getOperandAddress
+  auto resolve = [&]() {
+    switch (ins.mode) {
+    case CPU::Immediate:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = next;
+      }
+      break;
+    case CPU::ZeroPage:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = lo;
+      }
+      break;
+    case CPU::ZeroPage_X:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = static_cast<uint8_t>(lo + this->X[lane]);
+      }
+      break;
+    case CPU::ZeroPage_Y:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = static_cast<uint8_t>(lo + this->Y[lane]);
+      }
+      break;
+    case CPU::Absolute:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = operand;
+      }
+      break;
+    case CPU::Absolute_X:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = static_cast<uint16_t>(operand + this->X[lane]);
+      }
+      break;
+    case CPU::Absolute_Y:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = static_cast<uint16_t>(operand + this->Y[lane]);
+      }
+      break;
+    case CPU::Indirect_X:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        if (mask[lane]) {
+          uint8_t pointer = static_cast<uint8_t>(lo + this->X[lane]);
+          address[lane] =
+              read(lane, pointer) |
+              (read(lane, static_cast<uint8_t>(pointer + 1)) << 8);
+        }
+      }
+      break;
+    case CPU::Indirect_Y:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        if (mask[lane]) {
+          uint16_t base = read(lane, lo) |
+                          (read(lane, static_cast<uint8_t>(lo + 1)) << 8);
+          address[lane] = static_cast<uint16_t>(base + this->Y[lane]);
+        }
+      }
+      break;
+    case CPU::Indirect:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        if (mask[lane]) {
+          // The 6502 doesn't carry into the high byte of the pointer
+          uint16_t high = (operand & 0xFF) == 0xFF ? (operand & 0xFF00)
+                                                   : operand + 1;
+          address[lane] = read(lane, operand) | (read(lane, high) << 8);
+        }
+      }
+      break;
+    case CPU::NoneAddressing:
+      for (size_t lane = 0; lane < LANES; lane++) {
+        address[lane] = 0xFFFF;
+      }
+      break;
+    }
+  };
+  // Same RAM address in every lane, its row is read and written as a whole
+  bool uniformRam = (ins.mode == CPU::ZeroPage) ||
+                    (ins.mode == CPU::Absolute && operand <= RAM_END);
+  uint8_t *row =
+      this->ram[(ins.mode == CPU::ZeroPage ? lo : operand) & 0x7FF];
+  auto load = [&]() {
+    if (ins.mode == CPU::Immediate) {
+      memset(value, lo, LANES);
+      return;
+    }
+    if (uniformRam) {
+      memcpy(value, row, LANES);
+      return;
+    }
+    resolve();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      if (mask[lane]) {
+        value[lane] = read(lane, address[lane]);
+      }
+    }
+  };
+  auto loadRegister = [&](uint8_t *reg) {
+    load();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      reg[lane] = blend(mask[lane], value[lane], reg[lane]);
+      this->S[lane] = blend(
+          mask[lane], setZeroAndNegative(this->S[lane], value[lane]),
+          this->S[lane]);
+    }
+  };
+  auto store = [&](const uint8_t *reg) {
+    if (uniformRam) {
+      for (size_t lane = 0; lane < LANES; lane++) {
+        row[lane] = blend(mask[lane], reg[lane], row[lane]);
+      }
+      return;
+    }
+    resolve();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      if (mask[lane]) {
+        write(lane, address[lane], reg[lane]);
+      }
+    }
+  };
+  // Register to register, with or without setting Z and N
+  auto transfer = [&](uint8_t *to, const uint8_t *from, bool flags) {
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t result = from[lane];
+      to[lane] = blend(mask[lane], result, to[lane]);
+      if (flags) {
+        this->S[lane] =
+            blend(mask[lane], setZeroAndNegative(this->S[lane], result),
+                  this->S[lane]);
+      }
+    }
+  };
+  auto increment = [&](uint8_t *reg, uint8_t delta) {
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t result = reg[lane] + delta;
+      reg[lane] = blend(mask[lane], result, reg[lane]);
+      this->S[lane] =
+          blend(mask[lane], setZeroAndNegative(this->S[lane], result),
+                this->S[lane]);
+    }
+  };
+  // Read, modify and write back memory, op updates the status of the lane
+  auto modify = [&](auto op) {
+    resolve();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      if (mask[lane]) {
+        uint8_t data = op(lane, read(lane, address[lane]));
+        write(lane, address[lane], data);
+      }
+    }
+  };
+  auto compare = [&](const uint8_t *reg) {
+    load();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t status = setFlag(this->S[lane], CPU::C, reg[lane] >= value[lane]);
+      status = setZeroAndNegative(
+          status, static_cast<uint8_t>(reg[lane] - value[lane]));
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+  };
+  auto logic = [&](auto op) {
+    load();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t result = op(this->A[lane], value[lane]);
+      this->A[lane] = blend(mask[lane], result, this->A[lane]);
+      this->S[lane] =
+          blend(mask[lane], setZeroAndNegative(this->S[lane], result),
+                this->S[lane]);
+    }
+  };
+  auto setStatus = [&](uint8_t set, uint8_t clear) {
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t status = (this->S[lane] | set) & ~clear;
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+  };
+  auto branch = [&](uint8_t flag, bool whenSet) {
+    uint16_t target = next + 1 + static_cast<uint16_t>(static_cast<int8_t>(lo));
+    for (size_t lane = 0; lane < LANES; lane++) {
+      bool taken = ((this->S[lane] & flag) != 0) == whenSet;
+      if (mask[lane] && taken) {
+        this->PC[lane] = target;
+      }
+    }
+  };
+  auto push = [&](size_t lane, uint8_t data) {
+    write(lane, STACK_PAGE + this->SP[lane], data);
+    this->SP[lane]--;
+  };
+  auto pop = [&](size_t lane) {
+    this->SP[lane]++;
+    return read(lane, STACK_PAGE + this->SP[lane]);
+  };
+  auto forLanes = [&](auto body) {
+    for (size_t lane = 0; lane < LANES; lane++) {
+      if (mask[lane]) {
+        body(lane);
+      }
+    }
+  };
+
+  switch (opcode) {
+  // BRK
+  case 0x00:
+    setStatus(CPU::B, 0);
+    forLanes([&](size_t lane) { this->stopped[lane] = true; });
+    break;
+  // LDA
+  case 0xA9:
+  case 0xA5:
+  case 0xB5:
+  case 0xAD:
+  case 0xBD:
+  case 0xB9:
+  case 0xA1:
+  case 0xB1:
+    loadRegister(this->A);
+    break;
+  // LDX
+  case 0xA2:
+  case 0xA6:
+  case 0xB6:
+  case 0xAE:
+  case 0xBE:
+    loadRegister(this->X);
+    break;
+  // LDY
+  case 0xA0:
+  case 0xA4:
+  case 0xB4:
+  case 0xAC:
+  case 0xBC:
+    loadRegister(this->Y);
+    break;
+  // STA
+  case 0x85:
+  case 0x95:
+  case 0x8D:
+  case 0x9D:
+  case 0x99:
+  case 0x81:
+  case 0x91:
+    store(this->A);
+    break;
+  // STX
+  case 0x86:
+  case 0x96:
+  case 0x8E:
+    store(this->X);
+    break;
+  // STY
+  case 0x84:
+  case 0x94:
+  case 0x8C:
+    store(this->Y);
+    break;
+  // TAX
+  case 0xAA:
+    transfer(this->X, this->A, true);
+    break;
+  // TAY
+  case 0xA8:
+    transfer(this->Y, this->A, true);
+    break;
+  // TSX
+  case 0xBA:
+    transfer(this->X, this->SP, true);
+    break;
+  // TXA
+  case 0x8A:
+    transfer(this->A, this->X, true);
+    break;
+  // TXS
+  case 0x9A:
+    transfer(this->SP, this->X, false);
+    break;
+  // TYA
+  case 0x98:
+    transfer(this->A, this->Y, true);
+    break;
+  // INX
+  case 0xE8:
+    increment(this->X, 1);
+    break;
+  // INY
+  case 0xC8:
+    increment(this->Y, 1);
+    break;
+  // DEX
+  case 0xCA:
+    increment(this->X, 0xFF);
+    break;
+  // DEY
+  case 0x88:
+    increment(this->Y, 0xFF);
+    break;
+  // ADC
+  case 0x69:
+  case 0x65:
+  case 0x75:
+  case 0x6D:
+  case 0x7D:
+  case 0x79:
+  case 0x61:
+  case 0x71:
+    load();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t a = this->A[lane];
+      uint8_t data = value[lane];
+      uint16_t sum = a + data + (this->S[lane] & CPU::C);
+      uint8_t result = static_cast<uint8_t>(sum);
+      uint8_t status = setFlag(this->S[lane], CPU::C, sum > 0xFF);
+      status = setFlag(status, CPU::V, ~(a ^ data) & (a ^ result) & 0x80);
+      status = setZeroAndNegative(status, result);
+      this->A[lane] = blend(mask[lane], result, a);
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+    break;
+  // SBC
+  case 0xE9:
+  case 0xE5:
+  case 0xF5:
+  case 0xED:
+  case 0xFD:
+  case 0xF9:
+  case 0xE1:
+  case 0xF1:
+    load();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t a = this->A[lane];
+      uint8_t data = value[lane];
+      uint8_t borrow = (this->S[lane] & CPU::C) ? 0 : 1;
+      uint16_t result = a - data - borrow;
+      uint8_t status = setFlag(this->S[lane], CPU::C, result <= 0xFF);
+      status = setFlag(status, CPU::V,
+                       ((a ^ data) & 0x80) && ((a ^ result) & 0x80));
+      status = setZeroAndNegative(status, static_cast<uint8_t>(result));
+      this->A[lane] = blend(mask[lane], static_cast<uint8_t>(result), a);
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+    break;
+  // AND
+  case 0x29:
+  case 0x25:
+  case 0x35:
+  case 0x2D:
+  case 0x3D:
+  case 0x39:
+  case 0x21:
+  case 0x31:
+    logic([](uint8_t a, uint8_t data) { return a & data; });
+    break;
+  // ORA
+  case 0x09:
+  case 0x05:
+  case 0x15:
+  case 0x0D:
+  case 0x1D:
+  case 0x19:
+  case 0x01:
+  case 0x11:
+    logic([](uint8_t a, uint8_t data) { return a | data; });
+    break;
+  // EOR
+  case 0x49:
+  case 0x45:
+  case 0x55:
+  case 0x4D:
+  case 0x5D:
+  case 0x59:
+  case 0x41:
+  case 0x51:
+    logic([](uint8_t a, uint8_t data) { return a ^ data; });
+    break;
+  // CMP
+  case 0xC9:
+  case 0xC5:
+  case 0xD5:
+  case 0xCD:
+  case 0xDD:
+  case 0xD9:
+  case 0xC1:
+  case 0xD1:
+    compare(this->A);
+    break;
+  // CPX
+  case 0xE0:
+  case 0xE4:
+  case 0xEC:
+    compare(this->X);
+    break;
+  // CPY
+  case 0xC0:
+  case 0xC4:
+  case 0xCC:
+    compare(this->Y);
+    break;
+  // BIT
+  case 0x24:
+  case 0x2C:
+    load();
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t data = value[lane];
+      uint8_t status =
+          setFlag(this->S[lane], CPU::Z, (this->A[lane] & data) == 0);
+      status = setFlag(status, CPU::N, data >> 7);
+      status = setFlag(status, CPU::V, data >> 6);
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+    break;
+  // ASL
+  case 0x0A:
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t a = this->A[lane];
+      uint8_t result = a << 1;
+      uint8_t status = setFlag(this->S[lane], CPU::C, a >> 7);
+      status = setZeroAndNegative(status, result);
+      this->A[lane] = blend(mask[lane], result, a);
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+    break;
+  case 0x06:
+  case 0x16:
+  case 0x0E:
+  case 0x1E:
+    modify([&](size_t lane, uint8_t data) {
+      uint8_t result = data << 1;
+      this->S[lane] = setZeroAndNegative(
+          setFlag(this->S[lane], CPU::C, data >> 7), result);
+      return result;
+    });
+    break;
+  // LSR
+  case 0x4A:
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t a = this->A[lane];
+      uint8_t result = a >> 1;
+      uint8_t status = setFlag(this->S[lane], CPU::C, a & 1);
+      status = setZeroAndNegative(status, result);
+      this->A[lane] = blend(mask[lane], result, a);
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+    break;
+  case 0x46:
+  case 0x56:
+  case 0x4E:
+  case 0x5E:
+    modify([&](size_t lane, uint8_t data) {
+      uint8_t result = data >> 1;
+      this->S[lane] = setZeroAndNegative(
+          setFlag(this->S[lane], CPU::C, data & 1), result);
+      return result;
+    });
+    break;
+  // ROL, like CPU::ROL the carry is only ever set here, never cleared
+  case 0x2A:
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t a = this->A[lane];
+      uint8_t result = (a << 1) | (this->S[lane] & CPU::C);
+      uint8_t status = setZeroAndNegative(this->S[lane] | (a >> 7), result);
+      this->A[lane] = blend(mask[lane], result, a);
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+    break;
+  case 0x26:
+  case 0x36:
+  case 0x2E:
+  case 0x3E:
+    modify([&](size_t lane, uint8_t data) {
+      uint8_t result = (data << 1) | (this->S[lane] & CPU::C);
+      this->S[lane] = setZeroAndNegative(this->S[lane] | (data >> 7), result);
+      return result;
+    });
+    break;
+  // ROR, same carry behaviour as ROL
+  case 0x6A:
+    for (size_t lane = 0; lane < LANES; lane++) {
+      uint8_t a = this->A[lane];
+      uint8_t result = (a >> 1) | ((this->S[lane] & CPU::C) << 7);
+      uint8_t status = setZeroAndNegative(this->S[lane] | (a & 1), result);
+      this->A[lane] = blend(mask[lane], result, a);
+      this->S[lane] = blend(mask[lane], status, this->S[lane]);
+    }
+    break;
+  case 0x66:
+  case 0x76:
+  case 0x6E:
+  case 0x7E:
+    modify([&](size_t lane, uint8_t data) {
+      uint8_t result = (data >> 1) | ((this->S[lane] & CPU::C) << 7);
+      this->S[lane] = setZeroAndNegative(this->S[lane] | (data & 1), result);
+      return result;
+    });
+    break;
+  // DEC
+  case 0xC6:
+  case 0xD6:
+  case 0xCE:
+  case 0xDE:
+    modify([&](size_t lane, uint8_t data) {
+      uint8_t result = data - 1;
+      this->S[lane] = setZeroAndNegative(this->S[lane], result);
+      return result;
+    });
+    break;
+  // INC
+  case 0xE6:
+  case 0xF6:
+  case 0xEE:
+  case 0xFE:
+    modify([&](size_t lane, uint8_t data) {
+      uint8_t result = data + 1;
+      this->S[lane] = setZeroAndNegative(this->S[lane], result);
+      return result;
+    });
+    break;
+  // BCC
+  case 0x90:
+    branch(CPU::C, false);
+    break;
+  // BCS
+  case 0xB0:
+    branch(CPU::C, true);
+    break;
+  // BEQ
+  case 0xF0:
+    branch(CPU::Z, true);
+    break;
+  // BMI
+  case 0x30:
+    branch(CPU::N, true);
+    break;
+  // BNE
+  case 0xD0:
+    branch(CPU::Z, false);
+    break;
+  // BPL
+  case 0x10:
+    branch(CPU::N, false);
+    break;
+  // BVC
+  case 0x50:
+    branch(CPU::V, false);
+    break;
+  // BVS
+  case 0x70:
+    branch(CPU::V, true);
+    break;
+  // CLC
+  case 0x18:
+    setStatus(0, CPU::C);
+    break;
+  // CLD
+  case 0xD8:
+    setStatus(0, CPU::D);
+    break;
+  // CLI
+  case 0x58:
+    setStatus(0, CPU::I);
+    break;
+  // CLV
+  case 0xB8:
+    setStatus(0, CPU::V);
+    break;
+  // SEC
+  case 0x38:
+    setStatus(CPU::C, 0);
+    break;
+  // SED
+  case 0xF8:
+    setStatus(CPU::D, 0);
+    break;
+  // SEI
+  case 0x78:
+    setStatus(CPU::I, 0);
+    break;
+  // JMP
+  case 0x4C:
+  case 0x6C:
+    resolve();
+    forLanes([&](size_t lane) { this->PC[lane] = address[lane]; });
+    break;
+  // JSR
+  case 0x20:
+    resolve();
+    forLanes([&](size_t lane) {
+      uint16_t returnAddress = next + 1;
+      push(lane, returnAddress >> 8);
+      push(lane, returnAddress & 0xFF);
+      this->PC[lane] = address[lane];
+    });
+    break;
+  // RTS
+  case 0x60:
+    forLanes([&](size_t lane) {
+      uint16_t low = pop(lane);
+      uint16_t high = pop(lane);
+      this->PC[lane] = ((high << 8) | low) + 1;
+    });
+    break;
+  // RTI, status handling as in CPU::RTI
+  case 0x40:
+    forLanes([&](size_t lane) {
+      uint8_t status = pop(lane);
+      status &= ~CPU::B;
+      status |= CPU::U;
+      uint16_t low = pop(lane);
+      uint16_t high = pop(lane);
+      this->S[lane] = status;
+      this->PC[lane] = (high << 8) | low;
+    });
+    break;
+  // PHA
+  case 0x48:
+    forLanes([&](size_t lane) { push(lane, this->A[lane]); });
+    break;
+  // PHP
+  case 0x08:
+    forLanes([&](size_t lane) {
+      push(lane, this->S[lane] | CPU::B | CPU::U);
+    });
+    break;
+  // PLA
+  case 0x68:
+    forLanes([&](size_t lane) {
+      this->A[lane] = pop(lane);
+      this->S[lane] = setZeroAndNegative(this->S[lane], this->A[lane]);
+    });
+    break;
+  // PLP
+  case 0x28:
+    forLanes([&](size_t lane) {
+      this->S[lane] = (pop(lane) & ~CPU::B) | CPU::U;
+    });
+    break;
+  // NOP
+  case 0xEA:
+    break;
+  }
+
+  uint16_t fallthrough = next + ins.bytes - 1;
+  for (size_t lane = 0; lane < LANES; lane++) {
+    bool advance = mask[lane] && this->PC[lane] == next;
+    this->PC[lane] = advance ? fallthrough : this->PC[lane];
+    this->cycles[lane] += mask[lane] ? ins.cycles : 0;
+  }
+}
+
+template class LockstepCPU<8>;
+template class LockstepCPU<16>;
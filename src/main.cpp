@@ -1,4 +1,11 @@
+#include "breakpoints.hpp"
 #include "cpu.hpp"
+#include "disassembler.hpp"
+#include "gdbstub.hpp"
+#include "palette.hpp"
+#include "profiler.hpp"
+#include "rng.hpp"
+#include "timeline.hpp"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_events.h>
 #include <SDL2/SDL_keycode.h>
@@ -8,7 +15,6 @@
 #include <chrono>
 #include <fstream>
 #include <iostream>
-#include <random>
 #include <thread>
 
 uint8_t game[] = {
@@ -41,18 +47,19 @@ uint8_t game[] = {
 
 uint8_t screenState[32 * 3 * 32] = {0};
 
-std::default_random_engine generator;
-std::uniform_int_distribution<uint8_t> distribution(1, 16);
 
-void processInput(CPU *cpu) {
+// False once the window is closed
+bool processInput(CPU *cpu, Timeline *timeline = nullptr) {
   SDL_Event event;
 
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
     case SDL_QUIT:
-      exit(0);
-      break;
+      return false;
     case SDL_KEYDOWN:
+      if (timeline != nullptr) {
+        timeline->markInput();
+      }
       switch (event.key.keysym.sym) {
       case SDLK_w:
         cpu->writeToMemory(0xff, 0x77);
@@ -69,34 +76,12 @@ void processInput(CPU *cpu) {
       }
     }
   }
+  return true;
 }
 
 SDL_Color mapColor(uint8_t byte) {
-  switch (byte) {
-  case 0:
-    return {0, 0, 0, 255};
-  case 1:
-    return {255, 255, 255, 255};
-  case 2:
-  case 9:
-    return {120, 120, 120, 255};
-  case 3:
-  case 10:
-    return {255, 0, 0, 255};
-  case 4:
-  case 11:
-    return {0, 255, 0, 255};
-  case 5:
-  case 12:
-    return {0, 0, 255, 255};
-  case 6:
-  case 13:
-    return {255, 0, 255, 255};
-  case 7:
-  case 14:
-    return {255, 255, 0, 255};
-  }
-  return {0, 255, 255, 255};
+  PaletteColor color = paletteColor(byte);
+  return {color.r, color.g, color.b, 255};
 }
 
 bool readScreenState(CPU *cpu, uint8_t frame[32 * 3 * 32]) {
@@ -121,7 +106,35 @@ bool readScreenState(CPU *cpu, uint8_t frame[32 * 3 * 32]) {
   return update;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+  // --profile <file> writes a callgrind profile and <file>.folded stacks
+  // --gdb <port> or --gdb-unix <path> waits for a GDB remote debugger
+  // --seed <n> seeds the random number generator, for replaying a run
+  // --trace <file> runs frame by frame at 60Hz and writes a Chrome trace of
+  // each frame's input poll, CPU run, texture upload, present and pacing
+  // sleep, with frame time percentiles on exit
+  std::string profilePath;
+  std::string tracePath;
+  std::string gdbUnixPath;
+  uint16_t gdbPort = 0;
+  uint64_t seed = std::chrono::steady_clock::now().time_since_epoch().count();
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--profile" && i + 1 < argc) {
+      profilePath = argv[++i];
+    } else if (arg == "--gdb" && i + 1 < argc) {
+      gdbPort = std::stoi(argv[++i]);
+    } else if (arg == "--gdb-unix" && i + 1 < argc) {
+      gdbUnixPath = argv[++i];
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = std::stoull(argv[++i]);
+    } else if (arg == "--trace" && i + 1 < argc) {
+      tracePath = argv[++i];
+    }
+  }
+  // All randomness comes from here, print the seed so the run can be repeated
+  Rng rng = Rng(seed);
+  std::cout << "Seed " << seed << "\n";
   std::ifstream input("./nestest.nes", std::ios::binary);
   std::vector<uint8_t> buffer(std::istreambuf_iterator<char>(input), {});
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -145,14 +158,73 @@ int main() {
     std::cout << "Error creating texture" << "\n";
   }
   Bus bus = Bus(buffer);
+  Disassembler disassembler = Disassembler(bus.getRom());
+  disassembler.analyze();
   CPU cpu = CPU(bus);
   //cpu.loadProgram(game, sizeof(game));
   cpu.reset();
   cpu.PC = 0x8000;
+  Profiler profiler;
+  if (!profilePath.empty()) {
+    cpu.profiler = &profiler;
+  }
+  if (gdbPort != 0 || !gdbUnixPath.empty()) {
+    Breakpoints breakpoints;
+    GdbStub stub = GdbStub(cpu, breakpoints);
+    bool listening = gdbPort != 0 ? stub.listenTcp(gdbPort)
+                                  : stub.listenUnix(gdbUnixPath);
+    if (listening) {
+      stub.serve();
+    }
+    return 0;
+  }
+  if (!tracePath.empty()) {
+    Timeline timeline;
+    timeline.setThreadName("main");
+    auto period = std::chrono::nanoseconds(1000000000 / 60);
+    auto deadline = std::chrono::steady_clock::now() + period;
+    for (uint32_t frame = 0;; frame++) {
+      TimelineScope frameScope(&timeline, TIMELINE_FRAME, frame);
+      {
+        TimelineScope scope(&timeline, TIMELINE_INPUT, frame);
+        if (!processInput(&cpu, &timeline)) {
+          break;
+        }
+        cpu.writeToMemory(0xfe, rng.nextInRange(1, 16));
+      }
+      bool running;
+      {
+        TimelineScope scope(&timeline, TIMELINE_CPU, frame);
+        running = cpu.runFrame();
+      }
+      {
+        TimelineScope scope(&timeline, TIMELINE_UPLOAD, frame);
+        readScreenState(&cpu, screenState);
+        SDL_UpdateTexture(texture, nullptr, screenState, 32 * 3);
+      }
+      {
+        TimelineScope scope(&timeline, TIMELINE_PRESENT, frame);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+        timeline.markPresent(frame);
+      }
+      if (!running) {
+        break;
+      }
+      TimelineScope scope(&timeline, TIMELINE_SLEEP, frame);
+      std::this_thread::sleep_until(deadline);
+      deadline += period;
+    }
+    std::ofstream trace(tracePath);
+    timeline.writeChromeTrace(trace);
+    timeline.writeSummary(std::cout);
+    return 0;
+  }
   cpu.interpretWithCB([&](CPU *cpu) {
-    std::cout << traceCpuState(cpu) << "\n";
+    std::cout << traceCpuState(cpu, &disassembler) << "\n";
 //    processInput(cpu);
-//    cpu->writeToMemory(0xfe, distribution(generator));
+//    cpu->writeToMemory(0xfe, rng.nextInRange(1, 16));
 //    if (readScreenState(cpu, screenState)) {
 //      SDL_UpdateTexture(texture, nullptr, screenState, 32 * 3);
 //      SDL_RenderClear(renderer);
@@ -161,4 +233,10 @@ int main() {
 //    }
 //    std::this_thread::sleep_for(std::chrono::microseconds(32));
   });
+  if (!profilePath.empty()) {
+    std::ofstream callgrind(profilePath);
+    profiler.writeCallgrind(callgrind, &disassembler);
+    std::ofstream folded(profilePath + ".folded");
+    profiler.writeFoldedStacks(folded);
+  }
 }
@@ -0,0 +1,85 @@
+#include "movie.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+Movie::Movie(uint64_t romHash, uint64_t seed) {
+  memset(&this->header, 0, sizeof(this->header));
+  memset(&this->startState, 0, sizeof(this->startState));
+  this->header.magic = MOVIE_MAGIC;
+  this->header.version = MOVIE_VERSION;
+  this->header.romHash = romHash;
+  this->header.seed = seed;
+}
+
+void Movie::setStartState(const SaveState &state) {
+  this->startState = state;
+  this->header.flags |= FROM_STATE;
+}
+
+void Movie::recordFrame(const uint8_t buttons[MOVIE_PORTS]) {
+  this->inputs.insert(this->inputs.end(), buttons, buttons + MOVIE_PORTS);
+}
+
+bool Movie::save(const std::string &path) const {
+  MovieHeader written = this->header;
+  written.frameCount = getFrameCount();
+  std::ofstream output(path, std::ios::binary);
+  output.write(reinterpret_cast<const char *>(&written), sizeof(written));
+  if (hasStartState()) {
+    output.write(reinterpret_cast<const char *>(&this->startState),
+                 sizeof(this->startState));
+  }
+  output.write(reinterpret_cast<const char *>(this->inputs.data()),
+               this->inputs.size());
+  if (!output) {
+    std::cout << "Could not write movie to " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool Movie::load(const std::string &path) {
+  std::ifstream input(path, std::ios::binary);
+  input.read(reinterpret_cast<char *>(&this->header), sizeof(this->header));
+  if (!input || this->header.magic != MOVIE_MAGIC ||
+      this->header.version != MOVIE_VERSION) {
+    std::cout << "Could not read movie from " << path << "\n";
+    return false;
+  }
+  if (hasStartState()) {
+    input.read(reinterpret_cast<char *>(&this->startState),
+               sizeof(this->startState));
+  }
+  this->inputs.resize(this->header.frameCount * MOVIE_PORTS);
+  input.read(reinterpret_cast<char *>(this->inputs.data()),
+             this->inputs.size());
+  if (!input) {
+    std::cout << "Movie " << path << " is truncated\n";
+    return false;
+  }
+  return true;
+}
+
+bool Movie::begin(CPU &cpu) const {
+  if (cpu.getBus().getRomHash() != this->header.romHash) {
+    std::cout << "Movie was recorded with a different ROM\n";
+    return false;
+  }
+  if (hasStartState()) {
+    return cpu.loadState(this->startState);
+  }
+  cpu.reset();
+  return true;
+}
+
+void Movie::applyInput(CPU &cpu, size_t frame) const {
+  for (uint8_t port = 0; port < MOVIE_PORTS; port++) {
+    cpu.getBus().setControllerState(port, getInput(frame, port));
+  }
+}
+
+bool Movie::playFrame(CPU &cpu, size_t frame) const {
+  applyInput(cpu, frame);
+  return cpu.runFrame();
+}
@@ -0,0 +1,568 @@
+#include "ppu.hpp"
+#include "bus.hpp"
+#include "codedatalogger.hpp"
+#include "hash.hpp"
+#include <algorithm>
+#include <cstring>
+
+#define NO_SPRITE_0_HIT UINT32_MAX
+#define FIRST_INVISIBLE_DOT (PPU_VISIBLE_LINES * PPU_DOTS_PER_LINE)
+
+// First CPU cycle that catches up past the dot
+static uint64_t cycleOfDot(uint64_t frame, uint32_t dot) {
+  return frame * CYCLES_PER_FRAME + (dot + 2) / 3;
+}
+
+PPU::PPU() {
+  this->frame = 0;
+  this->dot = 0;
+  this->sprite0Dot = NO_SPRITE_0_HIT;
+  this->ctrl = 0;
+  this->mask = 0;
+  this->status = 0;
+  this->oamAddress = 0;
+  this->v = 0;
+  this->t = 0;
+  this->fineX = 0;
+  this->writeToggle = false;
+  this->readBuffer = 0;
+  this->latch = 0;
+  this->nmiPending = false;
+  this->drawing = true;
+  this->codeDataLogger = nullptr;
+  this->vram.fill(0);
+  this->palette.fill(0);
+  this->oam.fill(0);
+  updateNextEvent();
+}
+
+void PPU::setRom(std::shared_ptr<const Rom> rom) { this->rom = rom; }
+
+void PPU::reset() {
+  this->frame = 0;
+  this->dot = 0;
+  this->sprite0Dot = NO_SPRITE_0_HIT;
+  this->ctrl = 0;
+  this->mask = 0;
+  this->t = 0;
+  this->fineX = 0;
+  this->writeToggle = false;
+  this->readBuffer = 0;
+  this->nmiPending = false;
+  updateNextEvent();
+}
+
+void PPU::catchUp(uint64_t cycle) {
+  uint64_t frame = cycle / CYCLES_PER_FRAME;
+  uint32_t dot = cycle % CYCLES_PER_FRAME * 3 + 1;
+  if (frame < this->frame || (frame == this->frame && dot <= this->dot)) {
+    return;
+  }
+  if (frame > this->frame) {
+    runEvents(PPU_DOTS_PER_FRAME);
+    // Nobody looked at the frames in between, all that is left of them is
+    // the NMI of their vblank
+    if (frame > this->frame + 1 && (this->ctrl & PPUCTRL_NMI)) {
+      this->nmiPending = true;
+    }
+    this->frame = frame;
+    this->dot = 0;
+  }
+  runEvents(dot);
+  updateNextEvent();
+}
+
+void PPU::runEvents(uint32_t until) {
+  while (this->dot < until) {
+    uint32_t next = nextEventDot(this->dot);
+    if (next >= until) {
+      break;
+    }
+    runEvent(next);
+    this->dot = next + 1;
+  }
+  this->dot = until;
+}
+
+uint32_t PPU::nextEventDot(uint32_t from) const {
+  uint32_t next = PPU_DOTS_PER_FRAME;
+  if (this->mask & (PPUMASK_BACKGROUND | PPUMASK_SPRITES)) {
+    uint32_t line =
+        (from + PPU_DOTS_PER_LINE - 1) / PPU_DOTS_PER_LINE * PPU_DOTS_PER_LINE;
+    if (line < FIRST_INVISIBLE_DOT) {
+      next = line;
+    }
+  }
+  if (this->sprite0Dot >= from) {
+    next = std::min(next, this->sprite0Dot);
+  }
+  if (from <= PPU_VBLANK_DOT) {
+    next = std::min<uint32_t>(next, PPU_VBLANK_DOT);
+  } else if (from <= PPU_PRERENDER_DOT) {
+    next = std::min<uint32_t>(next, PPU_PRERENDER_DOT);
+  }
+  return next;
+}
+
+void PPU::runEvent(uint32_t eventDot) {
+  if (eventDot < FIRST_INVISIBLE_DOT && eventDot % PPU_DOTS_PER_LINE == 0 &&
+      (this->mask & (PPUMASK_BACKGROUND | PPUMASK_SPRITES))) {
+    renderLine(eventDot / PPU_DOTS_PER_LINE);
+  } else if (eventDot == this->sprite0Dot) {
+    this->status |= PPUSTATUS_SPRITE_0;
+    this->sprite0Dot = NO_SPRITE_0_HIT;
+  } else if (eventDot == PPU_VBLANK_DOT) {
+    this->status |= PPUSTATUS_VBLANK;
+    if (this->ctrl & PPUCTRL_NMI) {
+      this->nmiPending = true;
+    }
+  } else if (eventDot == PPU_PRERENDER_DOT) {
+    this->status &= ~(PPUSTATUS_VBLANK | PPUSTATUS_SPRITE_0);
+    this->sprite0Dot = NO_SPRITE_0_HIT;
+  }
+}
+
+void PPU::renderLine(uint32_t line) {
+  if (line == 0) {
+    // Vertical bits are copied on the pre-render line, horizontal ones at
+    // the end of every line
+    this->v = this->t;
+  } else {
+    this->v = (this->v & ~0x041F) | (this->t & 0x041F);
+  }
+  if (this->drawing || hasSprite0(line)) {
+    drawLine(line);
+  }
+
+  // Fine Y, then coarse Y wrapping into the vertically adjacent nametable
+  if ((this->v & 0x7000) != 0x7000) {
+    this->v += 0x1000;
+  } else {
+    this->v &= ~0x7000;
+    uint16_t coarseY = (this->v >> 5) & 0x1F;
+    if (coarseY == 29) {
+      coarseY = 0;
+      this->v ^= 0x0800;
+    } else if (coarseY == 31) {
+      coarseY = 0;
+    } else {
+      coarseY++;
+    }
+    this->v = (this->v & ~0x03E0) | coarseY << 5;
+  }
+}
+
+// Whether sprite 0 can still hit on the line, the only thing drawing it
+// tells the CPU
+bool PPU::hasSprite0(uint32_t line) const {
+  if ((this->mask & (PPUMASK_BACKGROUND | PPUMASK_SPRITES)) !=
+          (PPUMASK_BACKGROUND | PPUMASK_SPRITES) ||
+      (this->status & PPUSTATUS_SPRITE_0) ||
+      this->sprite0Dot != NO_SPRITE_0_HIT) {
+    return false;
+  }
+  int height = this->ctrl & PPUCTRL_SPRITE_16 ? 16 : 8;
+  int row = static_cast<int>(line) - this->oam[0] - 1;
+  return row >= 0 && row < height;
+}
+
+void PPU::drawLine(uint32_t line) {
+  // Palette entry per pixel, 0 where transparent
+  uint8_t background[PPU_FRAME_WIDTH] = {};
+  if (this->mask & PPUMASK_BACKGROUND) {
+    uint16_t address = this->v;
+    uint16_t table = this->ctrl & PPUCTRL_BACKGROUND_TABLE ? 0x1000 : 0;
+    // 33 tiles, the first and last only partly visible when fine X is set
+    for (int tile = 0; tile < 33; tile++) {
+      uint8_t index = readVram(0x2000 | (address & 0x0FFF));
+      uint8_t attribute = readVram(0x23C0 | (address & 0x0C00) |
+                                   ((address >> 4) & 0x38) |
+                                   ((address >> 2) & 0x07));
+      uint8_t shift = ((address >> 4) & 4) | (address & 2);
+      uint8_t palette = ((attribute >> shift) & 3) << 2;
+      uint16_t pattern = table | index << 4 | ((address >> 12) & 7);
+      uint8_t low = readChr(pattern);
+      uint8_t high = readChr(pattern + 8);
+      if (this->codeDataLogger != nullptr) {
+        this->codeDataLogger->logChrDrawn(pattern);
+      }
+      for (int bit = 0; bit < 8; bit++) {
+        int x = tile * 8 + bit - this->fineX;
+        int shift = 7 - bit;
+        uint8_t color = ((low >> shift) & 1) | ((high >> shift) & 1) << 1;
+        if (x >= 0 && x < PPU_FRAME_WIDTH && color != 0) {
+          background[x] = palette | color;
+        }
+      }
+      // Coarse X, wrapping into the horizontally adjacent nametable
+      if ((address & 0x1F) == 31) {
+        address = (address & ~0x1F) ^ 0x0400;
+      } else {
+        address++;
+      }
+    }
+    if (!(this->mask & PPUMASK_BACKGROUND_LEFT)) {
+      memset(background, 0, 8);
+    }
+  }
+
+  uint8_t sprites[PPU_FRAME_WIDTH] = {};
+  bool behind[PPU_FRAME_WIDTH] = {};
+  if (this->mask & PPUMASK_SPRITES) {
+    int height = this->ctrl & PPUCTRL_SPRITE_16 ? 16 : 8;
+    int found = 0;
+    for (int sprite = 0; sprite < 64 && found < 8; sprite++) {
+      const uint8_t *entry = this->oam.data() + sprite * 4;
+      // Sprites show from the line after their Y
+      int row = static_cast<int>(line) - entry[0] - 1;
+      if (row < 0 || row >= height) {
+        continue;
+      }
+      found++;
+      uint8_t index = entry[1];
+      uint8_t attributes = entry[2];
+      if (attributes & 0x80) {
+        row = height - 1 - row;
+      }
+      uint16_t pattern;
+      if (height == 16) {
+        pattern = (index & 1) << 12 | (index & 0xFE) << 4 | (row & 8) << 1 |
+                  (row & 7);
+      } else {
+        pattern = (this->ctrl & PPUCTRL_SPRITE_TABLE ? 0x1000 : 0) |
+                  index << 4 | row;
+      }
+      uint8_t low = readChr(pattern);
+      uint8_t high = readChr(pattern + 8);
+      if (this->codeDataLogger != nullptr) {
+        this->codeDataLogger->logChrDrawn(pattern);
+      }
+      for (int bit = 0; bit < 8; bit++) {
+        int x = entry[3] + bit;
+        int shift = attributes & 0x40 ? bit : 7 - bit;
+        uint8_t color = ((low >> shift) & 1) | ((high >> shift) & 1) << 1;
+        if (x >= PPU_FRAME_WIDTH || color == 0 ||
+            (x < 8 && !(this->mask & PPUMASK_SPRITES_LEFT))) {
+          continue;
+        }
+        if (sprite == 0 && background[x] != 0 && x != 255 &&
+            !(this->status & PPUSTATUS_SPRITE_0) &&
+            this->sprite0Dot == NO_SPRITE_0_HIT) {
+          this->sprite0Dot = line * PPU_DOTS_PER_LINE + x + 1;
+        }
+        // Lower sprites win, even if they are behind the background
+        if (sprites[x] == 0) {
+          sprites[x] = 0x10 | (attributes & 3) << 2 | color;
+          behind[x] = attributes & 0x20;
+        }
+      }
+    }
+  }
+
+  if (!this->drawing) {
+    return;
+  }
+  if (this->framebuffer == nullptr) {
+    this->framebuffer = std::make_shared<Framebuffer>();
+    this->framebuffer->fill(0);
+  } else if (this->framebuffer.use_count() != 1) {
+    this->framebuffer = std::make_shared<Framebuffer>(*this->framebuffer);
+  }
+  uint8_t *pixels = this->framebuffer->data() + line * PPU_FRAME_WIDTH;
+  uint8_t gray = this->mask & PPUMASK_GRAYSCALE ? 0x30 : 0x3F;
+  for (int x = 0; x < PPU_FRAME_WIDTH; x++) {
+    uint8_t entry = background[x];
+    if (sprites[x] != 0 && (entry == 0 || !behind[x])) {
+      entry = sprites[x];
+    }
+    pixels[x] = this->palette[entry] & gray;
+  }
+}
+
+void PPU::updateNextEvent() {
+  if (this->nmiPending) {
+    this->nextEvent = 0;
+  } else if (this->ctrl & PPUCTRL_NMI) {
+    uint64_t frame = this->frame + (this->dot > PPU_VBLANK_DOT);
+    this->nextEvent = cycleOfDot(frame, PPU_VBLANK_DOT);
+  } else {
+    this->nextEvent = UINT64_MAX;
+  }
+}
+
+bool PPU::takeNmi(uint64_t cycle) {
+  catchUp(cycle);
+  if (!this->nmiPending) {
+    return false;
+  }
+  this->nmiPending = false;
+  updateNextEvent();
+  return true;
+}
+
+uint64_t PPU::getNextChange(uint64_t cycle) const {
+  uint64_t frame = cycle / CYCLES_PER_FRAME;
+  uint32_t dot = cycle % CYCLES_PER_FRAME * 3 + 1;
+  uint64_t next = this->nextEvent;
+  next = std::min(next, cycleOfDot(frame + (dot > PPU_VBLANK_DOT),
+                                   PPU_VBLANK_DOT));
+  next = std::min(next, cycleOfDot(frame + (dot > PPU_PRERENDER_DOT),
+                                   PPU_PRERENDER_DOT));
+  // Sprite 0 can only hit on the lines it covers
+  uint32_t first = (this->oam[0] + 1) * PPU_DOTS_PER_LINE;
+  if ((this->mask & (PPUMASK_BACKGROUND | PPUMASK_SPRITES)) ==
+          (PPUMASK_BACKGROUND | PPUMASK_SPRITES) &&
+      first < FIRST_INVISIBLE_DOT) {
+    uint32_t height = this->ctrl & PPUCTRL_SPRITE_16 ? 16 : 8;
+    uint32_t last = std::min<uint32_t>(first + height * PPU_DOTS_PER_LINE,
+                                       FIRST_INVISIBLE_DOT);
+    if (dot < last) {
+      next = std::min(next, std::max(cycle + 1, cycleOfDot(frame, first)));
+    } else {
+      next = std::min(next, cycleOfDot(frame + 1, first));
+    }
+  }
+  return next;
+}
+
+uint8_t PPU::readRegister(uint16_t address, uint64_t cycle) {
+  catchUp(cycle);
+  switch (address & 7) {
+  // PPUSTATUS, reading it ends the vblank flag and resets the write toggle
+  case 2:
+    this->latch = (this->status & 0xE0) | (this->latch & 0x1F);
+    this->status &= ~PPUSTATUS_VBLANK;
+    this->writeToggle = false;
+    break;
+  // OAMDATA
+  case 4:
+    this->latch = this->oam[this->oamAddress];
+    break;
+  // PPUDATA, buffered except for the palette
+  case 7: {
+    uint16_t vramAddress = this->v & 0x3FFF;
+    if (vramAddress >= 0x3F00) {
+      this->latch = readVram(vramAddress);
+      // The buffer gets the nametable byte under the palette
+      this->readBuffer = readVram(vramAddress - 0x1000);
+    } else {
+      this->latch = this->readBuffer;
+      this->readBuffer = readVram(vramAddress);
+      if (vramAddress < 0x2000 && this->codeDataLogger != nullptr) {
+        this->codeDataLogger->logChrRead(vramAddress);
+      }
+    }
+    this->v += this->ctrl & PPUCTRL_INCREMENT_32 ? 32 : 1;
+    break;
+  }
+  }
+  return this->latch;
+}
+
+uint8_t PPU::peekRegister(uint16_t address, uint64_t cycle) {
+  catchUp(cycle);
+  switch (address & 7) {
+  case 2:
+    return (this->status & 0xE0) | (this->latch & 0x1F);
+  case 4:
+    return this->oam[this->oamAddress];
+  case 7: {
+    uint16_t vramAddress = this->v & 0x3FFF;
+    return vramAddress >= 0x3F00 ? readVram(vramAddress) : this->readBuffer;
+  }
+  }
+  return this->latch;
+}
+
+void PPU::writeRegister(uint16_t address, uint8_t data, uint64_t cycle) {
+  catchUp(cycle);
+  this->latch = data;
+  switch (address & 7) {
+  // PPUCTRL, turning NMIs on during vblank fires one straight away
+  case 0:
+    if (!(this->ctrl & PPUCTRL_NMI) && (data & PPUCTRL_NMI) &&
+        (this->status & PPUSTATUS_VBLANK)) {
+      this->nmiPending = true;
+    }
+    this->ctrl = data;
+    this->t = (this->t & ~0x0C00) | (data & 3) << 10;
+    break;
+  // PPUMASK
+  case 1:
+    this->mask = data;
+    break;
+  // OAMADDR
+  case 3:
+    this->oamAddress = data;
+    break;
+  // OAMDATA
+  case 4:
+    this->oam[this->oamAddress++] = data;
+    break;
+  // PPUSCROLL, X then Y
+  case 5:
+    if (!this->writeToggle) {
+      this->t = (this->t & ~0x001F) | data >> 3;
+      this->fineX = data & 7;
+    } else {
+      this->t = (this->t & ~0x73E0) | (data & 0xF8) << 2 | (data & 7) << 12;
+    }
+    this->writeToggle = !this->writeToggle;
+    break;
+  // PPUADDR, high byte then low byte
+  case 6:
+    if (!this->writeToggle) {
+      this->t = (this->t & 0x00FF) | (data & 0x3F) << 8;
+    } else {
+      this->t = (this->t & 0xFF00) | data;
+      this->v = this->t;
+    }
+    this->writeToggle = !this->writeToggle;
+    break;
+  // PPUDATA
+  case 7:
+    writeVram(this->v & 0x3FFF, data);
+    this->v += this->ctrl & PPUCTRL_INCREMENT_32 ? 32 : 1;
+    break;
+  }
+  updateNextEvent();
+}
+
+void PPU::writeOam(const uint8_t *data, uint64_t cycle) {
+  catchUp(cycle);
+  for (int i = 0; i < 256; i++) {
+    this->oam[(this->oamAddress + i) & 0xFF] = data[i];
+  }
+}
+
+const uint8_t *PPU::getFramebuffer() const {
+  return this->framebuffer != nullptr ? this->framebuffer->data() : nullptr;
+}
+
+uint16_t PPU::nametableIndex(uint16_t address) const {
+  uint16_t index = address & 0x0FFF;
+  // Four screen carts bring their own 2KB, which isn't emulated, they see
+  // vertical mirroring
+  if (this->rom != nullptr && this->rom->screenMirroring == HORIZONTAL) {
+    return (index >> 1 & 0x0400) | (index & 0x03FF);
+  }
+  return index & 0x07FF;
+}
+
+uint8_t PPU::readChr(uint16_t address) const {
+  if (this->rom != nullptr && !this->rom->chrRom.empty()) {
+    return this->rom->chrRom[address % this->rom->chrRom.size()];
+  }
+  return this->chrRam != nullptr ? (*this->chrRam)[address] : 0;
+}
+
+uint8_t PPU::readVram(uint16_t address) const {
+  if (address < 0x2000) {
+    return readChr(address);
+  } else if (address < 0x3F00) {
+    return this->vram[nametableIndex(address)];
+  }
+  // $3F10/$3F14/$3F18/$3F1C mirror the backdrop entries
+  uint8_t index = address & 0x1F;
+  return this->palette[(index & 0x13) == 0x10 ? index & 0x0F : index];
+}
+
+void PPU::writeVram(uint16_t address, uint8_t data) {
+  if (address < 0x2000) {
+    if (this->rom != nullptr && !this->rom->chrRom.empty()) {
+      return;
+    }
+    if (this->chrRam == nullptr) {
+      this->chrRam = std::make_shared<ChrRam>();
+      this->chrRam->fill(0);
+    } else if (this->chrRam.use_count() != 1) {
+      this->chrRam = std::make_shared<ChrRam>(*this->chrRam);
+    }
+    (*this->chrRam)[address] = data;
+  } else if (address < 0x3F00) {
+    this->vram[nametableIndex(address)] = data;
+  } else {
+    uint8_t index = address & 0x1F;
+    this->palette[(index & 0x13) == 0x10 ? index & 0x0F : index] = data;
+  }
+}
+
+uint64_t PPU::hashState(uint64_t seed) const {
+  uint64_t registers = static_cast<uint64_t>(this->v) |
+                       static_cast<uint64_t>(this->t) << 16 |
+                       static_cast<uint64_t>(this->ctrl) << 32 |
+                       static_cast<uint64_t>(this->mask) << 40 |
+                       static_cast<uint64_t>(this->status) << 48 |
+                       static_cast<uint64_t>(this->oamAddress) << 56;
+  uint64_t latches = static_cast<uint64_t>(this->fineX) |
+                     static_cast<uint64_t>(this->writeToggle) << 8 |
+                     static_cast<uint64_t>(this->readBuffer) << 16 |
+                     static_cast<uint64_t>(this->latch) << 24 |
+                     static_cast<uint64_t>(this->nmiPending) << 32 |
+                     static_cast<uint64_t>(this->dot) << 40;
+  uint64_t hash = mixHash(seed ^ mixHash(registers) ^
+                          mixHash(latches ^ this->sprite0Dot));
+  hash = hashBytes(this->vram.data(), this->vram.size(), hash);
+  hash = hashBytes(this->palette.data(), this->palette.size(), hash);
+  hash = hashBytes(this->oam.data(), this->oam.size(), hash);
+  if (this->chrRam != nullptr) {
+    hash = hashBytes(this->chrRam->data(), this->chrRam->size(), hash);
+  }
+  return hash;
+}
+
+void PPU::saveState(PpuState &state) const {
+  state.frame = this->frame;
+  state.dot = this->dot;
+  state.sprite0Dot = this->sprite0Dot;
+  state.v = this->v;
+  state.t = this->t;
+  state.ctrl = this->ctrl;
+  state.mask = this->mask;
+  state.status = this->status;
+  state.oamAddress = this->oamAddress;
+  state.fineX = this->fineX;
+  state.writeToggle = this->writeToggle;
+  state.readBuffer = this->readBuffer;
+  state.latch = this->latch;
+  state.nmiPending = this->nmiPending;
+  state.chrRamUsed = this->chrRam != nullptr;
+  memset(state.padding, 0, sizeof(state.padding));
+  memcpy(state.vram, this->vram.data(), sizeof(state.vram));
+  memcpy(state.palette, this->palette.data(), sizeof(state.palette));
+  memcpy(state.oam, this->oam.data(), sizeof(state.oam));
+  if (this->chrRam != nullptr) {
+    memcpy(state.chrRam, this->chrRam->data(), sizeof(state.chrRam));
+  } else {
+    memset(state.chrRam, 0, sizeof(state.chrRam));
+  }
+}
+
+void PPU::loadState(const PpuState &state) {
+  this->frame = state.frame;
+  this->dot = state.dot;
+  this->sprite0Dot = state.sprite0Dot;
+  this->v = state.v;
+  this->t = state.t;
+  this->ctrl = state.ctrl;
+  this->mask = state.mask;
+  this->status = state.status;
+  this->oamAddress = state.oamAddress;
+  this->fineX = state.fineX;
+  this->writeToggle = state.writeToggle;
+  this->readBuffer = state.readBuffer;
+  this->latch = state.latch;
+  this->nmiPending = state.nmiPending;
+  memcpy(this->vram.data(), state.vram, sizeof(state.vram));
+  memcpy(this->palette.data(), state.palette, sizeof(state.palette));
+  memcpy(this->oam.data(), state.oam, sizeof(state.oam));
+  // Allocated or not as it was, hashes only cover it once allocated
+  bool hasChrRom = this->rom != nullptr && !this->rom->chrRom.empty();
+  if (hasChrRom || !state.chrRamUsed) {
+    this->chrRam = nullptr;
+  } else {
+    this->chrRam = std::make_shared<ChrRam>();
+    memcpy(this->chrRam->data(), state.chrRam, sizeof(state.chrRam));
+  }
+  updateNextEvent();
+}
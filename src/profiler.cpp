@@ -0,0 +1,215 @@
+#include "profiler.hpp"
+#include "cpu.hpp"
+#include "disassembler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+// Function id of the code running outside of any call we have seen
+#define ROOT_FUNCTION 0x10000
+
+static std::string functionName(uint32_t function) {
+  if (function == ROOT_FUNCTION) {
+    return "root";
+  }
+  char temp[10];
+  std::snprintf(temp, sizeof(temp), "sub_%04X", function);
+  return temp;
+}
+
+Profiler::Profiler() { reset(); }
+
+void Profiler::reset() {
+  this->instructions.assign(0x10000, 0);
+  this->cycles.assign(0x10000, 0);
+  this->owner.assign(0x10000, ROOT_FUNCTION);
+  this->totalCycles = 0;
+  this->totalInstructions = 0;
+  this->pairs.assign(0x10000, 0);
+  // Out of range until the first instruction
+  this->fallThrough = 0x10000;
+  this->previousOpcode = 0;
+  this->nodes.clear();
+  this->nodes.push_back(CallNode{0, ROOT_FUNCTION, 0, {}});
+  this->stack.clear();
+  this->edges.clear();
+}
+
+uint32_t Profiler::currentFunction() const {
+  return this->stack.empty() ? ROOT_FUNCTION : this->stack.back().function;
+}
+
+void Profiler::record(uint16_t pc, uint8_t opcode, uint8_t cycles,
+                      uint16_t nextPc, uint8_t sp) {
+  this->instructions[pc]++;
+  this->cycles[pc] += cycles;
+  this->totalInstructions++;
+  this->totalCycles += cycles;
+  this->owner[pc] = currentFunction();
+  this->nodes[this->stack.empty() ? 0 : this->stack.back().node].selfCycles +=
+      cycles;
+  if (pc == this->fallThrough) {
+    this->pairs[this->previousOpcode << 8 | opcode]++;
+  }
+  this->previousOpcode = opcode;
+  this->fallThrough = nextPc == pc + CPU::lookupTable[opcode].bytes
+                          ? nextPc
+                          : 0x10000;
+
+  switch (opcode) {
+  // JSR, the return address is already pushed so the caller's stack pointer
+  // is two bytes up
+  case 0x20:
+    call(pc, nextPc, static_cast<uint8_t>(sp + 2));
+    break;
+  // RTS, RTI
+  case 0x60:
+  case 0x40:
+    unwind(sp);
+    break;
+  }
+}
+
+void Profiler::enterInterrupt(uint16_t from, uint16_t handler, uint8_t sp) {
+  call(from, handler, sp);
+}
+
+void Profiler::call(uint16_t callSite, uint16_t function, uint8_t sp) {
+  uint32_t parent = this->stack.empty() ? 0 : this->stack.back().node;
+  uint32_t node;
+  auto child = this->nodes[parent].children.find(function);
+  if (child == this->nodes[parent].children.end()) {
+    node = this->nodes.size();
+    this->nodes[parent].children[function] = node;
+    this->nodes.push_back(CallNode{parent, function, 0, {}});
+  } else {
+    node = child->second;
+  }
+  this->edges[{callSite, function}].calls++;
+  this->stack.push_back(Frame{function, callSite, sp, node, this->totalCycles,
+                              this->totalInstructions});
+}
+
+void Profiler::unwind(uint8_t sp) {
+  // Pop every frame whose stack space has been released. This also cleans up
+  // after code that discards return addresses or returns past its caller.
+  while (!this->stack.empty() && this->stack.back().sp <= sp) {
+    const Frame &frame = this->stack.back();
+    CallEdge &edge = this->edges[{frame.callSite, frame.function}];
+    edge.inclusiveCycles += this->totalCycles - frame.entryCycles;
+    edge.inclusiveInstructions +=
+        this->totalInstructions - frame.entryInstructions;
+    this->stack.pop_back();
+  }
+}
+
+std::vector<std::pair<uint16_t, uint64_t>> Profiler::hottest(size_t n) const {
+  std::vector<std::pair<uint16_t, uint64_t>> result;
+  for (uint32_t pc = 0; pc < 0x10000; pc++) {
+    if (this->cycles[pc] != 0) {
+      result.push_back({static_cast<uint16_t>(pc), this->cycles[pc]});
+    }
+  }
+  auto hotter = [](const std::pair<uint16_t, uint64_t> &a,
+                   const std::pair<uint16_t, uint64_t> &b) {
+    return a.second > b.second;
+  };
+  n = std::min(n, result.size());
+  std::partial_sort(result.begin(), result.begin() + n, result.end(), hotter);
+  result.resize(n);
+  return result;
+}
+
+std::vector<std::pair<uint16_t, uint64_t>>
+Profiler::commonestPairs(size_t n) const {
+  std::vector<std::pair<uint16_t, uint64_t>> result;
+  for (uint32_t pair = 0; pair < 0x10000; pair++) {
+    if (this->pairs[pair] != 0) {
+      result.push_back({static_cast<uint16_t>(pair), this->pairs[pair]});
+    }
+  }
+  auto commoner = [](const std::pair<uint16_t, uint64_t> &a,
+                     const std::pair<uint16_t, uint64_t> &b) {
+    return a.second > b.second;
+  };
+  n = std::min(n, result.size());
+  std::partial_sort(result.begin(), result.begin() + n, result.end(),
+                    commoner);
+  result.resize(n);
+  return result;
+}
+
+void Profiler::writePairs(std::ostream &out, size_t n) const {
+  for (const auto &[pair, count] : commonestPairs(n)) {
+    uint8_t first = pair >> 8;
+    uint8_t second = pair & 0xFF;
+    double share =
+        100.0 * count / std::max<uint64_t>(this->totalInstructions, 1);
+    char line[96];
+    std::snprintf(line, sizeof(line), "%02X %-3s  %02X %-3s %12llu %6.2f%%%s\n",
+                  first, CPU::lookupTable[first].name.c_str(), second,
+                  CPU::lookupTable[second].name.c_str(),
+                  static_cast<unsigned long long>(count), share,
+                  CPU::isFused(first, second) ? "  fused" : "");
+    out << line;
+  }
+}
+
+void Profiler::writeCallgrind(std::ostream &out,
+                              Disassembler *disassembler) const {
+  out << "# callgrind format\n";
+  out << "version: 1\n";
+  out << "creator: cnes profiler\n";
+  out << "positions: instr\n";
+  out << "events: Instructions Cycles\n";
+  out << "summary: " << this->totalInstructions << " " << this->totalCycles
+      << "\n";
+
+  std::map<uint32_t, std::vector<uint16_t>> functions;
+  for (uint32_t pc = 0; pc < 0x10000; pc++) {
+    if (this->instructions[pc] != 0) {
+      functions[this->owner[pc]].push_back(pc);
+    }
+  }
+  std::map<uint32_t, std::vector<std::pair<uint16_t, uint16_t>>> calls;
+  for (const auto &edge : this->edges) {
+    calls[this->owner[edge.first.first]].push_back(edge.first);
+  }
+
+  char temp[64];
+  for (const auto &function : functions) {
+    out << "\nfn=" << functionName(function.first) << "\n";
+    for (uint16_t pc : function.second) {
+      const char *text =
+          disassembler != nullptr ? disassembler->format(pc) : nullptr;
+      if (text != nullptr) {
+        out << "# " << text << "\n";
+      }
+      std::snprintf(temp, sizeof(temp), "0x%04X ", pc);
+      out << temp << this->instructions[pc] << " " << this->cycles[pc] << "\n";
+    }
+    for (const auto &key : calls[function.first]) {
+      const CallEdge &edge = this->edges.at(key);
+      out << "cfn=" << functionName(key.second) << "\n";
+      std::snprintf(temp, sizeof(temp), "calls=%llu 0x%04X\n0x%04X ",
+                    static_cast<unsigned long long>(edge.calls), key.second,
+                    key.first);
+      out << temp << edge.inclusiveInstructions << " " << edge.inclusiveCycles
+          << "\n";
+    }
+  }
+}
+
+void Profiler::writeFoldedStacks(std::ostream &out) const {
+  for (const CallNode &node : this->nodes) {
+    if (node.selfCycles == 0) {
+      continue;
+    }
+    std::string path = functionName(node.function);
+    for (const CallNode *current = &node; current != &this->nodes[0];) {
+      current = &this->nodes[current->parent];
+      path = functionName(current->function) + ";" + path;
+    }
+    out << path << " " << node.selfCycles << "\n";
+  }
+}
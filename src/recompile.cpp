@@ -0,0 +1,58 @@
+#include "bus.hpp"
+#include "codedatalogger.hpp"
+#include "recompiler.hpp"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+// Static recompiler, writes C++ for the ROM that a binary can be linked with
+// to run it compiled instead of interpreted, see Recompiler.
+//
+//   nes_recompile <rom> <output.cpp> [<log.cdl>]
+//
+// A code/data log of the game (nes_headless --cdl) adds the indirect jump
+// targets in it as functions, otherwise they are interpreted.
+//
+// nes_add_recompiled_core in CMakeLists.txt runs it as part of the build.
+
+int main(int argc, char *argv[]) {
+  if (argc != 3 && argc != 4) {
+    std::cout << "usage: nes_recompile <rom> <output.cpp> [<log.cdl>]\n";
+    return 1;
+  }
+  std::string romPath = argv[1];
+  std::ifstream input(romPath, std::ios::binary);
+  std::vector<uint8_t> buffer(std::istreambuf_iterator<char>(input), {});
+  if (buffer.empty()) {
+    std::cout << "Could not read " << romPath << "\n";
+    return 1;
+  }
+  if (!Bus::readBytes(buffer).has_value()) {
+    std::cout << romPath << " is not an iNES ROM\n";
+    return 1;
+  }
+  Bus bus = Bus(buffer);
+  Recompiler recompiler = Recompiler(bus.getRom(), bus.getRomHash());
+  if (argc == 4) {
+    CodeDataLogger log = CodeDataLogger(bus.getRom());
+    if (!log.load(argv[3])) {
+      return 1;
+    }
+    for (uint16_t target : log.getIndirectTargets()) {
+      recompiler.addEntryPoint(target);
+    }
+  }
+  if (!recompiler.analyze()) {
+    return 1;
+  }
+  std::ofstream output(argv[2]);
+  recompiler.write(output, romPath);
+  if (!output) {
+    std::cout << "Could not write " << argv[2] << "\n";
+    return 1;
+  }
+  std::cerr << recompiler.getFunctionCount() << " functions, "
+            << recompiler.getInstructionCount() << " instructions, "
+            << recompiler.getFallbackCount() << " left to the interpreter\n";
+  return 0;
+}
@@ -0,0 +1,234 @@
+#include "recompiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+
+#define OPCODE_BRK 0x00
+#define OPCODE_JSR 0x20
+#define OPCODE_RTI 0x40
+#define OPCODE_JMP 0x4C
+#define OPCODE_RTS 0x60
+#define OPCODE_JMP_INDIRECT 0x6C
+
+// BRK stops the run and JMP indirect goes somewhere only known at run time,
+// CPU::step takes care of both
+static bool isFallback(const DecodedInstruction *entry) {
+  return (entry->flags & DecodedInstruction::UNKNOWN) ||
+         entry->opcode == OPCODE_BRK || entry->opcode == OPCODE_JMP_INDIRECT;
+}
+
+static bool isBranch(uint8_t opcode) {
+  // All of the branches are encoded as xxx10000
+  return (opcode & 0x1F) == 0x10;
+}
+
+// Instructions after which PC isn't simply the next instruction
+static bool isControl(uint8_t opcode) {
+  return isBranch(opcode) || opcode == OPCODE_JSR || opcode == OPCODE_RTI ||
+         opcode == OPCODE_JMP || opcode == OPCODE_RTS;
+}
+
+// Where PC can be right after the instruction, as far as the ROM tells
+static void jumpTargets(uint16_t address, const DecodedInstruction *entry,
+                        std::vector<uint16_t> &targets) {
+  uint16_t next = address + entry->bytes;
+  if (isBranch(entry->opcode)) {
+    targets.push_back(next + static_cast<int8_t>(entry->operand));
+    targets.push_back(next);
+  } else if (entry->opcode == OPCODE_JMP || entry->opcode == OPCODE_JSR) {
+    targets.push_back(entry->operand);
+  } else if (!isControl(entry->opcode)) {
+    targets.push_back(next);
+  }
+}
+
+static std::string hex(uint16_t value) {
+  char text[8];
+  std::snprintf(text, sizeof(text), "0x%04X", value);
+  return text;
+}
+
+static std::string label(uint16_t address) {
+  char text[8];
+  std::snprintf(text, sizeof(text), "L_%04X", address);
+  return text;
+}
+
+static std::string functionName(uint16_t entry) {
+  char text[12];
+  std::snprintf(text, sizeof(text), "aot_%04X", entry);
+  return text;
+}
+
+Recompiler::Recompiler(std::shared_ptr<const Rom> rom, uint64_t romHash)
+    : rom(rom), romHash(romHash), disassembler(rom) {
+  this->instructionCount = 0;
+  this->fallbackCount = 0;
+}
+
+uint16_t Recompiler::readVector(uint16_t address) const {
+  const std::vector<uint8_t> &prg = this->rom->progRom;
+  return prg[(address - 0x8000) % prg.size()] |
+         prg[(address + 1 - 0x8000) % prg.size()] << 8;
+}
+
+uint32_t Recompiler::ownerOf(uint16_t address) const {
+  return address < 0x8000 ? 0 : this->owners[address - 0x8000];
+}
+
+bool Recompiler::analyze() {
+  if (this->rom->progRom.empty()) {
+    std::cout << "No PRG ROM to recompile\n";
+    return false;
+  }
+  // Code in other banks can't be told apart by its address
+  if (this->rom->mapper != 0) {
+    std::cout << "Only NROM games can be recompiled, this one uses mapper "
+              << static_cast<int>(this->rom->mapper) << "\n";
+    return false;
+  }
+  this->functions.clear();
+  this->owners.assign(0x8000, 0);
+  this->fallbacks.assign(0x8000, false);
+  this->instructionCount = 0;
+  this->fallbackCount = 0;
+
+  std::deque<uint16_t> entries;
+  for (uint16_t vector : {NMI_VECTOR, RESET_VECTOR, IRQ_VECTOR}) {
+    entries.push_back(readVector(vector));
+  }
+  entries.insert(entries.end(), this->entryPoints.begin(),
+                 this->entryPoints.end());
+  std::vector<uint16_t> pending, targets;
+  while (!entries.empty()) {
+    Function function;
+    function.entry = entries.front();
+    entries.pop_front();
+    uint32_t owner = this->functions.size() + 1;
+    pending.assign(1, function.entry);
+    while (!pending.empty()) {
+      uint16_t address = pending.back();
+      pending.pop_back();
+      if (address < 0x8000 || ownerOf(address) != 0 ||
+          this->fallbacks[address - 0x8000]) {
+        continue;
+      }
+      const DecodedInstruction *entry = this->disassembler.lookup(address);
+      if (isFallback(entry)) {
+        this->fallbacks[address - 0x8000] = true;
+        this->fallbackCount++;
+        continue;
+      }
+      this->owners[address - 0x8000] = owner;
+      function.instructions.push_back(address);
+      targets.clear();
+      if (entry->opcode == OPCODE_JSR) {
+        // The subroutine is a function of its own, RTS comes back here
+        entries.push_back(entry->operand);
+        uint16_t next = address + entry->bytes;
+        if (next > address) {
+          targets.push_back(next);
+        }
+      } else {
+        jumpTargets(address, entry, targets);
+      }
+      pending.insert(pending.end(), targets.begin(), targets.end());
+    }
+    if (function.instructions.empty()) {
+      continue;
+    }
+    std::sort(function.instructions.begin(), function.instructions.end());
+    this->instructionCount += function.instructions.size();
+    this->functions.push_back(std::move(function));
+  }
+  return true;
+}
+
+void Recompiler::writeFunction(std::ostream &out, size_t index) {
+  const Function &function = this->functions[index];
+  uint32_t owner = index + 1;
+  out << "static bool " << functionName(function.entry)
+      << "(CPU &cpu, uint64_t until, uint16_t &last) {\n"
+      << "  uint64_t start = cpu.cycles;\n"
+      << "  switch (cpu.PC) {\n";
+  for (uint16_t address : function.instructions) {
+    out << "  case " << hex(address) << ": goto " << label(address) << ";\n";
+  }
+  out << "  default: return false;\n"
+      << "  }\n";
+
+  std::vector<uint16_t> targets;
+  for (size_t i = 0; i < function.instructions.size(); i++) {
+    uint16_t address = function.instructions[i];
+    const DecodedInstruction *entry = this->disassembler.lookup(address);
+    const CPU::instruction *ins =
+        this->disassembler.getInstruction(entry->opcode);
+    char execute[64];
+    std::snprintf(execute, sizeof(execute), "aotExecute<0x%02X, %d, %d>",
+                  entry->opcode, ins->bytes, ins->cycles);
+    out << label(address) << ": // " << this->disassembler.format(address)
+        << "\n"
+        << "  if (aotStop(cpu, until)) return aotLeave(cpu, " << hex(address)
+        << ", start);\n"
+        << "  " << execute << "(cpu, " << hex(address) << ");\n";
+
+    bool followed = i + 1 < function.instructions.size();
+    uint16_t following = followed ? function.instructions[i + 1] : 0;
+    targets.clear();
+    jumpTargets(address, entry, targets);
+    if (!isControl(entry->opcode)) {
+      uint16_t next = targets[0];
+      if (next <= address || ownerOf(next) != owner) {
+        out << "  return true;\n";
+      } else if (!followed || following != next) {
+        out << "  goto " << label(next) << ";\n";
+      }
+      continue;
+    }
+    // Only forward, going back returns so runFrame sees the loop
+    for (uint16_t target : targets) {
+      if (target > address && ownerOf(target) == owner) {
+        out << "  if (cpu.PC == " << hex(target) << ") goto "
+            << label(target) << ";\n";
+      }
+    }
+    out << "  last = " << hex(address) << ";\n"
+        << "  return true;\n";
+  }
+  out << "}\n\n";
+}
+
+void Recompiler::write(std::ostream &out, const std::string &source) {
+  out << "// Generated by nes_recompile from " << source
+      << ", do not edit.\n"
+      << "// " << this->functions.size() << " functions, "
+      << this->instructionCount << " instructions, " << this->fallbackCount
+      << " left to the interpreter\n"
+      << "#include \"aot.hpp\"\n\n";
+  for (size_t i = 0; i < this->functions.size(); i++) {
+    writeFunction(out, i);
+  }
+
+  char hash[24];
+  std::snprintf(hash, sizeof(hash), "0x%016llXULL",
+                static_cast<unsigned long long>(this->romHash));
+  if (this->instructionCount == 0) {
+    out << "[[maybe_unused]] static const bool registered =\n"
+        << "    registerAotProgram(" << hash << ", nullptr, 0, 0);\n";
+    return;
+  }
+  // Every instruction is a way in, RTS and RTI land in the middle of
+  // functions
+  out << "static const AotEntry entries[] = {\n";
+  for (const Function &function : this->functions) {
+    for (uint16_t address : function.instructions) {
+      out << "    {" << hex(address) << ", " << functionName(function.entry)
+          << "},\n";
+    }
+  }
+  out << "};\n\n"
+      << "[[maybe_unused]] static const bool registered = registerAotProgram(\n"
+      << "    " << hash << ", entries, sizeof(entries) / sizeof(entries[0]), "
+      << this->functions.size() << ");\n";
+}
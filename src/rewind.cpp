@@ -0,0 +1,172 @@
+#include "rewind.hpp"
+#include <algorithm>
+#include <cstring>
+
+RewindBuffer::RewindBuffer(size_t arenaSize, uint32_t interval,
+                           uint32_t keyframeInterval)
+    : interval(std::max<uint32_t>(interval, 1)),
+      keyframeInterval(std::max<uint32_t>(keyframeInterval, 1)) {
+  this->arena.resize(arenaSize);
+  // An unchanged frame encodes to nothing, so records can outnumber bytes.
+  // Bound them anyway, the ring drops whole keyframe groups when it is full.
+  this->records.resize(
+      std::max<size_t>(arenaSize / 16, this->keyframeInterval * 2));
+  // Worst case encoding is a four byte run header for every other byte
+  this->encoded.resize(sizeof(SaveState) + 4 * (sizeof(SaveState) / 2 + 1));
+  clear();
+}
+
+void RewindBuffer::clear() {
+  this->framesUntilCapture = 1;
+  this->snapshotsUntilKeyframe = 0;
+  this->writeOffset = 0;
+  this->bytesUsed = 0;
+  this->first = 0;
+  this->count = 0;
+}
+
+void RewindBuffer::onFrame(const CPU &cpu) {
+  if (--this->framesUntilCapture == 0) {
+    capture(cpu);
+    this->framesUntilCapture = this->interval;
+  }
+}
+
+size_t RewindBuffer::encode(const SaveState *from, const SaveState &to) {
+  // Runs of [uint16 unchanged bytes][uint16 changed bytes][changed ^ old]
+  const uint8_t *a = reinterpret_cast<const uint8_t *>(from);
+  const uint8_t *b = reinterpret_cast<const uint8_t *>(&to);
+  uint8_t *out = this->encoded.data();
+  size_t length = 0;
+  size_t position = 0;
+  while (position < sizeof(SaveState)) {
+    size_t start = position;
+    while (position < sizeof(SaveState) &&
+           (a != nullptr ? a[position] : 0) == b[position]) {
+      position++;
+    }
+    if (position == sizeof(SaveState)) {
+      break;
+    }
+    uint16_t skip = position - start;
+    size_t literal = position;
+    while (position < sizeof(SaveState) &&
+           (a != nullptr ? a[position] : 0) != b[position]) {
+      out[length + 4 + position - literal] =
+          (a != nullptr ? a[position] : 0) ^ b[position];
+      position++;
+    }
+    uint16_t changed = position - literal;
+    memcpy(out + length, &skip, 2);
+    memcpy(out + length + 2, &changed, 2);
+    length += 4 + changed;
+  }
+  return length;
+}
+
+void RewindBuffer::apply(const Record &record, SaveState &state) {
+  uint8_t *bytes = reinterpret_cast<uint8_t *>(&state);
+  const uint8_t *in = this->arena.data() + record.offset;
+  size_t position = 0;
+  for (size_t read = 0; read < record.length;) {
+    uint16_t skip, changed;
+    memcpy(&skip, in + read, 2);
+    memcpy(&changed, in + read + 2, 2);
+    read += 4;
+    position += skip;
+    for (uint16_t i = 0; i < changed; i++) {
+      bytes[position++] ^= in[read++];
+    }
+  }
+}
+
+void RewindBuffer::dropOldestGroup() {
+  do {
+    this->bytesUsed -= recordAt(0).length;
+    this->first = (this->first + 1) % this->records.size();
+    this->count--;
+  } while (this->count > 0 && !recordAt(0).keyframe);
+}
+
+void RewindBuffer::push(const uint8_t *data, size_t length, bool keyframe) {
+  size_t offset = this->writeOffset;
+  if (offset + length > this->arena.size()) {
+    offset = 0;
+  }
+  // Records are laid out in the order they were written, so anything in the
+  // way is the oldest history
+  while (this->count > 0) {
+    const Record &oldest = recordAt(0);
+    bool overlaps = oldest.offset < offset + length &&
+                    offset < oldest.offset + oldest.length;
+    if (!overlaps && this->count < this->records.size()) {
+      break;
+    }
+    dropOldestGroup();
+  }
+  memcpy(this->arena.data() + offset, data, length);
+  this->writeOffset = offset + length;
+  this->bytesUsed += length;
+  recordAt(this->count) = Record{static_cast<uint32_t>(offset),
+                                 static_cast<uint32_t>(length), keyframe};
+  this->count++;
+}
+
+void RewindBuffer::capture(const CPU &cpu) {
+  cpu.saveState(this->scratch);
+  bool keyframe = this->count == 0 || this->snapshotsUntilKeyframe == 0;
+  size_t length = encode(keyframe ? nullptr : &this->current, this->scratch);
+  if (length > this->arena.size()) {
+    // Can't fit even a single snapshot
+    clear();
+    return;
+  }
+  push(this->encoded.data(), length, keyframe);
+  if (!keyframe && !recordAt(0).keyframe) {
+    // Making room dropped the keyframe this delta builds on, start over with
+    // the snapshot stored whole
+    clear();
+    keyframe = true;
+    push(this->encoded.data(), encode(nullptr, this->scratch), keyframe);
+  }
+  this->current = this->scratch;
+  this->snapshotsUntilKeyframe =
+      keyframe ? this->keyframeInterval - 1 : this->snapshotsUntilKeyframe - 1;
+}
+
+bool RewindBuffer::rewind(CPU &cpu) {
+  if (this->count == 0) {
+    return false;
+  }
+  cpu.loadState(this->current);
+  Record newest = recordAt(this->count - 1);
+  this->count--;
+  this->bytesUsed -= newest.length;
+  this->writeOffset = newest.offset;
+  this->framesUntilCapture = this->interval;
+  if (this->count == 0) {
+    return true;
+  }
+
+  // Step current back to the snapshot before the one just restored
+  if (!newest.keyframe) {
+    // XOR deltas undo themselves
+    apply(newest, this->current);
+  } else {
+    // Rebuild forwards from the keyframe before it
+    size_t keyframe = this->count - 1;
+    while (!recordAt(keyframe).keyframe) {
+      keyframe--;
+    }
+    memset(&this->current, 0, sizeof(SaveState));
+    for (size_t i = keyframe; i < this->count; i++) {
+      apply(recordAt(i), this->current);
+    }
+  }
+  size_t sinceKeyframe = 0;
+  while (!recordAt(this->count - 1 - sinceKeyframe).keyframe) {
+    sinceKeyframe++;
+  }
+  this->snapshotsUntilKeyframe = this->keyframeInterval - 1 - sinceKeyframe;
+  return true;
+}
@@ -0,0 +1,72 @@
+#include "runahead.hpp"
+#include <chrono>
+
+static uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+RunAhead::RunAhead(uint32_t frames) : frames(frames) { resetStats(); }
+
+void RunAhead::resetStats() { this->stats = Stats{0, 0, 0, 0, 0}; }
+
+bool RunAhead::runFrame(CPU &cpu,
+                        const std::function<void(const CPU &)> &present) {
+  this->stats.hostFrames++;
+  // Only the last frame ahead is shown, the ones before it aren't drawn
+  bool drawing = cpu.getBus().getPpu().isDrawing();
+  if (this->frames > 0) {
+    cpu.getBus().setPpuDrawing(false);
+  }
+  auto start = std::chrono::steady_clock::now();
+  bool running = cpu.runFrame();
+  this->stats.realNanos += nanosSince(start);
+  this->stats.emulatedFrames++;
+  if (!running || this->frames == 0) {
+    cpu.getBus().setPpuDrawing(drawing);
+    present(cpu);
+    return running;
+  }
+
+  start = std::chrono::steady_clock::now();
+  cpu.saveState(this->state);
+  this->stats.stateNanos += nanosSince(start);
+
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < this->frames; i++) {
+    this->stats.emulatedFrames++;
+    if (i + 1 == this->frames) {
+      cpu.getBus().setPpuDrawing(drawing);
+    }
+    if (!cpu.runFrame()) {
+      // Show how far it got, the real timeline decides whether to stop
+      break;
+    }
+  }
+  this->stats.aheadNanos += nanosSince(start);
+  cpu.getBus().setPpuDrawing(drawing);
+  present(cpu);
+
+  start = std::chrono::steady_clock::now();
+  cpu.loadState(this->state);
+  this->stats.stateNanos += nanosSince(start);
+  return true;
+}
+
+void RunAhead::report(std::ostream &out) const {
+  if (this->stats.hostFrames == 0) {
+    return;
+  }
+  double frames = this->stats.hostFrames;
+  double real = this->stats.realNanos / frames / 1000;
+  double ahead = this->stats.aheadNanos / frames / 1000;
+  double state = this->stats.stateNanos / frames / 1000;
+  out << "Run-ahead " << this->frames << ": " << this->stats.hostFrames
+      << " host frames, " << this->stats.emulatedFrames
+      << " emulated frames\n";
+  out << "  real frame " << real << "us, ahead " << ahead
+      << "us, save/restore " << state << "us per host frame\n";
+  out << "  " << (real > 0 ? (real + ahead + state) / real : 0)
+      << "x the cost of running without run-ahead\n";
+}
@@ -0,0 +1,23 @@
+#include "savestate.hpp"
+#include <fstream>
+#include <iostream>
+
+bool writeSaveState(const std::string &path, const SaveState &state) {
+  std::ofstream output(path, std::ios::binary);
+  output.write(reinterpret_cast<const char *>(&state), sizeof(state));
+  if (!output) {
+    std::cout << "Could not write save state to " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool readSaveState(const std::string &path, SaveState &state) {
+  std::ifstream input(path, std::ios::binary);
+  input.read(reinterpret_cast<char *>(&state), sizeof(state));
+  if (!input || state.magic != SAVE_STATE_MAGIC) {
+    std::cout << "Could not read save state from " << path << "\n";
+    return false;
+  }
+  return true;
+}
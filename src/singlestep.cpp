@@ -0,0 +1,255 @@
+#include "singlestep.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+// B and U are not real flags, only what PHP and BRK push has them
+#define STATUS_MASK static_cast<uint8_t>(~(CPU::FLAGS::B | CPU::FLAGS::U))
+
+SingleStepReader::SingleStepReader() : started(false) {}
+
+bool SingleStepReader::open(const std::string &path) {
+  return this->reader.open(path);
+}
+
+void SingleStepReader::openString(std::string text) {
+  this->reader.openString(std::move(text));
+}
+
+bool SingleStepReader::readState(SingleStepState &state) {
+  JsonReader &reader = this->reader;
+  state = SingleStepState{};
+  std::string key;
+  int64_t value;
+  if (!reader.beginObject()) {
+    return false;
+  }
+  while (reader.hasNext()) {
+    if (!reader.readKey(key)) {
+      return false;
+    }
+    if (key == "ram") {
+      reader.beginArray();
+      while (reader.hasNext()) {
+        int64_t address, data;
+        if (!reader.beginArray() || !reader.hasNext() ||
+            !reader.readInteger(address) || !reader.hasNext() ||
+            !reader.readInteger(data) || reader.hasNext()) {
+          return false;
+        }
+        state.ram.emplace_back(address, data);
+      }
+      continue;
+    }
+    if (key != "pc" && key != "s" && key != "a" && key != "x" && key != "y" &&
+        key != "p") {
+      reader.skipValue();
+      continue;
+    }
+    if (!reader.readInteger(value)) {
+      return false;
+    }
+    switch (key[0]) {
+    case 'p':
+      if (key == "pc") {
+        state.pc = value;
+      } else {
+        state.p = value;
+      }
+      break;
+    case 's':
+      state.s = value;
+      break;
+    case 'a':
+      state.a = value;
+      break;
+    case 'x':
+      state.x = value;
+      break;
+    case 'y':
+      state.y = value;
+      break;
+    }
+  }
+  return !reader.failed();
+}
+
+bool SingleStepReader::next(SingleStepCase &test) {
+  JsonReader &reader = this->reader;
+  if (!this->started) {
+    this->started = true;
+    if (!reader.beginArray()) {
+      return false;
+    }
+  }
+  if (!reader.hasNext() || !reader.beginObject()) {
+    return false;
+  }
+  test.cycles = 0;
+  std::string key;
+  while (reader.hasNext()) {
+    if (!reader.readKey(key)) {
+      return false;
+    }
+    if (key == "name") {
+      reader.readString(test.name);
+    } else if (key == "initial") {
+      readState(test.initial);
+    } else if (key == "final") {
+      readState(test.final);
+    } else if (key == "cycles") {
+      reader.beginArray();
+      while (reader.hasNext()) {
+        reader.skipValue();
+        test.cycles++;
+      }
+    } else {
+      reader.skipValue();
+    }
+  }
+  return !reader.failed();
+}
+
+SingleStepRunner::SingleStepRunner(size_t threads) : threadCount(threads) {
+  if (this->threadCount == 0) {
+    this->threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+void SingleStepRunner::add(uint8_t opcode, std::string path) {
+  this->files.emplace_back(opcode, std::move(path));
+}
+
+size_t SingleStepRunner::addDirectory(const std::string &directory) {
+  size_t found = 0;
+  for (const CPU::instruction &ins : CPU::opcodeTable) {
+    // The published files are lower case, accept upper case too
+    for (const char *format : {"%02x.json", "%02X.json"}) {
+      char name[16];
+      snprintf(name, sizeof(name), format, ins.opcode);
+      std::filesystem::path path = std::filesystem::path(directory) / name;
+      std::error_code error;
+      if (std::filesystem::is_regular_file(path, error)) {
+        add(ins.opcode, path.string());
+        found++;
+        break;
+      }
+    }
+  }
+  return found;
+}
+
+std::vector<SingleStepResult> SingleStepRunner::run() {
+  std::vector<SingleStepResult> results(this->files.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < this->files.size(); i = next++) {
+      results[i] = runFile(this->files[i].first, this->files[i].second);
+    }
+  };
+  std::vector<std::thread> threads;
+  size_t count = std::min(this->threadCount, this->files.size());
+  for (size_t i = 1; i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
+SingleStepResult SingleStepRunner::runFile(uint8_t opcode,
+                                           const std::string &path) {
+  SingleStepResult result = {};
+  result.opcode = opcode;
+  SingleStepReader reader;
+  if (!reader.open(path)) {
+    result.error = reader.getError();
+    return result;
+  }
+  CPU cpu = CPU(Bus::flat());
+  SingleStepCase test;
+  while (reader.next(test)) {
+    result.cases++;
+    bool cyclesMatch;
+    std::string difference = runCase(cpu, test, cyclesMatch);
+    if (!difference.empty()) {
+      if (result.failures == 0) {
+        result.firstFailure = test.name + ": " + difference;
+      }
+      result.failures++;
+    } else if (!cyclesMatch) {
+      result.cycleMismatches++;
+    }
+  }
+  if (reader.failed()) {
+    result.error = reader.getError();
+  }
+  return result;
+}
+
+static void describe(std::string &difference, const char *what,
+                     uint32_t actual, uint32_t expected, int digits) {
+  char line[64];
+  snprintf(line, sizeof(line), "%s%s = $%0*X, expected $%0*X",
+           difference.empty() ? "" : ", ", what, digits, actual, digits,
+           expected);
+  difference += line;
+}
+
+std::string SingleStepRunner::runCase(CPU &cpu, const SingleStepCase &test,
+                                      bool &cyclesMatch) {
+  uint8_t *memory = cpu.getBus().getFlatMemory();
+  for (const auto &[address, value] : test.initial.ram) {
+    memory[address] = value;
+  }
+  cpu.PC = test.initial.pc;
+  cpu.SP = test.initial.s;
+  cpu.A = test.initial.a;
+  cpu.X = test.initial.x;
+  cpu.Y = test.initial.y;
+  cpu.S = test.initial.p;
+  cpu.cycles = 0;
+  cpu.step();
+  cyclesMatch = cpu.cycles == test.cycles;
+
+  std::string difference;
+  const SingleStepState &expected = test.final;
+  if (cpu.PC != expected.pc) {
+    describe(difference, "PC", cpu.PC, expected.pc, 4);
+  }
+  if (cpu.SP != expected.s) {
+    describe(difference, "S", cpu.SP, expected.s, 2);
+  }
+  if (cpu.A != expected.a) {
+    describe(difference, "A", cpu.A, expected.a, 2);
+  }
+  if (cpu.X != expected.x) {
+    describe(difference, "X", cpu.X, expected.x, 2);
+  }
+  if (cpu.Y != expected.y) {
+    describe(difference, "Y", cpu.Y, expected.y, 2);
+  }
+  if ((cpu.S & STATUS_MASK) != (expected.p & STATUS_MASK)) {
+    describe(difference, "P", cpu.S, expected.p, 2);
+  }
+  for (const auto &[address, value] : expected.ram) {
+    if (memory[address] != value) {
+      char what[16];
+      snprintf(what, sizeof(what), "[$%04X]", address);
+      describe(difference, what, memory[address], value, 2);
+    }
+  }
+  // Leave memory zeroed for the next case, the final state lists every
+  // address the instruction wrote
+  for (const auto &entry : test.initial.ram) {
+    memory[entry.first] = 0;
+  }
+  for (const auto &entry : expected.ram) {
+    memory[entry.first] = 0;
+  }
+  return difference;
+}
@@ -0,0 +1,226 @@
+#include "timeline.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Calibrating over less than this is too coarse, export waits it out
+#define TIMELINE_MIN_CALIBRATION_NANOS 1000000
+
+static const char *const PHASE_NAMES[TIMELINE_PHASE_COUNT] = {
+    "frame",          "cpu",     "ppu",          "apu",
+    "input poll",     "texture upload", "present", "pacing sleep",
+    "input to present"};
+
+static std::atomic<uint64_t> nextTimelineId(1);
+
+static int64_t steadyNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+const char *timelinePhaseName(TimelinePhase phase) {
+  return phase < TIMELINE_PHASE_COUNT ? PHASE_NAMES[phase] : "?";
+}
+
+Timeline::Timeline()
+    : id(nextTimelineId++), pendingInput(0), startTicks(now()),
+      startNanos(steadyNanos()) {}
+
+uint64_t Timeline::now() {
+#if defined(__x86_64__) || defined(__i386__)
+  // Invariant on every x86 CPU from the last decade, and far cheaper than a
+  // clock_gettime call
+  return __rdtsc();
+#else
+  return steadyNanos();
+#endif
+}
+
+Timeline::Ring &Timeline::threadRing() {
+  // One entry per thread, refilled when the thread records into another
+  // timeline
+  thread_local uint64_t cachedId = 0;
+  thread_local Ring *cachedRing = nullptr;
+  if (cachedId == this->id) {
+    return *cachedRing;
+  }
+  std::thread::id self = std::this_thread::get_id();
+  std::lock_guard<std::mutex> guard(this->lock);
+  // Back from another timeline, the ring it had here is still there
+  for (const std::unique_ptr<Ring> &ring : this->rings) {
+    if (ring->owner == self) {
+      cachedRing = ring.get();
+      cachedId = this->id;
+      return *cachedRing;
+    }
+  }
+  auto ring = std::make_unique<Ring>();
+  ring->events.resize(TIMELINE_RING_SIZE);
+  ring->written = 0;
+  ring->thread = this->rings.size() + 1;
+  ring->owner = self;
+  ring->name = "thread " + std::to_string(ring->thread);
+  cachedRing = ring.get();
+  cachedId = this->id;
+  this->rings.push_back(std::move(ring));
+  return *cachedRing;
+}
+
+void Timeline::record(TimelinePhase phase, uint64_t start, uint64_t end,
+                      uint32_t frame) {
+  Ring &ring = threadRing();
+  uint64_t written = ring.written.load(std::memory_order_relaxed);
+  ring.events[written % TIMELINE_RING_SIZE] = {start, end,
+                                               static_cast<uint32_t>(phase),
+                                               frame};
+  ring.written.store(written + 1, std::memory_order_release);
+}
+
+size_t Timeline::getThreadCount() const {
+  std::lock_guard<std::mutex> guard(this->lock);
+  return this->rings.size();
+}
+
+void Timeline::setThreadName(const std::string &name) {
+  Ring &ring = threadRing();
+  std::lock_guard<std::mutex> guard(this->lock);
+  ring.name = name;
+}
+
+void Timeline::markInput() {
+  // Only the first input since the last present counts
+  uint64_t expected = 0;
+  this->pendingInput.compare_exchange_strong(expected, now());
+}
+
+void Timeline::markPresent(uint32_t frame) {
+  uint64_t input = this->pendingInput.exchange(0);
+  if (input != 0) {
+    record(TIMELINE_LATENCY, input, now(), frame);
+  }
+}
+
+template <typename F> void Timeline::forEachEvent(F visit) const {
+  std::lock_guard<std::mutex> guard(this->lock);
+  for (const std::unique_ptr<Ring> &ring : this->rings) {
+    uint64_t written = ring->written.load(std::memory_order_acquire);
+    uint64_t first =
+        written > TIMELINE_RING_SIZE ? written - TIMELINE_RING_SIZE : 0;
+    for (uint64_t i = first; i < written; i++) {
+      visit(*ring, ring->events[i % TIMELINE_RING_SIZE]);
+    }
+  }
+}
+
+std::vector<TimelineEvent> Timeline::getEvents(TimelinePhase phase) const {
+  std::vector<TimelineEvent> events;
+  forEachEvent([&](const Ring &, const TimelineEvent &event) {
+    if (event.phase == static_cast<uint32_t>(phase)) {
+      events.push_back(event);
+    }
+  });
+  return events;
+}
+
+double Timeline::ticksPerMicrosecond() const {
+  int64_t nanos = steadyNanos() - this->startNanos;
+  while (nanos < TIMELINE_MIN_CALIBRATION_NANOS) {
+    nanos = steadyNanos() - this->startNanos;
+  }
+  uint64_t ticks = now() - this->startTicks;
+  return ticks * 1000.0 / nanos;
+}
+
+double Timeline::ticksToMicroseconds(uint64_t ticks) const {
+  return ticks / ticksPerMicrosecond();
+}
+
+TimelineStats Timeline::getStats(TimelinePhase phase) const {
+  std::vector<TimelineEvent> events = getEvents(phase);
+  TimelineStats stats = {};
+  stats.count = events.size();
+  if (events.empty()) {
+    return stats;
+  }
+  double scale = 1.0 / ticksPerMicrosecond();
+  std::vector<double> durations;
+  durations.reserve(events.size());
+  double total = 0;
+  for (const TimelineEvent &event : events) {
+    durations.push_back((event.end - event.start) * scale);
+    total += durations.back();
+  }
+  std::sort(durations.begin(), durations.end());
+  // Nearest rank
+  auto percentile = [&](double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p * durations.size()));
+    return durations[std::max<size_t>(rank, 1) - 1];
+  };
+  stats.mean = total / durations.size();
+  stats.p50 = percentile(0.50);
+  stats.p90 = percentile(0.90);
+  stats.p99 = percentile(0.99);
+  stats.max = durations.back();
+  return stats;
+}
+
+void Timeline::writeChromeTrace(std::ostream &out) const {
+  double scale = 1.0 / ticksPerMicrosecond();
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  {
+    std::lock_guard<std::mutex> guard(this->lock);
+    for (const std::unique_ptr<Ring> &ring : this->rings) {
+      // Names are plain identifiers chosen by the caller, quotes and
+      // backslashes are dropped rather than escaped
+      std::string name;
+      for (char c : ring->name) {
+        if (c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20) {
+          name += c;
+        }
+      }
+      out << (first ? "" : ",")
+          << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+          << ring->thread << ",\"args\":{\"name\":\"" << name << "\"}}";
+      first = false;
+    }
+  }
+  forEachEvent([&](const Ring &ring, const TimelineEvent &event) {
+    char line[256];
+    // Microseconds with nanosecond precision, as the format expects
+    snprintf(line, sizeof(line),
+             "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+             "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}",
+             first ? "" : ",",
+             timelinePhaseName(static_cast<TimelinePhase>(event.phase)),
+             ring.thread,
+             static_cast<int64_t>(event.start - this->startTicks) * scale,
+             (event.end - event.start) * scale, event.frame);
+    out << line;
+    first = false;
+  });
+  out << "\n]}\n";
+}
+
+void Timeline::writeSummary(std::ostream &out) const {
+  char line[160];
+  snprintf(line, sizeof(line), "%-17s %8s %9s %9s %9s %9s %9s\n", "phase (us)",
+           "count", "mean", "p50", "p90", "p99", "max");
+  out << line;
+  for (int phase = 0; phase < TIMELINE_PHASE_COUNT; phase++) {
+    TimelineStats stats = getStats(static_cast<TimelinePhase>(phase));
+    if (stats.count == 0) {
+      continue;
+    }
+    snprintf(line, sizeof(line),
+             "%-17s %8zu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+             timelinePhaseName(static_cast<TimelinePhase>(phase)), stats.count,
+             stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+    out << line;
+  }
+}
@@ -0,0 +1,91 @@
+#include "batchrunner.hpp"
+#include "rng.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+class BatchRunnerTest : public ::testing::Test {
+protected:
+  // LDX #$00
+  // poll: LDA #$01, STA $4016, LDA #$00, STA $4016, LDY #$08
+  // bit: LDA $4016, STA $40,X, INX, DEY, BNE bit, JMP poll
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xA9, 0x01, 0x8D, 0x16, 0x40,
+                                  0xA9, 0x00, 0x8D, 0x16, 0x40, 0xA0, 0x08,
+                                  0xAD, 0x16, 0x40, 0x95, 0x40, 0xE8, 0x88,
+                                  0xD0, 0xF7, 0x4C, 0x02, 0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+  uint64_t romHash = Bus(rom).getRomHash();
+
+  std::shared_ptr<const Movie> randomMovie(uint64_t seed, size_t frames) {
+    std::shared_ptr<Movie> movie = std::make_shared<Movie>(romHash, seed);
+    Rng rng = Rng(seed);
+    for (size_t frame = 0; frame < frames; frame++) {
+      uint8_t buttons[MOVIE_PORTS] = {static_cast<uint8_t>(rng.next()), 0};
+      movie->recordFrame(buttons);
+    }
+    return movie;
+  }
+
+  BatchJob job(std::shared_ptr<const Movie> movie, uint32_t frames) {
+    return BatchJob{rom, movie, frames, true, {{0x40, 8}}};
+  }
+};
+
+TEST_F(BatchRunnerTest, TestResultsMatchSequentialRuns) {
+  BatchRunner runner = BatchRunner(4, 3);
+  std::vector<std::shared_ptr<const Movie>> movies;
+  std::vector<uint32_t> budgets;
+  for (uint64_t i = 0; i < 16; i++) {
+    movies.push_back(randomMovie(i + 1, 20));
+    budgets.push_back(1 + i * 3 % 25);
+    EXPECT_EQ(runner.add(job(movies[i], budgets[i])), i);
+  }
+  std::vector<BatchResult> results = runner.run();
+  ASSERT_EQ(results.size(), 16u);
+
+  for (size_t i = 0; i < results.size(); i++) {
+    CPU cpu = CPU(Bus(rom));
+    ASSERT_TRUE(movies[i]->begin(cpu));
+    std::vector<uint64_t> hashes;
+    for (uint32_t frame = 0; frame < budgets[i]; frame++) {
+      // Input runs out after 20 frames and the last buttons stay held
+      if (frame < movies[i]->getFrameCount()) {
+        movies[i]->applyInput(cpu, frame);
+      }
+      cpu.runFrame();
+      hashes.push_back(cpu.hashState());
+    }
+    EXPECT_TRUE(results[i].started);
+    EXPECT_FALSE(results[i].stopped);
+    EXPECT_EQ(results[i].frames, budgets[i]);
+    EXPECT_EQ(results[i].frameHashes, hashes) << i;
+    EXPECT_EQ(results[i].stateHash, cpu.hashState()) << i;
+    ASSERT_EQ(results[i].ram.size(), 8u);
+    for (uint16_t offset = 0; offset < 8; offset++) {
+      EXPECT_EQ(results[i].ram[offset], cpu.readFromMemory(0x40 + offset));
+    }
+  }
+}
+
+TEST_F(BatchRunnerTest, TestJobWithoutMovieRunsFromReset) {
+  BatchRunner runner = BatchRunner(2);
+  runner.add(job(nullptr, 5));
+  std::vector<BatchResult> results = runner.run();
+  CPU cpu = CPU(Bus(rom));
+  cpu.reset();
+  for (int i = 0; i < 5; i++) {
+    cpu.runFrame();
+  }
+  EXPECT_EQ(results[0].stateHash, cpu.hashState());
+}
+
+TEST_F(BatchRunnerTest, TestMovieForOtherRomDoesNotStart) {
+  BatchRunner runner = BatchRunner(2);
+  runner.add(job(std::make_shared<const Movie>(0x1234), 5));
+  runner.add(job(nullptr, 2));
+  std::vector<BatchResult> results = runner.run();
+  EXPECT_FALSE(results[0].started);
+  EXPECT_EQ(results[0].frames, 0u);
+  EXPECT_TRUE(results[1].started);
+  EXPECT_EQ(results[1].frames, 2u);
+}
@@ -0,0 +1,231 @@
+#include "breakpoints.hpp"
+#include "cpu.hpp"
+#include "gdbstub.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// LDA $0200, STA $0201, LDA #$05, JMP $8000
+static const std::vector<uint8_t> PROGRAM = {0xAD, 0x00, 0x02, 0x8D, 0x01,
+                                             0x02, 0xA9, 0x05, 0x4C, 0x00,
+                                             0x80};
+
+class BreakpointsTest : public ::testing::Test {
+protected:
+  Breakpoints breakpoints;
+  CPU cpu = CPU(Bus(buildRom(PROGRAM, 0x8000)));
+
+  void SetUp() override {
+    cpu.reset();
+    cpu.breakpoints = &breakpoints;
+  }
+};
+
+TEST_F(BreakpointsTest, TestPageBitmap) {
+  breakpoints.add(Breakpoints::EXECUTE, 0x8005);
+  breakpoints.add(Breakpoints::EXECUTE, 0x8005);
+  breakpoints.add(Breakpoints::EXECUTE, 0x80C0);
+  EXPECT_EQ(breakpoints.getPageCount(Breakpoints::EXECUTE, 0x80), 2);
+  EXPECT_EQ(breakpoints.getPageCount(Breakpoints::READ, 0x80), 0);
+  EXPECT_TRUE(breakpoints.has(Breakpoints::EXECUTE, 0x8005));
+  EXPECT_FALSE(breakpoints.has(Breakpoints::EXECUTE, 0x8105));
+  EXPECT_FALSE(breakpoints.has(Breakpoints::READ, 0x8005));
+
+  // Other pages never look at the bitmap, others on the page do
+  EXPECT_FALSE(breakpoints.checkExecute(0x8105));
+  EXPECT_FALSE(breakpoints.checkExecute(0x8004));
+  EXPECT_FALSE(breakpoints.hasHit());
+  EXPECT_TRUE(breakpoints.checkExecute(0x80C0));
+  ASSERT_TRUE(breakpoints.hasHit());
+  EXPECT_EQ(breakpoints.getHit().kind, Breakpoints::EXECUTE);
+  EXPECT_EQ(breakpoints.getHit().address, 0x80C0);
+
+  // Resuming skips the breakpoint once
+  breakpoints.clearHit();
+  breakpoints.resumeFrom(0x80C0);
+  EXPECT_FALSE(breakpoints.checkExecute(0x80C0));
+  EXPECT_TRUE(breakpoints.checkExecute(0x80C0));
+
+  breakpoints.remove(Breakpoints::EXECUTE, 0x8005);
+  breakpoints.remove(Breakpoints::EXECUTE, 0x8005);
+  EXPECT_EQ(breakpoints.getPageCount(Breakpoints::EXECUTE, 0x80), 1);
+  breakpoints.clear();
+  EXPECT_EQ(breakpoints.getPageCount(Breakpoints::EXECUTE, 0x80), 0);
+  EXPECT_FALSE(breakpoints.hasHit());
+}
+
+TEST_F(BreakpointsTest, TestExecuteHit) {
+  breakpoints.add(Breakpoints::EXECUTE, 0x8003);
+  EXPECT_TRUE(cpu.step());
+  // Stops before running the instruction
+  EXPECT_FALSE(cpu.step());
+  EXPECT_EQ(cpu.PC, 0x8003);
+  ASSERT_TRUE(breakpoints.hasHit());
+  EXPECT_EQ(breakpoints.getHit().kind, Breakpoints::EXECUTE);
+  EXPECT_EQ(breakpoints.getHit().address, 0x8003);
+}
+
+TEST_F(BreakpointsTest, TestWatchpointHits) {
+  breakpoints.add(Breakpoints::READ, 0x0200);
+  breakpoints.add(Breakpoints::WRITE, 0x0201);
+  // Stops once the instruction doing the access is done
+  EXPECT_FALSE(cpu.step());
+  EXPECT_EQ(cpu.PC, 0x8003);
+  ASSERT_TRUE(breakpoints.hasHit());
+  EXPECT_EQ(breakpoints.getHit().kind, Breakpoints::READ);
+  EXPECT_EQ(breakpoints.getHit().address, 0x0200);
+
+  breakpoints.clearHit();
+  EXPECT_FALSE(cpu.step());
+  EXPECT_EQ(cpu.PC, 0x8006);
+  ASSERT_TRUE(breakpoints.hasHit());
+  EXPECT_EQ(breakpoints.getHit().kind, Breakpoints::WRITE);
+  EXPECT_EQ(breakpoints.getHit().address, 0x0201);
+}
+
+TEST_F(BreakpointsTest, TestFetchesDontTripReadWatchpoints) {
+  // The opcode, absolute and immediate operands and the JMP target
+  for (uint16_t address : {0x8000, 0x8001, 0x8002, 0x8006, 0x8007, 0x8009}) {
+    breakpoints.add(Breakpoints::READ, address);
+  }
+  for (int i = 0; i < 8; i++) {
+    EXPECT_TRUE(cpu.step()) << i;
+  }
+  EXPECT_FALSE(breakpoints.hasHit());
+}
+
+class GdbStubTest : public ::testing::Test {
+protected:
+  Breakpoints breakpoints;
+  CPU cpu = CPU(Bus(buildRom(PROGRAM, 0x8000)));
+  GdbStub stub = GdbStub(cpu, breakpoints);
+  int client;
+  std::thread server;
+
+  void SetUp() override {
+    cpu.reset();
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    client = fds[0];
+    server = std::thread([this, fd = fds[1]] { stub.serveClient(fd); });
+  }
+
+  void TearDown() override {
+    close(client);
+    if (server.joinable()) {
+      server.join();
+    }
+  }
+
+  // Sends the packet and returns the payload of the reply
+  std::string request(const std::string &payload) {
+    uint8_t sum = 0;
+    for (char c : payload) {
+      sum += static_cast<uint8_t>(c);
+    }
+    char checksum[4];
+    std::snprintf(checksum, sizeof(checksum), "#%02x", sum);
+    std::string framed = "$" + payload + checksum;
+    EXPECT_EQ(write(client, framed.data(), framed.size()),
+              static_cast<ssize_t>(framed.size()));
+
+    std::string received;
+    size_t end;
+    while ((end = received.find('#')) == std::string::npos ||
+           received.size() < end + 3) {
+      char temp[256];
+      ssize_t count = read(client, temp, sizeof(temp));
+      if (count <= 0) {
+        ADD_FAILURE() << "connection closed after " << payload;
+        return "";
+      }
+      received.append(temp, count);
+    }
+    // The acknowledgement comes first
+    EXPECT_EQ(received[0], '+');
+    size_t start = received.find('$');
+    return received.substr(start + 1, end - start - 1);
+  }
+};
+
+TEST_F(GdbStubTest, TestRegisters) {
+  EXPECT_EQ(request("?"), "S05");
+  EXPECT_EQ(request("qSupported:multiprocess+"), "PacketSize=4000");
+  // A, X, Y, P, SP then PC little endian
+  EXPECT_EQ(request("g"), "00000030fd0080");
+  EXPECT_EQ(request("G11223304660380"), "OK");
+  EXPECT_EQ(request("g"), "11223304660380");
+  EXPECT_EQ(request("G11"), "E01");
+  EXPECT_EQ(request("D"), "OK");
+}
+
+TEST_F(GdbStubTest, TestMemory) {
+  EXPECT_EQ(request("M200,2:abcd"), "OK");
+  EXPECT_EQ(request("m1ff,4"), "00abcd00");
+  // The ROM
+  EXPECT_EQ(request("m8000,3"), "ad0002");
+  // Too short for the length, or longer than a packet
+  EXPECT_EQ(request("M200,2:ab"), "E01");
+  EXPECT_EQ(request("M200,80000001:00"), "E01");
+  EXPECT_EQ(request("m0,ffffffff"), "E01");
+  EXPECT_EQ(request("m0,2001"), "E01");
+  EXPECT_EQ(request("m0,2000").size(), 0x4000u);
+  EXPECT_EQ(request("D"), "OK");
+}
+
+TEST_F(GdbStubTest, TestBreakpointsAndRunning) {
+  EXPECT_EQ(request("Z0,8003,1"), "OK");
+  EXPECT_TRUE(breakpoints.has(Breakpoints::EXECUTE, 0x8003));
+  EXPECT_EQ(request("c"), "S05");
+  EXPECT_EQ(request("g").substr(10), "0380");
+
+  // Continuing from a breakpoint runs the instruction it's on
+  EXPECT_EQ(request("z0,8003,1"), "OK");
+  EXPECT_EQ(request("Z2,201,1"), "OK");
+  EXPECT_EQ(request("c"), "T05watch:0201;");
+  EXPECT_EQ(request("g").substr(10), "0680");
+  EXPECT_EQ(request("Z3,200,1"), "OK");
+  EXPECT_EQ(request("Z4,201,1"), "OK");
+  EXPECT_EQ(request("c"), "T05rwatch:0200;");
+  EXPECT_EQ(request("c"), "T05awatch:0201;");
+  EXPECT_EQ(request("z4,201,1"), "OK");
+  EXPECT_FALSE(breakpoints.has(Breakpoints::WRITE, 0x0201));
+
+  EXPECT_EQ(request("s"), "S05");
+  EXPECT_EQ(request("g").substr(10), "0880");
+  EXPECT_EQ(request("z3,200,1"), "OK");
+  EXPECT_EQ(request("s8000"), "S05");
+  EXPECT_EQ(request("g").substr(10), "0380");
+  EXPECT_EQ(request("Z2,0,10001"), "E01");
+  EXPECT_EQ(request("Z9,0,1"), "");
+  EXPECT_EQ(request("D"), "OK");
+  EXPECT_EQ(breakpoints.getPageCount(Breakpoints::READ, 0x02), 0);
+}
+
+TEST_F(GdbStubTest, TestMemoryReadsHaveNoSideEffects) {
+  // In vblank, with the controller strobed so it has bits to shift
+  cpu.getBus().setControllerState(0, BUTTON_A);
+  cpu.writeToMemory(0x4016, 1);
+  cpu.writeToMemory(0x4016, 0);
+  cpu.cycles = PPU_VBLANK_DOT / 3 + 10;
+  cpu.getBus().setClock(cpu.cycles);
+  uint64_t hash = cpu.hashState();
+  EXPECT_EQ(request("m2000,8"), "0000800000000000");
+  EXPECT_EQ(request("m4016,1"), "01");
+  EXPECT_EQ(request("m4016,1"), "01");
+  EXPECT_EQ(cpu.hashState(), hash);
+  EXPECT_EQ(request("D"), "OK");
+}
+
+TEST_F(GdbStubTest, TestDetachUnhooksTheCpu) {
+  EXPECT_EQ(request("g").size(), 14u);
+  EXPECT_EQ(cpu.breakpoints, &breakpoints);
+  EXPECT_EQ(request("D"), "OK");
+  server.join();
+  EXPECT_EQ(cpu.breakpoints, nullptr);
+}
@@ -0,0 +1,109 @@
+#include "capture.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+
+class CaptureTest : public ::testing::Test {
+protected:
+  std::string videoPath = testing::TempDir() + "capture_test.y4m";
+  std::string audioPath = testing::TempDir() + "capture_test.wav";
+
+  void TearDown() override {
+    remove(videoPath.c_str());
+    remove(audioPath.c_str());
+  }
+
+  std::vector<uint8_t> readFile(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(input), {});
+  }
+
+  uint32_t readLittle(const std::vector<uint8_t> &data, size_t offset) {
+    return data[offset] | data[offset + 1] << 8 | data[offset + 2] << 16 |
+           data[offset + 3] << 24;
+  }
+};
+
+TEST_F(CaptureTest, TestWritesY4mAndWav) {
+  Capture capture = Capture(4);
+  ASSERT_TRUE(capture.open(videoPath, audioPath));
+  uint8_t screen[CAPTURE_FRAME_SIZE];
+  std::vector<int16_t> samples(CAPTURE_SAMPLES_PER_FRAME);
+  for (int frame = 0; frame < 50; frame++) {
+    // Black with one white pixel moving along the first row
+    memset(screen, 0, sizeof(screen));
+    screen[frame % SCREEN_WIDTH] = 1;
+    samples[0] = frame;
+    ASSERT_TRUE(capture.pushFrame(screen, samples.data(), samples.size()));
+  }
+  ASSERT_TRUE(capture.close());
+  CaptureStats stats = capture.getStats();
+  EXPECT_EQ(stats.framesQueued, 50u);
+  EXPECT_EQ(stats.framesWritten, 50u);
+  EXPECT_EQ(stats.framesDropped, 0u);
+  EXPECT_LE(stats.queueHighWater, 4u);
+
+  std::vector<uint8_t> video = readFile(videoPath);
+  std::string header = "YUV4MPEG2 W32 H32 F60:1 Ip A1:1 C444\n";
+  ASSERT_GE(video.size(), header.size());
+  EXPECT_EQ(std::string(video.begin(), video.begin() + header.size()), header);
+  size_t frameSize = 6 + 3 * CAPTURE_FRAME_SIZE;
+  ASSERT_EQ(video.size(), header.size() + 50 * frameSize);
+  EXPECT_EQ(stats.bytesWritten, video.size() + readFile(audioPath).size());
+  const uint8_t *lastFrame = video.data() + header.size() + 49 * frameSize;
+  EXPECT_EQ(memcmp(lastFrame, "FRAME\n", 6), 0);
+  // Studio range luma, white is 235 and black is 16
+  EXPECT_EQ(lastFrame[6 + 49 % SCREEN_WIDTH], 235);
+  EXPECT_EQ(lastFrame[6 + 0], 16);
+
+  std::vector<uint8_t> audio = readFile(audioPath);
+  size_t dataSize = 50 * CAPTURE_SAMPLES_PER_FRAME * sizeof(int16_t);
+  ASSERT_EQ(audio.size(), 44 + dataSize);
+  EXPECT_EQ(memcmp(audio.data(), "RIFF", 4), 0);
+  EXPECT_EQ(readLittle(audio, 4), 36 + dataSize);
+  EXPECT_EQ(readLittle(audio, 24), static_cast<uint32_t>(CAPTURE_SAMPLE_RATE));
+  EXPECT_EQ(readLittle(audio, 40), dataSize);
+  // First sample of the last frame
+  EXPECT_EQ(audio[44 + 49 * CAPTURE_SAMPLES_PER_FRAME * 2], 49);
+}
+
+TEST_F(CaptureTest, TestDroppedFramesAreCounted) {
+  Capture capture = Capture(1, CAPTURE_DROP);
+  ASSERT_TRUE(capture.open(videoPath, ""));
+  uint8_t screen[CAPTURE_FRAME_SIZE] = {0};
+  size_t pushed = 0;
+  for (int frame = 0; frame < 2000; frame++) {
+    pushed += capture.pushFrame(screen, nullptr, 0);
+  }
+  ASSERT_TRUE(capture.close());
+  CaptureStats stats = capture.getStats();
+  EXPECT_EQ(stats.framesQueued, pushed);
+  EXPECT_EQ(stats.framesQueued + stats.framesDropped, 2000u);
+  EXPECT_EQ(stats.framesWritten, stats.framesQueued);
+  EXPECT_EQ(stats.blockedNanos, 0u);
+  size_t frameSize = 6 + 3 * CAPTURE_FRAME_SIZE;
+  EXPECT_EQ(readFile(videoPath).size() % frameSize,
+            std::string("YUV4MPEG2 W32 H32 F60:1 Ip A1:1 C444\n").size());
+}
+
+TEST_F(CaptureTest, TestPictureUsesPpuSizeAndPalette) {
+  Capture capture = Capture(2, CAPTURE_BLOCK, CAPTURE_PICTURE);
+  ASSERT_EQ(capture.getFrameSize(), 256u * 240u);
+  ASSERT_TRUE(capture.open(videoPath, ""));
+  // Palette black ($0F) with white ($30) in the last pixel
+  std::vector<uint8_t> picture(capture.getFrameSize(), 0x0F);
+  picture.back() = 0x30;
+  ASSERT_TRUE(capture.pushFrame(picture.data(), nullptr, 0));
+  ASSERT_TRUE(capture.close());
+
+  std::vector<uint8_t> video = readFile(videoPath);
+  std::string header = "YUV4MPEG2 W256 H240 F60:1 Ip A1:1 C444\n";
+  ASSERT_EQ(video.size(), header.size() + 6 + 3 * 256 * 240);
+  EXPECT_EQ(std::string(video.begin(), video.begin() + header.size()), header);
+  const uint8_t *luma = video.data() + header.size() + 6;
+  EXPECT_EQ(luma[0], 16);
+  EXPECT_GT(luma[256 * 240 - 1], 200);
+}
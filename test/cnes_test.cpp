@@ -0,0 +1,133 @@
+#include "cnes.h"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+class CnesTest : public ::testing::Test {
+protected:
+  // loop: LDA #$01, STA $4016, LDA #$00, STA $4016
+  // LDA $4016, STA $0200, INC $0201, JMP loop
+  std::vector<uint8_t> program = {0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9, 0x00,
+                                  0x8D, 0x16, 0x40, 0xAD, 0x16, 0x40, 0x8D,
+                                  0x00, 0x02, 0xEE, 0x01, 0x02, 0x4C, 0x00,
+                                  0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+  cnes_t *nes = nullptr;
+
+  void SetUp() override {
+    nes = cnes_create();
+    ASSERT_NE(nes, nullptr);
+    ASSERT_EQ(cnes_load_rom(nes, rom.data(), rom.size()), CNES_OK);
+  }
+  void TearDown() override { cnes_destroy(nes); }
+};
+
+TEST_F(CnesTest, TestRejectsBadInput) {
+  cnes_t *empty = cnes_create();
+  EXPECT_EQ(cnes_step_frame(empty), CNES_ERROR_NO_ROM);
+  EXPECT_EQ(cnes_framebuffer(empty), nullptr);
+  uint8_t junk[16] = {0};
+  EXPECT_EQ(cnes_load_rom(empty, junk, sizeof(junk)), CNES_ERROR_BAD_ROM);
+  // Shorter than the header, or than the ROM banks it announces
+  EXPECT_EQ(cnes_load_rom(empty, rom.data(), 4), CNES_ERROR_BAD_ROM);
+  std::vector<uint8_t> header(rom.begin(), rom.begin() + 16);
+  header[4] = 2;
+  EXPECT_EQ(cnes_load_rom(empty, header.data(), header.size()),
+            CNES_ERROR_BAD_ROM);
+  EXPECT_EQ(cnes_load_rom(empty, rom.data(), rom.size() - 1),
+            CNES_ERROR_BAD_ROM);
+  // Mapper 1
+  std::vector<uint8_t> banked = rom;
+  banked[6] = 0x10;
+  EXPECT_EQ(cnes_load_rom(empty, banked.data(), banked.size()),
+            CNES_ERROR_BAD_ROM);
+  EXPECT_EQ(cnes_step_frame(empty), CNES_ERROR_NO_ROM);
+  cnes_destroy(empty);
+
+  EXPECT_EQ(cnes_step_frame(nullptr), CNES_ERROR_INVALID_ARGUMENT);
+  EXPECT_EQ(cnes_set_input(nes, 2, 0), CNES_ERROR_INVALID_ARGUMENT);
+  EXPECT_EQ(cnes_api_version(), CNES_API_VERSION);
+}
+
+TEST_F(CnesTest, TestPointersSeeEmulatedMemory) {
+  const uint8_t *frame = cnes_framebuffer(nes);
+  uint8_t *ram = cnes_ram(nes);
+  ASSERT_NE(frame, nullptr);
+  ASSERT_NE(ram, nullptr);
+  EXPECT_EQ(frame, ram + 0x200);
+
+  cnes_set_input(nes, 0, CNES_BUTTON_A);
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  EXPECT_EQ(cnes_frame_count(nes), 1u);
+  EXPECT_EQ(frame[0], 1);
+  uint8_t counter = frame[1];
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  EXPECT_NE(frame[1], counter);
+  // The pointers stay put from frame to frame
+  EXPECT_EQ(cnes_framebuffer(nes), frame);
+
+  // Writes go straight into the emulated RAM
+  ram[0x10] = 0x5A;
+  std::vector<uint8_t> state(cnes_state_size());
+  ASSERT_EQ(cnes_save_state(nes, state.data(), state.size()), CNES_OK);
+  ram[0x10] = 0;
+  ASSERT_EQ(cnes_load_state(nes, state.data(), state.size()), CNES_OK);
+  EXPECT_EQ(ram[0x10], 0x5A);
+
+  size_t samples = 1;
+  cnes_audio(nes, &samples);
+  EXPECT_EQ(samples, 0u);
+}
+
+TEST_F(CnesTest, TestStateRoundTrip) {
+  for (int frame = 0; frame < 5; frame++) {
+    ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  }
+  std::vector<uint8_t> state(cnes_state_size());
+  ASSERT_EQ(cnes_save_state(nes, state.data(), state.size()), CNES_OK);
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  std::vector<uint8_t> expected(cnes_ram(nes), cnes_ram(nes) + CNES_RAM_SIZE);
+
+  ASSERT_EQ(cnes_load_state(nes, state.data(), state.size()), CNES_OK);
+  EXPECT_EQ(cnes_frame_count(nes), 5u);
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  EXPECT_EQ(std::vector<uint8_t>(cnes_ram(nes), cnes_ram(nes) + CNES_RAM_SIZE),
+            expected);
+
+  EXPECT_EQ(cnes_load_state(nes, state.data(), state.size() - 1),
+            CNES_ERROR_INVALID_ARGUMENT);
+  state[0] ^= 0xFF;
+  EXPECT_EQ(cnes_load_state(nes, state.data(), state.size()),
+            CNES_ERROR_BAD_STATE);
+}
+
+TEST_F(CnesTest, TestPpuFramebuffer) {
+  // LDA #$3F, STA $2006, LDA #$00, STA $2006, LDA #$21, STA $2007,
+  // LDA #$08, STA $2001, loop: JMP loop
+  std::vector<uint8_t> drawing =
+      buildRom({0xA9, 0x3F, 0x8D, 0x06, 0x20, 0xA9, 0x00, 0x8D, 0x06, 0x20,
+                0xA9, 0x21, 0x8D, 0x07, 0x20, 0xA9, 0x08, 0x8D, 0x01, 0x20,
+                0x4C, 0x14, 0x80},
+               0x8000);
+  EXPECT_EQ(cnes_ppu_framebuffer(nullptr), nullptr);
+  EXPECT_EQ(cnes_set_drawing(nullptr, 1), CNES_ERROR_INVALID_ARGUMENT);
+
+  // Not drawing, kept across the ROM load
+  ASSERT_EQ(cnes_set_drawing(nes, 0), CNES_OK);
+  ASSERT_EQ(cnes_load_rom(nes, drawing.data(), drawing.size()), CNES_OK);
+  EXPECT_EQ(cnes_ppu_framebuffer(nes), nullptr);
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  EXPECT_EQ(cnes_ppu_framebuffer(nes), nullptr);
+
+  ASSERT_EQ(cnes_set_drawing(nes, 1), CNES_OK);
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  const uint8_t *pixels = cnes_ppu_framebuffer(nes);
+  ASSERT_NE(pixels, nullptr);
+  // Every pixel is the backdrop colour
+  EXPECT_EQ(pixels[0], 0x21);
+  EXPECT_EQ(pixels[CNES_PPU_FRAME_WIDTH * CNES_PPU_FRAME_HEIGHT - 1], 0x21);
+  ASSERT_EQ(cnes_step_frame(nes), CNES_OK);
+  EXPECT_EQ(cnes_ppu_framebuffer(nes), pixels);
+}
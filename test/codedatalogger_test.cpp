@@ -0,0 +1,132 @@
+#include "codedatalogger.hpp"
+#include "cpu.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <gtest/gtest.h>
+
+class CodeDataLoggerTest : public ::testing::Test {
+protected:
+  std::string path = testing::TempDir() + "codedatalogger_test.cdl";
+
+  void TearDown() override { remove(path.c_str()); }
+};
+
+TEST_F(CodeDataLoggerTest, TestLogsCodeAndData) {
+  // LDA $8020, STA $00, LDA #$80, STA $01, JMP ($0000)
+  // $8010: JMP $8010
+  // $8020: .db $10
+  std::vector<uint8_t> program = {0xAD, 0x20, 0x80, 0x85, 0x00, 0xA9,
+                                  0x80, 0x85, 0x01, 0x6C, 0x00, 0x00};
+  program.resize(0x21, 0xFF);
+  program[0x10] = 0x4C;
+  program[0x11] = 0x10;
+  program[0x12] = 0x80;
+  program[0x20] = 0x10;
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+  CPU cpu = CPU(Bus(rom));
+  CPU unlogged = CPU(Bus(rom));
+  CodeDataLogger logger = CodeDataLogger(cpu.getBus().getRom());
+  cpu.getBus().setCodeDataLogger(&logger);
+  cpu.reset();
+  unlogged.reset();
+  for (int frame = 0; frame < 2; frame++) {
+    ASSERT_TRUE(cpu.runFrame());
+    ASSERT_TRUE(unlogged.runFrame());
+  }
+  // Logging doesn't change how it runs
+  EXPECT_EQ(cpu.hashState(), unlogged.hashState());
+
+  const std::vector<uint8_t> &log = logger.getLog();
+  ASSERT_EQ(log.size(), 0x4000u);
+  for (size_t offset = 0; offset < 0x0C; offset++) {
+    EXPECT_EQ(log[offset], CDL_CODE) << offset;
+  }
+  EXPECT_EQ(log[0x0C], 0);
+  EXPECT_EQ(log[0x10], CDL_CODE | CDL_INDIRECT_CODE);
+  EXPECT_EQ(log[0x12], CDL_CODE);
+  EXPECT_EQ(log[0x20], CDL_DATA);
+  // The reset vector, read through $E000-$FFFF
+  EXPECT_EQ(log[0x3FFC], CDL_DATA | 3 << CDL_BANK_SHIFT);
+  EXPECT_EQ(log[0x3FFA], 0);
+  EXPECT_EQ(logger.getIndirectTargets(), std::vector<uint16_t>{0x8010});
+
+  CdlStats stats = logger.getStats();
+  EXPECT_EQ(stats.code, 15u);
+  EXPECT_EQ(stats.data, 3u);
+  EXPECT_EQ(stats.indirectCode, 1u);
+  EXPECT_EQ(stats.chrBytes, 0u);
+
+  // Forks don't log
+  CPU child = cpu.fork();
+  EXPECT_EQ(child.getBus().getCodeDataLogger(), nullptr);
+  EXPECT_EQ(cpu.getBus().getCodeDataLogger(), &logger);
+}
+
+TEST_F(CodeDataLoggerTest, TestLogsChr) {
+  // LDA #$00, STA $2006, STA $2006, LDA $2007, LDA $2007, LDA #$08,
+  // STA $2001, loop: JMP loop
+  std::vector<uint8_t> rom = buildRom(
+      {0xA9, 0x00, 0x8D, 0x06, 0x20, 0x8D, 0x06, 0x20, 0xAD, 0x07, 0x20, 0xAD,
+       0x07, 0x20, 0xA9, 0x08, 0x8D, 0x01, 0x20, 0x4C, 0x13, 0x80},
+      0x8000);
+  // 8KB of CHR ROM
+  rom[5] = 1;
+  rom.resize(rom.size() + 0x2000, 0);
+  CPU cpu = CPU(Bus(rom));
+  CodeDataLogger logger = CodeDataLogger(cpu.getBus().getRom());
+  cpu.getBus().setCodeDataLogger(&logger);
+  cpu.reset();
+  for (int frame = 0; frame < 2; frame++) {
+    ASSERT_TRUE(cpu.runFrame());
+  }
+  // Catches the PPU up
+  cpu.hashState();
+
+  const std::vector<uint8_t> &log = logger.getLog();
+  ASSERT_EQ(log.size(), 0x6000u);
+  // The background is all tile 0 of the first pattern table
+  EXPECT_EQ(log[0x4000], CDL_CHR_DRAWN | CDL_CHR_READ);
+  EXPECT_EQ(log[0x4001], CDL_CHR_DRAWN | CDL_CHR_READ);
+  EXPECT_EQ(log[0x4002], CDL_CHR_DRAWN);
+  EXPECT_EQ(log[0x400F], CDL_CHR_DRAWN);
+  EXPECT_EQ(log[0x4010], 0);
+  CdlStats stats = logger.getStats();
+  EXPECT_EQ(stats.chrBytes, 0x2000u);
+  EXPECT_EQ(stats.chrDrawn, 16u);
+  EXPECT_EQ(stats.chrRead, 2u);
+}
+
+TEST_F(CodeDataLoggerTest, TestSaveAndMerge) {
+  Bus bus = Bus(buildRom({0x4C, 0x00, 0x80}, 0x8000));
+  CodeDataLogger first = CodeDataLogger(bus.getRom());
+  first.logCode(0x8000, 3);
+  ASSERT_TRUE(first.save(path));
+
+  CodeDataLogger second = CodeDataLogger(bus.getRom());
+  second.logData(0xC002);
+  ASSERT_TRUE(second.load(path));
+  EXPECT_EQ(second.getLog()[0], CDL_CODE);
+  EXPECT_EQ(second.getLog()[2], CDL_CODE | CDL_DATA | 2 << CDL_BANK_SHIFT);
+
+  // Logs of other ROMs are refused
+  std::vector<uint8_t> raw = buildRom({0x4C, 0x00, 0x80}, 0x8000);
+  raw[4] = 2;
+  raw.resize(16 + 0x8000, 0xFF);
+  CodeDataLogger other = CodeDataLogger(Bus(raw).getRom());
+  EXPECT_FALSE(other.load(path));
+  EXPECT_FALSE(other.load(path + ".missing"));
+}
+
+TEST_F(CodeDataLoggerTest, TestNoPrgRom) {
+  // A flat bus has no ROM, nothing is logged and nothing divides by zero
+  CodeDataLogger logger = CodeDataLogger(Bus::flat().getRom());
+  logger.logCode(0x8000, 3);
+  logger.logIndirectCode(0x8000);
+  logger.logData(0xC000);
+  logger.logChrDrawn(0x0010);
+  EXPECT_TRUE(logger.getLog().empty());
+  CdlStats stats = logger.getStats();
+  EXPECT_EQ(stats.code, 0u);
+  EXPECT_EQ(stats.data, 0u);
+}
@@ -0,0 +1,211 @@
+#include "conformance.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+
+class ConformanceRunnerTest : public ::testing::Test {
+protected:
+  // LDA #value, STA address
+  static void store(std::vector<uint8_t> &program, uint16_t address,
+                    uint8_t value) {
+    program.insert(program.end(), {0xA9, value, 0x8D,
+                                   static_cast<uint8_t>(address & 0xFF),
+                                   static_cast<uint8_t>(address >> 8)});
+  }
+
+  // JMP to itself
+  static void hang(std::vector<uint8_t> &program) {
+    uint16_t address = 0x8000 + program.size();
+    program.insert(program.end(), {0x4C, static_cast<uint8_t>(address & 0xFF),
+                                   static_cast<uint8_t>(address >> 8)});
+  }
+
+  // Reports through $6000 the way blargg's tests do, then hangs
+  static std::vector<uint8_t> blarggProgram(uint8_t status) {
+    std::vector<uint8_t> program;
+    store(program, 0x6001, 0xDE);
+    store(program, 0x6002, 0xB0);
+    store(program, 0x6003, 0x61);
+    store(program, 0x6004, 'O');
+    store(program, 0x6005, 'K');
+    store(program, 0x6006, '\n');
+    store(program, 0x6000, status);
+    hang(program);
+    return program;
+  }
+
+  // Writes the nestest result codes and stops on `stop`, an unofficial
+  // opcode unless a test says otherwise. The reset vector points past it at
+  // code that fails, so only a run entered at $C000 passes.
+  static std::vector<uint8_t> nestestRom(uint8_t official, uint8_t unofficial,
+                                         uint8_t stop = 0x02) {
+    std::vector<uint8_t> program;
+    store(program, 0x02, official);
+    store(program, 0x03, unofficial);
+    program.push_back(stop);
+    program.resize(0x40, 0xEA);
+    store(program, 0x02, 0xFF);
+    program.push_back(0x00);
+    return buildRom(program, 0x8040);
+  }
+
+  static ConformanceTest test(const std::string &name,
+                                std::vector<uint8_t> rom, uint64_t budget) {
+    return {name, std::move(rom), name.find("nestest") == 0, budget};
+  }
+};
+
+TEST_F(ConformanceRunnerTest, TestBlarggResults) {
+  ConformanceResult passed = ConformanceRunner::runTest(
+      test("pass", buildRom(blarggProgram(0x00), 0x8000), 10000000));
+  EXPECT_EQ(passed.kind, CONFORMANCE_BLARGG);
+  EXPECT_EQ(passed.status, CONFORMANCE_PASS);
+  EXPECT_EQ(passed.message, "OK");
+  // Stops as soon as the result is in
+  EXPECT_LT(passed.cycles, 2u * CYCLES_PER_FRAME);
+
+  ConformanceResult failed = ConformanceRunner::runTest(
+      test("fail", buildRom(blarggProgram(0x03), 0x8000), 10000000));
+  EXPECT_EQ(failed.status, CONFORMANCE_FAIL);
+  EXPECT_EQ(failed.code, 3);
+
+  ConformanceResult running = ConformanceRunner::runTest(
+      test("running", buildRom(blarggProgram(0x80), 0x8000), 10000000));
+  EXPECT_EQ(running.kind, CONFORMANCE_BLARGG);
+  EXPECT_EQ(running.status, CONFORMANCE_TIMEOUT);
+  EXPECT_GE(running.cycles, 10000000u);
+  EXPECT_LT(running.cycles, 10000000u + CYCLES_PER_FRAME);
+}
+
+TEST_F(ConformanceRunnerTest, TestBlarggResetRequest) {
+  // LDA $10, BNE second, INC $10, ask for a reset and wait. The second run
+  // after the reset passes.
+  std::vector<uint8_t> program = {0xA5, 0x10, 0xD0, 0x00, 0xE6, 0x10};
+  store(program, 0x6001, 0xDE);
+  store(program, 0x6002, 0xB0);
+  store(program, 0x6003, 0x61);
+  store(program, 0x6000, 0x81);
+  hang(program);
+  program[3] = program.size() - 4;
+  store(program, 0x6000, 0x00);
+  hang(program);
+  ConformanceResult result = ConformanceRunner::runTest(
+      test("reset", buildRom(program, 0x8000), 10000000));
+  EXPECT_EQ(result.status, CONFORMANCE_PASS);
+  EXPECT_GT(result.cycles, static_cast<uint64_t>(CONFORMANCE_RESET_DELAY));
+  EXPECT_LT(result.cycles, 10000000u);
+}
+
+TEST_F(ConformanceRunnerTest, TestNestestEntersAtC000) {
+  ConformanceResult passed =
+      ConformanceRunner::runTest(test("nestest.nes", nestestRom(0, 0), 100000));
+  EXPECT_EQ(passed.kind, CONFORMANCE_NESTEST);
+  EXPECT_EQ(passed.status, CONFORMANCE_PASS);
+
+  ConformanceResult official =
+      ConformanceRunner::runTest(test("nestest.nes", nestestRom(7, 0), 100000));
+  EXPECT_EQ(official.status, CONFORMANCE_FAIL);
+  EXPECT_EQ(official.code, 7);
+
+  ConformanceResult unofficial = ConformanceRunner::runTest(
+      test("nestest.nes", nestestRom(0, 0x15), 100000));
+  EXPECT_EQ(unofficial.status, CONFORMANCE_FAIL);
+  EXPECT_EQ(unofficial.code, 0x15);
+
+  // Stopping on BRK, or on an opcode the CPU should know, before any result
+  // was written
+  ConformanceResult brk = ConformanceRunner::runTest(
+      test("nestest.nes", nestestRom(0, 0, 0x00), 100000));
+  EXPECT_EQ(brk.status, CONFORMANCE_CRASH);
+  EXPECT_EQ(brk.message, "stopped at $C00B");
+
+  // The same ROM entered through its reset vector fails
+  ConformanceResult reset =
+      ConformanceRunner::runTest(test("other", nestestRom(0, 0), 100000));
+  EXPECT_EQ(reset.kind, CONFORMANCE_OTHER);
+  EXPECT_EQ(reset.status, CONFORMANCE_CRASH);
+}
+
+TEST_F(ConformanceRunnerTest, TestOtherRomsAndSkips) {
+  std::vector<uint8_t> program;
+  hang(program);
+  ConformanceResult ran = ConformanceRunner::runTest(
+      test("loop", buildRom(program, 0x8000), 5 * CYCLES_PER_FRAME));
+  EXPECT_EQ(ran.kind, CONFORMANCE_OTHER);
+  EXPECT_EQ(ran.status, CONFORMANCE_PASS);
+  EXPECT_GE(ran.cycles, 5u * CYCLES_PER_FRAME);
+
+  ConformanceResult crashed = ConformanceRunner::runTest(
+      test("brk", buildRom({0x00}, 0x8000), 5 * CYCLES_PER_FRAME));
+  EXPECT_EQ(crashed.status, CONFORMANCE_CRASH);
+  EXPECT_FALSE(crashed.message.empty());
+
+  std::vector<uint8_t> mmc1 = buildRom(program, 0x8000);
+  mmc1[6] = 0x10;
+  ConformanceResult skipped =
+      ConformanceRunner::runTest(test("mmc1", mmc1, 5 * CYCLES_PER_FRAME));
+  EXPECT_EQ(skipped.status, CONFORMANCE_SKIPPED);
+  EXPECT_EQ(skipped.cycles, 0u);
+}
+
+TEST_F(ConformanceRunnerTest, TestParallelRunMatchesSequential) {
+  ConformanceRunner runner = ConformanceRunner(3);
+  std::vector<ConformanceTest> tests;
+  for (uint8_t i = 0; i < 12; i++) {
+    if (i % 3 == 0) {
+      tests.push_back(test("nestest", nestestRom(i, 0), 100000));
+    } else {
+      std::vector<uint8_t> program = blarggProgram(i % 2 ? 0 : i);
+      tests.push_back(
+          test("blargg", buildRom(program, 0x8000), i * CYCLES_PER_FRAME));
+    }
+    EXPECT_EQ(runner.add(tests.back()), i);
+  }
+  std::vector<ConformanceResult> results = runner.run();
+  ASSERT_EQ(results.size(), tests.size());
+  for (size_t i = 0; i < tests.size(); i++) {
+    ConformanceResult expected = ConformanceRunner::runTest(tests[i]);
+    EXPECT_EQ(results[i].status, expected.status);
+    EXPECT_EQ(results[i].code, expected.code);
+    EXPECT_EQ(results[i].cycles, expected.cycles);
+  }
+}
+
+TEST_F(ConformanceRunnerTest, TestAddDirectoryReadsBudgets) {
+  namespace fs = std::filesystem;
+  fs::path directory = fs::path(testing::TempDir()) / "conformance_test";
+  fs::remove_all(directory);
+  fs::create_directories(directory / "blargg");
+  auto write = [&](const fs::path &path, const std::vector<uint8_t> &data) {
+    std::ofstream output(directory / path, std::ios::binary);
+    output.write(reinterpret_cast<const char *>(data.data()), data.size());
+  };
+  write("nestest.nes", nestestRom(0, 0));
+  write("blargg/b.nes", buildRom(blarggProgram(0), 0x8000));
+  write("blargg/a.nes", buildRom(blarggProgram(0), 0x8000));
+  write("notes.txt", {'h', 'i'});
+  std::string budgets = "# rom cycles\nblargg/b.nes 1234\n";
+  write("budgets.txt", std::vector<uint8_t>(budgets.begin(), budgets.end()));
+
+  ConformanceRunner runner = ConformanceRunner(2);
+  ASSERT_TRUE(runner.addDirectory(directory.string()));
+  const std::vector<ConformanceTest> &tests = runner.getTests();
+  ASSERT_EQ(tests.size(), 3u);
+  EXPECT_EQ(tests[0].name, "blargg/a.nes");
+  EXPECT_EQ(tests[0].cycleBudget, CONFORMANCE_DEFAULT_CYCLES);
+  EXPECT_EQ(tests[1].name, "blargg/b.nes");
+  EXPECT_EQ(tests[1].cycleBudget, 1234u);
+  EXPECT_EQ(tests[2].name, "nestest.nes");
+  EXPECT_TRUE(tests[2].nestest);
+  EXPECT_EQ(tests[2].cycleBudget,
+            static_cast<uint64_t>(CONFORMANCE_NESTEST_CYCLES));
+  EXPECT_FALSE(runner.addDirectory((directory / "missing").string()));
+
+  std::vector<ConformanceResult> results = runner.run();
+  for (const ConformanceResult &result : results) {
+    EXPECT_EQ(result.status, CONFORMANCE_PASS);
+  }
+  fs::remove_all(directory);
+}
@@ -0,0 +1,164 @@
+#include "differential.hpp"
+#include "rng.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+// Reference CPU that corrupts a byte once it reaches a frame, a stand in for
+// a broken fast path
+class FaultyBackend : public CpuBackend {
+public:
+  FaultyBackend(std::vector<uint8_t> rom, uint64_t faultFrame,
+                uint16_t address = 0x0041)
+      : CpuBackend(std::move(rom)), faultFrame(faultFrame), address(address) {}
+  std::string getName() const override { return "faulty"; }
+  bool runFrame() override {
+    bool running = CpuBackend::runFrame();
+    if (getCpu().getFrame() == faultFrame) {
+      getCpu().writeToMemory(address, getCpu().readFromMemory(address) ^ 0x01);
+    }
+    return running;
+  }
+
+private:
+  uint64_t faultFrame;
+  uint16_t address;
+};
+
+class DifferentialTest : public ::testing::Test {
+protected:
+  // LDX #$00
+  // poll: LDA #$01, STA $4016, LDA #$00, STA $4016, LDY #$08
+  // bit: LDA $4016, STA $40,X, INX, DEY, BNE bit, JMP poll
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xA9, 0x01, 0x8D, 0x16, 0x40,
+                                  0xA9, 0x00, 0x8D, 0x16, 0x40, 0xA0, 0x08,
+                                  0xAD, 0x16, 0x40, 0x95, 0x40, 0xE8, 0x88,
+                                  0xD0, 0xF7, 0x4C, 0x02, 0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+
+  Movie randomMovie(uint64_t seed, size_t frames) {
+    Movie movie = Movie(Bus(rom).getRomHash(), seed);
+    Rng rng = Rng(seed);
+    for (size_t frame = 0; frame < frames; frame++) {
+      uint8_t buttons[MOVIE_PORTS] = {static_cast<uint8_t>(rng.next()),
+                                      static_cast<uint8_t>(rng.next())};
+      movie.recordFrame(buttons);
+    }
+    return movie;
+  }
+};
+
+TEST_F(DifferentialTest, TestLockstepMatchesInterpreter) {
+  CpuBackend reference = CpuBackend(rom);
+  LockstepBackend<8> candidate = LockstepBackend<8>(rom, 3);
+  Movie movie = randomMovie(7, 60);
+  DifferentialResult result =
+      DifferentialExecutor(reference, candidate).run(&movie, 1000);
+  EXPECT_TRUE(result.started);
+  EXPECT_FALSE(result.diverged) << result.report;
+  EXPECT_FALSE(result.stopped);
+  EXPECT_EQ(result.frames, 60u);
+  EXPECT_EQ(result.report, "");
+  EXPECT_EQ(candidate.hashState(), reference.hashState());
+  EXPECT_EQ(candidate.getCycles(), reference.getCycles());
+}
+
+TEST_F(DifferentialTest, TestReportsFirstDivergence) {
+  CpuBackend reference = CpuBackend(rom);
+  FaultyBackend candidate = FaultyBackend(rom, 5);
+  Movie movie = randomMovie(3, 20);
+  DifferentialResult result =
+      DifferentialExecutor(reference, candidate).run(&movie, 20);
+  ASSERT_TRUE(result.diverged);
+  EXPECT_EQ(result.frames, 4u);
+  uint8_t want = result.reference.bus.cpuVram[0x41];
+  char line[64];
+  snprintf(line, sizeof(line), "RAM $0041: cpu $%02X, faulty $%02X\n", want,
+           want ^ 1);
+  EXPECT_EQ(result.report, std::string("frame 4: states differ\n") + line);
+
+  // The last match is where both sides stood after frame 3
+  CPU replay = CPU(Bus(rom));
+  ASSERT_TRUE(movie.begin(replay));
+  for (size_t frame = 0; frame < 4; frame++) {
+    movie.playFrame(replay, frame);
+  }
+  SaveState expected;
+  replay.saveState(expected);
+  EXPECT_EQ(DifferentialExecutor::diffStates(expected, result.lastMatch, "a",
+                                             "b"),
+            "");
+  EXPECT_EQ(memcmp(&expected, &result.lastMatch, sizeof(SaveState)), 0);
+}
+
+TEST_F(DifferentialTest, TestStopsAndRejectsOtherRoms) {
+  // LDA #$01, STA $10, BRK
+  std::vector<uint8_t> stopping = buildRom({0xA9, 0x01, 0x85, 0x10, 0x00},
+                                           0x8000);
+  CpuBackend reference = CpuBackend(stopping);
+  LockstepBackend<16> candidate = LockstepBackend<16>(stopping);
+  DifferentialResult result =
+      DifferentialExecutor(reference, candidate).run(nullptr, 10);
+  EXPECT_FALSE(result.diverged) << result.report;
+  EXPECT_TRUE(result.stopped);
+  EXPECT_EQ(result.frames, 1u);
+
+  CpuBackend other = CpuBackend(rom);
+  Movie movie = randomMovie(1, 5);
+  result = DifferentialExecutor(reference, other).run(&movie, 5);
+  EXPECT_FALSE(result.started);
+  EXPECT_FALSE(result.diverged);
+}
+
+TEST_F(DifferentialTest, TestDiffListsEveryField) {
+  SaveState a = {}, b = {};
+  b.cpu.PC = 0x8001;
+  b.cpu.cycles = 9;
+  b.bus.controllerShift[1] = 0x80;
+  for (int i = 0; i < DIFFERENTIAL_RAM_REPORT_LIMIT + 3; i++) {
+    b.bus.cpuVram[0x100 + i] = 1;
+  }
+  std::string report = DifferentialExecutor::diffStates(a, b, "ref", "new");
+  EXPECT_EQ(report.find("cycles: ref $0, new $9\nPC: ref $0000, new $8001\n"
+                        "controller 2 shift: ref $00, new $80\n"
+                        "RAM $0100: ref $00, new $01\n"),
+            0u);
+  EXPECT_NE(report.find("RAM $010F"), std::string::npos);
+  EXPECT_EQ(report.find("RAM $0110"), std::string::npos);
+  EXPECT_NE(report.find("and 3 more RAM bytes\n"), std::string::npos);
+}
+
+TEST_F(DifferentialTest, TestReportsPpuOnlyDivergence) {
+  // OAMADDR, nothing the CPU side of the state has
+  CpuBackend reference = CpuBackend(rom);
+  FaultyBackend candidate = FaultyBackend(rom, 2, 0x2003);
+  DifferentialResult result =
+      DifferentialExecutor(reference, candidate).run(nullptr, 5);
+  ASSERT_TRUE(result.diverged);
+  EXPECT_EQ(result.frames, 1u);
+  EXPECT_NE(result.report.find("OAMADDR: cpu $00, faulty $01\n"),
+            std::string::npos)
+      << result.report;
+  EXPECT_EQ(result.report.find("saved states match"), std::string::npos);
+}
+
+TEST_F(DifferentialTest, TestDiffListsPrgRamAndPpuMemories) {
+  SaveState a = {}, b = {};
+  b.bus.prgRamUsed = 1;
+  b.bus.prgRam[0x10] = 0x55;
+  b.bus.dmaStall = 3;
+  b.bus.ppu.palette[1] = 0x21;
+  for (int i = 0; i < DIFFERENTIAL_RAM_REPORT_LIMIT + 2; i++) {
+    b.bus.ppu.vram[i] = 1;
+  }
+  std::string report = DifferentialExecutor::diffStates(a, b, "ref", "new");
+  EXPECT_NE(report.find("DMA stall: ref $0, new $3\n"), std::string::npos);
+  EXPECT_NE(report.find("PRG RAM used: ref $0, new $1\n"), std::string::npos);
+  EXPECT_NE(report.find("PRG RAM $6010: ref $00, new $55\n"),
+            std::string::npos);
+  EXPECT_NE(report.find("palette $3F01: ref $00, new $21\n"),
+            std::string::npos);
+  EXPECT_NE(report.find("VRAM $200F"), std::string::npos);
+  EXPECT_EQ(report.find("VRAM $2010"), std::string::npos);
+  EXPECT_NE(report.find("and 2 more VRAM bytes\n"), std::string::npos);
+}
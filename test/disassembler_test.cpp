@@ -0,0 +1,148 @@
+#include "disassembler.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+class DisassemblerTest : public ::testing::Test {
+protected:
+  // $8000 LDX #$05, DEX, BNE $8002, JSR $8010, JMP $8008 ... $8010 RTS
+  std::vector<uint8_t> program = {0xA2, 0x05, 0xCA, 0xD0, 0xFD, 0x20,
+                                  0x10, 0x80, 0x4C, 0x08, 0x80, 0xFF,
+                                  0xFF, 0xFF, 0xFF, 0xFF, 0x60};
+  Bus bus = Bus(buildRom(program, 0x8000, 0x8010, 0x8010));
+  Disassembler disassembler = Disassembler(bus.getRom());
+
+  void SetUp() override { disassembler.analyze(); }
+};
+
+TEST_F(DisassemblerTest, TestReachableCodeFromVectors) {
+  for (uint16_t address : {0x8000, 0x8002, 0x8003, 0x8005, 0x8008, 0x8010}) {
+    const DecodedInstruction *entry = disassembler.lookup(address);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_TRUE(entry->flags & DecodedInstruction::REACHABLE) << address;
+  }
+  // Operand bytes and the padding after the JMP are never reached
+  EXPECT_FALSE(disassembler.lookup(0x8001)->flags &
+               DecodedInstruction::REACHABLE);
+  EXPECT_FALSE(disassembler.lookup(0x800B)->flags &
+               DecodedInstruction::REACHABLE);
+}
+
+TEST_F(DisassemblerTest, TestControlFlowTargetsAreMarked) {
+  EXPECT_TRUE(disassembler.lookup(0x8000)->flags &
+              DecodedInstruction::ENTRY_POINT);
+  EXPECT_TRUE(disassembler.lookup(0x8010)->flags &
+              DecodedInstruction::ENTRY_POINT);
+  EXPECT_TRUE(disassembler.lookup(0x8002)->flags &
+              DecodedInstruction::JUMP_TARGET);
+  EXPECT_TRUE(disassembler.lookup(0x8008)->flags &
+              DecodedInstruction::JUMP_TARGET);
+}
+
+TEST_F(DisassemblerTest, TestDecodeIsMemoized) {
+  const DecodedInstruction *entry = disassembler.lookup(0x8005);
+  EXPECT_EQ(entry->opcode, 0x20);
+  EXPECT_EQ(entry->bytes, 3);
+  EXPECT_EQ(entry->operand, 0x8010);
+  EXPECT_EQ(disassembler.lookup(0x8005), entry);
+  // A 16KB ROM is mirrored at $C000, and shares the cached view
+  EXPECT_EQ(disassembler.lookup(0xC005), entry);
+  // RAM is never cached
+  EXPECT_EQ(disassembler.lookup(0x0200), nullptr);
+}
+
+TEST_F(DisassemblerTest, TestFormat) {
+  EXPECT_STREQ(disassembler.format(0x8000), "LDX #$05");
+  EXPECT_STREQ(disassembler.format(0x8003), "BNE $8002");
+  EXPECT_STREQ(disassembler.format(0x8005), "JSR $8010");
+  EXPECT_STREQ(disassembler.format(0x800B), ".db $FF");
+  EXPECT_EQ(disassembler.format(0x0000), nullptr);
+}
+
+TEST_F(DisassemblerTest, TestTraceMatchesUncachedTrace) {
+  CPU cpu = CPU(bus);
+  for (uint16_t address : {0x8000, 0x8003, 0x8005, 0x8008}) {
+    cpu.PC = address;
+    EXPECT_EQ(traceCpuState(&cpu, &disassembler), traceCpuState(&cpu));
+  }
+}
+
+TEST(DisassemblerTraceTest, TestTraceFillsInOperandValues) {
+  // LDA $10, LDA $10,X, LDA $0200, LDA $0200,X, LDA $0200,Y, LDA ($10,X),
+  // LDA ($10),Y, ASL A, NOP, JMP ($0020)
+  std::vector<uint8_t> program = {0xA5, 0x10, 0xB5, 0x10, 0xAD, 0x00, 0x02,
+                                  0xBD, 0x00, 0x02, 0xB9, 0x00, 0x02, 0xA1,
+                                  0x10, 0xB1, 0x10, 0x0A, 0xEA, 0x6C, 0x20,
+                                  0x00};
+  Bus bus = Bus(buildRom(program, 0x8000));
+  Disassembler disassembler = Disassembler(bus.getRom());
+  CPU cpu = CPU(bus);
+  cpu.X = 0x05;
+  cpu.Y = 0x01;
+  cpu.writeToMemory(0x10, 0x00);
+  cpu.writeToMemory(0x11, 0x02);
+  cpu.writeToMemory(0x15, 0x00);
+  cpu.writeToMemory(0x16, 0x02);
+  cpu.writeToMemory(0x20, 0x34);
+  cpu.writeToMemory(0x21, 0x12);
+  cpu.writeToMemory(0x0200, 0x42);
+  cpu.writeToMemory(0x0201, 0x43);
+  for (uint16_t address = 0x8000; address < 0x8000 + program.size();) {
+    cpu.PC = address;
+    EXPECT_EQ(traceCpuState(&cpu, &disassembler), traceCpuState(&cpu))
+        << std::hex << address;
+    address += disassembler.lookup(address)->bytes;
+  }
+  cpu.PC = 0x800D;
+  EXPECT_NE(traceCpuState(&cpu, &disassembler)
+                .find("800D     A1 10     LDA ($10,X) = 15 @ 0200 = 42 A:"),
+            std::string::npos);
+  cpu.PC = 0x800F;
+  EXPECT_NE(traceCpuState(&cpu, &disassembler)
+                .find("LDA ($10),Y = 0200 @ 0201 = 43 A:"),
+            std::string::npos);
+  cpu.PC = 0x8011;
+  EXPECT_NE(traceCpuState(&cpu, &disassembler).find("ASL A  A:"),
+            std::string::npos);
+  cpu.PC = 0x8013;
+  EXPECT_NE(traceCpuState(&cpu, &disassembler).find("JMP ($0020) = 1234 A:"),
+            std::string::npos);
+}
+
+TEST(DisassemblerTraceTest, TestTraceHasNoSideEffects) {
+  // LDA $2002, BIT $2002, LDA $2007, LDA $4016
+  std::vector<uint8_t> program = {0xAD, 0x02, 0x20, 0x2C, 0x02, 0x20,
+                                  0xAD, 0x07, 0x20, 0xAD, 0x16, 0x40};
+  Bus bus = Bus(buildRom(program, 0x8000));
+  Disassembler disassembler = Disassembler(bus.getRom());
+  CPU cpu = CPU(bus);
+  cpu.reset();
+  // PPUADDR $2000, then the strobe so the controller has bits to shift
+  cpu.writeToMemory(0x2006, 0x20);
+  cpu.writeToMemory(0x2006, 0x00);
+  cpu.getBus().setControllerState(0, BUTTON_A);
+  cpu.writeToMemory(0x4016, 1);
+  cpu.writeToMemory(0x4016, 0);
+  // In vblank
+  cpu.cycles = PPU_VBLANK_DOT / 3 + 10;
+  cpu.getBus().setClock(cpu.cycles);
+  uint64_t hash = cpu.hashState();
+
+  for (uint16_t address = 0x8000; address < 0x8000 + program.size();) {
+    cpu.PC = address;
+    std::string fast = traceCpuState(&cpu, &disassembler);
+    EXPECT_EQ(fast, traceCpuState(&cpu)) << std::hex << address;
+    EXPECT_EQ(fast, traceCpuState(&cpu, &disassembler)) << std::hex << address;
+    address += disassembler.lookup(address)->bytes;
+  }
+  cpu.PC = 0x8000;
+  EXPECT_EQ(cpu.hashState(), hash);
+  EXPECT_NE(traceCpuState(&cpu, &disassembler).find("LDA $2002 = 80"),
+            std::string::npos);
+  cpu.PC = 0x8009;
+  EXPECT_NE(traceCpuState(&cpu, &disassembler).find("LDA $4016 = 01"),
+            std::string::npos);
+  // The real read still sees vblank and clears it
+  EXPECT_EQ(cpu.readFromMemory(0x2002) & PPUSTATUS_VBLANK, PPUSTATUS_VBLANK);
+  EXPECT_EQ(cpu.readFromMemory(0x2002) & PPUSTATUS_VBLANK, 0);
+}
@@ -0,0 +1,114 @@
+#include "envserver.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <thread>
+#include <unistd.h>
+
+class EnvServerTest : public ::testing::Test {
+protected:
+  // loop: LDA #$01, STA $4016, LDA #$00, STA $4016
+  // LDA $4016, STA $0200, INC $0201, JMP loop
+  std::vector<uint8_t> program = {0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9, 0x00,
+                                  0x8D, 0x16, 0x40, 0xAD, 0x16, 0x40, 0x8D,
+                                  0x00, 0x02, 0xEE, 0x01, 0x02, 0x4C, 0x00,
+                                  0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+  std::string socketPath = testing::TempDir() + "envserver_test.sock";
+  std::string sharedName = "/cnes-envserver-test-" + std::to_string(getpid());
+
+  EnvStepEntry entry(uint32_t instance, uint32_t frames, uint8_t buttons,
+                     uint8_t flags = 0) {
+    EnvStepEntry entry = {instance, frames, {buttons, 0}, flags, 0};
+    return entry;
+  }
+};
+
+TEST_F(EnvServerTest, TestStepMatchesDirectRun) {
+  EnvServer server = EnvServer(rom, 3);
+  ASSERT_TRUE(server.open(socketPath, sharedName));
+  ASSERT_EQ(server.step(0, {entry(1, 4, BUTTON_A)}), 1);
+
+  CPU cpu = CPU(Bus(rom));
+  cpu.reset();
+  cpu.getBus().setControllerState(0, BUTTON_A);
+  for (int frame = 0; frame < 4; frame++) {
+    cpu.runFrame();
+  }
+  const EnvObservation &observation = server.getObservation(0, 1);
+  EXPECT_EQ(observation.sequence, 0u);
+  EXPECT_EQ(observation.frame, 4u);
+  EXPECT_EQ(observation.stateHash, cpu.hashState());
+  EXPECT_EQ(memcmp(observation.ram, cpu.getBus().getRam(), 2048), 0);
+  EXPECT_EQ(observation.ram[ENV_FRAME_OFFSET], 1);
+  // Rendering is never enabled, so the PPU has not drawn a line
+  EXPECT_EQ(cpu.getBus().getFramebuffer(cpu.cycles), nullptr);
+  uint8_t blank[sizeof(observation.picture)] = {0};
+  EXPECT_EQ(memcmp(observation.picture, blank, sizeof(blank)), 0);
+  // Untouched instances have no observation yet
+  EXPECT_EQ(server.getObservation(0, 0).sequence, UINT32_MAX);
+
+  EXPECT_EQ(server.step(1, {entry(3, 1, 0)}), -1);
+  ASSERT_EQ(server.step(1, {entry(1, 0, 0, ENV_RESET)}), 1);
+  EXPECT_EQ(server.getObservation(1, 1).frame, 0u);
+}
+
+TEST_F(EnvServerTest, TestObservationHasPicture) {
+  // Backdrop colour $21, show the background, then spin:
+  // LDA #$3F, STA $2006, LDA #$00, STA $2006, LDA #$21, STA $2007
+  // LDA #$08, STA $2001, loop: JMP loop
+  std::vector<uint8_t> rendering = buildRom(
+      {0xA9, 0x3F, 0x8D, 0x06, 0x20, 0xA9, 0x00, 0x8D, 0x06, 0x20, 0xA9, 0x21,
+       0x8D, 0x07, 0x20, 0xA9, 0x08, 0x8D, 0x01, 0x20, 0x4C, 0x14, 0x80},
+      0x8000);
+  EnvServer server = EnvServer(rendering, 1);
+  ASSERT_TRUE(server.open(socketPath, sharedName));
+  ASSERT_EQ(server.step(0, {entry(0, 2, 0)}), 1);
+
+  CPU cpu = CPU(Bus(rendering));
+  cpu.reset();
+  cpu.runFrame();
+  cpu.runFrame();
+  const uint8_t *picture = cpu.getBus().getFramebuffer(cpu.cycles);
+  ASSERT_NE(picture, nullptr);
+  const EnvObservation &observation = server.getObservation(0, 0);
+  EXPECT_EQ(observation.picture[0], 0x21);
+  EXPECT_EQ(memcmp(observation.picture, picture, sizeof(observation.picture)),
+            0);
+}
+
+TEST_F(EnvServerTest, TestPipelinedClient) {
+  EnvServer server = EnvServer(rom, 2);
+  ASSERT_TRUE(server.open(socketPath, sharedName));
+  std::thread serving([&server]() { EXPECT_TRUE(server.serve()); });
+
+  EnvClient client;
+  ASSERT_TRUE(client.connect(socketPath));
+  EXPECT_EQ(client.getHello().instanceCount, 2u);
+  EXPECT_EQ(client.getHello().slotCount, static_cast<uint32_t>(ENV_SLOTS));
+  // Both batches are in flight before the first reply is read
+  ASSERT_TRUE(client.sendStep(0, {entry(0, 2, BUTTON_A), entry(1, 2, 0)}));
+  ASSERT_TRUE(client.sendStep(1, {entry(0, 1, 0)}));
+
+  EnvReply reply;
+  ASSERT_TRUE(client.receive(reply));
+  EXPECT_EQ(reply.sequence, 0u);
+  EXPECT_EQ(reply.status, 2);
+  const EnvObservation &first = client.getObservation(reply.slot, 0);
+  EXPECT_EQ(first.frame, 2u);
+  EXPECT_EQ(first.ram[ENV_FRAME_OFFSET], 1);
+  EXPECT_EQ(client.getObservation(reply.slot, 1).ram[ENV_FRAME_OFFSET], 0);
+
+  ASSERT_TRUE(client.receive(reply));
+  EXPECT_EQ(reply.sequence, 1u);
+  EXPECT_EQ(reply.status, 1);
+  const EnvObservation &second = client.getObservation(reply.slot, 0);
+  EXPECT_EQ(second.sequence, 1u);
+  EXPECT_EQ(second.frame, 3u);
+  EXPECT_EQ(second.ram[ENV_FRAME_OFFSET], 0);
+
+  ASSERT_TRUE(client.sendClose());
+  ASSERT_TRUE(client.receive(reply));
+  serving.join();
+}
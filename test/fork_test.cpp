@@ -0,0 +1,106 @@
+#include "cpu.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+class ForkTest : public ::testing::Test {
+protected:
+  // LDX #$00, loop: INX, STX $10,X, JMP loop
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xE8, 0x96,
+                                  0x10, 0x4C, 0x02, 0x80};
+  CPU cpu = CPU(Bus(buildRom(program, 0x8000)));
+
+  void SetUp() override { cpu.reset(); }
+};
+
+TEST_F(ForkTest, TestChildSharesPagesUntilWritten) {
+  cpu.runFrame();
+  CPU child = cpu.fork();
+  EXPECT_EQ(child.getBus().getPrivatePageCount(), 0u);
+  EXPECT_EQ(cpu.getBus().getPrivatePageCount(), 0u);
+  EXPECT_EQ(child.hashState(), cpu.hashState());
+
+  child.writeToMemory(0x0301, 0xAB);
+  EXPECT_EQ(child.getBus().getPrivatePageCount(), 1u);
+  EXPECT_EQ(child.readFromMemory(0x0301), 0xAB);
+  // Mirrors see the child's copy of the page
+  EXPECT_EQ(child.readFromMemory(0x0B01), 0xAB);
+  EXPECT_EQ(cpu.readFromMemory(0x0301), 0x00);
+  EXPECT_NE(child.hashState(), cpu.hashState());
+
+  // The parent is the only owner left of that page and takes it back
+  cpu.writeToMemory(0x0302, 0xCD);
+  EXPECT_EQ(cpu.getBus().getPrivatePageCount(), 1u);
+  EXPECT_EQ(child.readFromMemory(0x0302), 0x00);
+}
+
+TEST_F(ForkTest, TestChildRunsLikeAFullCopy) {
+  cpu.runFrame();
+  CPU copy = cpu;
+  CPU child = cpu.fork();
+  for (int i = 0; i < 5; i++) {
+    copy.runFrame();
+    child.runFrame();
+  }
+  SaveState expected, actual;
+  copy.saveState(expected);
+  child.saveState(actual);
+  EXPECT_EQ(memcmp(&expected, &actual, sizeof(SaveState)), 0);
+  EXPECT_EQ(child.hashState(), copy.hashState());
+  EXPECT_NE(child.hashState(), cpu.hashState());
+}
+
+TEST_F(ForkTest, TestForkOutlivesParent) {
+  CPU *parent = new CPU(cpu.fork());
+  parent->runFrame();
+  CPU child = parent->fork();
+  uint64_t hash = parent->hashState();
+  delete parent;
+  EXPECT_EQ(child.hashState(), hash);
+  child.runFrame();
+  EXPECT_NE(child.hashState(), hash);
+  // Pages the program never touches are still shared with the fixture
+  EXPECT_EQ(child.getBus().getPrivatePageCount(), 1u);
+}
+
+TEST_F(ForkTest, TestHashIgnoresFrameNumber) {
+  CPU later = cpu;
+  later.cycles += CYCLES_PER_FRAME * 10;
+  EXPECT_EQ(later.hashState(), cpu.hashState());
+  later.cycles += 1;
+  EXPECT_NE(later.hashState(), cpu.hashState());
+}
+
+TEST_F(ForkTest, TestPrgRamIsCopiedOnWrite) {
+  EXPECT_EQ(cpu.readFromMemory(0x6000), 0x00);
+  cpu.writeToMemory(0x6000, 0x12);
+  CPU copy = cpu;
+  CPU child = cpu.fork();
+  EXPECT_EQ(child.readFromMemory(0x6000), 0x12);
+
+  child.writeToMemory(0x7FFF, 0x34);
+  cpu.writeToMemory(0x6000, 0x56);
+  copy.writeToMemory(0x6001, 0x78);
+  EXPECT_EQ(child.readFromMemory(0x6000), 0x12);
+  EXPECT_EQ(child.readFromMemory(0x7FFF), 0x34);
+  EXPECT_EQ(cpu.readFromMemory(0x6000), 0x56);
+  EXPECT_EQ(cpu.readFromMemory(0x7FFF), 0x00);
+  EXPECT_EQ(cpu.readFromMemory(0x6001), 0x00);
+  EXPECT_EQ(copy.readFromMemory(0x6000), 0x12);
+}
+
+TEST_F(ForkTest, TestReadModifyWriteCopiesSharedPage) {
+  // INC $10, ASL $0210, BRK
+  CPU rmw = CPU(Bus(buildRom({0xE6, 0x10, 0x0E, 0x10, 0x02, 0x00}, 0x8000)));
+  rmw.reset();
+  rmw.writeToMemory(0x0010, 0x41);
+  rmw.writeToMemory(0x0210, 0x81);
+  CPU child = rmw.fork();
+  EXPECT_FALSE(child.runFrame());
+  EXPECT_EQ(child.readFromMemory(0x0010), 0x42);
+  EXPECT_EQ(child.readFromMemory(0x0210), 0x02);
+  EXPECT_TRUE(child.S & CPU::FLAGS::C);
+  EXPECT_EQ(rmw.readFromMemory(0x0010), 0x41);
+  EXPECT_EQ(rmw.readFromMemory(0x0210), 0x81);
+  EXPECT_EQ(child.getBus().getPrivatePageCount(), 2u);
+}
@@ -0,0 +1,74 @@
+#include "cpu.hpp"
+#include "profiler.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+class IdleLoopTest : public ::testing::Test {
+protected:
+  // Runs the program for a few frames with and without skipping, checks both
+  // end in the same state and returns the stats of the skipping run
+  IdleLoopStats runBoth(const std::vector<uint8_t> &program,
+                        size_t frames = 3) {
+    std::vector<uint8_t> rom = buildRom(program, 0x8000);
+    CPU skipping = CPU(Bus(rom));
+    CPU running = CPU(Bus(rom));
+    skipping.reset();
+    running.reset();
+    running.skipIdleLoops = false;
+    for (size_t i = 0; i < frames; i++) {
+      EXPECT_EQ(skipping.runFrame(), running.runFrame());
+      EXPECT_EQ(skipping.cycles, running.cycles) << i;
+      EXPECT_EQ(skipping.hashState(), running.hashState()) << i;
+    }
+    EXPECT_EQ(running.getIdleLoopStats().loops, 0u);
+    return skipping.getIdleLoopStats();
+  }
+};
+
+TEST_F(IdleLoopTest, TestJumpToSelfIsSkipped) {
+  // LDA #$01, STA $10, JMP *
+  IdleLoopStats stats =
+      runBoth({0xA9, 0x01, 0x85, 0x10, 0x4C, 0x04, 0x80});
+  EXPECT_EQ(stats.loops, 3u);
+  // Each frame is nearly all skipped
+  EXPECT_GT(stats.cycles, 3u * (CYCLES_PER_FRAME - 100));
+}
+
+TEST_F(IdleLoopTest, TestStatusPollIsSkipped) {
+  // wait: LDA $2002, BPL wait, JMP wait
+  IdleLoopStats stats =
+      runBoth({0xAD, 0x02, 0x20, 0x10, 0xFB, 0x4C, 0x00, 0x80});
+  // Up to vblank, up to the pre-render line where the flag would clear and
+  // up to the end of the frame
+  EXPECT_EQ(stats.loops, 9u);
+}
+
+TEST_F(IdleLoopTest, TestRamPollWithCompareIsSkipped) {
+  // LDA #$07, STA $20, wait: LDA $20, AND #$03, CMP #$03, BEQ wait, BRK
+  IdleLoopStats stats = runBoth({0xA9, 0x07, 0x85, 0x20, 0xA5, 0x20, 0x29,
+                                 0x03, 0xC9, 0x03, 0xF0, 0xF8, 0x00});
+  EXPECT_EQ(stats.loops, 3u);
+}
+
+TEST_F(IdleLoopTest, TestLoopsThatChangeStateRun) {
+  // loop: INX, STX $10, JMP loop
+  EXPECT_EQ(runBoth({0xE8, 0x86, 0x10, 0x4C, 0x00, 0x80}).loops, 0u);
+  // loop: DEX, BNE loop, JMP $8000
+  EXPECT_EQ(runBoth({0xCA, 0xD0, 0xFD, 0x4C, 0x00, 0x80}).loops, 0u);
+  // Controller reads shift the buttons out
+  // wait: LDA $4016, BEQ wait
+  EXPECT_EQ(runBoth({0xAD, 0x16, 0x40, 0xF0, 0xFB}).loops, 0u);
+}
+
+TEST_F(IdleLoopTest, TestNotSkippedWhileProfiling) {
+  CPU cpu = CPU(Bus(buildRom({0x4C, 0x00, 0x80}, 0x8000)));
+  cpu.reset();
+  Profiler profiler;
+  cpu.profiler = &profiler;
+  ASSERT_TRUE(cpu.runFrame());
+  EXPECT_EQ(cpu.getIdleLoopStats().loops, 0u);
+  cpu.profiler = nullptr;
+  ASSERT_TRUE(cpu.runFrame());
+  EXPECT_EQ(cpu.getIdleLoopStats().loops, 1u);
+}
@@ -0,0 +1,84 @@
+#include "hash.hpp"
+#include "keyframeindex.hpp"
+#include "rng.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <gtest/gtest.h>
+
+class KeyframeIndexTest : public ::testing::Test {
+protected:
+  // LDX #$00
+  // poll: LDA #$01, STA $4016, LDA #$00, STA $4016, LDY #$08
+  // bit: LDA $4016, STA $40,X, INX, DEY, BNE bit, JMP poll
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xA9, 0x01, 0x8D, 0x16, 0x40,
+                                  0xA9, 0x00, 0x8D, 0x16, 0x40, 0xA0, 0x08,
+                                  0xAD, 0x16, 0x40, 0x95, 0x40, 0xE8, 0x88,
+                                  0xD0, 0xF7, 0x4C, 0x02, 0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+  std::string path = testing::TempDir() + "keyframeindex_test.cnki";
+  CPU cpu = CPU(Bus(rom));
+  Movie movie = Movie(cpu.getBus().getRomHash(), 3);
+  // State hash at the start of every frame
+  std::vector<uint64_t> hashes;
+
+  void TearDown() override { remove(path.c_str()); }
+
+  uint64_t stateHash(const CPU &cpu) {
+    SaveState state;
+    cpu.saveState(state);
+    return hashBytes(&state, sizeof(state));
+  }
+
+  // Records frames of random input while writing an index
+  void record(uint32_t frames, uint32_t interval) {
+    KeyframeIndexWriter writer;
+    ASSERT_TRUE(writer.open(path, cpu.getBus().getRomHash(), interval));
+    ASSERT_TRUE(movie.begin(cpu));
+    Rng rng = Rng(movie.getSeed());
+    for (uint32_t frame = 0; frame < frames; frame++) {
+      hashes.push_back(stateHash(cpu));
+      ASSERT_TRUE(writer.onFrame(cpu, frame, movie.getInputOffset(frame)));
+      uint8_t buttons[MOVIE_PORTS] = {static_cast<uint8_t>(rng.next()), 0};
+      movie.recordFrame(buttons);
+      ASSERT_TRUE(movie.playFrame(cpu, frame));
+    }
+    hashes.push_back(stateHash(cpu));
+  }
+};
+
+TEST_F(KeyframeIndexTest, TestIndexHasEntryEveryInterval) {
+  record(25, 10);
+  KeyframeIndex index;
+  ASSERT_TRUE(index.open(path));
+  ASSERT_EQ(index.getCount(), 3u);
+  EXPECT_EQ(index.getInterval(), 10u);
+  for (size_t i = 0; i < index.getCount(); i++) {
+    EXPECT_EQ(index.getEntry(i).frame, i * 10);
+    EXPECT_EQ(index.getEntry(i).movieOffset, movie.getInputOffset(i * 10));
+  }
+  EXPECT_EQ(index.find(9)->frame, 0u);
+  EXPECT_EQ(index.find(10)->frame, 10u);
+  EXPECT_EQ(index.find(24)->frame, 20u);
+}
+
+TEST_F(KeyframeIndexTest, TestSeekMatchesReplayFromPowerOn) {
+  record(40, 8);
+  KeyframeIndex index;
+  ASSERT_TRUE(index.open(path));
+  for (uint32_t frame : {0u, 1u, 7u, 8u, 9u, 23u, 39u, 40u}) {
+    CPU player = CPU(Bus(rom));
+    ASSERT_TRUE(index.seek(movie, player, frame)) << frame;
+    EXPECT_EQ(stateHash(player), hashes[frame]) << frame;
+  }
+}
+
+TEST_F(KeyframeIndexTest, TestTruncatedEntryIsIgnored) {
+  record(20, 5);
+  FILE *file = fopen(path.c_str(), "ab");
+  fwrite("partial", 1, 7, file);
+  fclose(file);
+  KeyframeIndex index;
+  ASSERT_TRUE(index.open(path));
+  EXPECT_EQ(index.getCount(), 4u);
+}
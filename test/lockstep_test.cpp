@@ -0,0 +1,139 @@
+#include "cpu.hpp"
+#include "lockstep.hpp"
+#include "rng.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+
+class LockstepTest : public ::testing::Test {
+protected:
+  // LDX #$00
+  // poll: LDA #$01, STA $4016, LDA #$00, STA $4016, LDY #$08
+  // bit: LDA $4016, STA $40,X, INX, DEY, BNE bit
+  // CMP #$01, BNE skip, INC $10
+  // skip: ADC $10, STA ($20),Y, JMP poll
+  std::vector<uint8_t> program = {
+      0xA2, 0x00, 0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9, 0x00, 0x8D, 0x16, 0x40,
+      0xA0, 0x08, 0xAD, 0x16, 0x40, 0x95, 0x40, 0xE8, 0x88, 0xD0, 0xF7, 0xC9,
+      0x01, 0xD0, 0x02, 0xE6, 0x10, 0x65, 0x10, 0x91, 0x20, 0x4C, 0x02, 0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+
+  template <size_t LANES>
+  void expectLaneMatchesCpu(const LockstepCPU<LANES> &lockstep, size_t lane,
+                            const CPU &cpu) {
+    SaveState expected;
+    SaveState actual;
+    cpu.saveState(expected);
+    lockstep.saveState(lane, actual);
+    EXPECT_EQ(memcmp(&expected, &actual, sizeof(SaveState)), 0) << lane;
+  }
+};
+
+TEST_F(LockstepTest, TestLanesMatchScalarCpus) {
+  LockstepCPU<16> lockstep = LockstepCPU<16>(rom);
+  lockstep.reset();
+  std::vector<CPU> cpus(16, CPU(Bus(rom)));
+  for (CPU &cpu : cpus) {
+    cpu.reset();
+  }
+  Rng rng = Rng(7);
+  for (int frame = 0; frame < 20; frame++) {
+    for (size_t lane = 0; lane < 16; lane++) {
+      // Half the lanes hold their input, so lanes both share and split paths
+      uint8_t buttons = lane < 8 ? 0 : static_cast<uint8_t>(rng.next());
+      lockstep.setControllerState(lane, 0, buttons);
+      cpus[lane].getBus().setControllerState(0, buttons);
+    }
+    ASSERT_TRUE(lockstep.runFrame());
+    for (size_t lane = 0; lane < 16; lane++) {
+      ASSERT_TRUE(cpus[lane].runFrame());
+      expectLaneMatchesCpu(lockstep, lane, cpus[lane]);
+    }
+  }
+  // Identical lanes never split, so groups cover more than one lane
+  EXPECT_GT(lockstep.getLaneSteps(), 2 * lockstep.getGroupSteps());
+}
+
+TEST_F(LockstepTest, TestStateMovesBetweenCpuAndLane) {
+  CPU cpu = CPU(Bus(rom));
+  cpu.reset();
+  cpu.getBus().setControllerState(0, BUTTON_RIGHT | BUTTON_A);
+  cpu.runFrame();
+  SaveState state;
+  cpu.saveState(state);
+
+  LockstepCPU<8> lockstep = LockstepCPU<8>(rom);
+  lockstep.reset();
+  ASSERT_TRUE(lockstep.loadState(3, state));
+  expectLaneMatchesCpu(lockstep, 3, cpu);
+  ASSERT_TRUE(lockstep.runFrame());
+  ASSERT_TRUE(cpu.runFrame());
+  expectLaneMatchesCpu(lockstep, 3, cpu);
+
+  state.romHash++;
+  EXPECT_FALSE(lockstep.loadState(0, state));
+}
+
+TEST_F(LockstepTest, TestBrkStopsOnlyItsLanes) {
+  // LDA $4016, BEQ loop, BRK
+  // loop: JMP loop
+  std::vector<uint8_t> stopper = {0xA9, 0x01, 0x8D, 0x16, 0x40, 0xAD,
+                                  0x16, 0x40, 0xF0, 0x01, 0x00, 0x4C,
+                                  0x0B, 0x80};
+  LockstepCPU<8> lockstep = LockstepCPU<8>(buildRom(stopper, 0x8000));
+  lockstep.reset();
+  lockstep.setControllerState(5, 0, BUTTON_A);
+  EXPECT_FALSE(lockstep.runFrame());
+  for (size_t lane = 0; lane < 8; lane++) {
+    EXPECT_EQ(lockstep.isStopped(lane), lane == 5) << lane;
+  }
+  EXPECT_GE(lockstep.cycles[0], static_cast<uint64_t>(CYCLES_PER_FRAME));
+}
+
+TEST_F(LockstepTest, TestPrgRamMatchesCpu) {
+  // LDX #$00, loop: INX, STX $6001, LDA $6001, STA $10, JMP loop
+  std::vector<uint8_t> prgRamRom =
+      buildRom({0xA2, 0x00, 0xE8, 0x8E, 0x01, 0x60, 0xAD, 0x01, 0x60, 0x85,
+                0x10, 0x4C, 0x02, 0x80},
+               0x8000);
+  CPU cpu = CPU(Bus(prgRamRom));
+  cpu.reset();
+  LockstepCPU<8> lockstep = LockstepCPU<8>(prgRamRom);
+  lockstep.reset();
+  expectLaneMatchesCpu(lockstep, 0, cpu);
+  for (int frame = 0; frame < 3; frame++) {
+    ASSERT_TRUE(lockstep.runFrame());
+    ASSERT_TRUE(cpu.runFrame());
+    expectLaneMatchesCpu(lockstep, 5, cpu);
+    EXPECT_EQ(lockstep.hashState(5), cpu.hashState());
+  }
+  EXPECT_NE(lockstep.peek(5, 0x10), 0);
+}
+
+TEST_F(LockstepTest, TestLdyMatchesCpu) {
+  // LDA #$11, STA $10, LDA #$22, STA $12, LDA #$33, STA $0300, LDA #$44,
+  // STA $0302, LDX #$02
+  // LDY #$55, STY $20, LDY $10, STY $21, LDY $10,X, STY $22,
+  // LDY $0300, STY $23, LDY $0300,X, STY $24, loop: JMP loop
+  std::vector<uint8_t> ldyRom = buildRom(
+      {0xA9, 0x11, 0x85, 0x10, 0xA9, 0x22, 0x85, 0x12, 0xA9, 0x33, 0x8D,
+       0x00, 0x03, 0xA9, 0x44, 0x8D, 0x02, 0x03, 0xA2, 0x02, 0xA0, 0x55,
+       0x84, 0x20, 0xA4, 0x10, 0x84, 0x21, 0xB4, 0x10, 0x84, 0x22, 0xAC,
+       0x00, 0x03, 0x84, 0x23, 0xBC, 0x00, 0x03, 0x84, 0x24, 0x4C, 0x2A,
+       0x80},
+      0x8000);
+  CPU cpu = CPU(Bus(ldyRom));
+  cpu.reset();
+  LockstepCPU<8> lockstep = LockstepCPU<8>(ldyRom);
+  lockstep.reset();
+  ASSERT_TRUE(cpu.runFrame());
+  ASSERT_TRUE(lockstep.runFrame());
+  const uint8_t expected[] = {0x55, 0x11, 0x22, 0x33, 0x44};
+  for (uint16_t i = 0; i < 5; i++) {
+    EXPECT_EQ(cpu.readFromMemory(0x20 + i), expected[i]) << i;
+    EXPECT_EQ(lockstep.peek(3, 0x20 + i), expected[i]) << i;
+  }
+  EXPECT_EQ(cpu.Y, 0x44);
+  expectLaneMatchesCpu(lockstep, 3, cpu);
+}
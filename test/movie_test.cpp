@@ -0,0 +1,94 @@
+#include "hash.hpp"
+#include "movie.hpp"
+#include "rng.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <gtest/gtest.h>
+
+class MovieTest : public ::testing::Test {
+protected:
+  // LDX #$00
+  // poll: LDA #$01, STA $4016, LDA #$00, STA $4016, LDY #$08
+  // bit: LDA $4016, STA $40,X, INX, DEY, BNE bit, JMP poll
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xA9, 0x01, 0x8D, 0x16, 0x40,
+                                  0xA9, 0x00, 0x8D, 0x16, 0x40, 0xA0, 0x08,
+                                  0xAD, 0x16, 0x40, 0x95, 0x40, 0xE8, 0x88,
+                                  0xD0, 0xF7, 0x4C, 0x02, 0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+  std::string path = testing::TempDir() + "movie_test.cnm";
+
+  void TearDown() override { remove(path.c_str()); }
+
+  uint64_t stateHash(const CPU &cpu) {
+    SaveState state;
+    cpu.saveState(state);
+    return hashBytes(&state, sizeof(state));
+  }
+};
+
+TEST_F(MovieTest, TestControllerShiftsOutButtonsInOrder) {
+  Bus bus = Bus(rom);
+  bus.setControllerState(0, BUTTON_A | BUTTON_START | BUTTON_RIGHT);
+  bus.writeToMemory(CONTROLLER_1, 1);
+  bus.writeToMemory(CONTROLLER_1, 0);
+  uint8_t expected[8] = {1, 0, 0, 1, 0, 0, 0, 1};
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(bus.readFromMemory(CONTROLLER_1) & 1, expected[i]) << i;
+  }
+  EXPECT_EQ(bus.readFromMemory(CONTROLLER_1) & 1, 1);
+  EXPECT_EQ(bus.readFromMemory(CONTROLLER_2) & 1, 0);
+}
+
+TEST_F(MovieTest, TestPlaybackReproducesRecordedRun) {
+  CPU recorder = CPU(Bus(rom));
+  Movie recording = Movie(recorder.getBus().getRomHash(), 42);
+  ASSERT_TRUE(recording.begin(recorder));
+  Rng rng = Rng(recording.getSeed());
+  std::vector<uint64_t> hashes;
+  for (int frame = 0; frame < 30; frame++) {
+    uint8_t buttons[MOVIE_PORTS] = {static_cast<uint8_t>(rng.next()), 0};
+    recording.recordFrame(buttons);
+    recorder.getBus().setControllerState(0, buttons[0]);
+    ASSERT_TRUE(recorder.runFrame());
+    hashes.push_back(stateHash(recorder));
+  }
+  ASSERT_TRUE(recording.save(path));
+
+  Movie movie;
+  ASSERT_TRUE(movie.load(path));
+  EXPECT_EQ(movie.getFrameCount(), 30u);
+  EXPECT_EQ(movie.getSeed(), 42u);
+  CPU player = CPU(Bus(rom));
+  ASSERT_TRUE(movie.begin(player));
+  for (size_t frame = 0; frame < movie.getFrameCount(); frame++) {
+    ASSERT_TRUE(movie.playFrame(player, frame));
+    EXPECT_EQ(stateHash(player), hashes[frame]) << frame;
+  }
+}
+
+TEST_F(MovieTest, TestMovieStartsFromSaveState) {
+  CPU cpu = CPU(Bus(rom));
+  cpu.reset();
+  cpu.runFrame();
+  SaveState state;
+  cpu.saveState(state);
+  Movie movie = Movie(cpu.getBus().getRomHash());
+  movie.setStartState(state);
+  uint8_t buttons[MOVIE_PORTS] = {BUTTON_B, 0};
+  movie.recordFrame(buttons);
+  ASSERT_TRUE(movie.save(path));
+
+  Movie loaded;
+  ASSERT_TRUE(loaded.load(path));
+  ASSERT_TRUE(loaded.hasStartState());
+  CPU player = CPU(Bus(rom));
+  ASSERT_TRUE(loaded.begin(player));
+  EXPECT_EQ(stateHash(player), stateHash(cpu));
+}
+
+TEST_F(MovieTest, TestMovieRejectsOtherRom) {
+  Movie movie = Movie(0x1234);
+  CPU cpu = CPU(Bus(rom));
+  EXPECT_FALSE(movie.begin(cpu));
+}
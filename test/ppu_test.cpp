@@ -0,0 +1,208 @@
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+
+class PPUTest : public ::testing::Test {
+protected:
+  PPU ppu;
+
+  // Tile 1 solid colour 3, at the top left of the first nametable, and
+  // sprite 0 with the same tile on line 1 at x = 0
+  void drawSprite0Scene() {
+    writeAddress(0x0010);
+    for (int i = 0; i < 16; i++) {
+      ppu.writeRegister(0x2007, 0xFF, 10);
+    }
+    writeAddress(0x2000);
+    ppu.writeRegister(0x2007, 0x01, 10);
+    writeAddress(0x3F00);
+    ppu.writeRegister(0x2007, 0x0F, 10);
+    writeAddress(0x3F03);
+    ppu.writeRegister(0x2007, 0x30, 10);
+    writeAddress(0x3F13);
+    ppu.writeRegister(0x2007, 0x16, 10);
+    writeAddress(0x0000);
+    uint8_t oam[256] = {};
+    oam[1] = 0x01;
+    ppu.writeOam(oam, 10);
+    // Background and sprites, left columns included
+    ppu.writeRegister(0x2001, 0x1E, 10);
+  }
+
+  void writeAddress(uint16_t address) {
+    ppu.writeRegister(0x2006, address >> 8, 10);
+    ppu.writeRegister(0x2006, address & 0xFF, 10);
+  }
+};
+
+TEST_F(PPUTest, TestVblankFlag) {
+  uint64_t vblank = CYCLES_PER_FRAME + (PPU_VBLANK_DOT + 2) / 3;
+  EXPECT_EQ(ppu.readRegister(0x2002, vblank - 1) & PPUSTATUS_VBLANK, 0);
+  // Mirrored every 8 bytes, reading clears it
+  EXPECT_NE(ppu.readRegister(0x3FFA, vblank) & PPUSTATUS_VBLANK, 0);
+  EXPECT_EQ(ppu.readRegister(0x2002, vblank + 1) & PPUSTATUS_VBLANK, 0);
+  // Cleared on the pre-render line if nobody read it
+  uint64_t next = vblank + CYCLES_PER_FRAME;
+  ppu.catchUp(next);
+  ppu.catchUp(next + 100);
+  EXPECT_EQ(ppu.readRegister(0x2002, 2 * CYCLES_PER_FRAME + 29668) &
+                PPUSTATUS_VBLANK,
+            0);
+  EXPECT_EQ(ppu.getNextChange(next + 100), 2 * CYCLES_PER_FRAME + 29668);
+}
+
+TEST_F(PPUTest, TestNmiScheduling) {
+  EXPECT_EQ(ppu.getNextEvent(), UINT64_MAX);
+  ppu.writeRegister(0x2000, PPUCTRL_NMI, 10);
+  uint64_t vblank = (PPU_VBLANK_DOT + 2) / 3;
+  EXPECT_EQ(ppu.getNextEvent(), vblank);
+  EXPECT_FALSE(ppu.takeNmi(vblank - 1));
+  EXPECT_TRUE(ppu.takeNmi(vblank));
+  EXPECT_FALSE(ppu.takeNmi(vblank + 1));
+  EXPECT_EQ(ppu.getNextEvent(), CYCLES_PER_FRAME + vblank);
+
+  // Turning NMIs on during vblank fires one straight away
+  ppu.writeRegister(0x2000, 0, vblank + 2);
+  EXPECT_EQ(ppu.getNextEvent(), UINT64_MAX);
+  ppu.writeRegister(0x2000, PPUCTRL_NMI, vblank + 3);
+  EXPECT_EQ(ppu.getNextEvent(), 0u);
+  EXPECT_TRUE(ppu.takeNmi(vblank + 4));
+}
+
+TEST_F(PPUTest, TestVramReadsAreBuffered) {
+  writeAddress(0x2400);
+  ppu.writeRegister(0x2007, 0x11, 10);
+  ppu.writeRegister(0x2007, 0x22, 10);
+  writeAddress(0x3F10);
+  ppu.writeRegister(0x2007, 0x2A, 10);
+
+  writeAddress(0x2400);
+  EXPECT_EQ(ppu.readRegister(0x2007, 10), 0);
+  EXPECT_EQ(ppu.readRegister(0x2007, 10), 0x11);
+  EXPECT_EQ(ppu.readRegister(0x2007, 10), 0x22);
+  // Palette reads are not buffered, $3F10 is the backdrop
+  writeAddress(0x3F00);
+  EXPECT_EQ(ppu.readRegister(0x2007, 10), 0x2A);
+  // Vertical mirroring without a ROM, going down 32 at a time
+  ppu.writeRegister(0x2000, PPUCTRL_INCREMENT_32, 10);
+  writeAddress(0x2C00);
+  ppu.readRegister(0x2007, 10);
+  EXPECT_EQ(ppu.readRegister(0x2007, 10), 0x11);
+  EXPECT_EQ(ppu.readRegister(0x2007, 10), 0);
+}
+
+TEST_F(PPUTest, TestSprite0HitAndLines) {
+  drawSprite0Scene();
+  EXPECT_EQ(ppu.getFramebuffer(), nullptr);
+  // Line 1 of the next frame, the hit is on its second dot
+  uint64_t hit = CYCLES_PER_FRAME + (PPU_DOTS_PER_LINE + 1 + 2) / 3;
+  EXPECT_EQ(ppu.readRegister(0x2002, hit - 1) & PPUSTATUS_SPRITE_0, 0);
+  EXPECT_NE(ppu.readRegister(0x2002, hit) & PPUSTATUS_SPRITE_0, 0);
+
+  const uint8_t *pixels = ppu.getFramebuffer();
+  ASSERT_NE(pixels, nullptr);
+  EXPECT_EQ(pixels[0], 0x30);
+  EXPECT_EQ(pixels[PPU_FRAME_WIDTH], 0x16);
+  EXPECT_EQ(pixels[PPU_FRAME_WIDTH + 8], 0x0F);
+
+  // Lasts until the pre-render line
+  uint64_t prerender = CYCLES_PER_FRAME + (PPU_PRERENDER_DOT + 2) / 3;
+  EXPECT_NE(ppu.readRegister(0x2002, prerender - 1) & PPUSTATUS_SPRITE_0, 0);
+  EXPECT_EQ(ppu.readRegister(0x2002, prerender) & PPUSTATUS_SPRITE_0, 0);
+}
+
+TEST_F(PPUTest, TestNotDrawingStillHitsSprite0) {
+  drawSprite0Scene();
+  PPU drawn = ppu;
+  ppu.setDrawing(false);
+  uint64_t hit = CYCLES_PER_FRAME + (PPU_DOTS_PER_LINE + 1 + 2) / 3;
+  EXPECT_EQ(ppu.readRegister(0x2002, hit - 1) & PPUSTATUS_SPRITE_0, 0);
+  EXPECT_NE(ppu.readRegister(0x2002, hit) & PPUSTATUS_SPRITE_0, 0);
+  drawn.readRegister(0x2002, hit - 1);
+  drawn.readRegister(0x2002, hit);
+  ppu.catchUp(2 * CYCLES_PER_FRAME + 500);
+  drawn.catchUp(2 * CYCLES_PER_FRAME + 500);
+  EXPECT_EQ(ppu.hashState(0), drawn.hashState(0));
+  // Only the line with sprite 0 was drawn, to find the hit
+  EXPECT_EQ(ppu.getFramebuffer(), nullptr);
+
+  // The next frame is drawn as usual
+  ppu.setDrawing(true);
+  ppu.catchUp(3 * CYCLES_PER_FRAME + 500);
+  drawn.catchUp(3 * CYCLES_PER_FRAME + 500);
+  ASSERT_NE(ppu.getFramebuffer(), nullptr);
+  EXPECT_EQ(memcmp(ppu.getFramebuffer(), drawn.getFramebuffer(),
+                   PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT),
+            0);
+}
+
+TEST_F(PPUTest, TestCatchUpInAnySteps) {
+  drawSprite0Scene();
+  PPU stepped = ppu;
+  for (uint64_t cycle = 10; cycle < 3 * CYCLES_PER_FRAME; cycle += 97) {
+    stepped.catchUp(cycle);
+  }
+  stepped.catchUp(3 * CYCLES_PER_FRAME + 500);
+  ppu.catchUp(3 * CYCLES_PER_FRAME + 500);
+  EXPECT_EQ(ppu.hashState(0), stepped.hashState(0));
+  EXPECT_EQ(memcmp(ppu.getFramebuffer(), stepped.getFramebuffer(),
+                   PPU_FRAME_WIDTH * PPU_FRAME_HEIGHT),
+            0);
+
+  SaveState first, second;
+  ppu.saveState(first.bus.ppu);
+  stepped.saveState(second.bus.ppu);
+  EXPECT_EQ(memcmp(&first.bus.ppu, &second.bus.ppu, sizeof(PpuState)), 0);
+  PPU loaded;
+  loaded.loadState(first.bus.ppu);
+  EXPECT_EQ(loaded.hashState(0), ppu.hashState(0));
+}
+
+TEST_F(PPUTest, TestCpuTakesNmis) {
+  // LDA #$80, STA $2000, SEC, loop: JMP loop
+  // nmi: INC $10, RTI
+  std::vector<uint8_t> rom =
+      buildRom({0xA9, 0x80, 0x8D, 0x00, 0x20, 0x38, 0x4C, 0x06, 0x80, 0xE6,
+                0x10, 0x40},
+               0x8000, 0x8009);
+  CPU skipping = CPU(Bus(rom));
+  CPU running = CPU(Bus(rom));
+  skipping.reset();
+  running.reset();
+  running.skipIdleLoops = false;
+  for (int frame = 0; frame < 3; frame++) {
+    ASSERT_TRUE(skipping.runFrame());
+    ASSERT_TRUE(running.runFrame());
+    EXPECT_EQ(skipping.cycles, running.cycles);
+    EXPECT_EQ(skipping.hashState(), running.hashState());
+  }
+  uint8_t count;
+  skipping.getBus().readRam(0x10, &count, 1);
+  EXPECT_EQ(count, 3);
+  EXPECT_EQ(skipping.getIdleLoopStats().loops, 6u);
+  // RTI brings the interrupted flags back
+  EXPECT_TRUE(skipping.S & CPU::C);
+  EXPECT_FALSE(skipping.S & CPU::I);
+  EXPECT_EQ(skipping.SP, 0xFD);
+}
+
+TEST_F(PPUTest, TestOamDmaStallsCpu) {
+  // LDA #$42, STA $0200, LDA #$02, STA $4014, NOP
+  CPU cpu = CPU(Bus(buildRom(
+      {0xA9, 0x42, 0x8D, 0x00, 0x02, 0xA9, 0x02, 0x8D, 0x14, 0x40, 0xEA},
+      0x8000)));
+  cpu.reset();
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(cpu.step());
+  }
+  EXPECT_EQ(cpu.cycles, 7u + 2 + 4 + 2 + 4);
+  ASSERT_TRUE(cpu.step());
+  // The copy started on an even cycle, no extra cycle to line up
+  EXPECT_EQ(cpu.cycles, 7u + 2 + 4 + 2 + 4 + 513 + 2);
+  SaveState state;
+  cpu.saveState(state);
+  EXPECT_EQ(state.bus.ppu.oam[0], 0x42);
+}
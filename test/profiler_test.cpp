@@ -0,0 +1,120 @@
+#include "cpu.hpp"
+#include "profiler.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <sstream>
+
+class ProfilerTest : public ::testing::Test {
+protected:
+  Profiler profiler;
+
+  // $8000 JSR $8010, $8010 JSR $8020, an interrupt at $8020 runs NOP and RTI
+  // at $9000, then both subroutines return
+  void runNestedCalls() {
+    profiler.record(0x8000, 0x20, 6, 0x8010, 0xFD);
+    EXPECT_EQ(profiler.getCallDepth(), 1u);
+    profiler.record(0x8010, 0x20, 6, 0x8020, 0xFB);
+    EXPECT_EQ(profiler.getCallDepth(), 2u);
+    profiler.enterInterrupt(0x8020, 0x9000, 0xFB);
+    EXPECT_EQ(profiler.getCallDepth(), 3u);
+    profiler.record(0x9000, 0xEA, 2, 0x9001, 0xF8);
+    profiler.record(0x9001, 0x40, 6, 0x8020, 0xFB);
+    EXPECT_EQ(profiler.getCallDepth(), 2u);
+    profiler.record(0x8020, 0x60, 6, 0x8013, 0xFD);
+    EXPECT_EQ(profiler.getCallDepth(), 1u);
+    profiler.record(0x8013, 0x60, 6, 0x8003, 0xFF);
+    EXPECT_EQ(profiler.getCallDepth(), 0u);
+  }
+};
+
+TEST_F(ProfilerTest, TestShadowStackUnwinds) {
+  runNestedCalls();
+  EXPECT_EQ(profiler.getTotalCycles(), 32u);
+  EXPECT_EQ(profiler.getInstructionCount(0x9000), 1u);
+  EXPECT_EQ(profiler.getCycleCount(0x9001), 6u);
+
+  // Dropping the return address and leaving through an outer RTS unwinds
+  // everything it jumped over
+  profiler.record(0x8000, 0x20, 6, 0x8010, 0xFD);
+  profiler.record(0x8010, 0x20, 6, 0x8020, 0xFB);
+  profiler.record(0x8020, 0x68, 4, 0x8021, 0xFC);
+  profiler.record(0x8021, 0x68, 4, 0x8022, 0xFD);
+  EXPECT_EQ(profiler.getCallDepth(), 2u);
+  profiler.record(0x8022, 0x60, 6, 0x8003, 0xFF);
+  EXPECT_EQ(profiler.getCallDepth(), 0u);
+}
+
+TEST_F(ProfilerTest, TestCallgrindExport) {
+  runNestedCalls();
+  std::ostringstream out;
+  profiler.writeCallgrind(out, nullptr);
+  EXPECT_EQ(out.str(), "# callgrind format\n"
+                       "version: 1\n"
+                       "creator: cnes profiler\n"
+                       "positions: instr\n"
+                       "events: Instructions Cycles\n"
+                       "summary: 6 32\n"
+                       "\n"
+                       "fn=sub_8010\n"
+                       "0x8010 1 6\n"
+                       "0x8013 1 6\n"
+                       "cfn=sub_8020\n"
+                       "calls=1 0x8020\n"
+                       "0x8010 3 14\n"
+                       "\n"
+                       "fn=sub_8020\n"
+                       "0x8020 1 6\n"
+                       "cfn=sub_9000\n"
+                       "calls=1 0x9000\n"
+                       "0x8020 2 8\n"
+                       "\n"
+                       "fn=sub_9000\n"
+                       "0x9000 1 2\n"
+                       "0x9001 1 6\n"
+                       "\n"
+                       "fn=root\n"
+                       "0x8000 1 6\n"
+                       "cfn=sub_8010\n"
+                       "calls=1 0x8010\n"
+                       "0x8000 5 26\n");
+}
+
+TEST_F(ProfilerTest, TestFoldedStacksExport) {
+  runNestedCalls();
+  std::ostringstream out;
+  profiler.writeFoldedStacks(out);
+  EXPECT_EQ(out.str(), "root 6\n"
+                       "root;sub_8010 12\n"
+                       "root;sub_8010;sub_8020 6\n"
+                       "root;sub_8010;sub_8020;sub_9000 8\n");
+}
+
+TEST_F(ProfilerTest, TestCpuReportsCallsAndInterrupts) {
+  // LDA #$80, STA $2000, loop: JMP loop
+  // $8010 nmi: JSR $8020, RTI
+  // $8020: RTS
+  std::vector<uint8_t> program = {0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C,
+                                  0x05, 0x80};
+  program.resize(0x21, 0xEA);
+  program[0x10] = 0x20;
+  program[0x11] = 0x20;
+  program[0x12] = 0x80;
+  program[0x13] = 0x40;
+  program[0x20] = 0x60;
+  CPU cpu = CPU(Bus(buildRom(program, 0x8000, 0x8010)));
+  cpu.reset();
+  cpu.profiler = &profiler;
+  for (int frame = 0; frame < 3; frame++) {
+    ASSERT_TRUE(cpu.runFrame());
+  }
+  EXPECT_EQ(profiler.getInstructionCount(0x8013),
+            profiler.getInstructionCount(0x8010));
+  EXPECT_GE(profiler.getInstructionCount(0x8013), 2u);
+  EXPECT_EQ(profiler.getCallDepth(), 0u);
+
+  std::ostringstream folded;
+  profiler.writeFoldedStacks(folded);
+  EXPECT_NE(folded.str().find("\nroot;sub_8010 "), std::string::npos);
+  EXPECT_NE(folded.str().find("\nroot;sub_8010;sub_8020 "), std::string::npos);
+}
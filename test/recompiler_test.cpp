@@ -0,0 +1,105 @@
+#include "aot.hpp"
+#include "cpu.hpp"
+#include "recompiler.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <sstream>
+
+// LDX #$00, loop: INX, JMP loop
+static const std::vector<uint8_t> COUNTING_PROGRAM = {0xA2, 0x00, 0xE8, 0x4C,
+                                                      0x02, 0x80};
+
+// What nes_recompile writes for COUNTING_PROGRAM
+static bool countingLoop(CPU &cpu, uint64_t until, uint16_t &last) {
+  uint64_t start = cpu.cycles;
+  switch (cpu.PC) {
+  case 0x8000: goto L_8000;
+  case 0x8002: goto L_8002;
+  case 0x8003: goto L_8003;
+  default: return false;
+  }
+L_8000:
+  if (aotStop(cpu, until)) return aotLeave(cpu, 0x8000, start);
+  aotExecute<0xA2, 2, 2>(cpu, 0x8000);
+L_8002:
+  if (aotStop(cpu, until)) return aotLeave(cpu, 0x8002, start);
+  aotExecute<0xE8, 1, 2>(cpu, 0x8002);
+L_8003:
+  if (aotStop(cpu, until)) return aotLeave(cpu, 0x8003, start);
+  aotExecute<0x4C, 3, 3>(cpu, 0x8003);
+  last = 0x8003;
+  return true;
+}
+
+class RecompilerTest : public ::testing::Test {};
+
+TEST_F(RecompilerTest, TestFindsFunctions) {
+  // JSR sub, loop: DEY, BNE loop, JMP ($0010)
+  // nmi: BRK
+  // sub: LDX #$05, RTS
+  Bus bus = Bus(buildRom({0x20, 0x0A, 0x80, 0x88, 0xD0, 0xFD, 0x6C, 0x10,
+                          0x00, 0x00, 0xA2, 0x05, 0x60},
+                         0x8000, 0x8009));
+  Recompiler recompiler = Recompiler(bus.getRom(), bus.getRomHash());
+  ASSERT_TRUE(recompiler.analyze());
+  // Reset, which IRQ shares, and the subroutine
+  EXPECT_EQ(recompiler.getFunctionCount(), 2u);
+  EXPECT_EQ(recompiler.getInstructionCount(), 5u);
+  // JMP indirect and BRK
+  EXPECT_EQ(recompiler.getFallbackCount(), 2u);
+
+  std::ostringstream out;
+  recompiler.write(out, "test.nes");
+  std::string code = out.str();
+  EXPECT_NE(code.find("static bool aot_8000("), std::string::npos);
+  EXPECT_NE(code.find("static bool aot_800A("), std::string::npos);
+  EXPECT_NE(code.find("L_8004: // BNE $8003"), std::string::npos);
+  EXPECT_NE(code.find("aotExecute<0x20, 3, 6>(cpu, 0x8000);"),
+            std::string::npos);
+  // The backward branch goes back to runFrame, as does falling through to
+  // JMP indirect, which is left to the interpreter
+  EXPECT_NE(code.find("  last = 0x8004;\n  return true;\n}"),
+            std::string::npos);
+  EXPECT_EQ(code.find("L_8006"), std::string::npos);
+  EXPECT_EQ(code.find("L_8009"), std::string::npos);
+  // RTS comes back to $8003 through the entry table
+  EXPECT_NE(code.find("{0x8003, aot_8000},"), std::string::npos);
+  EXPECT_NE(code.find("{0x800C, aot_800A},"), std::string::npos);
+}
+
+TEST_F(RecompilerTest, TestRejectsBankedRoms) {
+  std::vector<uint8_t> rom = buildRom({0x4C, 0x00, 0x80}, 0x8000);
+  // Mapper 1
+  rom[6] = 0x10;
+  Bus bus = Bus(rom);
+  Recompiler recompiler = Recompiler(bus.getRom(), bus.getRomHash());
+  EXPECT_FALSE(recompiler.analyze());
+}
+
+TEST_F(RecompilerTest, TestCompiledRunMatchesInterpreter) {
+  std::vector<uint8_t> rom = buildRom(COUNTING_PROGRAM, 0x8000);
+  CPU other = CPU(Bus(buildRom({0x4C, 0x00, 0x80}, 0x8000)));
+  Bus bus = Bus(rom);
+  AotEntry entries[] = {{0x8000, countingLoop},
+                        {0x8002, countingLoop},
+                        {0x8003, countingLoop}};
+  ASSERT_TRUE(registerAotProgram(bus.getRomHash(), entries, 3, 1));
+  EXPECT_FALSE(other.hasCompiledCode());
+
+  CPU compiled = CPU(bus);
+  CPU interpreted = CPU(bus);
+  ASSERT_TRUE(compiled.hasCompiledCode());
+  interpreted.runCompiled = false;
+  compiled.reset();
+  interpreted.reset();
+  for (int frame = 0; frame < 3; frame++) {
+    ASSERT_TRUE(compiled.runFrame());
+    ASSERT_TRUE(interpreted.runFrame());
+    EXPECT_EQ(compiled.cycles, interpreted.cycles);
+    EXPECT_EQ(compiled.PC, interpreted.PC);
+    EXPECT_EQ(compiled.hashState(), interpreted.hashState());
+  }
+  EXPECT_GT(compiled.getCompiledCycles(), 2 * CYCLES_PER_FRAME);
+  EXPECT_EQ(interpreted.getCompiledCycles(), 0u);
+}
@@ -0,0 +1,64 @@
+#include "rewind.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+class RewindTest : public ::testing::Test {
+protected:
+  // LDX #$00, loop: INX, STX $10,X, JMP loop
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xE8, 0x96,
+                                  0x10, 0x4C, 0x02, 0x80};
+  Bus bus = Bus(buildRom(program, 0x8000));
+  CPU cpu = CPU(bus);
+
+  void SetUp() override { cpu.reset(); }
+
+  // Runs frames, capturing into the buffer and keeping every state
+  std::vector<SaveState> runFrames(RewindBuffer &buffer, int frames) {
+    std::vector<SaveState> history;
+    for (int i = 0; i < frames; i++) {
+      cpu.runFrame();
+      buffer.onFrame(cpu);
+      SaveState state;
+      cpu.saveState(state);
+      history.push_back(state);
+    }
+    return history;
+  }
+};
+
+TEST_F(RewindTest, TestRewindStepsBackThroughEveryFrame) {
+  RewindBuffer buffer = RewindBuffer(1 << 16, 1, 8);
+  std::vector<SaveState> history = runFrames(buffer, 30);
+  EXPECT_EQ(buffer.getSnapshotCount(), 30u);
+
+  for (int frame = 29; frame >= 0; frame--) {
+    ASSERT_TRUE(buffer.rewind(cpu));
+    SaveState state;
+    cpu.saveState(state);
+    EXPECT_EQ(memcmp(&state, &history[frame], sizeof(SaveState)), 0) << frame;
+  }
+  EXPECT_FALSE(buffer.rewind(cpu));
+}
+
+TEST_F(RewindTest, TestDeltasAreSmallerThanKeyframes) {
+  RewindBuffer buffer = RewindBuffer(1 << 16, 1, 1000);
+  runFrames(buffer, 11);
+  // One keyframe of mostly zero RAM, then ten frames of a few changed bytes
+  EXPECT_LT(buffer.getBytesUsed(), sizeof(SaveState) + 10 * 300);
+}
+
+TEST_F(RewindTest, TestArenaStaysBoundedAndKeepsNewestHistory) {
+  RewindBuffer buffer = RewindBuffer(4096, 2, 4);
+  std::vector<SaveState> history = runFrames(buffer, 400);
+  EXPECT_LE(buffer.getBytesUsed(), 4096u);
+  ASSERT_GT(buffer.getSnapshotCount(), 1u);
+
+  // Captures happen on every other frame starting with the first
+  for (int frame = 398; buffer.getSnapshotCount() > 0; frame -= 2) {
+    ASSERT_TRUE(buffer.rewind(cpu));
+    SaveState state;
+    cpu.saveState(state);
+    EXPECT_EQ(memcmp(&state, &history[frame], sizeof(SaveState)), 0) << frame;
+  }
+}
@@ -0,0 +1,60 @@
+#include "hash.hpp"
+#include "runahead.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+class RunAheadTest : public ::testing::Test {
+protected:
+  // LDX #$00, loop: INX, STX $10,X, JMP loop
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xE8, 0x96,
+                                  0x10, 0x4C, 0x02, 0x80};
+  std::vector<uint8_t> rom = buildRom(program, 0x8000);
+  CPU cpu = CPU(Bus(rom));
+  CPU reference = CPU(Bus(rom));
+
+  void SetUp() override {
+    cpu.reset();
+    reference.reset();
+  }
+
+  uint64_t stateHash(const CPU &cpu) {
+    SaveState state;
+    cpu.saveState(state);
+    return hashBytes(&state, sizeof(state));
+  }
+};
+
+TEST_F(RunAheadTest, TestPresentsFramesAheadAndKeepsRealTimeline) {
+  RunAhead runAhead = RunAhead(2);
+  std::vector<uint64_t> expected;
+  for (int i = 0; i < 12; i++) {
+    reference.runFrame();
+    expected.push_back(stateHash(reference));
+  }
+
+  for (int frame = 0; frame < 10; frame++) {
+    int presented = 0;
+    ASSERT_TRUE(runAhead.runFrame(cpu, [&](const CPU &shown) {
+      presented++;
+      EXPECT_EQ(stateHash(shown), expected[frame + 2]) << frame;
+    }));
+    EXPECT_EQ(presented, 1);
+    EXPECT_EQ(stateHash(cpu), expected[frame]) << frame;
+  }
+  EXPECT_EQ(runAhead.getStats().hostFrames, 10u);
+  EXPECT_EQ(runAhead.getStats().emulatedFrames, 30u);
+  // Drawing was only off for the frames thrown away
+  EXPECT_TRUE(cpu.getBus().getPpu().isDrawing());
+}
+
+TEST_F(RunAheadTest, TestZeroFramesIsPlainFrame) {
+  RunAhead runAhead = RunAhead(0);
+  ASSERT_TRUE(runAhead.runFrame(cpu, [&](const CPU &shown) {
+    EXPECT_EQ(&shown, &cpu);
+  }));
+  reference.runFrame();
+  EXPECT_EQ(stateHash(cpu), stateHash(reference));
+  EXPECT_EQ(runAhead.getStats().emulatedFrames, 1u);
+  EXPECT_EQ(runAhead.getStats().stateNanos, 0u);
+}
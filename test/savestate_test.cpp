@@ -0,0 +1,131 @@
+#include "cpu.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+
+class SaveStateTest : public ::testing::Test {
+protected:
+  // LDX #$00, loop: INX, STX $10,X, JMP loop
+  std::vector<uint8_t> program = {0xA2, 0x00, 0xE8, 0x96,
+                                  0x10, 0x4C, 0x02, 0x80};
+  Bus bus = Bus(buildRom(program, 0x8000));
+  CPU cpu = CPU(bus);
+
+  void SetUp() override { cpu.reset(); }
+
+  void run(int instructions) {
+    for (int i = 0; i < instructions; i++) {
+      cpu.step();
+    }
+  }
+};
+
+TEST_F(SaveStateTest, TestRoundTripRestoresRegistersAndRam) {
+  run(20);
+  SaveState state;
+  cpu.saveState(state);
+  CPU before = cpu;
+
+  run(50);
+  EXPECT_NE(cpu.X, before.X);
+  ASSERT_TRUE(cpu.loadState(state));
+  EXPECT_EQ(cpu.A, before.A);
+  EXPECT_EQ(cpu.X, before.X);
+  EXPECT_EQ(cpu.S, before.S);
+  EXPECT_EQ(cpu.SP, before.SP);
+  EXPECT_EQ(cpu.PC, before.PC);
+  EXPECT_EQ(cpu.cycles, before.cycles);
+  for (uint16_t address = 0x10; address < 0x60; address++) {
+    EXPECT_EQ(cpu.readFromMemory(address), before.readFromMemory(address));
+  }
+}
+
+TEST_F(SaveStateTest, TestReplayAfterLoadIsDeterministic) {
+  run(10);
+  SaveState start, first, second;
+  cpu.saveState(start);
+  run(40);
+  cpu.saveState(first);
+  ASSERT_TRUE(cpu.loadState(start));
+  run(40);
+  cpu.saveState(second);
+  EXPECT_EQ(memcmp(&first, &second, sizeof(SaveState)), 0);
+}
+
+TEST_F(SaveStateTest, TestRejectsStateFromAnotherRom) {
+  SaveState state;
+  cpu.saveState(state);
+  Bus otherBus = Bus(buildRom({0xEA}, 0x8000));
+  CPU other = CPU(otherBus);
+  EXPECT_FALSE(other.loadState(state));
+
+  state.version = SAVE_STATE_VERSION + 1;
+  EXPECT_FALSE(cpu.loadState(state));
+}
+
+TEST(SaveStatePrgRamTest, TestPrgRamIsPartOfTheState) {
+  // LDX #$00, loop: INX, STX $6000, JMP loop
+  CPU cpu = CPU(Bus(buildRom({0xA2, 0x00, 0xE8, 0x8E, 0x00, 0x60, 0x4C, 0x02,
+                              0x80},
+                             0x8000)));
+  cpu.reset();
+  SaveState untouched, written;
+  cpu.saveState(untouched);
+  uint64_t untouchedHash = cpu.hashState();
+  EXPECT_EQ(untouched.bus.prgRamUsed, 0);
+
+  for (int i = 0; i < 9; i++) {
+    cpu.step();
+  }
+  ASSERT_EQ(cpu.readFromMemory(0x6000), 3);
+  cpu.saveState(written);
+  uint64_t writtenHash = cpu.hashState();
+  EXPECT_EQ(written.bus.prgRamUsed, 1);
+  EXPECT_EQ(written.bus.prgRam[0], 3);
+
+  // The hash changes with PRG RAM alone
+  cpu.writeToMemory(0x6000, 0x42);
+  EXPECT_NE(cpu.hashState(), writtenHash);
+
+  ASSERT_TRUE(cpu.loadState(written));
+  EXPECT_EQ(cpu.readFromMemory(0x6000), 3);
+  EXPECT_EQ(cpu.hashState(), writtenHash);
+  ASSERT_TRUE(cpu.loadState(untouched));
+  EXPECT_EQ(cpu.readFromMemory(0x6000), 0);
+  EXPECT_EQ(cpu.hashState(), untouchedHash);
+
+  // Loading into a fork leaves the parent's PRG RAM alone
+  ASSERT_TRUE(cpu.loadState(written));
+  CPU child = cpu.fork();
+  ASSERT_TRUE(child.loadState(untouched));
+  EXPECT_EQ(child.readFromMemory(0x6000), 0);
+  EXPECT_EQ(cpu.readFromMemory(0x6000), 3);
+}
+
+TEST(SaveStateChrRamTest, TestZeroChrRamKeepsItsHash) {
+  // LDA #$00, STA $2006, STA $2006, STA $2007, loop: JMP loop
+  std::vector<uint8_t> rom = buildRom(
+      {0xA9, 0x00, 0x8D, 0x06, 0x20, 0x8D, 0x06, 0x20, 0x8D, 0x07, 0x20,
+       0x4C, 0x0B, 0x80},
+      0x8000);
+  CPU cpu = CPU(Bus(rom));
+  cpu.reset();
+  SaveState untouched, cleared;
+  cpu.saveState(untouched);
+  uint64_t untouchedHash = cpu.hashState();
+  EXPECT_EQ(untouched.bus.ppu.chrRamUsed, 0);
+
+  // The game clears a pattern byte, allocating CHR RAM that is all zeros
+  ASSERT_TRUE(cpu.runFrame());
+  cpu.saveState(cleared);
+  uint64_t clearedHash = cpu.hashState();
+  EXPECT_EQ(cleared.bus.ppu.chrRamUsed, 1);
+
+  CPU loaded = CPU(Bus(rom));
+  ASSERT_TRUE(loaded.loadState(cleared));
+  EXPECT_EQ(loaded.hashState(), clearedHash);
+  ASSERT_TRUE(cpu.loadState(untouched));
+  EXPECT_EQ(cpu.hashState(), untouchedHash);
+  ASSERT_TRUE(cpu.loadState(cleared));
+  EXPECT_EQ(cpu.hashState(), clearedHash);
+}
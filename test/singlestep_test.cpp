@@ -0,0 +1,161 @@
+#include "singlestep.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <gtest/gtest.h>
+
+class SingleStepTest : public ::testing::Test {
+protected:
+  // LDA #$5C from $1234 and a case for it whose expected A is wrong
+  std::string cases =
+      "[{\"name\": \"a9 5c 2e\", "
+      "\"initial\": {\"pc\": 4660, \"s\": 253, \"a\": 0, \"x\": 1, "
+      "\"y\": 2, \"p\": 38, \"ram\": [[4660, 169], [4661, 92]]}, "
+      "\"final\": {\"pc\": 4662, \"s\": 253, \"a\": 92, \"x\": 1, \"y\": 2, "
+      "\"p\": 36, \"ram\": [[4660, 169], [4661, 92]]}, "
+      "\"cycles\": [[4660, 169, \"read\"], [4661, 92, \"read\"]]},\n"
+      " {\"name\": \"wrong\", "
+      "\"extra\": [1.5e3, true, null, {\"a\": \"\\\"\"}], "
+      "\"initial\": {\"pc\": 0, \"s\": 253, \"a\": 0, \"x\": 0, "
+      "\"y\": 0, \"p\": 36, \"ram\": [[0, 169], [1, 1]]}, "
+      "\"final\": {\"pc\": 2, \"s\": 253, \"a\": 2, \"x\": 0, \"y\": 0, "
+      "\"p\": 36, \"ram\": [[0, 169], [1, 1]]}, "
+      "\"cycles\": [[0, 169, \"read\"], [1, 1, \"read\"]]}]";
+};
+
+TEST_F(SingleStepTest, TestJsonReaderWalksValues) {
+  JsonReader reader;
+  reader.openString("{\"a\": [1, -2, 30], \"b\\n\\u00e9\": \"x\\ty\", "
+                    "\"c\": {\"d\": [false, 1e-3]}}");
+  std::string key, text;
+  int64_t value;
+  ASSERT_TRUE(reader.beginObject());
+  ASSERT_TRUE(reader.hasNext());
+  ASSERT_TRUE(reader.readKey(key));
+  EXPECT_EQ(key, "a");
+  ASSERT_TRUE(reader.beginArray());
+  std::vector<int64_t> values;
+  while (reader.hasNext()) {
+    ASSERT_TRUE(reader.readInteger(value));
+    values.push_back(value);
+  }
+  EXPECT_EQ(values, std::vector<int64_t>({1, -2, 30}));
+  ASSERT_TRUE(reader.hasNext());
+  ASSERT_TRUE(reader.readKey(key));
+  EXPECT_EQ(key, "b\n\xC3\xA9");
+  ASSERT_TRUE(reader.readString(text));
+  EXPECT_EQ(text, "x\ty");
+  ASSERT_TRUE(reader.hasNext());
+  ASSERT_TRUE(reader.readKey(key));
+  ASSERT_TRUE(reader.skipValue());
+  EXPECT_FALSE(reader.hasNext());
+  EXPECT_TRUE(reader.atEnd());
+  EXPECT_FALSE(reader.failed());
+}
+
+TEST_F(SingleStepTest, TestJsonReaderReportsErrors) {
+  JsonReader reader;
+  reader.openString("[1, 2 3]");
+  int64_t value;
+  ASSERT_TRUE(reader.beginArray());
+  ASSERT_TRUE(reader.hasNext());
+  ASSERT_TRUE(reader.readInteger(value));
+  ASSERT_TRUE(reader.hasNext());
+  ASSERT_TRUE(reader.readInteger(value));
+  EXPECT_FALSE(reader.hasNext());
+  EXPECT_TRUE(reader.failed());
+  EXPECT_EQ(reader.getError(), "expected ',' at byte 6");
+  // Stays failed
+  EXPECT_FALSE(reader.skipValue());
+
+  JsonReader fraction;
+  fraction.openString("1.5");
+  EXPECT_FALSE(fraction.readInteger(value));
+  JsonReader missing;
+  EXPECT_FALSE(missing.open(testing::TempDir() + "missing.json"));
+}
+
+TEST_F(SingleStepTest, TestReaderAndRunnerCheckCases) {
+  SingleStepReader reader;
+  reader.openString(cases);
+  SingleStepCase test;
+  ASSERT_TRUE(reader.next(test));
+  EXPECT_EQ(test.name, "a9 5c 2e");
+  EXPECT_EQ(test.initial.pc, 0x1234);
+  EXPECT_EQ(test.initial.x, 1);
+  EXPECT_EQ(test.final.a, 0x5C);
+  ASSERT_EQ(test.final.ram.size(), 2u);
+  EXPECT_EQ(test.final.ram[1].first, 0x1235);
+  EXPECT_EQ(test.final.ram[1].second, 0x5C);
+  EXPECT_EQ(test.cycles, 2u);
+
+  CPU cpu = CPU(Bus::flat());
+  bool cyclesMatch;
+  EXPECT_EQ(SingleStepRunner::runCase(cpu, test, cyclesMatch), "");
+  EXPECT_TRUE(cyclesMatch);
+  // Memory is cleared behind each case
+  EXPECT_EQ(cpu.readFromMemory(0x1234), 0x00);
+
+  ASSERT_TRUE(reader.next(test));
+  EXPECT_EQ(test.name, "wrong");
+  EXPECT_EQ(SingleStepRunner::runCase(cpu, test, cyclesMatch),
+            "A = $01, expected $02");
+  EXPECT_FALSE(reader.next(test));
+  EXPECT_FALSE(reader.failed());
+}
+
+TEST_F(SingleStepTest, TestRunnerRunsFilesInParallel) {
+  std::string path = testing::TempDir() + "singlestep_test_a9.json";
+  {
+    std::ofstream output(path);
+    output << cases;
+  }
+  SingleStepRunner runner = SingleStepRunner(2);
+  for (int i = 0; i < 4; i++) {
+    runner.add(0xA9, path);
+  }
+  runner.add(0xA5, testing::TempDir() + "singlestep_test_missing.json");
+  std::vector<SingleStepResult> results = runner.run();
+  ASSERT_EQ(results.size(), 5u);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(results[i].opcode, 0xA9);
+    EXPECT_EQ(results[i].cases, 2u);
+    EXPECT_EQ(results[i].failures, 1u);
+    EXPECT_EQ(results[i].firstFailure, "wrong: A = $01, expected $02");
+    EXPECT_EQ(results[i].error, "");
+  }
+  EXPECT_NE(results[4].error, "");
+  remove(path.c_str());
+}
+
+// Runs the published vectors when SINGLESTEP_TESTS points at a directory of
+// them, e.g. a checkout of SingleStepTests/65x02 nes6502/v1
+TEST_F(SingleStepTest, TestOpcodeTableAgainstVectors) {
+  const char *directory = getenv("SINGLESTEP_TESTS");
+  if (directory == nullptr) {
+    GTEST_SKIP() << "SINGLESTEP_TESTS is not set";
+  }
+  SingleStepRunner runner;
+  ASSERT_GT(runner.addDirectory(directory), 0u);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<SingleStepResult> results = runner.run();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  uint64_t cases = 0;
+  for (const SingleStepResult &result : results) {
+    cases += result.cases;
+    EXPECT_EQ(result.error, "") << std::hex << int(result.opcode);
+    EXPECT_EQ(result.failures, 0u)
+        << std::hex << int(result.opcode) << " first failure "
+        << result.firstFailure;
+    if (result.cycleMismatches > 0) {
+      std::cout << std::hex << int(result.opcode) << std::dec << ": "
+                << result.cycleMismatches << " cases with the wrong cycle "
+                << "count\n";
+    }
+  }
+  std::cout << results.size() << " opcodes, " << cases << " cases on "
+            << runner.getThreadCount() << " threads in " << seconds << "s\n";
+}
@@ -0,0 +1,107 @@
+#include "cpu.hpp"
+#include "profiler.hpp"
+#include "test_rom.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <sstream>
+
+class SuperinstructionTest : public ::testing::Test {
+protected:
+  // Runs the program for a few frames fused and unfused, checks both end
+  // every frame in the same state and returns the fused counts
+  std::array<uint64_t, FUSED_SEQUENCE_COUNT>
+  runBoth(const std::vector<uint8_t> &program, size_t frames = 3) {
+    std::vector<uint8_t> rom = buildRom(program, 0x8000);
+    CPU fused = CPU(Bus(rom));
+    CPU unfused = CPU(Bus(rom));
+    fused.reset();
+    unfused.reset();
+    fused.skipIdleLoops = false;
+    unfused.skipIdleLoops = false;
+    unfused.fuseInstructions = false;
+    for (size_t i = 0; i < frames; i++) {
+      EXPECT_EQ(fused.runFrame(), unfused.runFrame());
+      EXPECT_EQ(fused.cycles, unfused.cycles) << i;
+      EXPECT_EQ(fused.PC, unfused.PC) << i;
+      EXPECT_EQ(fused.hashState(), unfused.hashState()) << i;
+    }
+    return fused.getFusedCounts();
+  }
+};
+
+TEST_F(SuperinstructionTest, TestCountingLoopsMatchUnfused) {
+  // loop: LDX #$05, inner: DEX, BNE inner, LDY #$03, DEY, BNE -3,
+  // INX, CPX #$10, BNE -5, INY, CPY #$20, BNE -5, JMP loop
+  auto counts = runBoth({0xA2, 0x05, 0xCA, 0xD0, 0xFD, 0xA0, 0x03, 0x88,
+                         0xD0, 0xFD, 0xE8, 0xE0, 0x10, 0xD0, 0xFB, 0xC8,
+                         0xC0, 0x20, 0xD0, 0xFB, 0x4C, 0x00, 0x80});
+  for (size_t i = 0; i < 4; i++) {
+    EXPECT_GT(counts[i], 0u) << CPU::fusedTable[i].name;
+  }
+}
+
+TEST_F(SuperinstructionTest, TestLoadCompareBranchMatchesUnfused) {
+  // loop: INC $10, LDA $10, CMP #$80, BEQ +2, BNE +0, LDA $10, CMP #$40,
+  // BNE loop, JMP loop
+  auto counts = runBoth({0xE6, 0x10, 0xA5, 0x10, 0xC9, 0x80, 0xF0, 0x02,
+                         0xD0, 0x00, 0xA5, 0x10, 0xC9, 0x40, 0xD0, 0xF0,
+                         0x4C, 0x00, 0x80});
+  EXPECT_GT(counts[4], 0u);
+  EXPECT_GT(counts[5], 0u);
+}
+
+TEST_F(SuperinstructionTest, TestCopyMatchesUnfused) {
+  // LDX #$00, LDY #$08, loop: LDA $8000,X, STA $0300,Y, INX, INY,
+  // JMP loop
+  auto counts = runBoth({0xA2, 0x00, 0xA0, 0x08, 0xBD, 0x00, 0x80, 0x99,
+                         0x00, 0x03, 0xE8, 0xC8, 0x4C, 0x04, 0x80});
+  EXPECT_GT(counts[6], 0u);
+}
+
+TEST_F(SuperinstructionTest, TestBranchToOperandMatchesUnfused) {
+  // LDX #$02, DEX, BNE -1 lands on its own operand, which step() treats
+  // as not taken
+  runBoth({0xA2, 0x02, 0xCA, 0xD0, 0xFF, 0x4C, 0x00, 0x80});
+}
+
+TEST_F(SuperinstructionTest, TestProfilerCountsPairs) {
+  // LDX #$03, loop: DEX, BNE loop, BRK
+  CPU cpu = CPU(Bus(buildRom({0xA2, 0x03, 0xCA, 0xD0, 0xFD, 0x00}, 0x8000)));
+  cpu.reset();
+  Profiler profiler;
+  cpu.profiler = &profiler;
+  cpu.runFrame();
+  EXPECT_EQ(profiler.getPairCount(0xA2, 0xCA), 1u);
+  EXPECT_EQ(profiler.getPairCount(0xCA, 0xD0), 3u);
+  // Only the last BNE falls through, the others jump back
+  EXPECT_EQ(profiler.getPairCount(0xD0, 0xCA), 0u);
+  EXPECT_EQ(profiler.getPairCount(0xD0, 0x00), 1u);
+  EXPECT_EQ(cpu.getFusedCounts()[0], 0u);
+  auto commonest = profiler.commonestPairs(1);
+  ASSERT_EQ(commonest.size(), 1u);
+  EXPECT_EQ(commonest[0].first, 0xCAD0);
+
+  std::ostringstream report;
+  profiler.writePairs(report, 1);
+  EXPECT_EQ(report.str().substr(0, 14), "CA DEX  D0 BNE");
+  EXPECT_NE(report.str().find("fused"), std::string::npos);
+}
+
+TEST_F(SuperinstructionTest, TestTableLengthsAndCycles) {
+  // SEC, SED, SEI, PHA, PLA, PHP, PLP, STA $0300,X, JMP $8000
+  CPU cpu = CPU(Bus(buildRom({0x38, 0xF8, 0x78, 0x48, 0x68, 0x08, 0x28, 0x9D,
+                              0x00, 0x03, 0x4C, 0x00, 0x80},
+                             0x8000)));
+  cpu.reset();
+  cpu.skipIdleLoops = false;
+  cpu.fuseInstructions = false;
+  const uint8_t cycles[] = {2, 2, 2, 3, 4, 3, 4, 5};
+  const uint16_t next[] = {0x8001, 0x8002, 0x8003, 0x8004,
+                           0x8005, 0x8006, 0x8007, 0x800A};
+  for (size_t i = 0; i < 8; i++) {
+    uint64_t before = cpu.cycles;
+    ASSERT_TRUE(cpu.step());
+    EXPECT_EQ(cpu.cycles - before, cycles[i]) << i;
+    EXPECT_EQ(cpu.PC, next[i]) << i;
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Builds an NROM-128 image with the program at $8000 and the vectors pointing
+// at the given addresses
+inline std::vector<uint8_t> buildRom(const std::vector<uint8_t> &program,
+                                     uint16_t reset, uint16_t nmi = 0x8000,
+                                     uint16_t irq = 0x8000) {
+  std::vector<uint8_t> raw(16 + 0x4000, 0xFF);
+  uint8_t header[16] = {0x4E, 0x45, 0x53, 0x1A, 1, 0};
+  memcpy(raw.data(), header, sizeof(header));
+  memcpy(raw.data() + 16, program.data(), program.size());
+  uint8_t *vectors = raw.data() + 16 + 0x3FFA;
+  vectors[0] = nmi & 0xFF;
+  vectors[1] = nmi >> 8;
+  vectors[2] = reset & 0xFF;
+  vectors[3] = reset >> 8;
+  vectors[4] = irq & 0xFF;
+  vectors[5] = irq >> 8;
+  return raw;
+}
@@ -0,0 +1,151 @@
+#include "jsonreader.hpp"
+#include "timeline.hpp"
+#include <gtest/gtest.h>
+#include <sstream>
+#include <thread>
+
+class TimelineTest : public ::testing::Test {
+protected:
+  Timeline timeline;
+};
+
+TEST_F(TimelineTest, TestScopeRecordsEvent) {
+  {
+    TimelineScope scope(&timeline, TIMELINE_CPU, 7);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  // Does nothing without a timeline
+  { TimelineScope scope(nullptr, TIMELINE_CPU, 8); }
+  std::vector<TimelineEvent> events = timeline.getEvents(TIMELINE_CPU);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].frame, 7u);
+  EXPECT_GE(timeline.ticksToMicroseconds(events[0].end - events[0].start),
+            1500.0);
+  EXPECT_TRUE(timeline.getEvents(TIMELINE_PRESENT).empty());
+}
+
+TEST_F(TimelineTest, TestThreadsRecordIntoTheirOwnRings) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([this, i]() {
+      timeline.setThreadName("worker " + std::to_string(i));
+      for (uint32_t frame = 0; frame < 1000; frame++) {
+        TimelineScope scope(&timeline, TIMELINE_FRAME, frame);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  std::vector<TimelineEvent> events = timeline.getEvents(TIMELINE_FRAME);
+  ASSERT_EQ(events.size(), 4000u);
+  // Oldest first within each ring
+  for (size_t i = 0; i < events.size(); i++) {
+    EXPECT_EQ(events[i].frame, i % 1000);
+  }
+}
+
+TEST_F(TimelineTest, TestAlternatingTimelinesKeepTheirRings) {
+  Timeline other;
+  timeline.setThreadName("main");
+  for (uint32_t frame = 0; frame < 100; frame++) {
+    timeline.record(TIMELINE_CPU, frame, frame + 1, frame);
+    other.record(TIMELINE_CPU, frame, frame + 1, frame);
+  }
+  EXPECT_EQ(timeline.getThreadCount(), 1u);
+  EXPECT_EQ(other.getThreadCount(), 1u);
+  EXPECT_EQ(timeline.getEvents(TIMELINE_CPU).size(), 100u);
+  EXPECT_EQ(other.getEvents(TIMELINE_CPU).size(), 100u);
+  // Still the ring named before switching
+  std::ostringstream trace;
+  timeline.writeChromeTrace(trace);
+  EXPECT_NE(trace.str().find("\"main\""), std::string::npos);
+}
+
+TEST_F(TimelineTest, TestRingKeepsNewestEvents) {
+  uint32_t total = TIMELINE_RING_SIZE + 10;
+  for (uint32_t frame = 0; frame < total; frame++) {
+    timeline.record(TIMELINE_SLEEP, frame, frame + 1, frame);
+  }
+  std::vector<TimelineEvent> events = timeline.getEvents(TIMELINE_SLEEP);
+  ASSERT_EQ(events.size(), static_cast<size_t>(TIMELINE_RING_SIZE));
+  EXPECT_EQ(events.front().frame, 10u);
+  EXPECT_EQ(events.back().frame, total - 1);
+}
+
+TEST_F(TimelineTest, TestStatsArePercentiles) {
+  // Ticks in a microsecond
+  uint64_t tick = 1000000 / timeline.ticksToMicroseconds(1000000);
+  // 1 to 100 microseconds
+  for (uint32_t i = 1; i <= 100; i++) {
+    timeline.record(TIMELINE_PRESENT, 0, i * tick, i);
+  }
+  TimelineStats stats = timeline.getStats(TIMELINE_PRESENT);
+  EXPECT_EQ(stats.count, 100u);
+  EXPECT_NEAR(stats.mean, 50.5, 1.0);
+  EXPECT_NEAR(stats.p50, 50, 1.0);
+  EXPECT_NEAR(stats.p90, 90, 1.0);
+  EXPECT_NEAR(stats.p99, 99, 1.0);
+  EXPECT_NEAR(stats.max, 100, 1.0);
+  EXPECT_EQ(timeline.getStats(TIMELINE_APU).count, 0u);
+}
+
+TEST_F(TimelineTest, TestLatencyIsFromFirstInputToPresent) {
+  // A present with no input pending records nothing
+  timeline.markPresent(0);
+  EXPECT_TRUE(timeline.getEvents(TIMELINE_LATENCY).empty());
+  uint64_t before = Timeline::now();
+  timeline.markInput();
+  timeline.markInput();
+  timeline.markPresent(3);
+  timeline.markPresent(4);
+  std::vector<TimelineEvent> events = timeline.getEvents(TIMELINE_LATENCY);
+  ASSERT_EQ(events.size(), 1u);
+  EXPECT_EQ(events[0].frame, 3u);
+  EXPECT_GE(events[0].start, before);
+  EXPECT_GE(events[0].end, events[0].start);
+}
+
+TEST_F(TimelineTest, TestChromeTraceIsValidJson) {
+  timeline.setThreadName("emulation \"main\"");
+  { TimelineScope scope(&timeline, TIMELINE_CPU, 1); }
+  { TimelineScope scope(&timeline, TIMELINE_PRESENT, 1); }
+  std::ostringstream trace;
+  timeline.writeChromeTrace(trace);
+
+  JsonReader reader;
+  reader.openString(trace.str());
+  std::string key, value;
+  std::vector<std::string> names, phases;
+  ASSERT_TRUE(reader.beginObject());
+  while (reader.hasNext()) {
+    ASSERT_TRUE(reader.readKey(key));
+    if (key != "traceEvents") {
+      ASSERT_TRUE(reader.skipValue());
+      continue;
+    }
+    ASSERT_TRUE(reader.beginArray());
+    while (reader.hasNext()) {
+      ASSERT_TRUE(reader.beginObject());
+      while (reader.hasNext()) {
+        ASSERT_TRUE(reader.readKey(key));
+        if (key == "name" || key == "ph") {
+          ASSERT_TRUE(reader.readString(value));
+          (key == "name" ? names : phases).push_back(value);
+        } else {
+          ASSERT_TRUE(reader.skipValue());
+        }
+      }
+    }
+  }
+  EXPECT_TRUE(reader.atEnd());
+  EXPECT_FALSE(reader.failed()) << reader.getError();
+  EXPECT_EQ(names,
+            std::vector<std::string>({"thread_name", "cpu", "present"}));
+  EXPECT_EQ(phases, std::vector<std::string>({"M", "X", "X"}));
+
+  std::ostringstream summary;
+  timeline.writeSummary(summary);
+  EXPECT_NE(summary.str().find("cpu"), std::string::npos);
+  EXPECT_EQ(summary.str().find("apu"), std::string::npos);
+}